@@ -37,6 +37,7 @@ DEMOCPP="amalgamation_demo.cpp"
 ALL_PUBLIC_H="
 $SCRIPTPATH/include/roaring/roaring_version.h
 $SCRIPTPATH/include/roaring/portability.h
+$SCRIPTPATH/include/roaring/memory.h
 $SCRIPTPATH/include/roaring/isadetection.h
 $SCRIPTPATH/include/roaring/roaring_types.h
 $SCRIPTPATH/include/roaring/bitset/bitset.h
@@ -57,7 +58,6 @@ $SCRIPTPATH/include/roaring/containers/mixed_xor.h
 $SCRIPTPATH/include/roaring/containers/containers.h
 $SCRIPTPATH/include/roaring/roaring_array.h
 $SCRIPTPATH/include/roaring/roaring.h
-$SCRIPTPATH/include/roaring/memory.h
 $SCRIPTPATH/include/roaring/roaring64.h
 "
 
@@ -76,6 +76,9 @@ $SCRIPTPATH/cpp/roaring/roaring64map.hh
 ALL_PRIVATE_H="
 $SCRIPTPATH/include/roaring/containers/perfparameters.h
 $SCRIPTPATH/include/roaring/utilasm.h
+$SCRIPTPATH/include/roaring/counters.h
+$SCRIPTPATH/include/roaring/interner.h
+$SCRIPTPATH/include/roaring/allocator_switch.h
 $SCRIPTPATH/include/roaring/art/art.h
 "
 
@@ -50,6 +50,7 @@
 #include <roaring/containers/mixed_equal.h>
 #include <roaring/containers/run.h>
 #include <roaring/misc/configreport.h>
+#include <roaring/parallel.hh>
 #include <roaring/portability.h>
 #include <roaring/roaring.h>
 #include <roaring/roaring64.h>
@@ -3083,9 +3084,858 @@ void register_benchmarks(std::vector<Entry> &out) {
         e.reusable_state = true;
         out.push_back(std::move(e));
     }
+    {
+        Entry e;
+        e.name = "fastunion64/parallel";
+        e.description =
+            "Same as fastunion64/fastunion with roaring::parallel::fastunion "
+            "using one thread per core: the 1,000 outer slots are grouped "
+            "by key up front, and the groups are split among the threads "
+            "by their number of containers.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            Roaring64Map ans = roaring::parallel::fastunion(
+                s->ptrs.size(), s->ptrs.data());
+            return static_cast<int64_t>(ans.cardinality());
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_bitmaps;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
 }
 }  // namespace fastunion64
 
+// --------------------------------------------- Roaring64Map bucket operations
+
+namespace map64ops {
+
+constexpr uint32_t num_outer_slots = 4096;
+
+struct S {
+    Roaring64Map a;
+    Roaring64Map b;
+};
+
+// Outer slots of very different sizes: most hold a few hundred values, one
+// in 64 holds runs over 2^24 values, so that cutting the slots into equal
+// counts would leave some threads with most of the work.
+S *build() {
+    auto *s = new S;
+    std::mt19937_64 gen(99);
+    for (uint32_t slot = 0; slot < num_outer_slots; ++slot) {
+        uint64_t base = static_cast<uint64_t>(slot) << 32;
+        for (int i = 0; i < 500; ++i) {
+            s->a.add(base + gen() % (1u << 22));
+            s->b.add(base + gen() % (1u << 22));
+        }
+        if (slot % 64 == 0) {
+            for (uint64_t start = 0; start < (1u << 24); start += 1000) {
+                s->a.addRange(base + start, base + start + 300);
+                s->b.addRange(base + start + 200, base + start + 700);
+            }
+        }
+    }
+    return s;
+}
+
+void register_benchmarks(std::vector<Entry> &out) {
+    const unsigned threads = roaring::parallel::defaultThreadCount();
+    {
+        Entry e;
+        e.name = "map64ops/and";
+        e.description =
+            "Intersects two Roaring64Map bitmaps of 4,096 outer slots (most "
+            "with a few hundred values, one in 64 with 16,000 runs) with "
+            "operator&=, one slot after the other. Baseline for "
+            "map64ops/parallel_and.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            Roaring64Map r = s->a;
+            r &= s->b;
+            return static_cast<int64_t>(r.cardinality());
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_outer_slots;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "map64ops/parallel_and";
+        e.description =
+            "Same as map64ops/and with roaring::parallel::andInplace using "
+            "one thread per core, the slots split by their number of "
+            "containers. Includes the copy of the left-hand side, as the "
+            "baseline does.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [threads](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            Roaring64Map r = s->a;
+            roaring::parallel::andInplace(r, s->b, threads);
+            return static_cast<int64_t>(r.cardinality());
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_outer_slots;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "map64ops/or";
+        e.description =
+            "Unites the inputs of map64ops/and with operator|=. Baseline "
+            "for map64ops/parallel_or.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            Roaring64Map r = s->a;
+            r |= s->b;
+            return static_cast<int64_t>(r.cardinality());
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_outer_slots;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "map64ops/parallel_or";
+        e.description =
+            "Same as map64ops/or with roaring::parallel::orInplace using one "
+            "thread per core.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [threads](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            Roaring64Map r = s->a;
+            roaring::parallel::orInplace(r, s->b, threads);
+            return static_cast<int64_t>(r.cardinality());
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_outer_slots;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "map64ops/write";
+        e.description =
+            "Serializes the left-hand input of map64ops/and in the portable "
+            "format with Roaring64Map::write. Baseline for "
+            "map64ops/parallel_write.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            std::vector<char> buf(s->a.getSizeInBytes());
+            return static_cast<int64_t>(s->a.write(buf.data()));
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_outer_slots;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "map64ops/parallel_write";
+        e.description =
+            "Same as map64ops/write with roaring::parallel::write using one "
+            "thread per core: the slots are sized, then written at their "
+            "offsets, concurrently.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [threads](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            std::vector<char> buf(s->a.getSizeInBytes());
+            return static_cast<int64_t>(
+                roaring::parallel::write(s->a, buf.data(), true, threads));
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_outer_slots;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+}
+}  // namespace map64ops
+
+// --------------------------------------------- startup deserialization
+
+namespace startup {
+
+// Containers cycle through the three container types; about 90 MB serialized,
+// the size at which loading a bitmap on startup becomes noticeable.
+constexpr uint32_t num_containers = 1 << 14;
+
+struct S {
+    std::vector<char> buf32;
+    std::vector<char> buf64;
+};
+
+void fill(uint64_t base, uint32_t key, uint64_t *values, size_t *n) {
+    // Array, bitset, or run container depending on the key.
+    switch (key % 3) {
+        case 0:
+            for (uint32_t i = 0; i < 4000; ++i) values[(*n)++] = base + 16 * i;
+            break;
+        case 1:
+            for (uint32_t i = 0; i < 30000; ++i) values[(*n)++] = base + 2 * i;
+            break;
+        default:
+            for (uint32_t i = 0; i < 10; ++i) {
+                for (uint32_t j = 0; j < 100; ++j) {
+                    values[(*n)++] = base + 6000 * i + j;
+                }
+            }
+            break;
+    }
+}
+
+S *build() {
+    auto *s = new S;
+    std::vector<uint64_t> values(30000);
+    roaring_bitmap_t *r32 = roaring_bitmap_create();
+    roaring64_bitmap_t *r64 = roaring64_bitmap_create();
+    for (uint32_t key = 0; key < num_containers; ++key) {
+        size_t n = 0;
+        fill(0, key, values.data(), &n);
+        for (size_t i = 0; i < n; ++i) {
+            roaring_bitmap_add(r32, (uint32_t)(values[i] + (key << 16)));
+        }
+        // Spread the 64-bit bitmap over several buckets.
+        uint64_t base64 = ((uint64_t)(key % 16) << 32) + ((key / 16) << 16);
+        n = 0;
+        fill(base64, key, values.data(), &n);
+        roaring64_bitmap_add_many(r64, n, values.data());
+    }
+    roaring_bitmap_run_optimize(r32);
+    roaring64_bitmap_run_optimize(r64);
+    s->buf32.resize(roaring_bitmap_portable_size_in_bytes(r32));
+    roaring_bitmap_portable_serialize(r32, s->buf32.data());
+    s->buf64.resize(roaring64_bitmap_portable_size_in_bytes(r64));
+    roaring64_bitmap_portable_serialize(r64, s->buf64.data());
+    roaring_bitmap_free(r32);
+    roaring64_bitmap_free(r64);
+    return s;
+}
+
+void register_benchmarks(std::vector<Entry> &out) {
+    const unsigned threads = roaring::parallel::defaultThreadCount();
+    {
+        Entry e;
+        e.name = "startup/portable_deserialize";
+        e.description =
+            "Loads a 32-bit bitmap of 16,384 containers (mixing arrays, "
+            "bitsets and runs) from its portable serialization with "
+            "roaring_bitmap_portable_deserialize_safe, decoding containers "
+            "one after the other. Baseline for startup/parallel.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring_bitmap_t *r = roaring_bitmap_portable_deserialize_safe(
+                s->buf32.data(), s->buf32.size());
+            int64_t card = (int64_t)roaring_bitmap_get_cardinality(r);
+            roaring_bitmap_free(r);
+            return card;
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_containers;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "startup/parallel";
+        e.description =
+            "Same input as startup/portable_deserialize, loaded with "
+            "roaring::parallel::readSafe using one thread per core: the "
+            "header is parsed once, then each thread decodes a slice of the "
+            "containers in place using the offset header.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [threads](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring::Roaring r = roaring::parallel::readSafe(
+                s->buf32.data(), s->buf32.size(), threads);
+            return (int64_t)r.cardinality();
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_containers;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "startup/portable_deserialize64";
+        e.description =
+            "Loads a 64-bit bitmap of 16,384 containers spread over 16 "
+            "buckets with roaring64_bitmap_portable_deserialize_safe. "
+            "Baseline for startup/parallel64.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring64_bitmap_t *r = roaring64_bitmap_portable_deserialize_safe(
+                s->buf64.data(), s->buf64.size());
+            int64_t card = (int64_t)roaring64_bitmap_get_cardinality(r);
+            roaring64_bitmap_free(r);
+            return card;
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_containers;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "startup/parallel64";
+        e.description =
+            "Same input as startup/portable_deserialize64, loaded with "
+            "roaring::parallel::readSafe64 using one thread per core. The "
+            "ART index is built from the headers on the calling thread; "
+            "container payloads are decoded concurrently.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [threads](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring::Roaring64 r = roaring::parallel::readSafe64(
+                s->buf64.data(), s->buf64.size(), threads);
+            return (int64_t)r.cardinality();
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_containers;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+}
+}  // namespace startup
+
+// --------------------------------------------- bulk loading unsorted values
+
+namespace bulkload {
+
+// 10^8 random values: 400 MB of input for 32-bit, 800 MB for 64-bit.
+constexpr size_t num_values = 100000000;
+
+struct S {
+    std::vector<uint32_t> vals32;
+    std::vector<uint64_t> vals64;
+};
+
+S *build() {
+    auto *s = new S;
+    std::mt19937_64 gen(42);
+    s->vals32.resize(num_values);
+    s->vals64.resize(num_values);
+    for (size_t i = 0; i < num_values; ++i) {
+        uint64_t x = gen();
+        s->vals32[i] = (uint32_t)x;
+        // About 100 values per container over 2^20 keys.
+        s->vals64[i] = x >> 28;
+    }
+    return s;
+}
+
+void register_benchmarks(std::vector<Entry> &out) {
+    const unsigned threads = roaring::parallel::defaultThreadCount();
+    {
+        Entry e;
+        e.name = "bulkload/add_many";
+        e.description =
+            "Builds a 32-bit bitmap from 10^8 uniformly random values with "
+            "roaring_bitmap_add_many: every value looks up its container, "
+            "which is a cache miss most of the time. Baseline for "
+            "bulkload/from_unsorted and bulkload/parallel.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring_bitmap_t *r = roaring_bitmap_create();
+            roaring_bitmap_add_many(r, s->vals32.size(), s->vals32.data());
+            int64_t card = (int64_t)roaring_bitmap_get_cardinality(r);
+            roaring_bitmap_free(r);
+            return card;
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_values;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "bulkload/from_unsorted";
+        e.description =
+            "Same input as bulkload/add_many, loaded with "
+            "roaring_bitmap_from_unsorted on one thread: the values are "
+            "radix-partitioned by key, then each container is built at "
+            "once.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring_bitmap_t *r = roaring_bitmap_from_unsorted(
+                s->vals32.data(), s->vals32.size());
+            int64_t card = (int64_t)roaring_bitmap_get_cardinality(r);
+            roaring_bitmap_free(r);
+            return card;
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_values;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "bulkload/parallel";
+        e.description =
+            "Same as bulkload/from_unsorted with roaring::parallel::"
+            "fromUnsorted using one thread per core for the partitioning "
+            "and the container building.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [threads](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring::Roaring r = roaring::parallel::fromUnsorted(
+                s->vals32.data(), s->vals32.size(), threads);
+            return (int64_t)r.cardinality();
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_values;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "bulkload/add_many64";
+        e.description =
+            "Builds a 64-bit bitmap from 10^8 random values below 2^36 "
+            "(about 100 per container) with roaring64_bitmap_add_many. "
+            "Baseline for bulkload/parallel64.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring64_bitmap_t *r = roaring64_bitmap_create();
+            roaring64_bitmap_add_many(r, s->vals64.size(), s->vals64.data());
+            int64_t card = (int64_t)roaring64_bitmap_get_cardinality(r);
+            roaring64_bitmap_free(r);
+            return card;
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_values;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "bulkload/parallel64";
+        e.description =
+            "Same input as bulkload/add_many64, loaded with roaring::"
+            "parallel::fromUnsorted64 using one thread per core: values are "
+            "partitioned into buckets of consecutive keys, each bucket is "
+            "radix-sorted and its containers built, and the ART is filled "
+            "in key order.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [threads](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring::Roaring64 r = roaring::parallel::fromUnsorted64(
+                s->vals64.data(), s->vals64.size(), threads);
+            return (int64_t)r.cardinality();
+        };
+        e.teardown = [](void *sv) { delete static_cast<S *>(sv); };
+        e.ops_per_run = num_values;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+}
+}  // namespace bulkload
+
+// --------------------------------------------- bitset_t to roaring
+
+namespace frombitset {
+
+// A 2^28-bit scan result: sparse, dense and run-like windows in turn.
+constexpr size_t num_bits = size_t(1) << 28;
+
+bitset_t *build() {
+    bitset_t *b = bitset_create_with_capacity(num_bits);
+    std::mt19937_64 gen(7);
+    for (size_t window = 0; window < num_bits / 65536; ++window) {
+        size_t base = window * 65536;
+        switch (window % 3) {
+            case 0:
+                for (int i = 0; i < 500; ++i) {
+                    bitset_set(b, base + gen() % 65536);
+                }
+                break;
+            case 1:
+                for (int i = 0; i < 20000; ++i) {
+                    bitset_set(b, base + gen() % 65536);
+                }
+                break;
+            default:
+                for (size_t i = 0; i < 65536; i += 4096) {
+                    for (size_t j = 0; j < 1000; ++j) {
+                        bitset_set(b, base + i + j);
+                    }
+                }
+                break;
+        }
+    }
+    return b;
+}
+
+void register_benchmarks(std::vector<Entry> &out) {
+    {
+        Entry e;
+        e.name = "frombitset/next_set_bits";
+        e.description =
+            "Converts a 2^28-bit bitset_t (4096 windows alternating sparse, "
+            "dense and run-like) into a roaring bitmap by decoding set bits "
+            "with bitset_next_set_bits and roaring_bitmap_add_many. "
+            "Baseline for frombitset/from_bitset.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *b = static_cast<bitset_t *>(sv);
+            roaring_bitmap_t *r = roaring_bitmap_create();
+            size_t buffer[256];
+            uint32_t vals[256];
+            size_t howmany;
+            for (size_t start = 0;
+                 (howmany = bitset_next_set_bits(b, buffer, 256, &start)) > 0;
+                 start++) {
+                for (size_t i = 0; i < howmany; ++i) {
+                    vals[i] = (uint32_t)buffer[i];
+                }
+                roaring_bitmap_add_many(r, howmany, vals);
+            }
+            roaring_bitmap_run_optimize(r);
+            int64_t card = (int64_t)roaring_bitmap_get_cardinality(r);
+            roaring_bitmap_free(r);
+            return card;
+        };
+        e.teardown = [](void *sv) {
+            bitset_free(static_cast<bitset_t *>(sv));
+        };
+        e.ops_per_run = num_bits / 65536;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "frombitset/from_bitset";
+        e.description =
+            "Same input as frombitset/next_set_bits, converted with "
+            "roaring_bitmap_from_bitset: each 65536-bit window is "
+            "popcounted, then kept as a bitset, extracted to an array or "
+            "turned into runs.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *b = static_cast<bitset_t *>(sv);
+            roaring_bitmap_t *r = roaring_bitmap_from_bitset(b);
+            int64_t card = (int64_t)roaring_bitmap_get_cardinality(r);
+            roaring_bitmap_free(r);
+            return card;
+        };
+        e.teardown = [](void *sv) {
+            bitset_free(static_cast<bitset_t *>(sv));
+        };
+        e.ops_per_run = num_bits / 65536;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+}
+}  // namespace frombitset
+
+// --------------------------------------------- exporting to arrays
+
+namespace toarray {
+
+// About 5 * 10^7 values in arrays, bitsets and runs, for both widths.
+constexpr uint32_t num_keys = 3000;
+
+struct S {
+    roaring::Roaring r32;
+    roaring::Roaring64 r64;
+    roaring64_bitmap_t *c64;  // owned by r64
+    std::vector<uint32_t> out32;
+    std::vector<uint64_t> out64;
+};
+
+S *build() {
+    auto *s = new S;
+    s->c64 = roaring64_bitmap_create();
+    s->r64 = roaring::Roaring64(s->c64);
+    std::mt19937_64 gen(3);
+    std::vector<uint32_t> vals;
+    for (uint32_t key = 0; key < num_keys; ++key) {
+        uint32_t base = key << 16;
+        vals.clear();
+        switch (key % 3) {
+            case 0:
+                for (int i = 0; i < 2000; ++i) {
+                    vals.push_back(base + gen() % 65536);
+                }
+                break;
+            case 1:
+                for (uint32_t i = 0; i < 65536; i += 2) {
+                    vals.push_back(base + i);
+                }
+                break;
+            default:
+                for (uint32_t i = 0; i < 65536; i += 4096) {
+                    for (uint32_t j = 0; j < 3000; ++j) {
+                        vals.push_back(base + i + j);
+                    }
+                }
+                break;
+        }
+        s->r32.addMany(vals.size(), vals.data());
+        for (uint32_t v : vals) {
+            // Spread the keys over several 32-bit high halves.
+            s->r64.add(((uint64_t)(key % 7) << 40) + v);
+        }
+    }
+    s->r32.runOptimize();
+    s->r64.runOptimize();
+    s->out32.resize(s->r32.cardinality());
+    s->out64.resize(s->r64.cardinality());
+    return s;
+}
+
+void destroy(void *sv) { delete static_cast<S *>(sv); }
+
+int64_t checksum32(const S *s) {
+    return (int64_t)s->out32.front() + s->out32[s->out32.size() / 2] +
+           s->out32.back();
+}
+
+int64_t checksum64(const S *s) {
+    return (int64_t)(s->out64.front() + s->out64[s->out64.size() / 2] +
+                     s->out64.back());
+}
+
+void register_benchmarks(std::vector<Entry> &out) {
+    const unsigned threads = roaring::parallel::defaultThreadCount();
+    {
+        Entry e;
+        e.name = "toarray/iterator";
+        e.description =
+            "Writes a 32-bit bitmap of about 5*10^7 values (arrays, bitsets "
+            "and runs in turn) to an array with "
+            "roaring_uint32_iterator_read, 65536 values at a time. Baseline "
+            "for toarray/to_uint32_array and toarray/parallel.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring_uint32_iterator_t *it =
+                roaring_iterator_create(&s->r32.roaring);
+            uint32_t *p = s->out32.data();
+            uint32_t n;
+            while ((n = roaring_uint32_iterator_read(it, p, 65536)) > 0) {
+                p += n;
+            }
+            roaring_uint32_iterator_free(it);
+            return checksum32(s);
+        };
+        e.teardown = destroy;
+        e.ops_per_run = 1;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "toarray/to_uint32_array";
+        e.description =
+            "Same input as toarray/iterator, written with "
+            "roaring_bitmap_to_uint32_array: whole containers go through "
+            "the SIMD array, bitset and run decoders.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring_bitmap_to_uint32_array(&s->r32.roaring, s->out32.data());
+            return checksum32(s);
+        };
+        e.teardown = destroy;
+        e.ops_per_run = 1;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "toarray/parallel";
+        e.description =
+            "Same as toarray/to_uint32_array with roaring::parallel::"
+            "toUint32Array using one thread per core, each writing the "
+            "slice of the output that starts at its rank.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [threads](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring::parallel::toUint32Array(s->r32, s->out32.data(), threads);
+            return checksum32(s);
+        };
+        e.teardown = destroy;
+        e.ops_per_run = 1;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "toarray/iterator64";
+        e.description =
+            "Writes a 64-bit bitmap with the same containers as "
+            "toarray/iterator to an array with roaring64_iterator_read, "
+            "65536 values at a time. Baseline for toarray/to_uint64_array "
+            "and toarray/parallel64.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring64_iterator_t *it = roaring64_iterator_create(s->c64);
+            uint64_t *p = s->out64.data();
+            uint64_t n;
+            while ((n = roaring64_iterator_read(it, p, 65536)) > 0) {
+                p += n;
+            }
+            roaring64_iterator_free(it);
+            return checksum64(s);
+        };
+        e.teardown = destroy;
+        e.ops_per_run = 1;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "toarray/to_uint64_array";
+        e.description =
+            "Same input as toarray/iterator64, written with "
+            "roaring64_bitmap_to_uint64_array: whole containers are decoded "
+            "to 32-bit values, then widened with the high bits.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring64_bitmap_to_uint64_array(s->c64, s->out64.data());
+            return checksum64(s);
+        };
+        e.teardown = destroy;
+        e.ops_per_run = 1;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "toarray/parallel64";
+        e.description =
+            "Same as toarray/to_uint64_array with roaring::parallel::"
+            "toUint64Array using one thread per core.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [threads](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            roaring::parallel::toUint64Array(s->r64, s->out64.data(), threads);
+            return checksum64(s);
+        };
+        e.teardown = destroy;
+        e.ops_per_run = 1;
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+}
+}  // namespace toarray
+
+// --------------------------------------------- arena allocation
+
+namespace arena {
+
+// 64 bitmaps of 200 containers each, mixing arrays, bitsets and runs.
+constexpr size_t num_bitmaps = 64;
+
+struct S {
+    std::vector<roaring_bitmap_t *> bitmaps;
+    roaring_arena_t *arena;
+};
+
+S *build() {
+    auto *s = new S;
+    std::mt19937_64 gen(11);
+    for (size_t i = 0; i < num_bitmaps; ++i) {
+        roaring_bitmap_t *r = roaring_bitmap_create();
+        for (uint32_t key = 0; key < 200; ++key) {
+            uint32_t base = (key * 3 + (uint32_t)(i % 3)) << 16;
+            int n = key % 4 == 0 ? 6000 : 300;
+            for (int j = 0; j < n; ++j) {
+                roaring_bitmap_add(r, base + (uint32_t)(gen() % 65536));
+            }
+            if (key % 4 == 1) {
+                roaring_bitmap_add_range(r, base + 1000, base + 9000);
+            }
+        }
+        roaring_bitmap_run_optimize(r);
+        s->bitmaps.push_back(r);
+    }
+    s->arena = roaring_arena_create();
+    return s;
+}
+
+void destroy(void *sv) {
+    auto *s = static_cast<S *>(sv);
+    for (roaring_bitmap_t *r : s->bitmaps) roaring_bitmap_free(r);
+    roaring_arena_free(s->arena);
+    delete s;
+}
+
+// One "query": the pairwise unions and intersections of neighbours, each
+// result used once and then dropped.
+int64_t query(const S *s, bool free_results) {
+    int64_t total = 0;
+    for (size_t i = 0; i + 1 < s->bitmaps.size(); ++i) {
+        roaring_bitmap_t *u =
+            roaring_bitmap_or(s->bitmaps[i], s->bitmaps[i + 1]);
+        roaring_bitmap_t *x =
+            roaring_bitmap_and(s->bitmaps[i], s->bitmaps[i + 1]);
+        roaring_bitmap_or_inplace(u, x);
+        total += (int64_t)roaring_bitmap_get_cardinality(u);
+        if (free_results) {
+            roaring_bitmap_free(x);
+            roaring_bitmap_free(u);
+        }
+    }
+    return total;
+}
+
+void register_benchmarks(std::vector<Entry> &out) {
+    {
+        Entry e;
+        e.name = "arena/hook";
+        e.description =
+            "Computes and frees 63 unions and 63 intersections of 200-"
+            "container bitmaps, allocating through the memory hook (malloc). "
+            "Baseline for arena/scope.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            return query(static_cast<S *>(sv), true);
+        };
+        e.teardown = destroy;
+        e.ops_per_run = 2 * (num_bitmaps - 1);
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+    {
+        Entry e;
+        e.name = "arena/scope";
+        e.description =
+            "Same as arena/hook inside an arena scope: the results come from "
+            "size-class slabs and are released at once by "
+            "roaring_arena_reset, which keeps the slabs for the next run.";
+        e.setup = []() -> void * { return build(); };
+        e.run = [](void *sv) -> int64_t {
+            auto *s = static_cast<S *>(sv);
+            const roaring_allocator_t *previous =
+                roaring_allocator_enter(roaring_arena_allocator(s->arena));
+            int64_t total = query(s, false);
+            roaring_allocator_leave(previous);
+            roaring_arena_reset(s->arena);
+            return total;
+        };
+        e.teardown = destroy;
+        e.ops_per_run = 2 * (num_bitmaps - 1);
+        e.reusable_state = true;
+        out.push_back(std::move(e));
+    }
+}
+}  // namespace arena
+
 // --------------------------------------------- sparse cases (Roaring64Map)
 
 namespace sparse64 {
@@ -4410,7 +5260,13 @@ int main(int argc, char **argv) {
     adversarial::register_benchmarks(benchmarks);
     intersect_range::register_benchmarks(benchmarks);
     fastunion64::register_benchmarks(benchmarks);
+    map64ops::register_benchmarks(benchmarks);
     sparse64::register_benchmarks(benchmarks);
+    startup::register_benchmarks(benchmarks);
+    bulkload::register_benchmarks(benchmarks);
+    frombitset::register_benchmarks(benchmarks);
+    toarray::register_benchmarks(benchmarks);
+    arena::register_benchmarks(benchmarks);
     synthetic::register_all(benchmarks);
 
     std::vector<std::string> filters;
@@ -0,0 +1,691 @@
+/**
+ * Multi-threaded helpers for Roaring, Roaring64 and Roaring64Map.
+ *
+ * They live apart from roaring.hh and roaring64.hh so that only code that
+ * wants them depends on <thread>: link with your platform's thread library
+ * (e.g., Threads::Threads in CMake). The C library itself never creates
+ * threads; it exposes functions that are safe to call on disjoint ranges,
+ * which the helpers below drive with std::thread.
+ */
+#ifndef INCLUDE_ROARING_PARALLEL_HH_
+#define INCLUDE_ROARING_PARALLEL_HH_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "roaring.hh"
+#include "roaring64.hh"
+#include "roaring64map.hh"
+
+namespace roaring {
+namespace parallel {
+
+/**
+ * Number of threads used when 0 is passed as `num_threads`.
+ */
+inline unsigned defaultThreadCount() noexcept {
+    unsigned n = std::thread::hardware_concurrency();
+    return n == 0 ? 1 : n;
+}
+
+/**
+ * Calls fn(begin, end) on contiguous chunks covering [0, n), each chunk on its
+ * own thread (the calling thread takes the first one). Chunks hold at least
+ * `min_chunk` items so that small inputs do not pay for thread creation.
+ */
+template <typename Fn>
+void forEachChunk(uint64_t n, unsigned num_threads, uint64_t min_chunk,
+                  Fn fn) {
+    if (num_threads == 0) {
+        num_threads = defaultThreadCount();
+    }
+    if (min_chunk == 0) {
+        min_chunk = 1;
+    }
+    uint64_t chunks = (n + min_chunk - 1) / min_chunk;
+    if (chunks > num_threads) {
+        chunks = num_threads;
+    }
+    if (chunks <= 1) {
+        fn(uint64_t(0), n);
+        return;
+    }
+    std::vector<std::thread> threads;
+    threads.reserve(chunks - 1);
+    for (uint64_t i = 1; i < chunks; ++i) {
+        threads.emplace_back(fn, n * i / chunks, n * (i + 1) / chunks);
+    }
+    fn(uint64_t(0), n / chunks);
+    for (std::thread &t : threads) {
+        t.join();
+    }
+}
+
+/**
+ * Same as forEachChunk, but the chunks are cut so that they add up to about
+ * the same cost(i) over their items, rather than to the same number of items,
+ * and hold a cost of at least `min_cost`. Some chunks may be empty when a few
+ * items outweigh all others.
+ */
+template <typename Cost, typename Fn>
+void forEachWeightedChunk(uint64_t n, unsigned num_threads, uint64_t min_cost,
+                          Cost cost, Fn fn) {
+    if (num_threads == 0) {
+        num_threads = defaultThreadCount();
+    }
+    if (min_cost == 0) {
+        min_cost = 1;
+    }
+    std::vector<uint64_t> prefix(n + 1, 0);  // cost of items [0, i)
+    for (uint64_t i = 0; i < n; ++i) {
+        prefix[i + 1] = prefix[i] + cost(i);
+    }
+    uint64_t total = prefix[n];
+    uint64_t chunks = (total + min_cost - 1) / min_cost;
+    if (chunks > num_threads) {
+        chunks = num_threads;
+    }
+    if (chunks > n) {
+        chunks = n;
+    }
+    if (chunks <= 1) {
+        fn(uint64_t(0), n);
+        return;
+    }
+    std::vector<uint64_t> bounds(chunks + 1, n);
+    bounds[0] = 0;
+    for (uint64_t i = 1; i < chunks; ++i) {
+        bounds[i] = std::lower_bound(prefix.begin(), prefix.end(),
+                                     total * i / chunks) -
+                    prefix.begin();
+    }
+    std::vector<std::thread> threads;
+    threads.reserve(chunks - 1);
+    for (uint64_t i = 1; i < chunks; ++i) {
+        if (bounds[i] < bounds[i + 1]) {
+            threads.emplace_back(fn, bounds[i], bounds[i + 1]);
+        }
+    }
+    fn(uint64_t(0), bounds[1]);
+    for (std::thread &t : threads) {
+        t.join();
+    }
+}
+
+/**
+ * Containers read per thread, at least, by the parallel deserializers.
+ */
+static constexpr uint64_t kDeserializeMinChunk = 64;
+
+/**
+ * Same as Roaring::readSafe(buf, maxbytes) for the portable format, with the
+ * containers decoded by up to `num_threads` threads (0 for one per core).
+ * See roaring_bitmap_portable_deserialize_prepare().
+ */
+inline Roaring readSafe(const char *buf, size_t maxbytes,
+                        unsigned num_threads = 0) {
+    uint32_t count = 0;
+    api::roaring_bitmap_t *r =
+        api::roaring_bitmap_portable_deserialize_prepare(buf, maxbytes, &count);
+    if (r == NULL) {
+        ROARING_TERMINATE("failed alloc while reading");
+    }
+    forEachChunk(count, num_threads, kDeserializeMinChunk,
+                 [=](uint64_t begin, uint64_t end) {
+                     api::roaring_bitmap_portable_deserialize_range(
+                         r, buf, maxbytes, (uint32_t)begin, (uint32_t)end);
+                 });
+    r = api::roaring_bitmap_portable_deserialize_finish(r);
+    if (r == NULL) {
+        ROARING_TERMINATE("failed alloc while reading");
+    }
+    return Roaring(r);
+}
+
+/**
+ * Same as Roaring64::readSafe(buf, maxbytes), with the containers decoded by
+ * up to `num_threads` threads (0 for one per core). See
+ * roaring64_bitmap_portable_deserialize_prepare().
+ */
+inline Roaring64 readSafe64(const char *buf, size_t maxbytes,
+                            unsigned num_threads = 0) {
+    uint64_t count = 0;
+    api::roaring64_bitmap_t *r =
+        api::roaring64_bitmap_portable_deserialize_prepare(buf, maxbytes,
+                                                           &count);
+    if (r == NULL) {
+        ROARING_TERMINATE("failed alloc while reading");
+    }
+    forEachChunk(count, num_threads, kDeserializeMinChunk,
+                 [=](uint64_t begin, uint64_t end) {
+                     api::roaring64_bitmap_portable_deserialize_range(
+                         r, buf, maxbytes, begin, end);
+                 });
+    r = api::roaring64_bitmap_portable_deserialize_finish(r);
+    if (r == NULL) {
+        ROARING_TERMINATE("failed alloc while reading");
+    }
+    return Roaring64(r);
+}
+
+/**
+ * Values counted and scattered per thread, at least, by the bulk loaders.
+ */
+static constexpr uint64_t kBulkLoadMinPart = 1 << 16;
+
+/**
+ * Containers (or buckets of keys, for 64-bit values) built per thread, at
+ * least, by the bulk loaders.
+ */
+static constexpr uint64_t kBulkLoadMinChunk = 16;
+
+/**
+ * Same as roaring_bitmap_from_unsorted(vals, n), with the partitioning and the
+ * container building spread over up to `num_threads` threads (0 for one per
+ * core). See roaring_bulk_loader_t.
+ */
+inline Roaring fromUnsorted(const uint32_t *vals, size_t n,
+                            unsigned num_threads = 0) {
+    if (num_threads == 0) {
+        num_threads = defaultThreadCount();
+    }
+    uint64_t parts = (n + kBulkLoadMinPart - 1) / kBulkLoadMinPart;
+    if (parts > num_threads) parts = num_threads;
+    if (parts == 0) parts = 1;
+    api::roaring_bulk_loader_t *l =
+        api::roaring_bulk_loader_create(vals, n, (uint32_t)parts);
+    if (l == NULL) {
+        ROARING_TERMINATE("failed memory alloc in fromUnsorted");
+    }
+    forEachChunk(parts, num_threads, 1, [=](uint64_t begin, uint64_t end) {
+        for (uint64_t part = begin; part < end; ++part) {
+            api::roaring_bulk_loader_count(l, (uint32_t)part);
+        }
+    });
+    uint32_t num_keys = 0;
+    if (api::roaring_bulk_loader_plan(l, &num_keys)) {
+        forEachChunk(parts, num_threads, 1, [=](uint64_t begin, uint64_t end) {
+            for (uint64_t part = begin; part < end; ++part) {
+                api::roaring_bulk_loader_scatter(l, (uint32_t)part);
+            }
+        });
+        forEachChunk(num_keys, num_threads, kBulkLoadMinChunk,
+                     [=](uint64_t begin, uint64_t end) {
+                         api::roaring_bulk_loader_build(l, (uint32_t)begin,
+                                                        (uint32_t)end);
+                     });
+    }
+    api::roaring_bitmap_t *r = api::roaring_bulk_loader_finish(l);
+    if (r == NULL) {
+        ROARING_TERMINATE("failed memory alloc in fromUnsorted");
+    }
+    return Roaring(r);
+}
+
+/**
+ * Same as roaring64_bitmap_from_unsorted(vals, n), with the partitioning and
+ * the container building spread over up to `num_threads` threads (0 for one
+ * per core). See roaring64_bulk_loader_t.
+ */
+inline Roaring64 fromUnsorted64(const uint64_t *vals, size_t n,
+                                unsigned num_threads = 0) {
+    if (num_threads == 0) {
+        num_threads = defaultThreadCount();
+    }
+    uint64_t parts = (n + kBulkLoadMinPart - 1) / kBulkLoadMinPart;
+    if (parts > num_threads) parts = num_threads;
+    if (parts == 0) parts = 1;
+    api::roaring64_bulk_loader_t *l =
+        api::roaring64_bulk_loader_create(vals, n, (uint32_t)parts);
+    if (l == NULL) {
+        ROARING_TERMINATE("failed memory alloc in fromUnsorted64");
+    }
+    forEachChunk(parts, num_threads, 1, [=](uint64_t begin, uint64_t end) {
+        for (uint64_t part = begin; part < end; ++part) {
+            api::roaring64_bulk_loader_count(l, (uint32_t)part);
+        }
+    });
+    uint32_t num_buckets = 0;
+    if (api::roaring64_bulk_loader_plan(l, &num_buckets)) {
+        forEachChunk(parts, num_threads, 1, [=](uint64_t begin, uint64_t end) {
+            for (uint64_t part = begin; part < end; ++part) {
+                api::roaring64_bulk_loader_scatter(l, (uint32_t)part);
+            }
+        });
+        forEachChunk(num_buckets, num_threads, kBulkLoadMinChunk,
+                     [=](uint64_t begin, uint64_t end) {
+                         api::roaring64_bulk_loader_build(l, (uint32_t)begin,
+                                                          (uint32_t)end);
+                     });
+    }
+    api::roaring64_bitmap_t *r = api::roaring64_bulk_loader_finish(l);
+    if (r == NULL) {
+        ROARING_TERMINATE("failed memory alloc in fromUnsorted64");
+    }
+    return Roaring64(r);
+}
+
+/**
+ * Values written per thread, at least, by toUint32Array and toUint64Array.
+ */
+static constexpr uint64_t kExportMinChunk = 1 << 16;
+
+/**
+ * Same as r.toUint32Array(ans), with up to `num_threads` threads (0 for one
+ * per core) each writing a slice of `ans` with Roaring::rangeUint32Array().
+ */
+inline void toUint32Array(const Roaring &r, uint32_t *ans,
+                          unsigned num_threads = 0) {
+    forEachChunk(r.cardinality(), num_threads, kExportMinChunk,
+                 [&r, ans](uint64_t begin, uint64_t end) {
+                     r.rangeUint32Array(ans + begin, (size_t)begin,
+                                        (size_t)(end - begin));
+                 });
+}
+
+/**
+ * Same as r.toArray(ans), with up to `num_threads` threads (0 for one per
+ * core) each writing a slice of `ans` with Roaring64::rangeArray().
+ */
+inline void toUint64Array(const Roaring64 &r, uint64_t *ans,
+                          unsigned num_threads = 0) {
+    forEachChunk(r.cardinality(), num_threads, kExportMinChunk,
+                 [&r, ans](uint64_t begin, uint64_t end) {
+                     r.rangeArray(ans + begin, begin, end - begin);
+                 });
+}
+
+/**
+ * Lets the helpers below reach into the buckets of a BasicRoaring64Map. They
+ * run the same steps as its methods, with the work on the 32-bit bitmaps of
+ * the buckets spread over threads: the buckets are independent.
+ */
+struct Roaring64MapAccess {
+    template <class Map, class Buckets, class Iterator>
+    static Buckets &buckets(BasicRoaring64Map<Map, Buckets, Iterator> &r) {
+        return r.roarings;
+    }
+
+    template <class Map, class Buckets, class Iterator>
+    static const Buckets &buckets(
+        const BasicRoaring64Map<Map, Buckets, Iterator> &r) {
+        return r.roarings;
+    }
+
+    // A bucket of 'r' for 'key' with an empty bitmap.
+    template <class Map, class Buckets, class Iterator>
+    static typename Buckets::value_type emptyEntry(
+        const BasicRoaring64Map<Map, Buckets, Iterator> &r, uint32_t key) {
+        return r.newEntry(key, Roaring(r.allocator));
+    }
+
+    template <class Map, class Buckets, class Iterator>
+    static void eraseEmpty(BasicRoaring64Map<Map, Buckets, Iterator> &r) {
+        r.eraseEmpty(r.roarings.begin(), r.roarings.end());
+    }
+
+    template <class Map, class Buckets, class Iterator>
+    static void eraseEmptied(
+        BasicRoaring64Map<Map, Buckets, Iterator> &r,
+        const std::vector<typename Buckets::iterator> &emptied) {
+        r.eraseEmptied(emptied);
+    }
+};
+
+/**
+ * Containers processed per thread, at least, by the Roaring64Map helpers.
+ */
+static constexpr uint64_t kMapMinChunk = 256;
+
+/**
+ * The cost of the work on a 32-bit bitmap, as its number of containers (plus
+ * one, so that empty bitmaps are not free).
+ */
+inline uint64_t bucketCost(const Roaring &r) {
+    return uint64_t(r.roaring.high_low_container.size) + 1;
+}
+
+/**
+ * A 32-bit bitmap of the left-hand side of a per-bucket operation and the
+ * bitmap of the right-hand side with the same high 32 bits, or NULL.
+ */
+struct BucketPair {
+    Roaring *self;
+    const Roaring *other;
+};
+
+/**
+ * Calls op(pair) for each of `pairs`, spread over up to `num_threads`
+ * threads by the number of containers involved.
+ */
+template <typename Op>
+void forEachBucketPair(const std::vector<BucketPair> &pairs,
+                       unsigned num_threads, Op op) {
+    forEachWeightedChunk(
+        pairs.size(), num_threads, kMapMinChunk,
+        [&pairs](uint64_t i) {
+            const BucketPair &p = pairs[i];
+            return bucketCost(*p.self) +
+                   (p.other == NULL ? 0 : bucketCost(*p.other));
+        },
+        [&pairs, op](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; ++i) {
+                op(pairs[i]);
+            }
+        });
+}
+
+/**
+ * Pairs the buckets of `other` with those of `r`. The buckets of `r` that
+ * have a match go to `matched`, in key order. With `add_missing`, the buckets
+ * that `r` lacks are paired with fresh empty bitmaps in `added`, to be
+ * inserted into `r` once the pairs are processed.
+ */
+template <class Map, class Buckets, class Iterator>
+void pairWithOther(BasicRoaring64Map<Map, Buckets, Iterator> &r,
+                   const BasicRoaring64Map<Map, Buckets, Iterator> &other,
+                   bool add_missing,
+                   std::vector<BucketPair> &pairs,
+                   std::vector<typename Buckets::iterator> &matched,
+                   std::vector<typename Buckets::value_type> &added) {
+    Buckets &buckets = Roaring64MapAccess::buckets(r);
+    std::vector<const Roaring *> added_from;
+    for (const auto &entry : Roaring64MapAccess::buckets(other)) {
+        auto iter = buckets.find(entry.first);
+        if (iter != buckets.end()) {
+            matched.push_back(iter);
+            pairs.push_back({&iter->second, &entry.second});
+        } else if (add_missing) {
+            added.push_back(Roaring64MapAccess::emptyEntry(r, entry.first));
+            added_from.push_back(&entry.second);
+        }
+    }
+    // 'added' no longer moves.
+    for (size_t i = 0; i < added.size(); ++i) {
+        pairs.push_back({&added[i].second, added_from[i]});
+    }
+}
+
+/**
+ * Same as r &= other, with the buckets intersected by up to `num_threads`
+ * threads (0 for one per core).
+ */
+template <class Map, class Buckets, class Iterator>
+void andInplace(BasicRoaring64Map<Map, Buckets, Iterator> &r,
+                const BasicRoaring64Map<Map, Buckets, Iterator> &other,
+                unsigned num_threads = 0) {
+    if (&r == &other) {
+        return;
+    }
+    const Buckets &other_buckets = Roaring64MapAccess::buckets(other);
+    std::vector<BucketPair> pairs;
+    for (auto &entry : Roaring64MapAccess::buckets(r)) {
+        auto iter = other_buckets.find(entry.first);
+        pairs.push_back({&entry.second,
+                         iter == other_buckets.end() ? NULL : &iter->second});
+    }
+    forEachBucketPair(pairs, num_threads, [](const BucketPair &p) {
+        if (p.other == NULL) {
+            p.self->clear();
+        } else {
+            *p.self &= *p.other;
+        }
+    });
+    Roaring64MapAccess::eraseEmpty(r);
+}
+
+/**
+ * Same as r |= other, with the buckets united by up to `num_threads` threads
+ * (0 for one per core).
+ */
+template <class Map, class Buckets, class Iterator>
+void orInplace(BasicRoaring64Map<Map, Buckets, Iterator> &r,
+               const BasicRoaring64Map<Map, Buckets, Iterator> &other,
+               unsigned num_threads = 0) {
+    if (&r == &other) {
+        return;
+    }
+    std::vector<BucketPair> pairs;
+    std::vector<typename Buckets::iterator> matched;
+    std::vector<typename Buckets::value_type> added;
+    pairWithOther(r, other, true, pairs, matched, added);
+    forEachBucketPair(pairs, num_threads,
+                      [](const BucketPair &p) { *p.self |= *p.other; });
+    Roaring64MapAccess::buckets(r).insert(
+        std::make_move_iterator(added.begin()),
+        std::make_move_iterator(added.end()));
+}
+
+/**
+ * Same as r ^= other, with the buckets combined by up to `num_threads`
+ * threads (0 for one per core).
+ */
+template <class Map, class Buckets, class Iterator>
+void xorInplace(BasicRoaring64Map<Map, Buckets, Iterator> &r,
+                const BasicRoaring64Map<Map, Buckets, Iterator> &other,
+                unsigned num_threads = 0) {
+    if (&r == &other) {
+        r.clear();
+        return;
+    }
+    std::vector<BucketPair> pairs;
+    std::vector<typename Buckets::iterator> matched;
+    std::vector<typename Buckets::value_type> added;
+    pairWithOther(r, other, true, pairs, matched, added);
+    forEachBucketPair(pairs, num_threads,
+                      [](const BucketPair &p) { *p.self ^= *p.other; });
+    matched.erase(std::remove_if(matched.begin(), matched.end(),
+                                 [](typename Buckets::iterator iter) {
+                                     return !iter->second.isEmpty();
+                                 }),
+                  matched.end());
+    Roaring64MapAccess::eraseEmptied(r, matched);
+    Roaring64MapAccess::buckets(r).insert(
+        std::make_move_iterator(added.begin()),
+        std::make_move_iterator(added.end()));
+}
+
+/**
+ * Same as r -= other, with the buckets subtracted by up to `num_threads`
+ * threads (0 for one per core).
+ */
+template <class Map, class Buckets, class Iterator>
+void andnotInplace(BasicRoaring64Map<Map, Buckets, Iterator> &r,
+                   const BasicRoaring64Map<Map, Buckets, Iterator> &other,
+                   unsigned num_threads = 0) {
+    if (&r == &other) {
+        r.clear();
+        return;
+    }
+    std::vector<BucketPair> pairs;
+    std::vector<typename Buckets::iterator> matched;
+    std::vector<typename Buckets::value_type> added;
+    pairWithOther(r, other, false, pairs, matched, added);
+    forEachBucketPair(pairs, num_threads,
+                      [](const BucketPair &p) { *p.self -= *p.other; });
+    matched.erase(std::remove_if(matched.begin(), matched.end(),
+                                 [](typename Buckets::iterator iter) {
+                                     return !iter->second.isEmpty();
+                                 }),
+                  matched.end());
+    Roaring64MapAccess::eraseEmptied(r, matched);
+}
+
+/**
+ * The 32-bit bitmaps of `r`, in key order.
+ */
+template <class Map, class Buckets, class Iterator>
+std::vector<const Roaring *> bucketBitmaps(
+    const BasicRoaring64Map<Map, Buckets, Iterator> &r) {
+    std::vector<const Roaring *> bitmaps;
+    bitmaps.reserve(Roaring64MapAccess::buckets(r).size());
+    for (const auto &entry : Roaring64MapAccess::buckets(r)) {
+        bitmaps.push_back(&entry.second);
+    }
+    return bitmaps;
+}
+
+/**
+ * Same as r.cardinality(), with the buckets counted by up to `num_threads`
+ * threads (0 for one per core).
+ */
+template <class Map, class Buckets, class Iterator>
+uint64_t cardinality(const BasicRoaring64Map<Map, Buckets, Iterator> &r,
+                     unsigned num_threads = 0) {
+    if (r.isFull()) {
+        return r.cardinality();  // which reports the overflow
+    }
+    std::vector<const Roaring *> bitmaps = bucketBitmaps(r);
+    std::vector<uint64_t> counts(bitmaps.size());
+    forEachWeightedChunk(
+        bitmaps.size(), num_threads, kMapMinChunk,
+        [&bitmaps](uint64_t i) { return bucketCost(*bitmaps[i]); },
+        [&bitmaps, &counts](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; ++i) {
+                counts[i] = bitmaps[i]->cardinality();
+            }
+        });
+    uint64_t total = 0;
+    for (uint64_t count : counts) {
+        total += count;
+    }
+    return total;
+}
+
+/**
+ * Same as r.runOptimize(), with the buckets converted by up to `num_threads`
+ * threads (0 for one per core).
+ */
+template <class Map, class Buckets, class Iterator>
+bool runOptimize(BasicRoaring64Map<Map, Buckets, Iterator> &r,
+                 unsigned num_threads = 0) {
+    std::vector<Roaring *> bitmaps;
+    for (auto &entry : Roaring64MapAccess::buckets(r)) {
+        bitmaps.push_back(&entry.second);
+    }
+    std::vector<char> results(bitmaps.size(), 1);
+    forEachWeightedChunk(
+        bitmaps.size(), num_threads, kMapMinChunk,
+        [&bitmaps](uint64_t i) { return bucketCost(*bitmaps[i]); },
+        [&bitmaps, &results](uint64_t begin, uint64_t end) {
+            for (uint64_t i = begin; i < end; ++i) {
+                results[i] = bitmaps[i]->runOptimize();
+            }
+        });
+    return std::find(results.begin(), results.end(), 0) == results.end();
+}
+
+/**
+ * Same as r.write(buf, portable): the buckets are sized, then written at
+ * their offsets, by up to `num_threads` threads (0 for one per core).
+ * Returns the number of bytes written, r.getSizeInBytes(portable).
+ */
+template <class Map, class Buckets, class Iterator>
+size_t write(const BasicRoaring64Map<Map, Buckets, Iterator> &r, char *buf,
+             bool portable = true, unsigned num_threads = 0) {
+    const Buckets &buckets = Roaring64MapAccess::buckets(r);
+    std::vector<const Roaring *> bitmaps = bucketBitmaps(r);
+    std::vector<uint32_t> keys;
+    keys.reserve(buckets.size());
+    for (const auto &entry : buckets) {
+        keys.push_back(entry.first);
+    }
+    auto cost = [&bitmaps](uint64_t i) { return bucketCost(*bitmaps[i]); };
+    // offsets[i + 1] holds the size of bucket i until the prefix sum.
+    std::vector<size_t> offsets(bitmaps.size() + 1, 0);
+    forEachWeightedChunk(bitmaps.size(), num_threads, kMapMinChunk, cost,
+                         [&](uint64_t begin, uint64_t end) {
+                             for (uint64_t i = begin; i < end; ++i) {
+                                 offsets[i + 1] =
+                                     sizeof(uint32_t) +
+                                     bitmaps[i]->getSizeInBytes(portable);
+                             }
+                         });
+    offsets[0] = sizeof(uint64_t);
+    for (size_t i = 1; i < offsets.size(); ++i) {
+        offsets[i] += offsets[i - 1];
+    }
+    uint64_t map_size_le = croaring_htole64(uint64_t(bitmaps.size()));
+    std::memcpy(buf, &map_size_le, sizeof(uint64_t));
+    forEachWeightedChunk(bitmaps.size(), num_threads, kMapMinChunk, cost,
+                         [&](uint64_t begin, uint64_t end) {
+                             for (uint64_t i = begin; i < end; ++i) {
+                                 char *out = buf + offsets[i];
+                                 uint32_t key_le = croaring_htole32(keys[i]);
+                                 std::memcpy(out, &key_le, sizeof(uint32_t));
+                                 bitmaps[i]->write(out + sizeof(uint32_t),
+                                                   portable);
+                             }
+                         });
+    return offsets.back();
+}
+
+/**
+ * Same as Map::fastunion(n, inputs), Map being Roaring64Map or
+ * Roaring64FlatMap: the buckets of the inputs are grouped by key, and the
+ * groups united by up to `num_threads` threads (0 for one per core). The new
+ * bitmaps come from the allocator in scope on the calling thread.
+ */
+template <class Map>
+Map fastunion(size_t n, const Map **inputs, unsigned num_threads = 0) {
+    std::vector<std::pair<uint32_t, const api::roaring_bitmap_t *>> all;
+    for (size_t i = 0; i < n; ++i) {
+        for (const auto &entry : Roaring64MapAccess::buckets(*inputs[i])) {
+            all.push_back(std::make_pair(entry.first, &entry.second.roaring));
+        }
+    }
+    std::stable_sort(
+        all.begin(), all.end(),
+        [](const std::pair<uint32_t, const api::roaring_bitmap_t *> &a,
+           const std::pair<uint32_t, const api::roaring_bitmap_t *> &b) {
+            return a.first < b.first;
+        });
+    std::vector<const api::roaring_bitmap_t *> group_bitmaps;
+    std::vector<size_t> group_begin;  // the groups, plus the end
+    std::vector<uint64_t> group_cost;
+    for (size_t i = 0; i < all.size(); ++i) {
+        if (i == 0 || all[i].first != all[i - 1].first) {
+            group_begin.push_back(i);
+            group_cost.push_back(0);
+        }
+        group_bitmaps.push_back(all[i].second);
+        group_cost.back() +=
+            uint64_t(all[i].second->high_low_container.size) + 1;
+    }
+    size_t num_groups = group_begin.size();
+    group_begin.push_back(all.size());
+
+    std::vector<std::pair<uint32_t, Roaring>> results;
+    results.reserve(num_groups);
+    for (size_t g = 0; g < num_groups; ++g) {
+        results.push_back(std::make_pair(all[group_begin[g]].first, Roaring()));
+    }
+    const roaring_allocator_t *allocator = roaring_allocator_current();
+    forEachWeightedChunk(
+        num_groups, num_threads, kMapMinChunk,
+        [&group_cost](uint64_t g) { return group_cost[g]; },
+        [&, allocator](uint64_t begin, uint64_t end) {
+            AllocatorScope scope(allocator);
+            for (uint64_t g = begin; g < end; ++g) {
+                size_t first = group_begin[g];
+                results[g].second = Roaring(api::roaring_bitmap_or_many(
+                    group_begin[g + 1] - first, group_bitmaps.data() + first));
+            }
+        });
+    Map result;
+    Roaring64MapAccess::buckets(result).insert(
+        std::make_move_iterator(results.begin()),
+        std::make_move_iterator(results.end()));
+    return result;
+}
+
+}  // namespace parallel
+}  // namespace roaring
+
+#endif  // INCLUDE_ROARING_PARALLEL_HH_
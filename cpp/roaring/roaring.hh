@@ -6,6 +6,9 @@ A C++ header for Roaring Bitmaps.
 
 #include <algorithm>
 #include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
 #include <initializer_list>
 #include <limits>
 #include <new>
@@ -36,6 +39,16 @@ A C++ header for Roaring Bitmaps.
 
 #include <roaring/roaring_array.h>  // roaring::internal array functions used
 
+#if defined(__has_include)
+#if __cplusplus >= 201703L && __has_include(<memory_resource>)
+#include <memory_resource>
+#define ROARING_HAS_MEMORY_RESOURCE 1
+#endif
+#endif
+#ifndef ROARING_HAS_MEMORY_RESOURCE
+#define ROARING_HAS_MEMORY_RESOURCE 0
+#endif
+
 namespace roaring {
 
 class RoaringSetBitBiDirectionalIterator;
@@ -65,6 +78,137 @@ class BulkContext {
     roaring_bitmap_bulk_context_t context_;
 };
 
+/**
+ * Makes `allocator` the current allocator of the calling thread for the
+ * lifetime of the scope object (see roaring_allocator_enter()): bitmaps
+ * created meanwhile use it. The allocator itself is owned by the caller.
+ */
+class AllocatorScope {
+   public:
+    explicit AllocatorScope(const roaring_allocator_t *allocator) noexcept
+        : previous_(roaring_allocator_enter(allocator)) {}
+    ~AllocatorScope() { roaring_allocator_leave(previous_); }
+
+    AllocatorScope(const AllocatorScope &) = delete;
+    AllocatorScope &operator=(const AllocatorScope &) = delete;
+
+   private:
+    const roaring_allocator_t *previous_;
+};
+
+#if ROARING_HAS_MEMORY_RESOURCE
+/**
+ * Exposes a std::pmr::memory_resource as a roaring_allocator_t, so that
+ * bitmaps can draw from a std::pmr pool or monotonic buffer:
+ *
+ *     std::pmr::unsynchronized_pool_resource pool;
+ *     roaring::MemoryResourceAllocator allocator(&pool);
+ *     roaring::Roaring r(allocator.get());
+ *
+ * Each block is prefixed with its size and alignment, which the resource
+ * needs to deallocate it. The adapter, like the resource, must outlive the
+ * bitmaps using it, and the resource must be thread-safe if they are used
+ * from several threads.
+ */
+class MemoryResourceAllocator {
+   public:
+    explicit MemoryResourceAllocator(
+        std::pmr::memory_resource *resource =
+            std::pmr::get_default_resource()) noexcept
+        : resource_(resource) {
+        allocator_.context = this;
+        allocator_.malloc = [](void *context, size_t size) {
+            return allocate(context, 0, size);
+        };
+        allocator_.realloc = reallocate;
+        allocator_.calloc = [](void *context, size_t n, size_t size) {
+            if (size != 0 && n > SIZE_MAX / size) {
+                return (void *)nullptr;
+            }
+            void *p = allocate(context, 0, n * size);
+            if (p != nullptr) {
+                memset(p, 0, n * size);
+            }
+            return p;
+        };
+        allocator_.free = deallocate;
+        allocator_.aligned_malloc = allocate;
+        allocator_.aligned_free = deallocate;
+    }
+
+    MemoryResourceAllocator(const MemoryResourceAllocator &) = delete;
+    MemoryResourceAllocator &operator=(const MemoryResourceAllocator &) =
+        delete;
+
+    const roaring_allocator_t *get() const noexcept { return &allocator_; }
+    std::pmr::memory_resource *resource() const noexcept { return resource_; }
+
+   private:
+    struct Header {
+        size_t total;   // bytes obtained from the resource
+        size_t offset;  // from the start of the block to the user pointer,
+                        // also the alignment of the block
+    };
+
+    static void *allocate(void *context, size_t alignment,
+                          size_t size) noexcept {
+        auto *self = static_cast<MemoryResourceAllocator *>(context);
+        // A power of two at least as large as the header and the alignment.
+        size_t offset = alignof(std::max_align_t);
+        while (offset < sizeof(Header) || offset < alignment) {
+            offset *= 2;
+        }
+        if (size > SIZE_MAX - offset) {
+            return nullptr;
+        }
+        Header h{offset + size, offset};
+        char *base;
+        try {
+            base = static_cast<char *>(
+                self->resource_->allocate(h.total, h.offset));
+        } catch (...) {
+            return nullptr;
+        }
+        memcpy(base + offset - sizeof(Header), &h, sizeof(Header));
+        return base + offset;
+    }
+
+    static Header header_of(const void *p) noexcept {
+        Header h;
+        memcpy(&h, static_cast<const char *>(p) - sizeof(Header),
+               sizeof(Header));
+        return h;
+    }
+
+    static void deallocate(void *context, void *p) noexcept {
+        if (p == nullptr) {
+            return;
+        }
+        auto *self = static_cast<MemoryResourceAllocator *>(context);
+        Header h = header_of(p);
+        self->resource_->deallocate(static_cast<char *>(p) - h.offset, h.total,
+                                    h.offset);
+    }
+
+    static void *reallocate(void *context, void *p, size_t size) noexcept {
+        if (p == nullptr) {
+            return allocate(context, 0, size);
+        }
+        Header h = header_of(p);
+        void *q = allocate(context, 0, size);
+        if (q != nullptr) {
+            size_t old_size = h.total - h.offset;
+            memcpy(q, p, old_size < size ? old_size : size);
+            deallocate(context, p);
+        }
+        return q;
+    }
+
+    std::pmr::memory_resource *resource_;
+    roaring_allocator_t allocator_;
+};
+#endif  // ROARING_HAS_MEMORY_RESOURCE
+
 class Roaring {
     typedef api::roaring_bitmap_t roaring_bitmap_t;  // class-local name alias
 
@@ -100,14 +244,32 @@ class Roaring {
      * The pointer to the C struct will be invalid after the call.
      */
     explicit Roaring(roaring_bitmap_t *s) noexcept : roaring(*s) {
-        roaring_free(s);  // deallocate the passed-in pointer
+        // deallocate the passed-in pointer, with the allocator it came from
+        AllocatorScope scope(api::roaring_bitmap_get_allocator(&roaring));
+        roaring_free(s);
+    }
+
+    /**
+     * Create an empty bitmap that allocates through `allocator` (NULL for the
+     * memory hook), as do, by default, the results of operations taking it as
+     * their first operand. See roaring_allocator_t.
+     */
+    explicit Roaring(const roaring_allocator_t *allocator) : roaring{} {
+        AllocatorScope scope(allocator);
+        if (!api::roaring_bitmap_init_with_capacity(&roaring, 0)) {
+            ROARING_TERMINATE("failed memory alloc in constructor");
+        }
     }
 
     /**
-     * Copy constructor.
+     * Copy constructor. Like roaring_bitmap_copy(), the copy uses the current
+     * allocator if one was entered, otherwise the allocator of `r`.
      * It may throw std::runtime_error if there is insufficient memory.
      */
-    Roaring(const Roaring &r) : Roaring() {
+    Roaring(const Roaring &r)
+        : Roaring(roaring_allocator_current() != nullptr
+                      ? roaring_allocator_current()
+                      : api::roaring_bitmap_get_allocator(&r.roaring)) {
         if (!api::roaring_bitmap_overwrite(&roaring, &r.roaring)) {
             ROARING_TERMINATE("failed roaring_bitmap_overwrite in constructor");
         }
@@ -163,7 +325,7 @@ class Roaring {
      * discard the current content.
      */
     Roaring &operator=(Roaring &&r) noexcept {
-        api::roaring_bitmap_clear(&roaring);  // free this class's allocations
+        api::roaring_bitmap_release(&roaring);  // free this class's allocations
 
         // !!! See notes in the Move Constructor regarding roaring_bitmap_move()
         //
@@ -309,6 +471,13 @@ class Roaring {
      */
     void clear() { api::roaring_bitmap_clear(&roaring); }
 
+    /**
+     * The allocator of the bitmap, NULL for the memory hook.
+     */
+    const roaring_allocator_t *getAllocator() const noexcept {
+        return api::roaring_bitmap_get_allocator(&roaring);
+    }
+
     /**
      * Returns the greatest value in the set, or 0 if the set is empty.
      */
@@ -502,6 +671,17 @@ class Roaring {
         return api::roaring_bitmap_shrink_to_fit(&roaring);
     }
 
+    /**
+     * Repacks the bitmap into a single allocation for faster reads, see
+     * roaring_bitmap_seal(). Modifying the bitmap unseals it. Returns false
+     * in case of failure.
+     */
+    bool seal() noexcept { return api::roaring_bitmap_seal(&roaring); }
+
+    bool isSealed() const noexcept {
+        return api::roaring_bitmap_is_sealed(&roaring);
+    }
+
     /**
      * Iterate over the bitmap elements. The function iterator is called once
      * for all the values with ptr (can be NULL) as the second parameter of
@@ -748,6 +928,7 @@ class Roaring {
             ROARING_TERMINATE("failed to read frozen bitmap");
         }
         Roaring r;
+        api::roaring_bitmap_release(&r.roaring);
         r.roaring = *s;
         return r;
     }
@@ -763,6 +944,7 @@ class Roaring {
             ROARING_TERMINATE("failed to read portable frozen bitmap");
         }
         Roaring r;
+        api::roaring_bitmap_release(&r.roaring);
         r.roaring = *s;
         return r;
     }
@@ -907,23 +1089,28 @@ class Roaring {
     }
 
     /**
-     * Destructor.  By contract, calling roaring_bitmap_clear() is enough to
+     * Destructor.  By contract, calling roaring_bitmap_release() is enough to
      * release all auxiliary memory used by the structure.
      */
     ~Roaring() {
         if (!(roaring.high_low_container.flags & ROARING_FLAG_FROZEN)) {
-            api::roaring_bitmap_clear(&roaring);
+            api::roaring_bitmap_release(&roaring);
         } else {
             // The roaring member variable copies the `roaring_bitmap_t` and
             // nested `roaring_array_t` structures by value and is freed in the
             // constructor, however the underlying memory arena used for the
             // container data is not freed with it. Here we derive the arena
             // pointer from the second arena allocation in
-            // `roaring_bitmap_frozen_view` and free it as well.
+            // `roaring_bitmap_frozen_view` and free it as well. The allocator,
+            // if any, sits between the two.
+            size_t offset = sizeof(roaring_bitmap_t);
+            if (roaring.high_low_container.flags & ROARING_FLAG_ALLOCATOR) {
+                offset += sizeof(const roaring_allocator_t *);
+            }
             roaring_bitmap_free(
                 (roaring_bitmap_t *)((char *)
                                          roaring.high_low_container.containers -
-                                     sizeof(roaring_bitmap_t)));
+                                     offset));
         }
     }
 
@@ -174,7 +174,22 @@ class Roaring64 {
     explicit Roaring64(roaring64_bitmap_t* s) noexcept : roaring(s) {}
 
     /**
-     * Copy constructor.
+     * Create an empty bitmap that allocates through `allocator` (NULL for the
+     * memory hook), as do, by default, the results of operations taking it as
+     * their first operand. See roaring_allocator_t.
+     */
+    explicit Roaring64(const roaring_allocator_t* allocator)
+        : roaring(nullptr) {
+        AllocatorScope scope(allocator);
+        roaring = api::roaring64_bitmap_create();
+        if (roaring == nullptr) {
+            ROARING_TERMINATE("failed memory alloc in roaring64_bitmap_create");
+        }
+    }
+
+    /**
+     * Copy constructor. The copy uses the current allocator if one was
+     * entered, otherwise the allocator of `r`.
      */
     Roaring64(const Roaring64& r)
         : roaring(api::roaring64_bitmap_copy(r.roaring)) {
@@ -228,6 +243,28 @@ class Roaring64 {
         }
     }
 
+    /**
+     * The allocator of the bitmap, NULL for the memory hook.
+     */
+    const roaring_allocator_t* getAllocator() const noexcept {
+        return api::roaring64_bitmap_get_allocator(roaring);
+    }
+
+    /**
+     * Whether copies share containers with this bitmap until either side
+     * modifies them (see roaring64_bitmap_set_copy_on_write).
+     */
+    void setCopyOnWrite(bool val) noexcept {
+        api::roaring64_bitmap_set_copy_on_write(roaring, val);
+    }
+
+    /**
+     * Whether or not copy on write is active.
+     */
+    bool getCopyOnWrite() const noexcept {
+        return api::roaring64_bitmap_get_copy_on_write(roaring);
+    }
+
     /**
      * Construct a bitmap from a list of uint64_t values.
      */
@@ -414,6 +451,26 @@ class Roaring64 {
         return Roaring64(result);
     }
 
+    /**
+     * Computes the union of n bitmaps, see roaring64_bitmap_or_many().
+     */
+    static Roaring64 fastunion(size_t n, const Roaring64** inputs) {
+        const roaring64_bitmap_t** x =
+            (const roaring64_bitmap_t**)roaring_malloc(
+                n * sizeof(roaring64_bitmap_t*));
+        if (x == nullptr) {
+            ROARING_TERMINATE("failed memory alloc in fastunion");
+        }
+        for (size_t k = 0; k < n; ++k) x[k] = inputs[k]->roaring;
+
+        roaring64_bitmap_t* c_ans = api::roaring64_bitmap_or_many(n, x);
+        roaring_free(x);
+        if (c_ans == nullptr) {
+            ROARING_TERMINATE("failed memory alloc in fastunion");
+        }
+        return Roaring64(c_ans);
+    }
+
     /**
      * Remove run-length encoding even when it is more space efficient.
      * Return whether a change was applied.
@@ -440,6 +497,23 @@ class Roaring64 {
         return api::roaring64_bitmap_shrink_to_fit(roaring);
     }
 
+    /**
+     * Renumbers the containers in key order, see roaring64_bitmap_compact().
+     * Returns false in case of failure.
+     */
+    bool compact() noexcept { return api::roaring64_bitmap_compact(roaring); }
+
+    /**
+     * Repacks the bitmap into a single allocation for faster reads, see
+     * roaring64_bitmap_seal(). Modifying the bitmap unseals it. Returns false
+     * in case of failure.
+     */
+    bool seal() noexcept { return api::roaring64_bitmap_seal(roaring); }
+
+    bool isSealed() const noexcept {
+        return api::roaring64_bitmap_is_sealed(roaring);
+    }
+
     /**
      * How many bytes are required to serialize this bitmap.
      */
@@ -524,6 +598,15 @@ class Roaring64 {
         api::roaring64_bitmap_to_uint64_array(roaring, ans);
     }
 
+    /**
+     * Write the `limit` values of the bitmap that start at rank `offset`, in
+     * sorted order, to `ans`. Fewer values are written if the bitmap runs out.
+     */
+    void rangeArray(uint64_t* ans, uint64_t offset,
+                    uint64_t limit) const noexcept {
+        api::roaring64_bitmap_range_uint64_array(roaring, offset, limit, ans);
+    }
+
    private:
     roaring64_bitmap_t* roaring;
 };
@@ -17,6 +17,7 @@
 #include <cstring>    // for std::memcpy()
 #include <functional>
 #include <initializer_list>
+#include <iterator>
 #include <limits>
 #include <map>
 #include <new>
@@ -25,6 +26,7 @@
 #include <stdexcept>
 #include <string>
 #include <utility>
+#include <vector>
 
 #include "roaring.hh"
 
@@ -32,86 +34,335 @@ namespace roaring {
 
 using roaring::Roaring;
 
+/**
+ * Bucket storage for BasicRoaring64Map that keeps the 32-bit bitmaps in a
+ * vector sorted by their high 32 bits, instead of the nodes of a std::map.
+ * Iterating over the buckets walks contiguous memory and a lookup is a
+ * branchless binary search over a dense array of the keys, which favors
+ * bitmaps that are mostly read or built in key order. Inserting or erasing a
+ * single bucket moves all the buckets after it.
+ *
+ * It provides the subset of the std::map interface that BasicRoaring64Map
+ * uses; iterators are invalidated by any insertion or erasure.
+ */
+class Roaring64FlatBuckets {
+   public:
+    typedef uint32_t key_type;
+    typedef Roaring mapped_type;
+    typedef std::pair<uint32_t, Roaring> value_type;
+    typedef std::vector<value_type>::size_type size_type;
+    typedef std::vector<value_type>::iterator iterator;
+    typedef std::vector<value_type>::const_iterator const_iterator;
+    typedef std::vector<value_type>::const_reverse_iterator
+        const_reverse_iterator;
+
+    iterator begin() { return entries.begin(); }
+    iterator end() { return entries.end(); }
+    const_iterator begin() const { return entries.begin(); }
+    const_iterator end() const { return entries.end(); }
+    const_iterator cbegin() const { return entries.cbegin(); }
+    const_iterator cend() const { return entries.cend(); }
+    const_reverse_iterator crbegin() const { return entries.crbegin(); }
+    const_reverse_iterator crend() const { return entries.crend(); }
+
+    size_type size() const { return entries.size(); }
+    bool empty() const { return entries.empty(); }
+
+    void clear() {
+        entries.clear();
+        keys.clear();
+    }
+
+    void swap(Roaring64FlatBuckets &other) {
+        entries.swap(other.entries);
+        keys.swap(other.keys);
+    }
+
+    iterator lower_bound(uint32_t key) {
+        return entries.begin() + lowerBoundIndex(key);
+    }
+
+    const_iterator lower_bound(uint32_t key) const {
+        return entries.begin() + lowerBoundIndex(key);
+    }
+
+    iterator find(uint32_t key) {
+        size_t i = lowerBoundIndex(key);
+        return i < keys.size() && keys[i] == key ? entries.begin() + i
+                                                 : entries.end();
+    }
+
+    const_iterator find(uint32_t key) const {
+        size_t i = lowerBoundIndex(key);
+        return i < keys.size() && keys[i] == key ? entries.begin() + i
+                                                 : entries.end();
+    }
+
+    template <class... Args>
+    std::pair<iterator, bool> emplace(uint32_t key, Args &&...args) {
+        size_t i = lowerBoundIndex(key);
+        if (i < keys.size() && keys[i] == key) {
+            return std::make_pair(entries.begin() + i, false);
+        }
+        return std::make_pair(insertAt(i, key, std::forward<Args>(args)...),
+                              true);
+    }
+
+    std::pair<iterator, bool> emplace(value_type &&entry) {
+        return emplace(entry.first, std::move(entry.second));
+    }
+
+    std::pair<iterator, bool> insert(value_type &&entry) {
+        return emplace(entry.first, std::move(entry.second));
+    }
+
+    /**
+     * Like std::map, the hint is the position just after the new bucket:
+     * appending in key order with end() as the hint needs no search.
+     */
+    template <class... Args>
+    iterator emplace_hint(const_iterator hint, uint32_t key, Args &&...args) {
+        size_t i = hint - entries.cbegin();
+        if ((i < keys.size() && keys[i] < key) ||
+            (i > 0 && keys[i - 1] >= key)) {
+            i = lowerBoundIndex(key);
+        }
+        if (i < keys.size() && keys[i] == key) {
+            return entries.begin() + i;
+        }
+        return insertAt(i, key, std::forward<Args>(args)...);
+    }
+
+    iterator insert(const_iterator hint, value_type &&entry) {
+        return emplace_hint(hint, entry.first, std::move(entry.second));
+    }
+
+    /**
+     * Inserts the buckets of [first, last) whose keys are not present yet,
+     * merging them in with a single pass over the existing buckets.
+     */
+    template <class InputIt>
+    void insert(InputIt first, InputIt last) {
+        size_t old_size = entries.size();
+        for (; first != last; ++first) {
+            entries.emplace_back(*first);
+        }
+        auto by_key = [](const value_type &a, const value_type &b) {
+            return a.first < b.first;
+        };
+        auto middle = entries.begin() + old_size;
+        if (!std::is_sorted(middle, entries.end(), by_key)) {
+            std::stable_sort(middle, entries.end(), by_key);
+        }
+        if (old_size > 0 && middle != entries.end() &&
+            by_key(*middle, *(middle - 1))) {
+            std::inplace_merge(entries.begin(), middle, entries.end(),
+                               by_key);
+        }
+        // On equal keys, the bucket that was there first wins.
+        entries.erase(std::unique(entries.begin(), entries.end(),
+                                  [](const value_type &a, const value_type &b) {
+                                      return a.first == b.first;
+                                  }),
+                      entries.end());
+        rebuildKeys(0);
+    }
+
+    iterator erase(const_iterator pos) {
+        keys.erase(keys.begin() + (pos - entries.cbegin()));
+        return entries.erase(pos);
+    }
+
+    iterator erase(const_iterator first, const_iterator last) {
+        keys.erase(keys.begin() + (first - entries.cbegin()),
+                   keys.begin() + (last - entries.cbegin()));
+        return entries.erase(first, last);
+    }
+
+    /**
+     * Erases the buckets of [first, last) that hold empty bitmaps, moving
+     * the others down in a single pass. Returns the new position of 'last'.
+     */
+    iterator eraseEmpty(const_iterator first, const_iterator last) {
+        size_t begin_index = first - entries.cbegin();
+        auto end = entries.begin() + (last - entries.cbegin());
+        auto kept = std::remove_if(
+            entries.begin() + begin_index, end,
+            [](const value_type &entry) { return entry.second.isEmpty(); });
+        end = entries.erase(kept, end);
+        rebuildKeys(begin_index);
+        return end;
+    }
+
+    /**
+     * Erases the buckets at 'positions', which are in increasing order,
+     * moving the others down in a single pass.
+     */
+    void eraseSorted(const std::vector<iterator> &positions) {
+        if (positions.empty()) {
+            return;
+        }
+        size_t begin_index = positions.front() - entries.begin();
+        auto kept = positions.front();
+        auto next = positions.begin();
+        for (auto iter = positions.front(); iter != entries.end(); ++iter) {
+            if (next != positions.end() && iter == *next) {
+                ++next;
+                continue;
+            }
+            *kept++ = std::move(*iter);
+        }
+        entries.erase(kept, entries.end());
+        rebuildKeys(begin_index);
+    }
+
+   private:
+    template <class... Args>
+    iterator insertAt(size_t i, uint32_t key, Args &&...args) {
+        auto iter = entries.emplace(
+            entries.begin() + i, std::piecewise_construct,
+            std::forward_as_tuple(key),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+        keys.insert(keys.begin() + i, key);
+        return iter;
+    }
+
+    void rebuildKeys(size_t from) {
+        keys.resize(entries.size());
+        for (size_t i = from; i < entries.size(); ++i) {
+            keys[i] = entries[i].first;
+        }
+    }
+
+    /**
+     * The index of the first key not less than 'key'. The search halves the
+     * range without branching on the comparisons, which the compiler turns
+     * into conditional moves.
+     */
+    size_t lowerBoundIndex(uint32_t key) const {
+        size_t n = keys.size();
+        if (n == 0) {
+            return 0;
+        }
+        const uint32_t *base = keys.data();
+        while (n > 1) {
+            size_t half = n / 2;
+            base = (base[half - 1] < key) ? base + half : base;
+            n -= half;
+        }
+        return (base - keys.data()) + (*base < key);
+    }
+
+    std::vector<value_type> entries;
+    std::vector<uint32_t> keys;  // entries[i].first, kept dense for searches
+};
+
+namespace parallel {
+struct Roaring64MapAccess;  // see parallel.hh
+}
+
+template <class Derived, class Map>
+class BasicRoaring64MapSetBitBiDirectionalIterator;
+
+class Roaring64Map;
 class Roaring64MapSetBitBiDirectionalIterator;
+class Roaring64FlatMap;
+class Roaring64FlatMapSetBitBiDirectionalIterator;
 
 // For backwards compatibility; there used to be two kinds of iterators
 // (forward and bidirectional) and now there's only one.
 typedef Roaring64MapSetBitBiDirectionalIterator
     Roaring64MapSetBitForwardIterator;
 
-class Roaring64Map {
+/**
+ * The implementation of Roaring64Map and Roaring64FlatMap, which keep their
+ * 32-bit bitmaps in different Buckets. Derived is the map class itself, which
+ * the operators and static methods return, and Iterator its iterator class.
+ */
+template <class Derived, class Buckets, class Iterator>
+class BasicRoaring64Map {
     typedef api::roaring_bitmap_t roaring_bitmap_t;
 
    public:
     /**
      * Create an empty bitmap
      */
-    Roaring64Map() = default;
+    BasicRoaring64Map() = default;
+
+    /**
+     * Create an empty bitmap whose inner bitmaps allocate through `alloc`
+     * (NULL for the memory hook); see roaring_allocator_t. The outer map
+     * itself uses the default C++ allocator.
+     */
+    explicit BasicRoaring64Map(const roaring_allocator_t *alloc)
+        : allocator(alloc) {}
 
     /**
      * Construct a bitmap from a list of 32-bit integer values.
      */
-    Roaring64Map(size_t n, const uint32_t *data) { addMany(n, data); }
+    BasicRoaring64Map(size_t n, const uint32_t *data) { addMany(n, data); }
 
     /**
      * Construct a bitmap from a list of 64-bit integer values.
      */
-    Roaring64Map(size_t n, const uint64_t *data) { addMany(n, data); }
+    BasicRoaring64Map(size_t n, const uint64_t *data) { addMany(n, data); }
 
     /**
      * Construct a bitmap from an initializer list.
      */
-    Roaring64Map(std::initializer_list<uint64_t> l) {
+    BasicRoaring64Map(std::initializer_list<uint64_t> l) {
         addMany(l.size(), l.begin());
     }
 
     /**
      * Construct a 64-bit map from a 32-bit one
      */
-    explicit Roaring64Map(const Roaring &r) { emplaceOrInsert(0, r); }
+    explicit BasicRoaring64Map(const Roaring &r) { emplaceOrInsert(0, r); }
 
     /**
      * Construct a 64-bit map from a 32-bit rvalue
      */
-    explicit Roaring64Map(Roaring &&r) { emplaceOrInsert(0, std::move(r)); }
+    explicit BasicRoaring64Map(Roaring &&r) {
+        emplaceOrInsert(0, std::move(r));
+    }
 
     /**
      * Construct a roaring object from the C struct.
      *
      * Passing a NULL point is unsafe.
      */
-    explicit Roaring64Map(roaring_bitmap_t *s) {
+    explicit BasicRoaring64Map(roaring_bitmap_t *s) {
         emplaceOrInsert(0, Roaring(s));
     }
 
-    Roaring64Map(const Roaring64Map &r) = default;
+    BasicRoaring64Map(const BasicRoaring64Map &r) = default;
 
-    Roaring64Map(Roaring64Map &&r) noexcept = default;
+    BasicRoaring64Map(BasicRoaring64Map &&r) noexcept = default;
 
     /**
      * Copy assignment operator.
      */
-    Roaring64Map &operator=(const Roaring64Map &r) = default;
+    BasicRoaring64Map &operator=(const BasicRoaring64Map &r) = default;
 
     /**
      * Move assignment operator.
      */
-    Roaring64Map &operator=(Roaring64Map &&r) noexcept = default;
+    BasicRoaring64Map &operator=(BasicRoaring64Map &&r) noexcept = default;
 
     /**
      * Assignment from an initializer list.
      */
-    Roaring64Map &operator=(std::initializer_list<uint64_t> l) {
+    Derived &operator=(std::initializer_list<uint64_t> l) {
         // Delegate to move assignment operator
-        *this = Roaring64Map(l);
-        return *this;
+        derived() = Derived(l);
+        return derived();
     }
 
     /**
      * Construct a bitmap from a list of uint64_t values.
      */
-    static Roaring64Map bitmapOf(size_t n...) {
-        Roaring64Map ans;
+    static Derived bitmapOf(size_t n...) {
+        Derived ans;
         va_list vl;
         va_start(vl, n);
         for (size_t i = 0; i < n; i++) {
@@ -125,8 +376,8 @@ class Roaring64Map {
      * Construct a bitmap from a list of uint64_t values.
      * E.g., bitmapOfList({1,2,3}).
      */
-    static Roaring64Map bitmapOfList(std::initializer_list<uint64_t> l) {
-        Roaring64Map ans;
+    static Derived bitmapOfList(std::initializer_list<uint64_t> l) {
+        Derived ans;
         ans.addMany(l.size(), l.begin());
         return ans;
     }
@@ -422,14 +673,15 @@ class Roaring64Map {
 
             // 1b. Otherwise, remove the closed range [start_low, uint32_max]...
             start_inner.removeRangeClosed(start_low, uint32_max);
-            // Advance start_iter, but keep the old value so we can check the
-            // bitmap we just modified for emptiness and erase if it necessary.
-            auto temp = start_iter++;
-            eraseIfEmpty(temp);
+            // Advance start_iter, unless the bitmap we just modified is now
+            // empty: then it gets erased along with the slots of step 2.
+            if (!start_inner.isEmpty()) {
+                ++start_iter;
+            }
         }
 
         // 2. Completely erase all slots in the half-open interval...
-        roarings.erase(start_iter, end_iter);
+        end_iter = roarings.erase(start_iter, end_iter);
 
         // 3. If the end point falls on an existing entry...
         if (end_iter != roarings.end() && end_iter->first == end_high) {
@@ -579,10 +831,10 @@ class Roaring64Map {
      * Performance hint: if you are computing the intersection between several
      * bitmaps, two-by-two, it is best to start with the smallest bitmap.
      */
-    Roaring64Map &operator&=(const Roaring64Map &other) {
+    Derived &operator&=(const BasicRoaring64Map &other) {
         if (this == &other) {
             // ANDing *this with itself is a no-op.
-            return *this;
+            return derived();
         }
 
         // Logic table summarizing what to do when a given outer key is
@@ -597,24 +849,19 @@ class Roaring64Map {
         //                                   erase self if result is empty.
         //
         // Because there is only work to do when a key is present in 'self', the
-        // main for loop iterates over entries in 'self'.
-
-        decltype(roarings.begin()) self_next;
-        for (auto self_iter = roarings.begin(); self_iter != roarings.end();
-             self_iter = self_next) {
-            // Do the 'next' operation now, so we don't have to worry about
-            // invalidation of self_iter down below with the 'erase' operation.
-            self_next = std::next(self_iter);
+        // main for loop iterates over entries in 'self'. The entries that end
+        // up empty are erased together after the loop.
 
-            auto self_key = self_iter->first;
-            auto &self_bitmap = self_iter->second;
+        for (auto &self_entry : roarings) {
+            auto self_key = self_entry.first;
+            auto &self_bitmap = self_entry.second;
 
             auto other_iter = other.roarings.find(self_key);
             if (other_iter == other.roarings.end()) {
                 // 'other' doesn't have self_key. In the logic table above,
                 // this reflects the case (self.present & other.absent).
-                // So, erase self.
-                roarings.erase(self_iter);
+                // So, empty self.
+                self_bitmap.clear();
                 continue;
             }
 
@@ -623,12 +870,9 @@ class Roaring64Map {
             // other.
             const auto &other_bitmap = other_iter->second;
             self_bitmap &= other_bitmap;
-            if (self_bitmap.isEmpty()) {
-                // ...but if intersection is empty, remove it altogether.
-                roarings.erase(self_iter);
-            }
         }
-        return *this;
+        eraseEmpty(roarings.begin(), roarings.end());
+        return derived();
     }
 
     /**
@@ -636,11 +880,11 @@ class Roaring64Map {
      * bitmap, writing the result in the current bitmap. The provided bitmap
      * is not modified.
      */
-    Roaring64Map &operator-=(const Roaring64Map &other) {
+    Derived &operator-=(const BasicRoaring64Map &other) {
         if (this == &other) {
             // Subtracting *this from itself results in the empty map.
             roarings.clear();
-            return *this;
+            return derived();
         }
 
         // Logic table summarizing what to do when a given outer key is
@@ -656,8 +900,10 @@ class Roaring64Map {
         //
         // Because there is only work to do when a key is present in both 'self'
         // and 'other', the main while loop ping-pongs back and forth until it
-        // finds the next key that is the same on both sides.
+        // finds the next key that is the same on both sides. The entries that
+        // end up empty are erased together after the loop.
 
+        std::vector<typename roarings_t::iterator> emptied;
         auto self_iter = roarings.begin();
         auto other_iter = other.roarings.cbegin();
 
@@ -688,13 +934,13 @@ class Roaring64Map {
 
             if (self_bitmap.isEmpty()) {
                 // ...but if subtraction is empty, remove it altogether.
-                self_iter = roarings.erase(self_iter);
-            } else {
-                ++self_iter;
+                emptied.push_back(self_iter);
             }
+            ++self_iter;
             ++other_iter;
         }
-        return *this;
+        eraseEmptied(emptied);
+        return derived();
     }
 
     /**
@@ -704,10 +950,10 @@ class Roaring64Map {
      *
      * See also the fastunion function to aggregate many bitmaps more quickly.
      */
-    Roaring64Map &operator|=(const Roaring64Map &other) {
+    Derived &operator|=(const BasicRoaring64Map &other) {
         if (this == &other) {
             // ORing *this with itself is a no-op.
-            return *this;
+            return derived();
         }
 
         // Logic table summarizing what to do when a given outer key is
@@ -722,45 +968,19 @@ class Roaring64Map {
         //
         // Because there is only work to do when a key is present in 'other',
         // the main for loop iterates over entries in 'other'.
-
-        for (const auto &other_entry : other.roarings) {
-            const auto &other_bitmap = other_entry.second;
-
-            // Try to insert other_bitmap into self at other_key. We take
-            // advantage of the fact that std::map::insert will not overwrite an
-            // existing entry.
-            auto insert_result = roarings.insert(other_entry);
-            auto self_iter = insert_result.first;
-            auto insert_happened = insert_result.second;
-            auto &self_bitmap = self_iter->second;
-
-            if (insert_happened) {
-                // Key was not present in self, so insert was performed above.
-                // In the logic table above, this reflects the case
-                // (self.absent | other.present). Because the copy has already
-                // happened, thanks to the 'insert' operation above, we just
-                // need to set the copyOnWrite flag.
-                self_bitmap.setCopyOnWrite(copyOnWrite);
-                continue;
-            }
-
-            // Both sides have self_key, and the insert was not performed. In
-            // the logic table above, this reflects the case
-            // (self.present & other.present). So OR other into self.
-            self_bitmap |= other_bitmap;
-        }
-        return *this;
+        orIn(roarings, other.roarings);
+        return derived();
     }
 
     /**
      * Compute the XOR of the current bitmap and the provided bitmap, writing
      * the result in the current bitmap. The provided bitmap is not modified.
      */
-    Roaring64Map &operator^=(const Roaring64Map &other) {
+    Derived &operator^=(const BasicRoaring64Map &other) {
         if (this == &other) {
             // XORing *this with itself results in the empty map.
             roarings.clear();
-            return *this;
+            return derived();
         }
 
         // Logic table summarizing what to do when a given outer key is
@@ -776,45 +996,14 @@ class Roaring64Map {
         //
         // Because there is only work to do when a key is present in 'other',
         // the main for loop iterates over entries in 'other'.
-
-        for (const auto &other_entry : other.roarings) {
-            const auto &other_bitmap = other_entry.second;
-
-            // Try to insert other_bitmap into self at other_key. We take
-            // advantage of the fact that std::map::insert will not overwrite an
-            // existing entry.
-            auto insert_result = roarings.insert(other_entry);
-            auto self_iter = insert_result.first;
-            auto insert_happened = insert_result.second;
-            auto &self_bitmap = self_iter->second;
-
-            if (insert_happened) {
-                // Key was not present in self, so insert was performed above.
-                // In the logic table above, this reflects the case
-                // (self.absent ^ other.present). Because the copy has already
-                // happened, thanks to the 'insert' operation above, we just
-                // need to set the copyOnWrite flag.
-                self_bitmap.setCopyOnWrite(copyOnWrite);
-                continue;
-            }
-
-            // Both sides have self_key, and the insert was not performed. In
-            // the logic table above, this reflects the case
-            // (self.present ^ other.present). So XOR other into self.
-            self_bitmap ^= other_bitmap;
-
-            if (self_bitmap.isEmpty()) {
-                // ...but if intersection is empty, remove it altogether.
-                roarings.erase(self_iter);
-            }
-        }
-        return *this;
+        xorIn(roarings, other.roarings);
+        return derived();
     }
 
     /**
      * Exchange the content of this bitmap with another.
      */
-    void swap(Roaring64Map &r) { roarings.swap(r.roarings); }
+    void swap(BasicRoaring64Map &r) { roarings.swap(r.roarings); }
 
     /**
      * Get the cardinality of the bitmap (number of elements).
@@ -837,7 +1026,7 @@ class Roaring64Map {
         return std::accumulate(
             roarings.cbegin(), roarings.cend(), (uint64_t)0,
             [](uint64_t previous,
-               const std::pair<const uint32_t, Roaring> &map_entry) {
+               const typename roarings_t::value_type &map_entry) {
                 return previous + map_entry.second.cardinality();
             });
     }
@@ -848,7 +1037,7 @@ class Roaring64Map {
     bool isEmpty() const {
         return std::all_of(
             roarings.cbegin(), roarings.cend(),
-            [](const std::pair<const uint32_t, Roaring> &map_entry) {
+            [](const typename roarings_t::value_type &map_entry) {
                 return map_entry.second.isEmpty();
             });
     }
@@ -867,7 +1056,7 @@ class Roaring64Map {
         return roarings.size() ==
                        ((uint64_t)(std::numeric_limits<uint32_t>::max)()) + 1
                    ? std::all_of(roarings.cbegin(), roarings.cend(),
-                                 [](const std::pair<const uint32_t, Roaring>
+                                 [](const typename roarings_t::value_type
                                         &roaring_map_entry) {
                                      return roaring_map_entry.second.isFull();
                                  })
@@ -882,7 +1071,7 @@ class Roaring64Map {
     /**
      * Returns true if the bitmap is subset of the other.
      */
-    bool isSubset(const Roaring64Map &r) const {
+    bool isSubset(const BasicRoaring64Map &r) const {
         for (const auto &map_entry : roarings) {
             if (map_entry.second.isEmpty()) {
                 continue;
@@ -902,7 +1091,7 @@ class Roaring64Map {
      * (cardinality() == 2^64). Check isFull() before calling to avoid
      * exception.
      */
-    bool isStrictSubset(const Roaring64Map &r) const {
+    bool isStrictSubset(const BasicRoaring64Map &r) const {
         return isSubset(r) && cardinality() != r.cardinality();
     }
 
@@ -916,7 +1105,7 @@ class Roaring64Map {
         (void)std::accumulate(
             roarings.cbegin(), roarings.cend(), ans,
             [](uint64_t *previous,
-               const std::pair<const uint32_t, Roaring> &map_entry) {
+               const typename roarings_t::value_type &map_entry) {
                 for (uint32_t low_bits : map_entry.second)
                     *previous++ = uniteBytes(map_entry.first, low_bits);
                 return previous;
@@ -926,7 +1115,7 @@ class Roaring64Map {
     /**
      * Return true if the two bitmaps contain the same elements.
      */
-    bool operator==(const Roaring64Map &r) const {
+    bool operator==(const BasicRoaring64Map &r) const {
         // we cannot use operator == on the map because either side may contain
         // empty Roaring Bitmaps
         auto lhs_iter = roarings.cbegin();
@@ -989,9 +1178,7 @@ class Roaring64Map {
         // bitmap we are looking for, if it exists, will be at the first slot of
         // 'roarings'. If it does not exist, we have to create it.
         if (iter == roarings.end() || iter->first != 0) {
-            iter = roarings.emplace_hint(iter, std::piecewise_construct,
-                                         std::forward_as_tuple(0),
-                                         std::forward_as_tuple());
+            iter = roarings.emplace_hint(iter, 0, Roaring(allocator));
             auto &bitmap = iter->second;
             bitmap.setCopyOnWrite(copyOnWrite);
         }
@@ -1038,29 +1225,30 @@ class Roaring64Map {
         // 2. Flip intermediate bitmaps completely: [0, uint32_max]
         // 3. Partially flip the last bitmap in the closed interval
         //    [0, end_low]
+        //
+        // The bitmaps that end up empty are erased together at the end.
 
         auto num_intermediate_bitmaps = end_high - start_high - 1;
+        auto first_iter = current_iter;
 
         // 1. Partially flip the first bitmap.
         {
             auto &bitmap = current_iter->second;
             bitmap.flipClosed(start_low, uint32_max);
-            auto temp = current_iter++;
-            eraseIfEmpty(temp);
+            ++current_iter;
         }
 
         // 2. Flip intermediate bitmaps completely.
         for (uint32_t i = 0; i != num_intermediate_bitmaps; ++i) {
             auto &bitmap = current_iter->second;
             bitmap.flipClosed(0, uint32_max);
-            auto temp = current_iter++;
-            eraseIfEmpty(temp);
+            ++current_iter;
         }
 
         // 3. Partially flip the last bitmap.
         auto &bitmap = current_iter->second;
         bitmap.flipClosed(0, end_low);
-        eraseIfEmpty(current_iter);
+        eraseEmpty(first_iter, std::next(current_iter));
     }
 
     /**
@@ -1070,7 +1258,7 @@ class Roaring64Map {
     bool removeRunCompression() {
         return std::accumulate(
             roarings.begin(), roarings.end(), true,
-            [](bool previous, std::pair<const uint32_t, Roaring> &map_entry) {
+            [](bool previous, typename roarings_t::value_type &map_entry) {
                 return map_entry.second.removeRunCompression() && previous;
             });
     }
@@ -1084,7 +1272,7 @@ class Roaring64Map {
     bool runOptimize() {
         return std::accumulate(
             roarings.begin(), roarings.end(), true,
-            [](bool previous, std::pair<const uint32_t, Roaring> &map_entry) {
+            [](bool previous, typename roarings_t::value_type &map_entry) {
                 return map_entry.second.runOptimize() && previous;
             });
     }
@@ -1095,17 +1283,15 @@ class Roaring64Map {
      */
     size_t shrinkToFit() {
         size_t savedBytes = 0;
-        auto iter = roarings.begin();
-        while (iter != roarings.cend()) {
-            if (iter->second.isEmpty()) {
+        for (auto &map_entry : roarings) {
+            if (map_entry.second.isEmpty()) {
                 // empty Roarings are 84 bytes
                 savedBytes += 88;
-                roarings.erase(iter++);
             } else {
-                savedBytes += iter->second.shrinkToFit();
-                iter++;
+                savedBytes += map_entry.second.shrinkToFit();
             }
         }
+        eraseEmpty(roarings.begin(), roarings.end());
         return savedBytes;
     }
 
@@ -1220,7 +1406,7 @@ class Roaring64Map {
         buf += sizeof(uint64_t);
         std::for_each(roarings.cbegin(), roarings.cend(),
                       [&buf, portable](
-                          const std::pair<const uint32_t, Roaring> &map_entry) {
+                          const typename roarings_t::value_type &map_entry) {
                           // push map key
                           uint32_t key_le = croaring_htole32(map_entry.first);
                           std::memcpy(buf, &key_le, sizeof(uint32_t));
@@ -1246,8 +1432,8 @@ class Roaring64Map {
      * bytes could be read, possibly causing a buffer overflow. See also
      * readSafe.
      */
-    static Roaring64Map read(const char *buf, bool portable = true) {
-        Roaring64Map result;
+    static Derived read(const char *buf, bool portable = true) {
+        Derived result;
         // get map size
         uint64_t map_size;
         std::memcpy(&map_size, buf, sizeof(uint64_t));
@@ -1277,11 +1463,11 @@ class Roaring64Map {
      * Setting the portable flag to false enable a custom format that can save
      * space compared to the portable format (e.g., for very sparse bitmaps).
      */
-    static Roaring64Map readSafe(const char *buf, size_t maxbytes) {
+    static Derived readSafe(const char *buf, size_t maxbytes) {
         if (maxbytes < sizeof(uint64_t)) {
             ROARING_TERMINATE("ran out of bytes");
         }
-        Roaring64Map result;
+        Derived result;
         if (maxbytes < sizeof(uint64_t)) {
             ROARING_TERMINATE("ran out of bytes");
         }
@@ -1330,7 +1516,7 @@ class Roaring64Map {
             roarings.cbegin(), roarings.cend(),
             sizeof(uint64_t) + roarings.size() * sizeof(uint32_t),
             [=](size_t previous,
-                const std::pair<const uint32_t, Roaring> &map_entry) {
+                const typename roarings_t::value_type &map_entry) {
                 // add in bytes used by each Roaring
                 return previous + map_entry.second.getSizeInBytes(portable);
             });
@@ -1340,12 +1526,12 @@ class Roaring64Map {
      * For advanced users only. This function is unsafe. You must ensure that
      * the provided buffer is 32-byte aligned.
      */
-    static Roaring64Map frozenView(const char *buf) {
+    static Derived frozenView(const char *buf) {
         // We do not check that buf is 32-byte aligned. Caller is responsible.
         // size of bitmap buffer and key
         const size_t metadata_size = sizeof(size_t) + sizeof(uint32_t);
 
-        Roaring64Map result;
+        Derived result;
 
         // get map size
         uint64_t map_size;
@@ -1380,8 +1566,8 @@ class Roaring64Map {
      * For advanced users only. This function is unsafe in the sense that
      * that it may trigger unaligned memory access. Use with caution.
      */
-    static Roaring64Map portableDeserializeFrozen(const char *buf) {
-        Roaring64Map result;
+    static Derived portableDeserializeFrozen(const char *buf) {
+        Derived result;
         // get map size
         uint64_t map_size;
         std::memcpy(&map_size, buf, sizeof(uint64_t));
@@ -1477,32 +1663,32 @@ class Roaring64Map {
      * Consider also using the operator &= to avoid needlessly creating
      * many temporary bitmaps.
      */
-    Roaring64Map operator&(const Roaring64Map &o) const {
-        return Roaring64Map(*this) &= o;
+    Derived operator&(const BasicRoaring64Map &o) const {
+        return Derived(derived()) &= o;
     }
 
     /**
      * Computes the difference between two bitmaps and returns new bitmap.
      * The current bitmap and the provided bitmap are unchanged.
      */
-    Roaring64Map operator-(const Roaring64Map &o) const {
-        return Roaring64Map(*this) -= o;
+    Derived operator-(const BasicRoaring64Map &o) const {
+        return Derived(derived()) -= o;
     }
 
     /**
      * Computes the union between two bitmaps and returns new bitmap.
      * The current bitmap and the provided bitmap are unchanged.
      */
-    Roaring64Map operator|(const Roaring64Map &o) const {
-        return Roaring64Map(*this) |= o;
+    Derived operator|(const BasicRoaring64Map &o) const {
+        return Derived(derived()) |= o;
     }
 
     /**
      * Computes the symmetric union between two bitmaps and returns new bitmap.
      * The current bitmap and the provided bitmap are unchanged.
      */
-    Roaring64Map operator^(const Roaring64Map &o) const {
-        return Roaring64Map(*this) ^= o;
+    Derived operator^(const BasicRoaring64Map &o) const {
+        return Derived(derived()) ^= o;
     }
 
     /**
@@ -1512,7 +1698,7 @@ class Roaring64Map {
         if (copyOnWrite == val) return;
         copyOnWrite = val;
         std::for_each(roarings.begin(), roarings.end(),
-                      [=](std::pair<const uint32_t, Roaring> &map_entry) {
+                      [=](typename roarings_t::value_type &map_entry) {
                           map_entry.second.setCopyOnWrite(val);
                       });
     }
@@ -1542,11 +1728,17 @@ class Roaring64Map {
      */
     bool getCopyOnWrite() const { return copyOnWrite; }
 
+    /**
+     * The allocator of the inner bitmaps created by this map, NULL for the
+     * memory hook.
+     */
+    const roaring_allocator_t *getAllocator() const { return allocator; }
+
     /**
      * Computes the logical or (union) between "n" bitmaps (referenced by a
      * pointer).
      */
-    static Roaring64Map fastunion(size_t n, const Roaring64Map **inputs) {
+    static Derived fastunion(size_t n, const Derived **inputs) {
         // The strategy here is to basically do a "group by" operation.
         // We group the input roarings by key, do a 32-bit
         // roaring_bitmap_or_many on each group, and collect the results.
@@ -1566,8 +1758,8 @@ class Roaring64Map {
         // (i.e. pq_entry.iterator == pq_entry.end) it is not returned to the
         // priority queue.
         struct pq_entry {
-            roarings_t::const_iterator iterator;
-            roarings_t::const_iterator end;
+            typename roarings_t::const_iterator iterator;
+            typename roarings_t::const_iterator end;
         };
 
         // Custom comparator for the priority queue.
@@ -1610,7 +1802,7 @@ class Roaring64Map {
         //       4. If current_iter != end_iter, reinsert the pair into the
         //          priority queue.
         //    C. Invoke the 32-bit roaring_bitmap_or_many() and add to result
-        Roaring64Map result;
+        Derived result;
         while (!pq.empty()) {
             // Find the next key (the lowest key) in the priority queue.
             auto group_key = pq.top().iterator->first;
@@ -1669,10 +1861,11 @@ class Roaring64Map {
         return result;
     }
 
-    friend class Roaring64MapSetBitBiDirectionalIterator;
-    typedef Roaring64MapSetBitBiDirectionalIterator const_iterator;
-    typedef Roaring64MapSetBitBiDirectionalIterator
-        const_bidirectional_iterator;
+    template <class, class>
+    friend class BasicRoaring64MapSetBitBiDirectionalIterator;
+    friend struct parallel::Roaring64MapAccess;
+    typedef Iterator const_iterator;
+    typedef Iterator const_bidirectional_iterator;
 
     /**
      * Returns an iterator that can be used to access the position of the set
@@ -1692,10 +1885,15 @@ class Roaring64Map {
     const_iterator end() const;
 
    private:
-    typedef std::map<uint32_t, Roaring> roarings_t;
+    typedef Buckets roarings_t;
+    Derived &derived() { return static_cast<Derived &>(*this); }
+    const Derived &derived() const {
+        return static_cast<const Derived &>(*this);
+    }
     roarings_t roarings{};  // The empty constructor silences warnings from
                             // pedantic static analyzers.
     bool copyOnWrite{false};
+    const roaring_allocator_t *allocator{nullptr};  // of new inner bitmaps
     static constexpr uint32_t highBytes(const uint64_t in) {
         return uint32_t(in >> 32);
     }
@@ -1730,7 +1928,11 @@ class Roaring64Map {
      * to the (already existing or newly created) inner bitmap.
      */
     Roaring &lookupOrCreateInner(uint32_t key) {
-        auto &bitmap = roarings[key];
+        auto iter = roarings.lower_bound(key);
+        if (iter == roarings.end() || iter->first != key) {
+            iter = roarings.emplace_hint(iter, key, Roaring(allocator));
+        }
+        auto &bitmap = iter->second;
         bitmap.setCopyOnWrite(copyOnWrite);
         return bitmap;
     }
@@ -1769,20 +1971,28 @@ class Roaring64Map {
      * Roaring bitmaps if necessary. The interval must be valid and non-empty.
      * Returns an iterator to the bitmap at start_high.
      */
-    roarings_t::iterator ensureRangePopulated(uint32_t start_high,
-                                              uint32_t end_high) {
+    typename roarings_t::iterator ensureRangePopulated(uint32_t start_high,
+                                                       uint32_t end_high) {
         if (start_high > end_high) {
             ROARING_TERMINATE("Logic error: start_high > end_high");
         }
+        return populateIn(roarings, start_high, end_high);
+    }
+
+    // A std::map inserts the missing entries one at a time, each right where
+    // it goes...
+    template <class Map>
+    typename Map::iterator populateIn(Map &map, uint32_t start_high,
+                                      uint32_t end_high) {
         // next_populated_iter points to the first entry in the outer map with
         // key >= start_high, or end().
-        auto next_populated_iter = roarings.lower_bound(start_high);
+        auto next_populated_iter = map.lower_bound(start_high);
 
         // Use uint64_t to avoid an infinite loop when end_high == uint32_max.
-        roarings_t::iterator start_iter{};  // Definitely assigned in loop.
+        typename Map::iterator start_iter{};  // Definitely assigned in loop.
         for (uint64_t slot = start_high; slot <= end_high; ++slot) {
-            roarings_t::iterator slot_iter;
-            if (next_populated_iter != roarings.end() &&
+            typename Map::iterator slot_iter;
+            if (next_populated_iter != map.end() &&
                 next_populated_iter->first == slot) {
                 // 'slot' index has caught up to next_populated_iter.
                 // Note it here and advance next_populated_iter.
@@ -1793,10 +2003,10 @@ class Roaring64Map {
                 // it just prior to next_populated_iter, and set its copy
                 // on write flag. We take pains to use emplace_hint and
                 // piecewise_construct to minimize effort.
-                slot_iter = roarings.emplace_hint(
+                slot_iter = map.emplace_hint(
                     next_populated_iter, std::piecewise_construct,
                     std::forward_as_tuple(uint32_t(slot)),
-                    std::forward_as_tuple());
+                    std::forward_as_tuple(allocator));
                 auto &bitmap = slot_iter->second;
                 bitmap.setCopyOnWrite(copyOnWrite);
             }
@@ -1810,16 +2020,226 @@ class Roaring64Map {
         return start_iter;
     }
 
+    // ...while the flat buckets, where each insertion moves the buckets after
+    // it, insert them all at once.
+    Roaring64FlatBuckets::iterator populateIn(Roaring64FlatBuckets &map,
+                                              uint32_t start_high,
+                                              uint32_t end_high) {
+        auto next_populated_iter = map.lower_bound(start_high);
+        std::vector<Roaring64FlatBuckets::value_type> missing;
+        // Use uint64_t to avoid an infinite loop when end_high == uint32_max.
+        for (uint64_t slot = start_high; slot <= end_high; ++slot) {
+            if (next_populated_iter != map.end() &&
+                next_populated_iter->first == slot) {
+                ++next_populated_iter;
+            } else {
+                missing.push_back(
+                    newEntry(uint32_t(slot), Roaring(allocator)));
+            }
+        }
+        map.insert(std::make_move_iterator(missing.begin()),
+                   std::make_move_iterator(missing.end()));
+        return map.lower_bound(start_high);
+    }
+
+    /**
+     * Makes an entry for 'roarings' holding a copy of 'bitmap' with the
+     * allocator and copyOnWrite flag of this bitmap.
+     */
+    typename roarings_t::value_type newEntry(uint32_t key,
+                                             const Roaring &bitmap) const {
+        typename roarings_t::value_type entry(key, Roaring(allocator));
+        entry.second = bitmap;
+        entry.second.setCopyOnWrite(copyOnWrite);
+        return entry;
+    }
+
+    typename roarings_t::value_type newEntry(uint32_t key,
+                                             Roaring &&bitmap) const {
+        typename roarings_t::value_type entry(key, std::move(bitmap));
+        entry.second.setCopyOnWrite(copyOnWrite);
+        return entry;
+    }
+
     /**
      * Erases the entry pointed to by 'iter' from the 'roarings' map. Warning:
      * this invalidates 'iter'.
      */
-    void eraseIfEmpty(roarings_t::iterator iter) {
+    void eraseIfEmpty(typename roarings_t::iterator iter) {
         const auto &bitmap = iter->second;
         if (bitmap.isEmpty()) {
             roarings.erase(iter);
         }
     }
+
+    /**
+     * Erases the entries in [first, last) whose bitmaps are empty. Returns
+     * the new position of 'last'.
+     */
+    typename roarings_t::iterator eraseEmpty(
+        typename roarings_t::iterator first,
+        typename roarings_t::iterator last) {
+        return eraseEmptyIn(roarings, first, last);
+    }
+
+    /**
+     * Erases the entries at 'emptied', which are in key order and hold empty
+     * bitmaps. No entry may have been inserted since they were collected.
+     */
+    void eraseEmptied(
+        const std::vector<typename roarings_t::iterator> &emptied) {
+        eraseEmptiedIn(roarings, emptied);
+    }
+
+    // A std::map erases its entries one at a time...
+    template <class Map>
+    static typename Map::iterator eraseEmptyIn(Map &map,
+                                               typename Map::iterator first,
+                                               typename Map::iterator last) {
+        while (first != last) {
+            if (first->second.isEmpty()) {
+                first = map.erase(first);
+            } else {
+                ++first;
+            }
+        }
+        return last;
+    }
+
+    template <class Map>
+    static void eraseEmptiedIn(
+        Map &map, const std::vector<typename Map::iterator> &emptied) {
+        for (auto iter : emptied) {
+            map.erase(iter);
+        }
+    }
+
+    // ...while the flat buckets close all the gaps in a single pass.
+    static Roaring64FlatBuckets::iterator eraseEmptyIn(
+        Roaring64FlatBuckets &map, Roaring64FlatBuckets::iterator first,
+        Roaring64FlatBuckets::iterator last) {
+        return map.eraseEmpty(first, last);
+    }
+
+    static void eraseEmptiedIn(
+        Roaring64FlatBuckets &map,
+        const std::vector<Roaring64FlatBuckets::iterator> &emptied) {
+        map.eraseSorted(emptied);
+    }
+
+    // The main loops of operator|= and operator^=. A std::map inserts the
+    // entries missing from self as it finds them...
+    template <class Map>
+    void orIn(Map &map, const Map &other_map) {
+        for (const auto &other_entry : other_map) {
+            const auto &other_bitmap = other_entry.second;
+
+            // Try to insert an empty bitmap into self at other_key. We take
+            // advantage of the fact that std::map::emplace will not overwrite
+            // an existing entry.
+            auto insert_result = map.emplace(
+                std::piecewise_construct,
+                std::forward_as_tuple(other_entry.first),
+                std::forward_as_tuple(allocator));
+            auto self_iter = insert_result.first;
+            auto insert_happened = insert_result.second;
+            auto &self_bitmap = self_iter->second;
+
+            if (insert_happened) {
+                // Key was not present in self, so insert was performed above.
+                // In the logic table of operator|=, this reflects the case
+                // (self.absent | other.present). Copy other_bitmap into the
+                // new entry, which keeps the allocator of self, and set the
+                // copyOnWrite flag.
+                self_bitmap = other_bitmap;
+                self_bitmap.setCopyOnWrite(copyOnWrite);
+                continue;
+            }
+
+            // Both sides have self_key, and the insert was not performed. In
+            // the logic table of operator|=, this reflects the case
+            // (self.present & other.present). So OR other into self.
+            self_bitmap |= other_bitmap;
+        }
+    }
+
+    template <class Map>
+    void xorIn(Map &map, const Map &other_map) {
+        for (const auto &other_entry : other_map) {
+            const auto &other_bitmap = other_entry.second;
+
+            // Try to insert an empty bitmap into self at other_key. We take
+            // advantage of the fact that std::map::emplace will not overwrite
+            // an existing entry.
+            auto insert_result = map.emplace(
+                std::piecewise_construct,
+                std::forward_as_tuple(other_entry.first),
+                std::forward_as_tuple(allocator));
+            auto self_iter = insert_result.first;
+            auto insert_happened = insert_result.second;
+            auto &self_bitmap = self_iter->second;
+
+            if (insert_happened) {
+                // Key was not present in self, so insert was performed above.
+                // In the logic table of operator^=, this reflects the case
+                // (self.absent ^ other.present). Copy other_bitmap into the
+                // new entry, which keeps the allocator of self, and set the
+                // copyOnWrite flag.
+                self_bitmap = other_bitmap;
+                self_bitmap.setCopyOnWrite(copyOnWrite);
+                continue;
+            }
+
+            // Both sides have self_key, and the insert was not performed. In
+            // the logic table of operator^=, this reflects the case
+            // (self.present ^ other.present). So XOR other into self.
+            self_bitmap ^= other_bitmap;
+
+            if (self_bitmap.isEmpty()) {
+                // ...but if intersection is empty, remove it altogether.
+                map.erase(self_iter);
+            }
+        }
+    }
+
+    // ...while the flat buckets, where each insertion or erasure moves the
+    // buckets after it, apply them together after the loop.
+    void orIn(Roaring64FlatBuckets &map,
+              const Roaring64FlatBuckets &other_map) {
+        std::vector<Roaring64FlatBuckets::value_type> added;
+        for (const auto &other_entry : other_map) {
+            auto self_iter = map.find(other_entry.first);
+            if (self_iter == map.end()) {
+                added.push_back(
+                    newEntry(other_entry.first, other_entry.second));
+                continue;
+            }
+            self_iter->second |= other_entry.second;
+        }
+        map.insert(std::make_move_iterator(added.begin()),
+                   std::make_move_iterator(added.end()));
+    }
+
+    void xorIn(Roaring64FlatBuckets &map,
+               const Roaring64FlatBuckets &other_map) {
+        std::vector<Roaring64FlatBuckets::iterator> emptied;
+        std::vector<Roaring64FlatBuckets::value_type> added;
+        for (const auto &other_entry : other_map) {
+            auto self_iter = map.find(other_entry.first);
+            if (self_iter == map.end()) {
+                added.push_back(
+                    newEntry(other_entry.first, other_entry.second));
+                continue;
+            }
+            self_iter->second ^= other_entry.second;
+            if (self_iter->second.isEmpty()) {
+                emptied.push_back(self_iter);
+            }
+        }
+        map.eraseSorted(emptied);
+        map.insert(std::make_move_iterator(added.begin()),
+                   std::make_move_iterator(added.end()));
+    }
 };
 
 /**
@@ -1827,17 +2247,19 @@ class Roaring64Map {
  *
  * Recommend to explicitly construct this iterator.
  */
-class Roaring64MapSetBitBiDirectionalIterator {
+template <class Derived, class Map>
+class BasicRoaring64MapSetBitBiDirectionalIterator {
    public:
     typedef std::bidirectional_iterator_tag iterator_category;
     typedef uint64_t *pointer;
     typedef uint64_t &reference;
     typedef uint64_t value_type;
     typedef int64_t difference_type;
-    typedef Roaring64MapSetBitBiDirectionalIterator type_of_iterator;
+    typedef Derived type_of_iterator;
+    typedef Map map_type;
 
-    Roaring64MapSetBitBiDirectionalIterator(const Roaring64Map &parent,
-                                            bool exhausted = false)
+    BasicRoaring64MapSetBitBiDirectionalIterator(const map_type &parent,
+                                                 bool exhausted = false)
         : p(&parent.roarings) {
         if (exhausted || parent.roarings.empty()) {
             map_iter = p->cend();
@@ -1856,7 +2278,7 @@ class Roaring64MapSetBitBiDirectionalIterator {
      * Provides the location of the set bit.
      */
     value_type operator*() const {
-        return Roaring64Map::uniteBytes(map_iter->first, i.current_value);
+        return map_type::uniteBytes(map_iter->first, i.current_value);
     }
 
     bool operator<(const type_of_iterator &o) const {
@@ -1887,14 +2309,14 @@ class Roaring64MapSetBitBiDirectionalIterator {
         if (i.has_value == true) roaring_uint32_iterator_advance(&i);
         while (!i.has_value) {
             ++map_iter;
-            if (map_iter == p->cend()) return *this;
+            if (map_iter == p->cend()) return derived();
             roaring_iterator_init(&map_iter->second.roaring, &i);
         }
-        return *this;
+        return derived();
     }
 
     type_of_iterator operator++(int) {  // i++, must return orig. value
-        Roaring64MapSetBitBiDirectionalIterator orig(*this);
+        type_of_iterator orig(derived());
         roaring_uint32_iterator_advance(&i);
         while (!i.has_value) {
             ++map_iter;
@@ -1909,12 +2331,12 @@ class Roaring64MapSetBitBiDirectionalIterator {
      * Return true if there is such a value.
      */
     bool move_equalorlarger(const value_type &x) {
-        map_iter = p->lower_bound(Roaring64Map::highBytes(x));
+        map_iter = p->lower_bound(map_type::highBytes(x));
         if (map_iter != p->cend()) {
             roaring_iterator_init(&map_iter->second.roaring, &i);
-            if (map_iter->first == Roaring64Map::highBytes(x)) {
+            if (map_iter->first == map_type::highBytes(x)) {
                 if (roaring_uint32_iterator_move_equalorlarger(
-                        &i, Roaring64Map::lowBytes(x)))
+                        &i, map_type::lowBytes(x)))
                     return true;
                 ++map_iter;
                 if (map_iter == p->cend()) return false;
@@ -1934,20 +2356,20 @@ class Roaring64MapSetBitBiDirectionalIterator {
         if (map_iter == p->cend()) {
             --map_iter;
             roaring_iterator_init_last(&map_iter->second.roaring, &i);
-            if (i.has_value) return *this;
+            if (i.has_value) return derived();
         }
 
         roaring_uint32_iterator_previous(&i);
         while (!i.has_value) {
-            if (map_iter == p->cbegin()) return *this;
+            if (map_iter == p->cbegin()) return derived();
             map_iter--;
             roaring_iterator_init_last(&map_iter->second.roaring, &i);
         }
-        return *this;
+        return derived();
     }
 
     type_of_iterator operator--(int) {  // i--, must return orig. value
-        Roaring64MapSetBitBiDirectionalIterator orig(*this);
+        type_of_iterator orig(derived());
         if (map_iter == p->cend()) {
             --map_iter;
             roaring_iterator_init_last(&map_iter->second.roaring, &i);
@@ -1963,21 +2385,24 @@ class Roaring64MapSetBitBiDirectionalIterator {
         return orig;
     }
 
-    bool operator==(const Roaring64MapSetBitBiDirectionalIterator &o) const {
+    bool operator==(const type_of_iterator &o) const {
         if (map_iter == p->cend() && o.map_iter == o.p->cend()) return true;
         if (o.map_iter == o.p->cend()) return false;
         return **this == *o;
     }
 
-    bool operator!=(const Roaring64MapSetBitBiDirectionalIterator &o) const {
+    bool operator!=(const type_of_iterator &o) const {
         if (map_iter == p->cend() && o.map_iter == o.p->cend()) return false;
         if (o.map_iter == o.p->cend()) return true;
         return **this != *o;
     }
 
    private:
-    const std::map<uint32_t, Roaring> *p{nullptr};
-    std::map<uint32_t, Roaring>::const_iterator
+    typedef typename Map::roarings_t roarings_t;
+    Derived &derived() { return static_cast<Derived &>(*this); }
+
+    const roarings_t *p{nullptr};
+    typename roarings_t::const_iterator
         map_iter{};  // The empty constructor silences warnings from pedantic
                      // static analyzers.
     api::roaring_uint32_iterator_t
@@ -1985,12 +2410,54 @@ class Roaring64MapSetBitBiDirectionalIterator {
               // analyzers.
 };
 
-inline Roaring64MapSetBitBiDirectionalIterator Roaring64Map::begin() const {
-    return Roaring64MapSetBitBiDirectionalIterator(*this);
+/**
+ * A 64-bit bitmap made of 32-bit Roaring bitmaps, one for each value of the
+ * high 32 bits, kept in a std::map.
+ */
+class Roaring64Map
+    : public BasicRoaring64Map<Roaring64Map, std::map<uint32_t, Roaring>,
+                               Roaring64MapSetBitBiDirectionalIterator> {
+   public:
+    using BasicRoaring64Map::BasicRoaring64Map;
+    using BasicRoaring64Map::operator=;
+};
+
+class Roaring64MapSetBitBiDirectionalIterator
+    : public BasicRoaring64MapSetBitBiDirectionalIterator<
+          Roaring64MapSetBitBiDirectionalIterator, Roaring64Map> {
+   public:
+    using BasicRoaring64MapSetBitBiDirectionalIterator::
+        BasicRoaring64MapSetBitBiDirectionalIterator;
+};
+
+/**
+ * A Roaring64Map whose 32-bit bitmaps are kept in a sorted vector (see
+ * Roaring64FlatBuckets). It has the same interface as Roaring64Map.
+ */
+class Roaring64FlatMap
+    : public BasicRoaring64Map<Roaring64FlatMap, Roaring64FlatBuckets,
+                               Roaring64FlatMapSetBitBiDirectionalIterator> {
+   public:
+    using BasicRoaring64Map::BasicRoaring64Map;
+    using BasicRoaring64Map::operator=;
+};
+
+class Roaring64FlatMapSetBitBiDirectionalIterator
+    : public BasicRoaring64MapSetBitBiDirectionalIterator<
+          Roaring64FlatMapSetBitBiDirectionalIterator, Roaring64FlatMap> {
+   public:
+    using BasicRoaring64MapSetBitBiDirectionalIterator::
+        BasicRoaring64MapSetBitBiDirectionalIterator;
+};
+
+template <class Derived, class Buckets, class Iterator>
+inline Iterator BasicRoaring64Map<Derived, Buckets, Iterator>::begin() const {
+    return Iterator(derived());
 }
 
-inline Roaring64MapSetBitBiDirectionalIterator Roaring64Map::end() const {
-    return Roaring64MapSetBitBiDirectionalIterator(*this, true);
+template <class Derived, class Buckets, class Iterator>
+inline Iterator BasicRoaring64Map<Derived, Buckets, Iterator>::end() const {
+    return Iterator(derived(), true);
 }
 
 }  // namespace roaring
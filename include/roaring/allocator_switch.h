@@ -0,0 +1,67 @@
+/*
+ * allocator_switch.h
+ *
+ * Internal helpers, shared by the 32-bit and 64-bit bitmaps, that make the
+ * allocator of a bitmap current while the public functions allocate or free
+ * memory for it (see roaring_allocator_t). The *_impl functions do the work.
+ */
+#ifndef CROARING_ALLOCATOR_SWITCH_H_
+#define CROARING_ALLOCATOR_SWITCH_H_
+
+#include <stddef.h>
+
+#include <roaring/memory.h>
+
+#ifdef __cplusplus
+extern "C" {
+namespace roaring {
+namespace internal {
+#endif
+
+// Returned by the helpers below instead of the previous allocator when the
+// right one was already current, e.g., bitmaps using the memory hook on a
+// thread that does: leave_allocator() then has nothing to restore.
+static const roaring_allocator_t no_allocator_switch = {NULL, NULL, NULL, NULL,
+                                                        NULL, NULL, NULL};
+
+/**
+ * Makes `allocator` current (NULL for the memory hook). Returns what to pass
+ * to leave_allocator() afterwards.
+ */
+static inline const roaring_allocator_t *switch_allocator(
+    const roaring_allocator_t *allocator) {
+    if (allocator == roaring_allocator_current()) {
+        return &no_allocator_switch;
+    }
+    return roaring_allocator_enter(allocator);
+}
+
+/**
+ * Restores the allocator that was current before switch_allocator() or
+ * enter_result_allocator() returned `previous`.
+ */
+static inline void leave_allocator(const roaring_allocator_t *previous) {
+    if (previous != &no_allocator_switch) {
+        roaring_allocator_leave(previous);
+    }
+}
+
+/**
+ * New bitmaps returned by the public functions use the allocator entered by
+ * the caller, if any, otherwise `allocator`, that of their first argument.
+ */
+static inline const roaring_allocator_t *enter_result_allocator(
+    const roaring_allocator_t *allocator) {
+    if (roaring_allocator_current() != NULL) {
+        return &no_allocator_switch;
+    }
+    return switch_allocator(allocator);
+}
+
+#ifdef __cplusplus
+}
+}
+}  // extern "C" { namespace roaring { namespace internal {
+#endif
+
+#endif  // CROARING_ALLOCATOR_SWITCH_H_
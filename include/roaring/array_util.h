@@ -227,6 +227,13 @@ int array_container_to_uint32_array_vector16(void *vout, const uint16_t *array,
 int avx512_array_container_to_uint32_array(void *vout, const uint16_t *array,
                                            size_t cardinality, uint32_t base);
 #endif
+
+/**
+ * Writes base | in[i] to out[i] for i < n, with AVX-512 when available. The
+ * low 32 bits of base must be zero.
+ */
+void widen_uint32_to_uint64(uint64_t *out, const uint32_t *in, size_t n,
+                            uint64_t base);
 /**
  * Compute the cardinality of the intersection using SSE4 instructions
  */
@@ -81,6 +81,23 @@ void art_init_cleared(art_t *art);
  */
 art_val_t *art_insert(art_t *art, const art_key_chunk_t *key, art_val_t val);
 
+/**
+ * Bulk loading: appends the given key and value to a newly initialized ART
+ * (see `art_init_cleared`). Keys must be appended in strictly increasing
+ * order. The ART stays empty until `art_bulk_finish` builds its inner nodes,
+ * each one directly at its final type. Returns a pointer to the value
+ * appended, valid until the next append.
+ */
+art_val_t *art_bulk_append(art_t *art, const art_key_chunk_t *key,
+                           art_val_t val);
+
+/**
+ * Builds the inner nodes over the values appended with `art_bulk_append`,
+ * after which the ART can be used normally. Does nothing if no value was
+ * appended, or if called a second time.
+ */
+void art_bulk_finish(art_t *art);
+
 /**
  * Returns true if a value was erased. Sets `*erased_val` to the value erased,
  * if any.
@@ -232,6 +249,47 @@ size_t art_serialize(const art_t *art, char *buf);
  */
 size_t art_frozen_view(const char *buf, size_t maxbytes, art_t *art);
 
+/**
+ * Returns the number of bytes `art_compact` needs for the nodes of the ART.
+ */
+size_t art_compact_size_in_bytes(const art_t *art);
+
+/**
+ * Copies the ART to `dst` without unused elements, with the nodes of each type
+ * in breadth-first order and the leaves in key order. The node arrays of `dst`
+ * are carved out of `buf`, which must be 8 byte aligned and hold
+ * `art_compact_size_in_bytes(art)` bytes. Returns the number of bytes used, 0
+ * if the ART is empty or in case of allocation failure.
+ *
+ * As with `art_frozen_view`, `dst` should only be used in a readonly context
+ * (values may be updated in place) and `art_free` should not be called on it.
+ */
+size_t art_compact(const art_t *art, char *buf, art_t *dst);
+
+/**
+ * The leaves of an ART copied by `art_compact` are numbered in key order. The
+ * following functions map between leaves and their numbers, e.g., to keep
+ * per-leaf data in an array next to such an ART.
+ */
+
+/**
+ * Returns the number of leaves of an ART copied by `art_compact`.
+ */
+uint64_t art_compact_leaf_count(const art_t *art);
+
+/**
+ * Returns the number of the leaf holding `val`, a value pointer returned by a
+ * lookup or an iterator on an ART copied by `art_compact`.
+ */
+uint64_t art_compact_leaf_index(const art_t *art, const art_val_t *val);
+
+/**
+ * Returns the value of the leaf with the given number in an ART copied by
+ * `art_compact`, and copies its key to `key`.
+ */
+art_val_t *art_compact_leaf_at(const art_t *art, uint64_t index,
+                               art_key_chunk_t *key);
+
 #ifdef __cplusplus
 }  // extern "C"
 }  // namespace roaring
@@ -39,14 +39,18 @@ enum { DEFAULT_MAX_SIZE = 4096 };
 
 /* struct array_container - sparse representation of a bitmap
  *
- * @cardinality: number of indices in `array` (and the bitmap)
- * @capacity:    allocated size of `array`
- * @array:       sorted list of integers
+ * @cardinality:   number of indices in `array` (and the bitmap)
+ * @capacity:      allocated size of `array`
+ * @array:         sorted list of integers
+ * @inline_values: whether `array` follows the struct in the same allocation,
+ *                 as for containers created with a capacity of
+ *                 ARRAY_INLINE_SIZE or less: it is then not freed on its own
  */
 STRUCT_CONTAINER(array_container_s) {
     int32_t cardinality;
     int32_t capacity;
     uint16_t *array;
+    bool inline_values;
 };
 
 typedef struct array_container_s array_container_t;
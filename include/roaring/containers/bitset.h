@@ -410,6 +410,16 @@ int bitset_container_to_uint32_array(uint32_t *out,
                                      const bitset_container_t *bc,
                                      uint32_t base);
 
+/*
+ * Writes the values of the bitset as `base | value` to out, which must have
+ * room for the cardinality. The low 16 bits of base must be zero. Slices of
+ * the bitset are decoded on the stack and widened, so that no allocation is
+ * needed. Returns the number of values written.
+ */
+int bitset_container_to_uint64_array(uint64_t *out,
+                                     const bitset_container_t *bc,
+                                     uint64_t base);
+
 /*
  * Print this container using printf (useful for debugging).
  */
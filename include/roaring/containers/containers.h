@@ -72,6 +72,12 @@ STRUCT_CONTAINER(shared_container_s) {
     container_t *container;
     uint8_t typecode;
     croaring_refcount_t counter;  // to be managed atomically
+#ifdef __cplusplus
+    // See run_container_s.
+    shared_container_s() = default;
+    constexpr shared_container_s(container_t *c, uint8_t type, uint32_t count)
+        : container(c), typecode(type), counter(count) {}
+#endif
 };
 
 typedef struct shared_container_s shared_container_t;
@@ -94,6 +100,21 @@ container_t *get_copy_of_container(container_t *container, uint8_t *typecode,
  * the counter falls to zero). */
 void shared_container_free(shared_container_t *container);
 
+/* Returns the shared full container: a run container holding [0, 65536),
+ * typed SHARED_CONTAINER_TYPE. It lives for the whole process and its
+ * references are not counted, so any number of containers of any bitmap may
+ * be replaced by it without allocating. Freeing it is a no-op and copying it
+ * returns it. Unlike other shared containers, bitmaps hold it whether or not
+ * they are copy-on-write (64-bit bitmaps put it in place of their full
+ * containers), so get_copy_of_container() returns it even without copy on
+ * write. */
+container_t *shared_container_full(void);
+
+static inline bool container_is_shared_full(const container_t *c,
+                                            uint8_t typecode) {
+    return typecode == SHARED_CONTAINER_TYPE && c == shared_container_full();
+}
+
 /* extract a copy from the shared container, freeing the shared container if
 there is just one instance left,
 clone instances when the counter is higher than one
@@ -338,6 +359,46 @@ static inline container_t *container_from_range(uint8_t *type, uint32_t min,
     }
 }
 
+/**
+ * Creates a container holding the low 16 bits of n >= 1 values that share
+ * their high bits and are given in non-decreasing order (duplicates allowed).
+ * The smallest of the array, bitset and run representations is chosen, as
+ * run_optimize would, and allocated with exact capacity. Returns NULL if the
+ * values are not sorted or on allocation failure.
+ */
+container_t *container_from_sorted_uint32(const uint32_t *vals, size_t n,
+                                          uint8_t *type);
+container_t *container_from_sorted_uint64(const uint64_t *vals, size_t n,
+                                          uint8_t *type);
+
+/**
+ * Create a container holding the given runs, which must be sorted, disjoint
+ * and not adjacent. Like container_from_sorted_uint32, the representation is
+ * chosen as run_optimize would. Returns NULL on allocation failure.
+ */
+container_t *container_from_runs(const rle16_t *runs, int32_t n_runs,
+                                 uint8_t *type);
+
+/**
+ * Number of runs of consecutive values in the container.
+ */
+static inline int32_t container_number_of_runs(const container_t *c,
+                                               uint8_t typecode) {
+    c = container_unwrap_shared(c, &typecode);
+    switch (typecode) {
+        case BITSET_CONTAINER_TYPE:
+            return bitset_container_number_of_runs(
+                (bitset_container_t *)const_CAST_bitset(c));
+        case ARRAY_CONTAINER_TYPE:
+            return array_container_number_of_runs(const_CAST_array(c));
+        case RUN_CONTAINER_TYPE:
+            return const_CAST_run(c)->n_runs;
+    }
+    assert(false);
+    roaring_unreachable;
+    return 0;  // unreached
+}
+
 /**
  * "repair" the container after lazy operations.
  */
@@ -480,6 +541,13 @@ static inline int container_to_uint32_array(uint32_t *output,
     return 0;  // unreached
 }
 
+/**
+ * Writes the container's values as `high48 | value` to output, which must
+ * have room for the cardinality. Returns the cardinality.
+ */
+int container_to_uint64_array(uint64_t *output, const container_t *c,
+                              uint8_t typecode, uint64_t high48);
+
 /**
  * Add a value to a container, requires a  typecode, fills in new_typecode and
  * return (possibly different) container.
@@ -49,6 +49,12 @@ container_t *convert_to_bitset_or_array_container(run_container_t *rc,
                                                   int32_t card,
                                                   uint8_t *resulttype);
 
+/* Converts a bitset holding n_runs runs (see
+ * bitset_container_number_of_runs) to a run container, leaving the bitset
+ * alone. Returns NULL on allocation failure. */
+run_container_t *run_container_from_bitset(const bitset_container_t *bc,
+                                           int32_t n_runs);
+
 /* convert containers to and from runcontainers, as is most space efficient.
  * The container might be freed. */
 container_t *convert_run_optimize(container_t *c, uint8_t typecode_original,
@@ -35,6 +35,11 @@ enum { RUN_DEFAULT_INIT_SIZE = 0 };
    setting it to zero delays the malloc */
 enum { ARRAY_DEFAULT_INIT_SIZE = 0 };
 
+/* array containers of this capacity or less keep their values in the same
+   allocation as the container itself; array_container_create() starts with
+   this capacity, so that small sets need a single allocation */
+enum { ARRAY_INLINE_SIZE = 16 };
+
 /* automatic bitset conversion during lazy or */
 #ifndef LAZY_OR_BITSET_CONVERSION
 #define LAZY_OR_BITSET_CONVERSION true
@@ -70,6 +70,13 @@ STRUCT_CONTAINER(run_container_s) {
     int32_t n_runs;
     int32_t capacity;
     rle16_t *runs;
+#ifdef __cplusplus
+    // Derived structs are not aggregates before C++17: this constructor lets
+    // static containers be constant-initialized, as in C.
+    run_container_s() = default;
+    constexpr run_container_s(int32_t n, int32_t cap, rle16_t *r)
+        : n_runs(n), capacity(cap), runs(r) {}
+#endif
 };
 
 typedef struct run_container_s run_container_t;
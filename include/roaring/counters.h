@@ -0,0 +1,57 @@
+/*
+ * counters.h
+ *
+ * Internal instrumentation of container memory events, reported through
+ * roaring_counters_get(). The counters are compiled in with
+ * CROARING_COUNTERS=1 (the CMake option ROARING_COUNTERS); otherwise
+ * CROARING_COUNT() expands to nothing and costs nothing.
+ *
+ * Each thread updates its own counters with relaxed atomic loads and stores,
+ * no read-modify-write since no other thread writes them: the instrumented
+ * paths (container allocations, conversions) only pay for a thread-local
+ * lookup and an increment, and roaring_counters_get() may read them from
+ * another thread.
+ */
+#ifndef CROARING_COUNTERS_H_
+#define CROARING_COUNTERS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <roaring/roaring_types.h>
+
+#ifndef CROARING_COUNTERS
+#define CROARING_COUNTERS 0
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+namespace roaring {
+
+// Note: in pure C++ code, you should avoid putting `using` in header files
+using api::roaring_counters_t;
+
+namespace internal {
+#endif
+
+#if CROARING_COUNTERS
+/**
+ * Adds `n` to the counter of the calling thread at `index`, the position of
+ * the counter in roaring_counters_t seen as an array of uint64_t.
+ */
+void roaring_counters_add(size_t index, uint64_t n);
+
+#define CROARING_COUNT(field, n) \
+    roaring_counters_add(         \
+        offsetof(roaring_counters_t, field) / sizeof(uint64_t), (uint64_t)(n))
+#else
+#define CROARING_COUNT(field, n) ((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+}
+}  // extern "C" { namespace roaring { namespace internal {
+#endif
+
+#endif  // CROARING_COUNTERS_H_
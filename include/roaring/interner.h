@@ -0,0 +1,39 @@
+/*
+ * interner.h
+ *
+ * Internal part of roaring_interner_t, shared by the 32-bit and 64-bit
+ * bitmaps: both intern one container at a time.
+ */
+#ifndef CROARING_INTERNER_H_
+#define CROARING_INTERNER_H_
+
+#include <roaring/containers/containers.h>
+#include <roaring/roaring.h>
+
+#ifdef __cplusplus
+extern "C" {
+namespace roaring {
+
+// Note: in pure C++ code, you should avoid putting `using` in header files
+using api::roaring_interner_t;
+
+namespace internal {
+#endif
+
+/**
+ * Interns the container `c` of type `*typecode`, owned by a bitmap whose
+ * allocator is current. Returns the container that the bitmap should hold
+ * instead, a shared container, and updates `*typecode`; `c` is released if
+ * it was replaced. Adds the number of bytes released to `*bytes_saved`.
+ * Returns NULL, leaving `c` alone, in case of allocation failure.
+ */
+container_t *interner_intern_container(roaring_interner_t *in, container_t *c,
+                                       uint8_t *typecode, size_t *bytes_saved);
+
+#ifdef __cplusplus
+}
+}
+}  // extern "C" { namespace roaring { namespace internal {
+#endif
+
+#endif  // CROARING_INTERNER_H_
@@ -44,6 +44,99 @@ void roaring_free(void*);
 void* roaring_aligned_malloc(size_t, size_t);
 void roaring_aligned_free(void*);
 
+/**
+ * An allocator with a context, e.g., an arena, a NUMA-local pool or a
+ * per-tenant accounting layer. Unlike the memory hook, which is global, an
+ * allocator is attached to bitmaps:
+ *
+ * - a bitmap uses the allocator that is current (see roaring_allocator_enter())
+ *   on the thread that creates it, see roaring_bitmap_get_allocator();
+ * - every call that allocates or frees memory for a bitmap goes to that
+ *   bitmap's allocator, whatever is current on the calling thread;
+ * - results of operations (copies, unions, flips, ...) use the allocator
+ *   current on the calling thread if one was entered, otherwise that of
+ *   their first bitmap argument.
+ *
+ * The allocator must outlive the bitmaps that use it. Allocators used from
+ * several threads at once (e.g., by the helpers of roaring/parallel.hh) must
+ * be thread-safe. With copy-on-write, containers shared by bitmaps that use
+ * different allocators end up freed by either allocator: do not mix them.
+ */
+typedef struct roaring_allocator_s {
+    void* context;
+    void* (*malloc)(void* context, size_t size);
+    void* (*realloc)(void* context, void* p, size_t size);
+    void* (*calloc)(void* context, size_t n_elements, size_t element_size);
+    void (*free)(void* context, void* p);
+    void* (*aligned_malloc)(void* context, size_t alignment, size_t size);
+    void (*aligned_free)(void* context, void* p);
+} roaring_allocator_t;
+
+/**
+ * Makes `allocator` serve the allocations of the calling thread, and thus of
+ * the bitmaps it creates (NULL stands for the memory hook). Returns the
+ * allocator that was current before, to be passed to
+ * roaring_allocator_leave(); scopes may nest.
+ */
+const roaring_allocator_t* roaring_allocator_enter(
+    const roaring_allocator_t* allocator);
+
+/**
+ * Ends the scope opened by the roaring_allocator_enter() call that returned
+ * `previous`.
+ */
+void roaring_allocator_leave(const roaring_allocator_t* previous);
+
+/**
+ * Returns the allocator serving the calling thread, NULL for the memory hook.
+ */
+const roaring_allocator_t* roaring_allocator_current(void);
+
+/**
+ * An arena serves allocations from 256 KiB chunks obtained from the memory
+ * hook: blocks up to 32 KiB (container structs, array and run buffers, bitset
+ * payloads) come from per-size-class slabs with free lists, larger ones get an
+ * allocation of their own. Everything the arena handed out is released at
+ * once by roaring_arena_reset() or roaring_arena_free(), e.g., all the
+ * bitmaps computed by one query: bitmaps that use the arena may simply be
+ * dropped, but must not be used afterwards.
+ *
+ * An arena is used through its allocator, see roaring_arena_allocator(). Its
+ * allocator hands memory that does not come from the arena back to the memory
+ * hook when it is freed or reallocated.
+ *
+ * An arena is not thread-safe: use it on one thread at a time, or give each
+ * thread its own arena.
+ */
+typedef struct roaring_arena_s roaring_arena_t;
+
+/**
+ * Creates an empty arena. Returns NULL on failure.
+ */
+roaring_arena_t* roaring_arena_create(void);
+
+/**
+ * Releases every allocation made from the arena and the arena itself.
+ */
+void roaring_arena_free(roaring_arena_t* arena);
+
+/**
+ * Releases every allocation made from the arena, keeping its slab chunks for
+ * the next allocations (e.g., for the next query).
+ */
+void roaring_arena_reset(roaring_arena_t* arena);
+
+/**
+ * Returns the number of bytes the arena holds from the memory hook.
+ */
+size_t roaring_arena_size_in_bytes(const roaring_arena_t* arena);
+
+/**
+ * Returns the allocator serving allocations from the arena. It lives as long
+ * as the arena.
+ */
+const roaring_allocator_t* roaring_arena_allocator(roaring_arena_t* arena);
+
 #ifdef __cplusplus
 }
 #endif
@@ -524,6 +524,15 @@ static inline uint64_t croaring_bswap64(uint64_t x) {
 #define croaring_letoh32(x) croaring_htole32(x)
 #define croaring_letoh64(x) croaring_htole64(x)
 
+// Storage class for per-thread state (e.g., the active memory arena).
+#if defined(__cplusplus)
+#define CROARING_THREAD_LOCAL thread_local
+#elif CROARING_REGULAR_VISUAL_STUDIO
+#define CROARING_THREAD_LOCAL __declspec(thread)
+#else
+#define CROARING_THREAD_LOCAL _Thread_local
+#endif
+
 // Defines for the possible CROARING atomic implementations
 #define CROARING_ATOMIC_IMPL_NONE 1
 #define CROARING_ATOMIC_IMPL_CPP 2
@@ -550,6 +559,19 @@ static inline uint64_t croaring_bswap64(uint64_t x) {
 #endif
 #endif  // !defined(CROARING_ATOMIC_IMPL)
 
+// ThreadSanitizer does not model standalone fences, so under it the reference
+// count decrements acquire by themselves instead.
+#if defined(__SANITIZE_THREAD__)
+#define CROARING_SANITIZE_THREAD 1
+#elif defined(__has_feature)
+#if __has_feature(thread_sanitizer)
+#define CROARING_SANITIZE_THREAD 1
+#endif
+#endif
+#ifndef CROARING_SANITIZE_THREAD
+#define CROARING_SANITIZE_THREAD 0
+#endif
+
 #if CROARING_ATOMIC_IMPL == CROARING_ATOMIC_IMPL_C
 #include <stdatomic.h>
 typedef _Atomic(uint32_t) croaring_refcount_t;
@@ -569,11 +591,15 @@ static inline bool croaring_refcount_dec(croaring_refcount_t *val) {
     // after dropping a reference (any access to the object through this
     // reference must obviously happened before), and an "acquire" operation
     // before deleting the object.
+#if CROARING_SANITIZE_THREAD
+    return atomic_fetch_sub_explicit(val, 1, memory_order_acq_rel) == 1;
+#else
     bool is_zero = atomic_fetch_sub_explicit(val, 1, memory_order_release) == 1;
     if (is_zero) {
         atomic_thread_fence(memory_order_acquire);
     }
     return is_zero;
+#endif
 }
 
 static inline uint32_t croaring_refcount_get(const croaring_refcount_t *val) {
@@ -589,11 +615,15 @@ static inline void croaring_refcount_inc(croaring_refcount_t *val) {
 
 static inline bool croaring_refcount_dec(croaring_refcount_t *val) {
     // See above comments on the c11 atomic implementation for memory ordering
+#if CROARING_SANITIZE_THREAD
+    return val->fetch_sub(1, std::memory_order_acq_rel) == 1;
+#else
     bool is_zero = val->fetch_sub(1, std::memory_order_release) == 1;
     if (is_zero) {
         std::atomic_thread_fence(std::memory_order_acquire);
     }
     return is_zero;
+#endif
 }
 
 static inline uint32_t croaring_refcount_get(const croaring_refcount_t *val) {
@@ -60,14 +60,18 @@ inline roaring_bitmap_t *roaring_bitmap_create(void) {
 /**
  * Initialize a roaring bitmap structure in memory controlled by client.
  * Capacity is a performance hint for how many "containers" the data will need.
- * Can return false if auxiliary allocations fail when capacity greater than 0.
+ * Can return false if auxiliary allocations fail when capacity greater than 0,
+ * or when an allocator is current (see roaring_allocator_t): the bitmap keeps
+ * a pointer to it in a small block.
  */
 bool roaring_bitmap_init_with_capacity(roaring_bitmap_t *r, uint32_t cap);
 
 /**
  * Initialize a roaring bitmap structure in memory controlled by client.
- * The bitmap will be in a "clear" state, with no auxiliary allocations.
- * Since this performs no allocations, the function will not fail.
+ * The bitmap will be in a "clear" state, with no auxiliary allocations unless
+ * an allocator is current (see roaring_bitmap_init_with_capacity() and
+ * roaring_bitmap_release()). The function will not fail: should that
+ * allocation fail, the bitmap uses the memory hook instead.
  */
 inline void roaring_bitmap_init_cleared(roaring_bitmap_t *r) {
     roaring_bitmap_init_with_capacity(r, 0);
@@ -87,6 +91,63 @@ roaring_bitmap_t *roaring_bitmap_from_range(uint64_t min, uint64_t max,
  */
 roaring_bitmap_t *roaring_bitmap_of_ptr(size_t n_args, const uint32_t *vals);
 
+/**
+ * Creates a new bitmap from n values given in non-decreasing order
+ * (duplicates are allowed). This is faster than `roaring_bitmap_of_ptr()`:
+ * each 16-bit key is scanned once and its container is allocated directly
+ * with its final type (array, bitset or run, as if
+ * `roaring_bitmap_run_optimize()` had been called) and exact capacity.
+ *
+ * Returns NULL if the values are not sorted or in case of errors.
+ */
+roaring_bitmap_t *roaring_bitmap_from_sorted(const uint32_t *vals, size_t n);
+
+/**
+ * Creates a new bitmap from n values in any order (duplicates are allowed).
+ * For large batches of random values this is much faster than
+ * `roaring_bitmap_of_ptr()`: the values are radix-partitioned by their high
+ * 16 bits first, so that each container is then built in one go instead of
+ * being looked up for every value. Containers get their best type, as if
+ * `roaring_bitmap_run_optimize()` had been called.
+ *
+ * Needs about 2 bytes of scratch memory per value. Returns NULL in case of
+ * errors. To spread the work over threads, use `roaring_bulk_loader_t`.
+ */
+roaring_bitmap_t *roaring_bitmap_from_unsorted(const uint32_t *vals, size_t n);
+
+/**
+ * The steps of `roaring_bitmap_from_unsorted()`, exposed so that callers can
+ * run them on several threads (see roaring::parallel::fromUnsorted in
+ * cpp/roaring/parallel.hh). The input is split into `num_parts` contiguous
+ * parts of about n / num_parts values. In order:
+ *
+ * 1. `roaring_bulk_loader_count()` once for each part,
+ * 2. `roaring_bulk_loader_plan()`, which gives the number of distinct keys,
+ * 3. `roaring_bulk_loader_scatter()` once for each part,
+ * 4. `roaring_bulk_loader_build()` on ranges covering [0, num_keys),
+ * 5. `roaring_bulk_loader_finish()`.
+ *
+ * Calls within steps 1, 3 and 4 may run concurrently, as long as they cover
+ * different parts or ranges. The loader reads `vals` until it is finished,
+ * and `roaring_bulk_loader_finish()` must be called in every case, also after
+ * a failure of `roaring_bulk_loader_plan()`: it frees the loader and returns
+ * NULL if any step failed.
+ */
+typedef struct roaring_bulk_loader_s roaring_bulk_loader_t;
+
+/**
+ * Returns NULL in case of errors. Uses 512 kB (8 bytes for each of the 65536
+ * keys) per part.
+ */
+roaring_bulk_loader_t *roaring_bulk_loader_create(const uint32_t *vals,
+                                                  size_t n, uint32_t num_parts);
+void roaring_bulk_loader_count(roaring_bulk_loader_t *l, uint32_t part);
+bool roaring_bulk_loader_plan(roaring_bulk_loader_t *l, uint32_t *num_keys);
+void roaring_bulk_loader_scatter(roaring_bulk_loader_t *l, uint32_t part);
+void roaring_bulk_loader_build(roaring_bulk_loader_t *l, uint32_t begin,
+                               uint32_t end);
+roaring_bitmap_t *roaring_bulk_loader_finish(roaring_bulk_loader_t *l);
+
 /**
  * Check if the bitmap contains any shared containers.
  */
@@ -125,6 +186,13 @@ inline void roaring_bitmap_set_copy_on_write(roaring_bitmap_t *r, bool cow) {
     }
 }
 
+/**
+ * The allocator the bitmap was created with (see roaring_allocator_t), or
+ * NULL if it uses the memory hook.
+ */
+const roaring_allocator_t *roaring_bitmap_get_allocator(
+    const roaring_bitmap_t *r);
+
 /**
  * Return a copy of the bitmap with all values shifted by offset.
  * The returned pointer may be NULL in case of errors. The caller is responsible
@@ -557,10 +625,21 @@ bool roaring_bitmap_is_empty(const roaring_bitmap_t *r);
 /**
  * Empties the bitmap.  It will have no auxiliary allocations (so if the bitmap
  * was initialized in client memory via roaring_bitmap_init(), then a call to
- * roaring_bitmap_clear() would be enough to "free" it)
+ * roaring_bitmap_clear() would be enough to "free" it), except for the small
+ * block in which a bitmap with an allocator (see roaring_allocator_t) keeps
+ * it: see roaring_bitmap_release().
  */
 void roaring_bitmap_clear(roaring_bitmap_t *r);
 
+/**
+ * Empties the bitmap and drops its allocator, if any: it will have no
+ * auxiliary allocations and use the memory hook. A call to
+ * roaring_bitmap_release() is enough to "free" any bitmap initialized in
+ * client memory. Not for bitmaps from roaring_bitmap_create() and the like,
+ * which roaring_bitmap_free() releases with the allocator they came from.
+ */
+void roaring_bitmap_release(roaring_bitmap_t *r);
+
 /**
  * Convert the bitmap to a sorted array, output in `ans`.
  *
@@ -588,6 +667,29 @@ void roaring_bitmap_to_uint32_array(const roaring_bitmap_t *r, uint32_t *ans);
  */
 bool roaring_bitmap_to_bitset(const roaring_bitmap_t *r, bitset_t *bitset);
 
+/**
+ * Creates a new bitmap holding the values of the bits set in `bitset`. This
+ * is much faster than adding the values found with `bitset_next_set_bits()`:
+ * each window of 65536 bits is popcounted with SIMD instructions where
+ * available, then stored as an array (set bits extracted with AVX-512 when
+ * supported), as a copy of the window, or as runs, whichever is smallest (as
+ * if `roaring_bitmap_run_optimize()` had been called).
+ *
+ * Returns NULL if a bit at or past 2^32 is set, or in case of errors.
+ */
+roaring_bitmap_t *roaring_bitmap_from_bitset(const bitset_t *bitset);
+
+/**
+ * Writes the values [64 * first_word, 64 * (first_word + num_words)) of the
+ * bitmap into `words` as a bitset: value v sets bit v % 64 of
+ * words[v / 64 - first_word]. Words past the end of the 32-bit range are set
+ * to zero. This lets a large bitmap be converted one window at a time into a
+ * caller-provided buffer.
+ */
+void roaring_bitmap_to_bitset_window(const roaring_bitmap_t *r,
+                                     uint64_t *words, uint32_t first_word,
+                                     size_t num_words);
+
 /**
  * Convert the bitmap to a sorted array from `offset` by `limit`, output in
  * `ans`.
@@ -622,10 +724,39 @@ bool roaring_bitmap_run_optimize(roaring_bitmap_t *r);
 
 /**
  * If needed, reallocate memory to shrink the memory usage.
- * Returns the number of bytes saved.
+ * Returns the number of bytes saved. Does nothing to a sealed bitmap.
  */
 size_t roaring_bitmap_shrink_to_fit(roaring_bitmap_t *r);
 
+/**
+ * Repacks a bitmap that is done being built into a single cache-line aligned
+ * allocation: the keys and containers first, then the container payloads in
+ * key order, as in the frozen format but in memory. Reads then touch fewer
+ * cache lines and pages than with one allocation per container. Call
+ * `roaring_bitmap_run_optimize()` before sealing, if at all.
+ *
+ * A sealed bitmap can be read, copied and serialized like any other. Copies
+ * are not sealed and do not share containers with it, even with
+ * copy-on-write. Any function that modifies the bitmap unseals it first,
+ * which takes one allocation per container again; this invalidates iterators
+ * and bulk contexts, as any modification can. If unsealing fails for lack of
+ * memory, the function leaves the bitmap sealed and unchanged, and returns
+ * false (or 0) if it returns anything.
+ *
+ * Returns false if the bitmap is frozen or in case of allocation failure, in
+ * which case it is left as it was. Sealing an empty bitmap does nothing.
+ */
+bool roaring_bitmap_seal(roaring_bitmap_t *r);
+
+/**
+ * Moves the containers of a sealed bitmap back to their own allocations. Only
+ * needed to unseal ahead of modifications. Returns false in case of
+ * allocation failure, in which case the bitmap stays sealed.
+ */
+bool roaring_bitmap_unseal(roaring_bitmap_t *r);
+
+bool roaring_bitmap_is_sealed(const roaring_bitmap_t *r);
+
 /**
  * Write the bitmap to an output pointer, this output buffer should refer to
  * at least `roaring_bitmap_size_in_bytes(r)` allocated bytes.
@@ -746,6 +877,104 @@ roaring_bitmap_t *roaring_bitmap_portable_deserialize(const char *buf);
 roaring_bitmap_t *roaring_bitmap_portable_deserialize_safe(const char *buf,
                                                            size_t maxbytes);
 
+/**
+ * Deserialization of the portable format split in three steps, so that the
+ * containers of a large bitmap can be decoded by several threads. The library
+ * does not create threads itself.
+ *
+ * `roaring_bitmap_portable_deserialize_prepare()` validates the header of the
+ * serialized bitmap found at (buf, maxbytes) and returns a bitmap whose keys
+ * are set but whose containers are not read yet, or NULL in case of errors.
+ * The number of containers is written to `*container_count`.
+ *
+ * `roaring_bitmap_portable_deserialize_range()` then reads the containers
+ * [begin, end) in place. It may be called concurrently on disjoint ranges of
+ * the same bitmap, with the same (buf, maxbytes). Container offsets are taken
+ * from the offset header of the serialized bitmap when it is present.
+ *
+ * Once every range was read (successfully or not),
+ * `roaring_bitmap_portable_deserialize_finish()` must be called. It returns
+ * the bitmap if all containers were read, and otherwise frees it and returns
+ * NULL.
+ *
+ * The same caveats as for `roaring_bitmap_portable_deserialize_safe()` apply
+ * to the resulting bitmap.
+ */
+roaring_bitmap_t *roaring_bitmap_portable_deserialize_prepare(
+    const char *buf, size_t maxbytes, uint32_t *container_count);
+
+/**
+ * See `roaring_bitmap_portable_deserialize_prepare()`. Returns false if a
+ * container could not be read, in which case `finish` will return NULL.
+ */
+bool roaring_bitmap_portable_deserialize_range(roaring_bitmap_t *r,
+                                               const char *buf,
+                                               size_t maxbytes, uint32_t begin,
+                                               uint32_t end);
+
+/**
+ * See `roaring_bitmap_portable_deserialize_prepare()`.
+ */
+roaring_bitmap_t *roaring_bitmap_portable_deserialize_finish(
+    roaring_bitmap_t *r);
+
+/**
+ * A container interner lets bitmaps share their equal containers, e.g., the
+ * full or common containers of a large collection of bitmaps. Each container
+ * passed to the interner is hashed; if the interner already holds an equal
+ * container (same type and values), the bitmap releases its own and refers to
+ * the interned one through a shared container, as with copy-on-write.
+ * Otherwise the container becomes the interned one. Full containers are
+ * replaced by a container shared by every bitmap, which the interner does
+ * not need to hold.
+ *
+ * Interned bitmaps are set to copy-on-write (see
+ * `roaring_bitmap_set_copy_on_write()`): modifying one of them clones the
+ * shared container first. The interner holds a reference to every distinct
+ * container, released by `roaring_interner_free()`; the bitmaps may be freed
+ * before or after it.
+ *
+ * An interner is not thread-safe, and interning modifies the bitmap. Interned
+ * bitmaps may then be used on different threads, as copy-on-write bitmaps.
+ * The interner and the bitmaps interned with it should use the same allocator
+ * (the interner takes the current one on creation, see
+ * `roaring_allocator_enter()`).
+ *
+ * Serialized bitmaps hold a copy of each of their containers: use
+ * `roaring_bitmap_portable_deserialize_interned()` to share them again on
+ * load.
+ */
+typedef struct roaring_interner_s roaring_interner_t;
+
+/**
+ * Returns NULL in case of errors.
+ */
+roaring_interner_t *roaring_interner_create(void);
+void roaring_interner_free(roaring_interner_t *in);
+void roaring_interner_get_statistics(const roaring_interner_t *in,
+                                     roaring_interner_statistics_t *stats);
+
+/**
+ * Interns the containers of `r`. Returns the number of bytes released, in
+ * the unit of `roaring_interner_statistics_t::n_bytes_saved`. Does nothing to
+ * a frozen bitmap. In case of allocation failure, the remaining containers
+ * are left as they are.
+ */
+size_t roaring_bitmap_intern(roaring_bitmap_t *r, roaring_interner_t *in);
+
+/**
+ * Interns the containers of `number` bitmaps, see `roaring_bitmap_intern()`.
+ */
+size_t roaring_bitmap_intern_many(size_t number, roaring_bitmap_t **x,
+                                  roaring_interner_t *in);
+
+/**
+ * Like `roaring_bitmap_portable_deserialize_safe()`, then interns the
+ * containers of the result with `in`.
+ */
+roaring_bitmap_t *roaring_bitmap_portable_deserialize_interned(
+    const char *buf, size_t maxbytes, roaring_interner_t *in);
+
 /**
  * Read bitmap from a serialized buffer.
  * In case of failure, NULL is returned.
@@ -806,6 +1035,62 @@ size_t roaring_bitmap_portable_size_in_bytes(const roaring_bitmap_t *r);
  */
 size_t roaring_bitmap_portable_serialize(const roaring_bitmap_t *r, char *buf);
 
+typedef struct roaring_portable_writer_s roaring_portable_writer_t;
+
+/**
+ * Writes the portable serialization of a set of values given in sorted order,
+ * without building a bitmap. Values are accumulated one 16-bit key at a time:
+ * when a key is complete, its container is written out as the smallest of an
+ * array, a bitset or a run container (as if `roaring_bitmap_run_optimize()`
+ * had been called), so only one container is held in memory.
+ *
+ *     roaring_portable_writer_t *w =
+ *         roaring_portable_writer_create(buf, capacity);
+ *     roaring_portable_writer_add_many(w, n, sorted_values);
+ *     roaring_portable_writer_add_range(w, 1000, 2000);
+ *     size_t bytes = roaring_portable_writer_finish(w);
+ *     roaring_portable_writer_free(w);
+ *
+ * The containers are written to `buf` as they complete and the header is
+ * inserted in front of them by `roaring_portable_writer_finish()`, so `buf`
+ * must have room for the whole serialized bitmap: `capacity` bytes are never
+ * exceeded, the writer fails instead.
+ *
+ * Returns NULL on allocation failure.
+ */
+roaring_portable_writer_t *roaring_portable_writer_create(char *buf,
+                                                          size_t capacity);
+
+/**
+ * Adds values to the writer. Values may repeat, but must not go back to a
+ * 16-bit key (the high 16 bits) that precedes the key of the last value
+ * added: sorted input always satisfies this.
+ *
+ * Returns false if the input is out of order or the buffer is too small, in
+ * which case the writer rejects any further input.
+ */
+bool roaring_portable_writer_add_many(roaring_portable_writer_t *w,
+                                      size_t n_args, const uint32_t *vals);
+
+/**
+ * Adds all values in [min, max) to the writer, with the same ordering
+ * requirement and return value as `roaring_portable_writer_add_many()`.
+ */
+bool roaring_portable_writer_add_range(roaring_portable_writer_t *w,
+                                       uint64_t min, uint64_t max);
+
+/**
+ * Writes the last container and the header. Returns how many bytes were
+ * written to the buffer, or 0 if the writer failed. No more values may be
+ * added afterwards.
+ */
+size_t roaring_portable_writer_finish(roaring_portable_writer_t *w);
+
+/**
+ * Frees the writer. The buffer belongs to the caller and is left as is.
+ */
+void roaring_portable_writer_free(roaring_portable_writer_t *w);
+
 /*
  * "Frozen" serialization format imitates memory layout of roaring_bitmap_t.
  * Deserialized bitmap is a constant view of the underlying buffer.
@@ -839,6 +1124,9 @@ size_t roaring_bitmap_frozen_size_in_bytes(const roaring_bitmap_t *r);
  * compatible with little-endian systems. This is not a bug, it is by design,
  *since the format imitates C memory layout
  *
+ * Shared containers (see `roaring_interner_t`) are written out in full, as
+ * with the other formats.
+ *
  * When serializing data to a file, we recommend that you also use
  * checksums so that, at deserialization, you can be confident
  * that you are recovering the correct data.
@@ -1075,6 +1363,41 @@ uint32_t roaring_bitmap_maximum(const roaring_bitmap_t *r);
 void roaring_bitmap_statistics(const roaring_bitmap_t *r,
                                roaring_statistics_t *stat);
 
+/**
+ * (For advanced users.)
+ *
+ * Sums the container memory events of all the threads that used the library
+ * (see roaring_counters_t). Each thread updates its own counters with relaxed
+ * atomic stores, so the sum is approximate while other threads work. The
+ * counters only grow: measure a workload with the difference of two
+ * snapshots, see roaring_counters_subtract().
+ *
+ * Without CROARING_COUNTERS=1 at build time, the counters are all zero.
+ */
+void roaring_counters_get(roaring_counters_t *counters);
+
+/**
+ * (For advanced users.)
+ *
+ * Same as roaring_counters_get(), for the events of the calling thread only.
+ */
+void roaring_counters_get_thread(roaring_counters_t *counters);
+
+/**
+ * (For advanced users.)
+ *
+ * Subtracts the snapshot `since` from `counters`, field by field.
+ */
+void roaring_counters_subtract(roaring_counters_t *counters,
+                               const roaring_counters_t *since);
+
+/**
+ * (For advanced users.)
+ *
+ * Prints the counters, one line per container type and then the conversions.
+ */
+void roaring_counters_printf(const roaring_counters_t *counters);
+
 /**
  * Perform internal consistency checks. Returns true if the bitmap is
  * consistent. It may be useful to call this after deserializing bitmaps from
@@ -1357,6 +1680,45 @@ size_t roaring_uint32_iterator_read_prev_ranges(
     roaring_uint32_iterator_t *it, roaring_uint32_range_closed_t *buf,
     size_t count);
 
+/**
+ * Creates a new bitmap holding the union of n ranges, sorted by their `min`.
+ * Ranges may overlap or touch. This is faster than calling
+ * `roaring_bitmap_add_range_closed()` for each range: containers are built
+ * in one pass from their runs, with their final type and size, and keys
+ * covered entirely by a range get a full run container directly.
+ *
+ * Returns NULL if the ranges are not sorted, if a range has min > max, or in
+ * case of errors.
+ */
+roaring_bitmap_t *roaring_bitmap_from_ranges(
+    const roaring_uint32_range_closed_t *ranges, size_t n);
+
+/**
+ * Adds n ranges, sorted by their `min`, to the bitmap: same as a union with
+ * `roaring_bitmap_from_ranges(ranges, n)`. Returns false, leaving the bitmap
+ * unchanged, if the ranges are not sorted or if a range has min > max.
+ */
+bool roaring_bitmap_add_ranges(roaring_bitmap_t *r,
+                               const roaring_uint32_range_closed_t *ranges,
+                               size_t n);
+
+/**
+ * Returns the number of maximal ranges of consecutive values in the bitmap,
+ * as written by `roaring_bitmap_to_ranges()`. Ranges crossing container
+ * boundaries are counted once.
+ */
+size_t roaring_bitmap_range_count(const roaring_bitmap_t *r);
+
+/**
+ * Writes the first ${count} maximal ranges of the bitmap into ${buf}, in
+ * increasing order, and returns the number of ranges written. Passing
+ * `roaring_bitmap_range_count()` as ${count} exports them all; the result can
+ * be given back to `roaring_bitmap_from_ranges()`.
+ */
+size_t roaring_bitmap_to_ranges(const roaring_bitmap_t *r,
+                                roaring_uint32_range_closed_t *buf,
+                                size_t count);
+
 #ifdef __cplusplus
 }
 }
@@ -68,6 +68,30 @@ typedef struct roaring64_bulk_context_s {
 roaring64_bitmap_t *roaring64_bitmap_create(void);
 void roaring64_bitmap_free(roaring64_bitmap_t *r);
 
+/**
+ * The allocator the bitmap was created with (see roaring_allocator_t), or
+ * NULL if it uses the memory hook.
+ */
+const roaring_allocator_t *roaring64_bitmap_get_allocator(
+    const roaring64_bitmap_t *r);
+
+/**
+ * Whether copies of the bitmap share its containers (copy-on-write), as with
+ * `roaring_bitmap_set_copy_on_write()`. A copy then costs a reference count
+ * update per container, and a shared container is cloned only when one of the
+ * bitmaps modifies it. Copies, and the results of `and`, `or`, `xor` and
+ * `andnot`, inherit the flag.
+ *
+ * The first copy wraps the containers of `r` for sharing, which modifies `r`:
+ * take it while no other thread uses `r`. The copies can then be read,
+ * modified and freed on other threads, as the reference counts are atomic.
+ * Bitmaps that share containers should use the same allocator.
+ *
+ * When setting this flag to false, shared containers are cloned immediately.
+ */
+bool roaring64_bitmap_get_copy_on_write(const roaring64_bitmap_t *r);
+void roaring64_bitmap_set_copy_on_write(roaring64_bitmap_t *r, bool cow);
+
 /**
  * Returns a copy of a bitmap.
  * The returned pointer may be NULL in case of errors.
@@ -92,6 +116,52 @@ void roaring64_bitmap_overwrite(roaring64_bitmap_t *dest,
 roaring64_bitmap_t *roaring64_bitmap_of_ptr(size_t n_args,
                                             const uint64_t *vals);
 
+/**
+ * Creates a new bitmap from n values given in non-decreasing order
+ * (duplicates are allowed). Each 16-bit container is built in one pass with
+ * its final type and exact capacity, as with `roaring_bitmap_from_sorted()`,
+ * and inserted in key order.
+ *
+ * Returns NULL if the values are not sorted.
+ */
+roaring64_bitmap_t *roaring64_bitmap_from_sorted(const uint64_t *vals,
+                                                 size_t n);
+
+/**
+ * Creates a new bitmap from n values in any order (duplicates are allowed),
+ * like `roaring_bitmap_from_unsorted()`. The values are radix-partitioned by
+ * their high 48 bits into at most 65536 buckets of consecutive keys, each
+ * bucket is sorted and its containers built in one go, and the containers are
+ * inserted in key order.
+ *
+ * Needs about 8 bytes of scratch memory per value. Returns NULL in case of
+ * errors. To spread the work over threads, use `roaring64_bulk_loader_t`.
+ */
+roaring64_bitmap_t *roaring64_bitmap_from_unsorted(const uint64_t *vals,
+                                                   size_t n);
+
+/**
+ * The steps of `roaring64_bitmap_from_unsorted()`, used like
+ * `roaring_bulk_loader_t`: count each part, plan (which gives the number of
+ * buckets), scatter each part, build ranges of buckets covering
+ * [0, num_buckets), and finish. Calls within the count, scatter and build
+ * steps may run concurrently on different parts or ranges.
+ * `roaring64_bulk_loader_create()` reads the values once to find the range of
+ * keys.
+ */
+typedef struct roaring64_bulk_loader_s roaring64_bulk_loader_t;
+
+roaring64_bulk_loader_t *roaring64_bulk_loader_create(const uint64_t *vals,
+                                                      size_t n,
+                                                      uint32_t num_parts);
+void roaring64_bulk_loader_count(roaring64_bulk_loader_t *l, uint32_t part);
+bool roaring64_bulk_loader_plan(roaring64_bulk_loader_t *l,
+                                uint32_t *num_buckets);
+void roaring64_bulk_loader_scatter(roaring64_bulk_loader_t *l, uint32_t part);
+void roaring64_bulk_loader_build(roaring64_bulk_loader_t *l, uint32_t begin,
+                                 uint32_t end);
+roaring64_bitmap_t *roaring64_bulk_loader_finish(roaring64_bulk_loader_t *l);
+
 #ifdef __cplusplus
 /**
  * Creates a new bitmap which contains all values passed in as arguments.
@@ -285,7 +355,9 @@ bool roaring64_bitmap_contains_range_closed(const roaring64_bitmap_t *r,
  * context after doing any modification invokes undefined behavior.
  *
  * In order to exploit this optimization, the caller should call this function
- * with values with the same high 48 bits of the value consecutively.
+ * with values with the same high 48 bits of the value consecutively. The
+ * context remembers absent high bits as well, so consecutive misses with the
+ * same high 48 bits are cheap too.
  */
 bool roaring64_bitmap_contains_bulk(const roaring64_bitmap_t *r,
                                     roaring64_bulk_context_t *context,
@@ -320,6 +392,30 @@ uint64_t roaring64_bitmap_rank(const roaring64_bitmap_t *r, uint64_t val);
 bool roaring64_bitmap_get_index(const roaring64_bitmap_t *r, uint64_t val,
                                 uint64_t *out_index);
 
+/**
+ * Bulk version of `roaring64_bitmap_rank()`: writes the rank of each value of
+ * `[begin, end)` to `ans`, in one pass over the bitmap. The values must be
+ * sorted in increasing order. Caller is responsible to ensure that there is
+ * enough memory allocated, e.g.
+ * ```
+ * ans = malloc((end - begin) * sizeof(uint64_t));
+ * ```
+ */
+void roaring64_bitmap_rank_many(const roaring64_bitmap_t *r,
+                                const uint64_t *begin, const uint64_t *end,
+                                uint64_t *ans);
+
+/**
+ * Bulk version of `roaring64_bitmap_select()`: writes the element of each rank
+ * of `[begin, end)` to `elements`, in one pass over the bitmap. The ranks must
+ * be sorted in increasing order. Returns false if a rank is not less than the
+ * cardinality, in which case only the elements of the smaller ranks are
+ * written.
+ */
+bool roaring64_bitmap_select_many(const roaring64_bitmap_t *r,
+                                  const uint64_t *begin, const uint64_t *end,
+                                  uint64_t *elements);
+
 /**
  * Returns the number of values in the bitmap.
  */
@@ -365,10 +461,65 @@ bool roaring64_bitmap_run_optimize(roaring64_bitmap_t *r);
 
 /**
  * Shrinks internal arrays to eliminate any unused capacity. Returns the number
- * of bytes freed.
+ * of bytes freed. Containers shared with other bitmaps are left as they are.
+ * Does nothing to a sealed bitmap.
  */
 size_t roaring64_bitmap_shrink_to_fit(roaring64_bitmap_t *r);
 
+/**
+ * Renumbers the containers of the bitmap in key order and releases the unused
+ * slots of its container array, so that iterating over the bitmap walks the
+ * array sequentially. `roaring64_bitmap_shrink_to_fit()` does this as well,
+ * and so do the functions that remove values or containers, whenever fewer
+ * than a quarter of the slots remain in use. Returns false in case of
+ * allocation failure, or if the bitmap is frozen, in which case it is left as
+ * it was. Does nothing to a sealed bitmap, whose containers are in key order.
+ */
+bool roaring64_bitmap_compact(roaring64_bitmap_t *r);
+
+/**
+ * Repacks a bitmap that is done being built into a single cache-line aligned
+ * allocation: the container pointers, then the ART nodes in breadth-first
+ * order with the leaves last and in key order, then the containers and their
+ * payloads in key order. Lookups and iteration then touch fewer cache lines
+ * and pages. Call `roaring64_bitmap_run_optimize()` before sealing, if at all.
+ *
+ * A sealed bitmap also keeps the cumulative cardinality of its containers in
+ * key order, so that rank, select, get_index, get_cardinality and exports from
+ * an offset take a lookup rather than a scan of the containers.
+ *
+ * A sealed bitmap can be read, copied and serialized like any other. Copies
+ * are not sealed and do not share containers with it, even with
+ * copy-on-write. Any function that modifies the bitmap unseals it first,
+ * which invalidates iterators and bulk contexts, as any modification can. If
+ * unsealing fails for lack of memory, the function leaves the bitmap sealed
+ * and unchanged, and returns false (or 0) if it returns anything.
+ *
+ * Returns false if the bitmap is frozen or in case of allocation failure, in
+ * which case it is left as it was. Sealing an empty bitmap does nothing.
+ */
+bool roaring64_bitmap_seal(roaring64_bitmap_t *r);
+
+/**
+ * Moves the ART and containers of a sealed bitmap back to their own
+ * allocations. Only needed to unseal ahead of modifications. Returns false in
+ * case of allocation failure, in which case the bitmap stays sealed.
+ */
+bool roaring64_bitmap_unseal(roaring64_bitmap_t *r);
+
+bool roaring64_bitmap_is_sealed(const roaring64_bitmap_t *r);
+
+/**
+ * Interns the containers of `r` with `in`, so that they are shared with the
+ * equal containers of other bitmaps (32-bit or 64-bit) interned with it, see
+ * `roaring_interner_t`. Sets `r` to copy-on-write. Returns the number of
+ * bytes released. Does nothing to a frozen bitmap.
+ *
+ * A bitmap that shares containers cannot be frozen: unshare them with
+ * `roaring64_bitmap_set_copy_on_write(r, false)` first.
+ */
+size_t roaring64_bitmap_intern(roaring64_bitmap_t *r, roaring_interner_t *in);
+
 /**
  *  (For advanced users.)
  * Collect statistics about the bitmap
@@ -522,6 +673,31 @@ uint64_t roaring64_bitmap_andnot_cardinality(const roaring64_bitmap_t *r1,
 void roaring64_bitmap_andnot_inplace(roaring64_bitmap_t *r1,
                                      const roaring64_bitmap_t *r2);
 
+/**
+ * Computes the union of `number` bitmaps. The leaves of all bitmaps are merged
+ * in key order, and the containers sharing a key are combined at once, which
+ * is much faster than repeated calls to `roaring64_bitmap_or_inplace()` when
+ * there are many bitmaps. The caller is responsible for freeing the result.
+ * The returned pointer may be NULL in case of errors.
+ */
+roaring64_bitmap_t *roaring64_bitmap_or_many(size_t number,
+                                             const roaring64_bitmap_t **rs);
+
+/**
+ * Computes the intersection of `number` bitmaps, see
+ * `roaring64_bitmap_or_many()`. Only the keys present in every bitmap are
+ * visited.
+ */
+roaring64_bitmap_t *roaring64_bitmap_and_many(size_t number,
+                                              const roaring64_bitmap_t **rs);
+
+/**
+ * Computes the symmetric difference (xor) of `number` bitmaps, see
+ * `roaring64_bitmap_or_many()`.
+ */
+roaring64_bitmap_t *roaring64_bitmap_xor_many(size_t number,
+                                              const roaring64_bitmap_t **rs);
+
 /**
  * Compute the negation of the bitmap in the interval [min, max).
  * The number of negated values is `max - min`. Areas outside the range are
@@ -652,6 +828,46 @@ size_t roaring64_bitmap_portable_deserialize_size(const char *buf,
 roaring64_bitmap_t *roaring64_bitmap_portable_deserialize_safe(const char *buf,
                                                                size_t maxbytes);
 
+/**
+ * Deserialization of the portable format split in three steps, so that the
+ * containers of a large bitmap can be decoded by several threads. This is the
+ * 64-bit counterpart of `roaring_bitmap_portable_deserialize_prepare()`.
+ *
+ * `roaring64_bitmap_portable_deserialize_prepare()` validates the bucket and
+ * container headers found at (buf, maxbytes) and builds the index of the
+ * bitmap, without reading the containers. Returns NULL in case of errors. The
+ * number of containers, counted across all buckets, is written to
+ * `*container_count`.
+ *
+ * `roaring64_bitmap_portable_deserialize_range()` reads the containers
+ * [begin, end), numbered in key order. It may be called concurrently on
+ * disjoint ranges of the same bitmap, with the same (buf, maxbytes).
+ *
+ * Once every range was read, `roaring64_bitmap_portable_deserialize_finish()`
+ * must be called. It returns the bitmap if all containers were read, and
+ * otherwise frees it and returns NULL.
+ *
+ * The same caveats as for `roaring64_bitmap_portable_deserialize_safe()`
+ * apply to the resulting bitmap.
+ */
+roaring64_bitmap_t *roaring64_bitmap_portable_deserialize_prepare(
+    const char *buf, size_t maxbytes, uint64_t *container_count);
+
+/**
+ * See `roaring64_bitmap_portable_deserialize_prepare()`. Returns false if a
+ * container could not be read, in which case `finish` will return NULL.
+ */
+bool roaring64_bitmap_portable_deserialize_range(roaring64_bitmap_t *r,
+                                                 const char *buf,
+                                                 size_t maxbytes,
+                                                 uint64_t begin, uint64_t end);
+
+/**
+ * See `roaring64_bitmap_portable_deserialize_prepare()`.
+ */
+roaring64_bitmap_t *roaring64_bitmap_portable_deserialize_finish(
+    roaring64_bitmap_t *r);
+
 /**
  * Read a bitmap from a portable serialized buffer as a read-only view of the
  * container payloads. Headers and the ART index are allocated; bitset/array/run
@@ -696,7 +912,9 @@ roaring64_bitmap_t *roaring64_bitmap_portable_deserialize_frozen(
  * Returns the number of bytes required to serialize this bitmap in a "frozen"
  * format. This is not compatible with any other serialization formats.
  *
- * `roaring64_bitmap_shrink_to_fit()` must be called before this method.
+ * `roaring64_bitmap_shrink_to_fit()` must be called before this method, and
+ * the bitmap must not share containers (see
+ * `roaring64_bitmap_set_copy_on_write()`); otherwise, returns 0.
  */
 size_t roaring64_bitmap_frozen_size_in_bytes(const roaring64_bitmap_t *r);
 
@@ -705,7 +923,8 @@ size_t roaring64_bitmap_frozen_size_in_bytes(const roaring64_bitmap_t *r);
  * `roaring64_bitmap_frozen_size_in_bytes()` in size. Returns the number of
  * bytes used for serialization.
  *
- * `roaring64_bitmap_shrink_to_fit()` must be called before this method.
+ * `roaring64_bitmap_shrink_to_fit()` must be called before this method, and
+ * the bitmap must not share containers; otherwise, returns 0.
  *
  * The frozen format is optimized for speed of (de)serialization, as well as
  * allowing the user to create a bitmap based on a memory mapped file, which is
@@ -768,6 +987,18 @@ bool roaring64_bitmap_iterate(const roaring64_bitmap_t *r,
 void roaring64_bitmap_to_uint64_array(const roaring64_bitmap_t *r,
                                       uint64_t *out);
 
+/**
+ * Writes the values of rank [offset, offset + limit) to `out`, in increasing
+ * order, and returns the number of values written (less than `limit` if the
+ * bitmap runs out of values). Like `roaring_bitmap_range_uint32_array()`,
+ * this lets several threads export disjoint slices of one bitmap into a
+ * shared array (see roaring::parallel::toUint64Array in
+ * cpp/roaring/parallel.hh).
+ */
+uint64_t roaring64_bitmap_range_uint64_array(const roaring64_bitmap_t *r,
+                                             uint64_t offset, uint64_t limit,
+                                             uint64_t *out);
+
 /**
  * Create an iterator object that can be used to iterate through the values.
  * Caller is responsible for calling `roaring64_iterator_free()`.
@@ -945,6 +1176,39 @@ size_t roaring64_iterator_read_prev_ranges(roaring64_iterator_t *it,
                                            roaring64_range_closed_t *buf,
                                            size_t count);
 
+/**
+ * Creates a new bitmap holding the union of n ranges, sorted by their `min`,
+ * like `roaring_bitmap_from_ranges()`. Ranges may overlap or touch.
+ *
+ * Returns NULL if the ranges are not sorted, if a range has min > max, or in
+ * case of errors.
+ */
+roaring64_bitmap_t *roaring64_bitmap_from_ranges(
+    const roaring64_range_closed_t *ranges, size_t n);
+
+/**
+ * Adds n ranges, sorted by their `min`, to the bitmap: same as a union with
+ * `roaring64_bitmap_from_ranges(ranges, n)`. Returns false, leaving the bitmap
+ * unchanged, if the ranges are not sorted or if a range has min > max.
+ */
+bool roaring64_bitmap_add_ranges(roaring64_bitmap_t *r,
+                                 const roaring64_range_closed_t *ranges,
+                                 size_t n);
+
+/**
+ * Returns the number of maximal ranges of consecutive values in the bitmap,
+ * as written by `roaring64_bitmap_to_ranges()`.
+ */
+size_t roaring64_bitmap_range_count(const roaring64_bitmap_t *r);
+
+/**
+ * Writes the first ${count} maximal ranges of the bitmap into ${buf}, in
+ * increasing order, and returns the number of ranges written.
+ */
+size_t roaring64_bitmap_to_ranges(const roaring64_bitmap_t *r,
+                                  roaring64_range_closed_t *buf,
+                                  size_t count);
+
 #ifdef __cplusplus
 }  // extern "C"
 }  // namespace roaring
@@ -21,6 +21,7 @@
 
 #include <roaring/array_util.h>
 #include <roaring/containers/containers.h>  // get_writable_copy_if_shared()
+#include <roaring/memory.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -46,10 +47,30 @@ roaring_array_t *ra_create(void);
 
 /**
  * Initialize an existing roaring array with the specified capacity (in number
- * of containers)
+ * of containers), for the allocator that is current on the calling thread
  */
 bool ra_init_with_capacity(roaring_array_t *new_ra, uint32_t cap);
 
+/**
+ * Like ra_init_with_capacity, for the given allocator (NULL for the memory
+ * hook). On failure, the array is left empty, without an allocator.
+ */
+bool ra_init_with_allocator(roaring_array_t *new_ra,
+                            const roaring_allocator_t *allocator,
+                            uint32_t cap);
+
+/**
+ * The allocator of the array, or NULL if it uses the memory hook. See
+ * ROARING_FLAG_ALLOCATOR.
+ */
+static inline const roaring_allocator_t *ra_get_allocator(
+    const roaring_array_t *ra) {
+    if (!(ra->flags & ROARING_FLAG_ALLOCATOR)) {
+        return NULL;
+    }
+    return ((const roaring_allocator_t *const *)ra->containers)[-1];
+}
+
 /**
  * Initialize with zero capacity
  */
@@ -242,6 +263,76 @@ bool ra_portable_deserialize(roaring_array_t *ra, const char *buf,
  */
 size_t ra_portable_deserialize_size(const char *buf, const size_t maxbytes);
 
+/**
+ * Parsed header of a bitmap in the portable format, used to decode its
+ * containers independently of one another (e.g., from several threads).
+ * All pointers alias the serialized buffer.
+ */
+typedef struct ra_portable_header_s {
+    const char *buf;        // start of the serialized bitmap
+    const char *run_flags;  // bitmap of run containers, NULL if none
+    const char *keyscards;  // (key, cardinality - 1) pairs
+    const char *offsets;    // container offsets, NULL if omitted
+    size_t header_bytes;    // bytes before the first container
+    int32_t size;           // number of containers
+} ra_portable_header_t;
+
+/**
+ * Parses the header of a portable bitmap found at buf, not reading beyond
+ * maxbytes. Returns false if no valid header is found. Containers are not
+ * checked.
+ */
+bool ra_portable_parse_header(const char *buf, size_t maxbytes,
+                              ra_portable_header_t *header);
+
+/**
+ * Returns the key of the k-th container described by the header.
+ */
+uint16_t ra_portable_header_key(const ra_portable_header_t *header,
+                                int32_t k);
+
+/**
+ * Returns the typecode the k-th container will have once read.
+ */
+uint8_t ra_portable_header_typecode(const ra_portable_header_t *header,
+                                    int32_t k);
+
+/**
+ * Total number of bytes occupied by the serialized bitmap (header and
+ * containers). Uses the offset header when it is present, so that only the
+ * last container is visited. Returns 0 if the data does not fit in maxbytes.
+ */
+size_t ra_portable_header_total_bytes(const ra_portable_header_t *header,
+                                      size_t maxbytes);
+
+/**
+ * Allocates and reads the k-th container of the serialized bitmap. Returns
+ * NULL if the container does not fit in maxbytes or on allocation failure.
+ * Distinct containers may be read concurrently.
+ */
+container_t *ra_portable_read_container(const ra_portable_header_t *header,
+                                        size_t maxbytes, int32_t k,
+                                        uint8_t *typecode);
+
+/**
+ * First step of a deserialization that can be split across threads: sizes
+ * ra for all containers of the header, sets the keys and typecodes, and
+ * leaves every container slot NULL. ra->size is set to the final size.
+ */
+bool ra_portable_deserialize_prepare(roaring_array_t *ra,
+                                     const ra_portable_header_t *header);
+
+/**
+ * Reads the containers [begin, end) into the slots of a roaring array
+ * prepared with ra_portable_deserialize_prepare. Calls on disjoint ranges
+ * may run concurrently. On failure, the containers read by this call are
+ * freed and their slots left NULL.
+ */
+bool ra_portable_deserialize_range(roaring_array_t *ra,
+                                   const ra_portable_header_t *header,
+                                   size_t maxbytes, int32_t begin,
+                                   int32_t end);
+
 /**
  * How many bytes are required to serialize this bitmap (meant to be
  * compatible
@@ -278,6 +369,7 @@ void ra_remove_at_index(roaring_array_t *ra, int32_t i);
 
 /**
  * clears all containers, sets the size at 0 and shrinks the memory usage.
+ * The array keeps its allocator.
  */
 void ra_reset(roaring_array_t *ra);
 
@@ -47,6 +47,13 @@ struct container_s {};
 #define ROARING_FLAG_FROZEN UINT8_C(0x2)
 // 64-bit only: ART node arrays alias a frozen buffer (do not art_free).
 #define ROARING_FLAG_FROZEN_ART UINT8_C(0x4)
+// The arrays (or ART nodes), containers and payloads share a single aligned
+// block (see roaring_bitmap_seal and roaring64_bitmap_seal).
+#define ROARING_FLAG_SEALED UINT8_C(0x8)
+// 32-bit only: the bitmap has an allocator (see roaring_allocator_t), kept in
+// the block of its containers, right before them: such a bitmap always has a
+// block, if only for the allocator. roaring_array_t thus keeps its size.
+#define ROARING_FLAG_ALLOCATOR UINT8_C(0x10)
 
 /**
  * Roaring arrays are array-based key-value pairs having containers as values
@@ -143,6 +150,58 @@ typedef struct roaring64_statistics_s {
     // and n_values_arrays, n_values_rle, n_values_bitmap
 } roaring64_statistics_t;
 
+/**
+ *  (For advanced users.)
+ * Memory events of one type of container, see roaring_counters_t. Bytes count
+ * the container structs and their payloads, so that n_bytes_allocated minus
+ * n_bytes_freed is the memory held by live containers.
+ */
+typedef struct roaring_container_counters_s {
+    uint64_t n_allocs;   /* containers created */
+    uint64_t n_frees;    /* containers freed */
+    uint64_t n_reallocs; /* payloads grown or shrunk */
+    uint64_t n_bytes_allocated; /* bytes allocated, reallocations included */
+    uint64_t n_bytes_freed;     /* bytes freed, reallocations included */
+    uint64_t n_bytes_overallocated; /* bytes allocated beyond the requested
+                                       capacity when growing payloads */
+} roaring_container_counters_t;
+
+/**
+ *  (For advanced users.)
+ * The roaring_counters_t accumulate the container memory events of the
+ * library, see roaring_counters_get(). They are only maintained when the
+ * library is built with CROARING_COUNTERS=1 (the CMake option
+ * ROARING_COUNTERS), and stay zero otherwise.
+ */
+typedef struct roaring_counters_s {
+    roaring_container_counters_t array;
+    roaring_container_counters_t bitset;
+    roaring_container_counters_t run;
+
+    uint64_t n_array_to_bitset; /* containers converted from a type to */
+    uint64_t n_array_to_run;    /* another, e.g., an array turning into a */
+    uint64_t n_bitset_to_array; /* bitset as it fills up, or into a run */
+    uint64_t n_bitset_to_run;   /* container on run_optimize */
+    uint64_t n_run_to_array;
+    uint64_t n_run_to_bitset;
+
+    uint64_t n_shared_clones; /* copy-on-write containers copied because they
+                                 were shared when written to */
+} roaring_counters_t;
+
+/**
+ * What a roaring_interner_t has done so far, see
+ * roaring_interner_get_statistics().
+ */
+typedef struct roaring_interner_statistics_s {
+    uint64_t n_containers;   /* containers passed to the interner */
+    uint64_t n_distinct;     /* distinct containers it holds */
+    uint64_t n_deduplicated; /* containers replaced by a reference to an
+                                equal one */
+    uint64_t n_bytes_saved;  /* serialized size of the replaced containers
+                                that were released */
+} roaring_interner_statistics_t;
+
 /**
  * Roaring-internal type used to iterate within a roaring container.
  */
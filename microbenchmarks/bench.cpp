@@ -1,5 +1,6 @@
 #include "bench.h"
 
+#include <algorithm>
 #include <random>
 #include <vector>
 
@@ -24,6 +25,17 @@ static roaring_bitmap_t **synth_bitmaps_high = nullptr;
 static uint32_t *synth_queries_cold = nullptr;
 static uint32_t *synth_queries_warm = nullptr;
 
+// Sparse 64-bit dataset for contains() on a deep ART: kSparse64Chunks
+// containers at random 48-bit prefixes, each holding a few random values.
+// Half of the queries hit a stored value, the other half are random and
+// almost surely miss. The sorted copy groups queries sharing a prefix, which
+// is what roaring64_bitmap_contains_bulk() benefits from.
+static constexpr size_t kSparse64Chunks = 100000;
+static constexpr size_t kSparse64ValuesPerChunk = 4;
+static roaring64_bitmap_t *synth_sparse64 = nullptr;
+static uint64_t *synth_queries64 = nullptr;
+static uint64_t *synth_queries64_sorted = nullptr;
+
 static roaring_bitmap_t **build_synthetic_bitmaps(double density,
                                                   uint64_t seed) {
     std::mt19937_64 rng(seed);
@@ -67,6 +79,27 @@ static void load_synthetic() {
     for (size_t i = 0; i < kWarmRepeats; ++i) {
         synth_queries_warm[i] = dist(rng);
     }
+
+    std::vector<uint64_t> values;
+    values.reserve(kSparse64Chunks * kSparse64ValuesPerChunk);
+    synth_sparse64 = roaring64_bitmap_create();
+    for (size_t i = 0; i < kSparse64Chunks; ++i) {
+        uint64_t high = rng() & ~UINT64_C(0xFFFF);
+        for (size_t k = 0; k < kSparse64ValuesPerChunk; ++k) {
+            values.push_back(high | (rng() & 0xFFFF));
+            roaring64_bitmap_add(synth_sparse64, values.back());
+        }
+    }
+    synth_queries64 = (uint64_t *)malloc(sizeof(uint64_t) * kSyntheticCount);
+    for (size_t i = 0; i < kSyntheticCount; ++i) {
+        synth_queries64[i] =
+            (i % 2 == 0) ? values[rng() % values.size()] : rng();
+    }
+    synth_queries64_sorted =
+        (uint64_t *)malloc(sizeof(uint64_t) * kSyntheticCount);
+    std::copy(synth_queries64, synth_queries64 + kSyntheticCount,
+              synth_queries64_sorted);
+    std::sort(synth_queries64_sorted, synth_queries64_sorted + kSyntheticCount);
 }
 
 static void free_synthetic() {
@@ -80,6 +113,9 @@ static void free_synthetic() {
     free(synth_bitmaps_high);
     free(synth_queries_cold);
     free(synth_queries_warm);
+    roaring64_bitmap_free(synth_sparse64);
+    free(synth_queries64);
+    free(synth_queries64_sorted);
 }
 
 struct successive_intersection {
@@ -97,6 +133,22 @@ struct successive_intersection {
 auto SuccessiveIntersection = BasicBench<successive_intersection>;
 BENCHMARK(SuccessiveIntersection);
 
+struct successive_intersection_sealed {
+    static uint64_t run() {
+        uint64_t marker = 0;
+        for (size_t i = 0; i + 1 < count; ++i) {
+            roaring_bitmap_t *tempand =
+                roaring_bitmap_and(sealed_bitmaps[i], sealed_bitmaps[i + 1]);
+            marker += roaring_bitmap_get_cardinality(tempand);
+            roaring_bitmap_free(tempand);
+        }
+        return marker;
+    }
+};
+auto SuccessiveIntersectionSealed =
+    BasicBench<successive_intersection_sealed>;
+BENCHMARK(SuccessiveIntersectionSealed);
+
 struct successive_intersection64 {
     static uint64_t run() {
         uint64_t marker = 0;
@@ -277,6 +329,21 @@ struct random_access64 {
 auto RandomAccess64 = BasicBench<random_access64>;
 BENCHMARK(RandomAccess64);
 
+struct random_access64_sealed {
+    static uint64_t run() {
+        uint64_t marker = 0;
+        for (size_t i = 0; i < count; ++i) {
+            roaring64_bitmap_t *r = sealed_bitmaps64[i];
+            marker += roaring64_bitmap_contains(r, maxvalue / 4);
+            marker += roaring64_bitmap_contains(r, maxvalue / 2);
+            marker += roaring64_bitmap_contains(r, 3 * maxvalue / 4);
+        }
+        return marker;
+    }
+};
+auto RandomAccess64Sealed = BasicBench<random_access64_sealed>;
+BENCHMARK(RandomAccess64Sealed);
+
 struct random_access64_cpp {
     static uint64_t run() {
         uint64_t marker = 0;
@@ -335,6 +402,24 @@ struct iterate_all {
 auto IterateAll = BasicBench<iterate_all>;
 BENCHMARK(IterateAll);
 
+struct iterate_all_sealed {
+    static uint64_t run() {
+        uint64_t marker = 0;
+        for (size_t i = 0; i < count; ++i) {
+            roaring_bitmap_t *r = sealed_bitmaps[i];
+            roaring_uint32_iterator_t j;
+            roaring_iterator_init(r, &j);
+            while (j.has_value) {
+                marker++;
+                roaring_uint32_iterator_advance(&j);
+            }
+        }
+        return marker;
+    }
+};
+auto IterateAllSealed = BasicBench<iterate_all_sealed>;
+BENCHMARK(IterateAllSealed);
+
 struct iterate_all64 {
     static uint64_t run() {
         uint64_t marker = 0;
@@ -353,6 +438,24 @@ struct iterate_all64 {
 auto IterateAll64 = BasicBench<iterate_all64>;
 BENCHMARK(IterateAll64);
 
+struct iterate_all64_sealed {
+    static uint64_t run() {
+        uint64_t marker = 0;
+        for (size_t i = 0; i < count; ++i) {
+            roaring64_bitmap_t *r = sealed_bitmaps64[i];
+            roaring64_iterator_t *it = roaring64_iterator_create(r);
+            while (roaring64_iterator_has_value(it)) {
+                marker++;
+                roaring64_iterator_advance(it);
+            }
+            roaring64_iterator_free(it);
+        }
+        return marker;
+    }
+};
+auto IterateAll64Sealed = BasicBench<iterate_all64_sealed>;
+BENCHMARK(IterateAll64Sealed);
+
 struct compute_cardinality {
     static uint64_t run() {
         uint64_t marker = 0;
@@ -514,6 +617,115 @@ auto ContainsWarmHigh =
     BasicBenchPerQuery<contains_warm_high, kWarmBitmaps * kWarmRepeats>;
 BENCHMARK(ContainsWarmHigh);
 
+// Random contains on the sparse 64-bit bitmap: every query walks the ART down
+// to a leaf, or to the node where its prefix is missing.
+struct contains64_sparse {
+    static uint64_t run() {
+        uint64_t marker = 0;
+        for (size_t i = 0; i < kSyntheticCount; ++i) {
+            marker += roaring64_bitmap_contains(synth_sparse64,
+                                                synth_queries64[i]);
+        }
+        return marker;
+    }
+};
+auto Contains64Sparse =
+    BasicBenchPerQuery<contains64_sparse, kSyntheticCount>;
+BENCHMARK(Contains64Sparse);
+
+// Sorted queries through a bulk context, which skips the ART for queries
+// sharing the high 48 bits of the previous one, whether it hit or missed.
+struct contains64_sparse_bulk {
+    static uint64_t run() {
+        uint64_t marker = 0;
+        roaring64_bulk_context_t context{};
+        for (size_t i = 0; i < kSyntheticCount; ++i) {
+            marker += roaring64_bitmap_contains_bulk(
+                synth_sparse64, &context, synth_queries64_sorted[i]);
+        }
+        return marker;
+    }
+};
+auto Contains64SparseBulk =
+    BasicBenchPerQuery<contains64_sparse_bulk, kSyntheticCount>;
+BENCHMARK(Contains64SparseBulk);
+
+// Roaring64Map (std::map buckets) against Roaring64FlatMap (sorted vector
+// buckets) on the real data spread over many buckets.
+template <class Map>
+struct spread64_random_access {
+    static uint64_t run() {
+        uint64_t marker = 0;
+        for (size_t i = 0; i < count; ++i) {
+            const Map *r = spread64<Map>::bitmaps[i];
+            for (uint64_t k = 1; k < 16; ++k) {
+                marker += r->contains(k * (spread_maxvalue / 16));
+            }
+        }
+        return marker;
+    }
+};
+auto RandomAccessSpread64Map = BasicBench<spread64_random_access<Roaring64Map>>;
+BENCHMARK(RandomAccessSpread64Map);
+auto RandomAccessSpread64Flat =
+    BasicBench<spread64_random_access<Roaring64FlatMap>>;
+BENCHMARK(RandomAccessSpread64Flat);
+
+template <class Map>
+struct spread64_successive_intersection {
+    static uint64_t run() {
+        uint64_t marker = 0;
+        for (size_t i = 0; i + 1 < count; ++i) {
+            Map tmp =
+                *spread64<Map>::bitmaps[i] & *spread64<Map>::bitmaps[i + 1];
+            marker += tmp.cardinality();
+        }
+        return marker;
+    }
+};
+auto SuccessiveIntersectionSpread64Map =
+    BasicBench<spread64_successive_intersection<Roaring64Map>>;
+BENCHMARK(SuccessiveIntersectionSpread64Map);
+auto SuccessiveIntersectionSpread64Flat =
+    BasicBench<spread64_successive_intersection<Roaring64FlatMap>>;
+BENCHMARK(SuccessiveIntersectionSpread64Flat);
+
+template <class Map>
+struct spread64_successive_union {
+    static uint64_t run() {
+        uint64_t marker = 0;
+        for (size_t i = 0; i + 1 < count; ++i) {
+            Map tmp =
+                *spread64<Map>::bitmaps[i] | *spread64<Map>::bitmaps[i + 1];
+            marker += tmp.cardinality();
+        }
+        return marker;
+    }
+};
+auto SuccessiveUnionSpread64Map =
+    BasicBench<spread64_successive_union<Roaring64Map>>;
+BENCHMARK(SuccessiveUnionSpread64Map);
+auto SuccessiveUnionSpread64Flat =
+    BasicBench<spread64_successive_union<Roaring64FlatMap>>;
+BENCHMARK(SuccessiveUnionSpread64Flat);
+
+template <class Map>
+struct spread64_iterate {
+    static uint64_t run() {
+        uint64_t marker = 0;
+        for (size_t i = 0; i < count; ++i) {
+            for (uint64_t value : *spread64<Map>::bitmaps[i]) {
+                marker += value;
+            }
+        }
+        return marker;
+    }
+};
+auto IterateSpread64Map = BasicBench<spread64_iterate<Roaring64Map>>;
+BENCHMARK(IterateSpread64Map);
+auto IterateSpread64Flat = BasicBench<spread64_iterate<Roaring64FlatMap>>;
+BENCHMARK(IterateSpread64Flat);
+
 // Note that input data matters: census1881 produces mostly array containers.
 template <uint64_t offset>
 struct add_offset {
@@ -592,7 +804,11 @@ int main(int argc, char **argv) {
     benchmark::Shutdown();
     for (size_t i = 0; i < count; ++i) {
         roaring_bitmap_free(bitmaps[i]);
+        roaring_bitmap_free(sealed_bitmaps[i]);
+        roaring64_bitmap_free(sealed_bitmaps64[i]);
     }
+    free(sealed_bitmaps);
+    free(sealed_bitmaps64);
     free(array_buffer);
     free_synthetic();
 }
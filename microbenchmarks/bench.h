@@ -31,6 +31,7 @@
 #pragma GCC diagnostic ignored "-Wuninitialized"
 #pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
 #endif
+using roaring::Roaring64FlatMap;
 using roaring::Roaring64Map;
 
 event_collector collector;
@@ -38,13 +39,27 @@ size_t N = 1000;
 size_t bitmap_examples_bytes = 0;
 size_t count = 0;
 roaring_bitmap_t **bitmaps = NULL;
+roaring_bitmap_t **sealed_bitmaps = NULL;
 roaring64_bitmap_t **bitmaps64 = NULL;
+roaring64_bitmap_t **sealed_bitmaps64 = NULL;
 Roaring64Map **bitmaps64cpp = NULL;
 uint32_t *array_buffer;
 uint64_t *array_buffer64;
 uint32_t maxvalue = 0;
 uint32_t maxcard = 0;
 
+// The values v of the real data, as v << kSpreadShift: each 32-bit bucket of
+// a Roaring64Map then holds the values of 4096 consecutive v, so that the
+// bitmaps span hundreds of buckets.
+static constexpr int kSpreadShift = 20;
+template <class Map>
+struct spread64 {
+    static Map **bitmaps;
+};
+template <class Map>
+Map **spread64<Map>::bitmaps = NULL;
+uint64_t spread_maxvalue = 0;
+
 /**
  * Read the content of a file to a char array. Caller is
  * responsible for memory de-allocation.
@@ -257,6 +272,21 @@ static Roaring64Map **create_all_64bitmaps_cpp(size_t *howmany,
     return answer;
 }
 
+template <class Map>
+static Map **create_all_spread64_cpp(size_t *howmany, uint32_t **numbers,
+                                     size_t tcount, bool runoptimize) {
+    if (numbers == NULL) return NULL;
+    Map **answer = (Map **)malloc(sizeof(Map *) * tcount);
+    for (size_t i = 0; i < tcount; i++) {
+        answer[i] = new Map();
+        for (size_t j = 0; j < howmany[i]; ++j) {
+            answer[i]->add(uint64_t(numbers[i][j]) << kSpreadShift);
+        }
+        if (runoptimize) answer[i]->runOptimize();
+    }
+    return answer;
+}
+
 template <class func>
 static void BasicBench(benchmark::State &state) {
     // volatile to prevent optimizations.
@@ -300,9 +330,31 @@ int load(const char *dirname) {
     }
     bitmaps =
         create_all_bitmaps(howmany, numbers, count, runoptimize, copy_on_write);
+    if (bitmaps != NULL) {
+        sealed_bitmaps =
+            (roaring_bitmap_t **)malloc(sizeof(roaring_bitmap_t *) * count);
+        for (size_t i = 0; i < count; i++) {
+            sealed_bitmaps[i] = roaring_bitmap_copy(bitmaps[i]);
+            roaring_bitmap_seal(sealed_bitmaps[i]);
+        }
+    }
     bitmaps64 = create_all_64bitmaps(howmany, numbers, count, runoptimize);
+    if (bitmaps64 != NULL) {
+        sealed_bitmaps64 = (roaring64_bitmap_t **)malloc(
+            sizeof(roaring64_bitmap_t *) * count);
+        for (size_t i = 0; i < count; i++) {
+            sealed_bitmaps64[i] = roaring64_bitmap_copy(bitmaps64[i]);
+            roaring64_bitmap_seal(sealed_bitmaps64[i]);
+        }
+    }
     bitmaps64cpp =
         create_all_64bitmaps_cpp(howmany, numbers, count, runoptimize);
+    spread64<Roaring64Map>::bitmaps = create_all_spread64_cpp<Roaring64Map>(
+        howmany, numbers, count, runoptimize);
+    spread64<Roaring64FlatMap>::bitmaps =
+        create_all_spread64_cpp<Roaring64FlatMap>(howmany, numbers, count,
+                                                  runoptimize);
+    spread_maxvalue = uint64_t(maxvalue) << kSpreadShift;
 
     for (size_t i = 0; i < count; ++i) {
         free(numbers[i]);
@@ -2368,6 +2368,41 @@ CROARING_UNTARGET_AVX512
 #endif  // #if CROARING_COMPILER_SUPPORTS_AVX512
 #endif  // #if CROARING_IS_X64
 
+#if CROARING_IS_X64
+#if CROARING_COMPILER_SUPPORTS_AVX512
+CROARING_TARGET_AVX512
+CROARING_ALLOW_UNALIGNED
+static void avx512_widen_uint32_to_uint64(uint64_t *out, const uint32_t *in,
+                                          size_t n, uint64_t base) {
+    size_t i = 0;
+    const __m512i vbase = _mm512_set1_epi64((long long)base);
+    for (; i + sizeof(__m256i) / sizeof(uint32_t) <= n;
+         i += sizeof(__m256i) / sizeof(uint32_t)) {
+        __m256i vinput = _mm256_loadu_si256((const __m256i *)(in + i));
+        __m512i voutput = _mm512_or_si512(_mm512_cvtepu32_epi64(vinput), vbase);
+        _mm512_storeu_si512((__m512i *)(out + i), voutput);
+    }
+    for (; i < n; ++i) {
+        out[i] = base | in[i];
+    }
+}
+CROARING_UNTARGET_AVX512
+#endif  // #if CROARING_COMPILER_SUPPORTS_AVX512
+#endif  // #if CROARING_IS_X64
+
+void widen_uint32_to_uint64(uint64_t *out, const uint32_t *in, size_t n,
+                            uint64_t base) {
+#if CROARING_IS_X64 && CROARING_COMPILER_SUPPORTS_AVX512
+    if (croaring_hardware_support() & ROARING_SUPPORTS_AVX512) {
+        avx512_widen_uint32_to_uint64(out, in, n, base);
+        return;
+    }
+#endif
+    for (size_t i = 0; i < n; ++i) {
+        out[i] = base | in[i];
+    }
+}
+
 #ifdef __cplusplus
 }
 }
@@ -257,6 +257,37 @@ static art_ref_t art_node48_insert(art_t *art, art_node48_t *node,
 static art_ref_t art_node256_insert(art_t *art, art_node256_t *node,
                                     art_ref_t child, uint8_t key);
 
+#if CROARING_IS_X64
+// Node4 and Node16 keep at most 16 sorted keys, which a single SSE2 comparison
+// searches. Bit i of the masks below stands for keys[i], and only the first
+// `count` keys are considered: the others are stale.
+static inline __m128i art_load_keys4(const uint8_t keys[4]) {
+    int32_t packed;
+    memcpy(&packed, keys, sizeof(packed));
+    return _mm_cvtsi32_si128(packed);
+}
+
+static inline __m128i art_load_keys16(const uint8_t keys[16]) {
+    return _mm_loadu_si128((const __m128i *)keys);
+}
+
+// Keys equal to `key`.
+static inline uint32_t art_keys_equal_mask(__m128i keys, uint8_t count,
+                                           art_key_chunk_t key) {
+    __m128i equal = _mm_cmpeq_epi8(keys, _mm_set1_epi8((char)key));
+    return (uint32_t)_mm_movemask_epi8(equal) & ((UINT32_C(1) << count) - 1);
+}
+
+// Keys greater than or equal to `key`, compared as unsigned bytes.
+static inline uint32_t art_keys_at_least_mask(__m128i keys, uint8_t count,
+                                              art_key_chunk_t key) {
+    __m128i at_least =
+        _mm_cmpeq_epi8(_mm_max_epu8(keys, _mm_set1_epi8((char)key)), keys);
+    return (uint32_t)_mm_movemask_epi8(at_least) &
+           ((UINT32_C(1) << count) - 1);
+}
+#endif  // CROARING_IS_X64
+
 static art_node4_t *art_node4_create(art_t *art, const art_key_chunk_t prefix[],
                                      uint8_t prefix_size) {
     uint64_t index = art_allocate_index(art, CROARING_ART_NODE4_TYPE);
@@ -269,12 +300,21 @@ static art_node4_t *art_node4_create(art_t *art, const art_key_chunk_t prefix[],
 
 static inline art_ref_t art_node4_find_child(const art_node4_t *node,
                                              art_key_chunk_t key) {
+#if CROARING_IS_X64
+    uint32_t mask =
+        art_keys_equal_mask(art_load_keys4(node->keys), node->count, key);
+    if (mask != 0) {
+        return node->children[roaring_trailing_zeroes(mask)];
+    }
+    return CROARING_ART_NULL_REF;
+#else
     for (size_t i = 0; i < node->count; ++i) {
         if (node->keys[i] == key) {
             return node->children[i];
         }
     }
     return CROARING_ART_NULL_REF;
+#endif
 }
 
 static art_ref_t art_node4_insert(art_t *art, art_node4_t *node,
@@ -407,6 +447,12 @@ static inline art_indexed_child_t art_node4_child_at(const art_node4_t *node,
 
 static inline art_indexed_child_t art_node4_lower_bound(
     art_node4_t *node, art_key_chunk_t key_chunk) {
+#if CROARING_IS_X64
+    uint32_t mask = art_keys_at_least_mask(art_load_keys4(node->keys),
+                                           node->count, key_chunk);
+    return art_node4_child_at(
+        node, mask != 0 ? roaring_trailing_zeroes(mask) : node->count);
+#else
     art_indexed_child_t indexed_child;
     for (size_t i = 0; i < node->count; ++i) {
         if (node->keys[i] >= key_chunk) {
@@ -418,6 +464,7 @@ static inline art_indexed_child_t art_node4_lower_bound(
     }
     indexed_child.child = CROARING_ART_NULL_REF;
     return indexed_child;
+#endif
 }
 
 static bool art_internal_validate_at(const art_t *art, art_ref_t ref,
@@ -471,12 +518,21 @@ static art_node16_t *art_node16_create(art_t *art,
 
 static inline art_ref_t art_node16_find_child(const art_node16_t *node,
                                               art_key_chunk_t key) {
+#if CROARING_IS_X64
+    uint32_t mask =
+        art_keys_equal_mask(art_load_keys16(node->keys), node->count, key);
+    if (mask != 0) {
+        return node->children[roaring_trailing_zeroes(mask)];
+    }
+    return CROARING_ART_NULL_REF;
+#else
     for (size_t i = 0; i < node->count; ++i) {
         if (node->keys[i] == key) {
             return node->children[i];
         }
     }
     return CROARING_ART_NULL_REF;
+#endif
 }
 
 static art_ref_t art_node16_insert(art_t *art, art_node16_t *node,
@@ -594,6 +650,12 @@ static inline art_indexed_child_t art_node16_child_at(const art_node16_t *node,
 
 static inline art_indexed_child_t art_node16_lower_bound(
     art_node16_t *node, art_key_chunk_t key_chunk) {
+#if CROARING_IS_X64
+    uint32_t mask = art_keys_at_least_mask(art_load_keys16(node->keys),
+                                           node->count, key_chunk);
+    return art_node16_child_at(
+        node, mask != 0 ? roaring_trailing_zeroes(mask) : node->count);
+#else
     art_indexed_child_t indexed_child;
     for (size_t i = 0; i < node->count; ++i) {
         if (node->keys[i] >= key_chunk) {
@@ -605,6 +667,7 @@ static inline art_indexed_child_t art_node16_lower_bound(
     }
     indexed_child.child = CROARING_ART_NULL_REF;
     return indexed_child;
+#endif
 }
 
 static bool art_node16_internal_validate(const art_t *art,
@@ -1811,6 +1874,92 @@ art_val_t *art_insert(art_t *art, const art_key_chunk_t *key, art_val_t val) {
     return &((art_leaf_t *)art_deref(art, leaf))->val;
 }
 
+art_val_t *art_bulk_append(art_t *art, const art_key_chunk_t *key,
+                           art_val_t val) {
+    assert(art->root == CROARING_ART_NULL_REF);
+    uint64_t count = art->first_free[CROARING_ART_LEAF_TYPE];
+    assert(count == 0 ||
+           art_compare_keys(
+               ((art_leaf_t *)art_get_node(art, count - 1,
+                                           CROARING_ART_LEAF_TYPE))
+                   ->key,
+               key) < 0);
+    art_ref_t leaf = art_leaf_create(art, key, val);
+    // Leaves of a newly initialized ART are allocated in order, which is what
+    // art_bulk_finish relies on.
+    assert(art_ref_index(leaf) == count);
+    (void)count;
+    return &((art_leaf_t *)art_deref(art, leaf))->val;
+}
+
+// Builds the subtree holding the leaves in [first, last), all of which share
+// their first `depth` key bytes, and returns its root. Every inner node is
+// created at its final type, so none is grown along the way.
+static art_ref_t art_bulk_build_at(art_t *art, uint64_t first, uint64_t last,
+                                   uint8_t depth) {
+    if (last - first == 1) {
+        return art_to_ref(first, CROARING_ART_LEAF_TYPE);
+    }
+    // The leaves array is not reallocated while inner nodes are created.
+    const art_leaf_t *leaves =
+        (const art_leaf_t *)art->nodes[CROARING_ART_LEAF_TYPE];
+    // Keys are sorted: the prefix shared by the first and last keys is shared
+    // by all of them.
+    uint8_t prefix_size =
+        art_common_prefix(leaves[first].key, depth, ART_KEY_BYTES,
+                          leaves[last - 1].key, depth, ART_KEY_BYTES);
+    uint8_t chunk_depth = depth + prefix_size;
+    size_t child_count = 1;
+    for (uint64_t i = first + 1; i < last; ++i) {
+        child_count += leaves[i].key[chunk_depth] !=
+                       leaves[i - 1].key[chunk_depth];
+    }
+    const art_key_chunk_t *prefix = leaves[first].key + depth;
+    art_typecode_t typecode;
+    art_node_t *node;
+    if (child_count <= 4) {
+        typecode = CROARING_ART_NODE4_TYPE;
+        node = (art_node_t *)art_node4_create(art, prefix, prefix_size);
+    } else if (child_count <= 16) {
+        typecode = CROARING_ART_NODE16_TYPE;
+        node = (art_node_t *)art_node16_create(art, prefix, prefix_size);
+    } else if (child_count <= 48) {
+        typecode = CROARING_ART_NODE48_TYPE;
+        node = (art_node_t *)art_node48_create(art, prefix, prefix_size);
+    } else {
+        typecode = CROARING_ART_NODE256_TYPE;
+        node = (art_node_t *)art_node256_create(art, prefix, prefix_size);
+    }
+    art_ref_t ref = art_get_ref(art, node, typecode);
+    uint64_t child_first = first;
+    while (child_first < last) {
+        art_key_chunk_t chunk = leaves[child_first].key[chunk_depth];
+        uint64_t child_last = child_first + 1;
+        while (child_last < last &&
+               leaves[child_last].key[chunk_depth] == chunk) {
+            child_last++;
+        }
+        art_ref_t child =
+            art_bulk_build_at(art, child_first, child_last, chunk_depth + 1);
+        // Building the child may have moved the node.
+        art_ref_t new_ref = art_node_insert_leaf(
+            art, (art_inner_node_t *)art_deref(art, ref), typecode, chunk,
+            child);
+        assert(new_ref == ref);
+        (void)new_ref;
+        child_first = child_last;
+    }
+    return ref;
+}
+
+void art_bulk_finish(art_t *art) {
+    uint64_t count = art->first_free[CROARING_ART_LEAF_TYPE];
+    if (art->root != CROARING_ART_NULL_REF || count == 0) {
+        return;
+    }
+    art->root = art_bulk_build_at(art, 0, count, 0);
+}
+
 bool art_erase(art_t *art, const art_key_chunk_t *key, art_val_t *erased_val) {
     art_val_t erased_val_local;
     if (erased_val == NULL) {
@@ -2392,6 +2541,147 @@ size_t art_frozen_view(const char *buf, size_t maxbytes, art_t *art) {
     return buf - initial_buf;
 }
 
+// Counts the nodes reachable from `ref`, by typecode.
+static void art_count_nodes_at(const art_t *art, art_ref_t ref,
+                               uint64_t counts[]) {
+    art_typecode_t typecode = art_ref_typecode(ref);
+    counts[typecode]++;
+    if (art_is_leaf(ref)) {
+        return;
+    }
+    art_node_t *node = art_deref(art, ref);
+    art_indexed_child_t child = art_node_next_child(node, typecode, -1);
+    while (child.child != CROARING_ART_NULL_REF) {
+        art_count_nodes_at(art, child.child, counts);
+        child = art_node_next_child(node, typecode, child.index);
+    }
+}
+
+// Copies the leaves below the (compacted) inner node at `ref` to the leaf
+// array of `dst` in key order. The leaf references in `dst` still point into
+// `art` until they are replaced here.
+static void art_compact_leaves_at(const art_t *art, art_t *dst, art_ref_t ref,
+                                  uint64_t *next_leaf) {
+    art_typecode_t typecode = art_ref_typecode(ref);
+    art_node_t *node = art_deref(dst, ref);
+    art_indexed_child_t child = art_node_next_child(node, typecode, -1);
+    while (child.child != CROARING_ART_NULL_REF) {
+        if (art_is_leaf(child.child)) {
+            art_ref_t leaf = art_to_ref((*next_leaf)++, CROARING_ART_LEAF_TYPE);
+            memcpy(art_deref(dst, leaf), art_deref(art, child.child),
+                   sizeof(art_leaf_t));
+            art_replace((art_inner_node_t *)node, typecode, child.key_chunk,
+                        leaf);
+        } else {
+            art_compact_leaves_at(art, dst, child.child, next_leaf);
+        }
+        child = art_node_next_child(node, typecode, child.index);
+    }
+}
+
+size_t art_compact_size_in_bytes(const art_t *art) {
+    if (art->root == CROARING_ART_NULL_REF) {
+        return 0;
+    }
+    uint64_t counts[6] = {0};
+    art_count_nodes_at(art, art->root, counts);
+    size_t size = 0;
+    for (art_typecode_t t = CROARING_ART_MIN_TYPE; t <= CROARING_ART_MAX_TYPE;
+         ++t) {
+        size += counts[t] * ART_NODE_SIZES[t];
+    }
+    return size;
+}
+
+size_t art_compact(const art_t *art, char *buf, art_t *dst) {
+    art_init_cleared(dst);
+    if (art->root == CROARING_ART_NULL_REF) {
+        return 0;
+    }
+    uint64_t counts[6] = {0};
+    art_count_nodes_at(art, art->root, counts);
+    uint64_t inner_count = 0;
+    for (art_typecode_t t = CROARING_ART_NODE4_TYPE;
+         t <= CROARING_ART_MAX_TYPE; ++t) {
+        inner_count += counts[t];
+    }
+    // Holds the nodes of `art` in breadth-first order, which is also the
+    // order of their indices in `dst`.
+    art_ref_t *queue = NULL;
+    if (inner_count > 0) {
+        queue = (art_ref_t *)roaring_malloc(inner_count * sizeof(art_ref_t));
+        if (queue == NULL) {
+            return 0;
+        }
+    }
+
+    // The widest nodes first, the leaves last.
+    char *cursor = buf;
+    for (art_typecode_t t = CROARING_ART_MAX_TYPE; t >= CROARING_ART_MIN_TYPE;
+         --t) {
+        dst->first_free[t] = counts[t];
+        dst->capacities[t] = counts[t];
+        if (counts[t] > 0) {
+            dst->nodes[t] = cursor;
+            cursor += counts[t] * ART_NODE_SIZES[t];
+        }
+    }
+
+    if (art_is_leaf(art->root)) {
+        dst->root = art_to_ref(0, CROARING_ART_LEAF_TYPE);
+        memcpy(art_deref(dst, dst->root), art_deref(art, art->root),
+               sizeof(art_leaf_t));
+        return cursor - buf;
+    }
+    // Inner nodes get their index in `dst` when they are queued, and are
+    // copied when they are dequeued, both in breadth-first order.
+    uint64_t queued[6] = {0};
+    uint64_t copied[6] = {0};
+    uint64_t tail = 0;
+    art_typecode_t root_type = art_ref_typecode(art->root);
+    dst->root = art_to_ref(queued[root_type]++, root_type);
+    queue[tail++] = art->root;
+    for (uint64_t head = 0; head < tail; ++head) {
+        art_ref_t ref = queue[head];
+        art_typecode_t typecode = art_ref_typecode(ref);
+        art_node_t *node = art_get_node(dst, copied[typecode]++, typecode);
+        memcpy(node, art_deref(art, ref), ART_NODE_SIZES[typecode]);
+        art_indexed_child_t child = art_node_next_child(node, typecode, -1);
+        while (child.child != CROARING_ART_NULL_REF) {
+            if (!art_is_leaf(child.child)) {
+                art_typecode_t child_type = art_ref_typecode(child.child);
+                queue[tail++] = child.child;
+                art_replace((art_inner_node_t *)node, typecode,
+                            child.key_chunk,
+                            art_to_ref(queued[child_type]++, child_type));
+            }
+            child = art_node_next_child(node, typecode, child.index);
+        }
+    }
+    roaring_free(queue);
+    uint64_t next_leaf = 0;
+    art_compact_leaves_at(art, dst, dst->root, &next_leaf);
+    return cursor - buf;
+}
+
+uint64_t art_compact_leaf_count(const art_t *art) {
+    return art->first_free[CROARING_ART_LEAF_TYPE];
+}
+
+uint64_t art_compact_leaf_index(const art_t *art, const art_val_t *val) {
+    const art_leaf_t *leaf =
+        (const art_leaf_t *)((const char *)val - offsetof(art_leaf_t, val));
+    return leaf - (const art_leaf_t *)art->nodes[CROARING_ART_LEAF_TYPE];
+}
+
+art_val_t *art_compact_leaf_at(const art_t *art, uint64_t index,
+                               art_key_chunk_t *key) {
+    art_leaf_t *leaf = (art_leaf_t *)art_get_node(art, index,
+                                                  CROARING_ART_LEAF_TYPE);
+    memcpy(key, leaf->key, ART_KEY_BYTES);
+    return &leaf->val;
+}
+
 #ifdef __cplusplus
 }  // extern "C"
 }  // namespace roaring
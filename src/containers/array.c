@@ -8,6 +8,7 @@
 #include <stdlib.h>
 
 #include <roaring/containers/array.h>
+#include <roaring/counters.h>
 #include <roaring/memory.h>
 
 #if CROARING_IS_X64
@@ -49,12 +50,18 @@ extern inline bool array_container_full(const array_container_t *array);
 array_container_t *array_container_create_given_capacity(int32_t size) {
     array_container_t *container;
 
-    if ((container = (array_container_t *)roaring_malloc(
-             sizeof(array_container_t))) == NULL) {
+    if (size > 0 && size <= ARRAY_INLINE_SIZE) {
+        // Small arrays take a single allocation.
+        if ((container = (array_container_t *)roaring_malloc(
+                 sizeof(array_container_t) + size * sizeof(uint16_t))) ==
+            NULL) {
+            return NULL;
+        }
+        container->array = (uint16_t *)(container + 1);
+    } else if ((container = (array_container_t *)roaring_malloc(
+                    sizeof(array_container_t))) == NULL) {
         return NULL;
-    }
-
-    if (size <= 0) {  // we don't want to rely on malloc(0)
+    } else if (size <= 0) {  // we don't want to rely on malloc(0)
         container->array = NULL;
     } else if ((container->array = (uint16_t *)roaring_malloc(sizeof(uint16_t) *
                                                               size)) == NULL) {
@@ -62,15 +69,20 @@ array_container_t *array_container_create_given_capacity(int32_t size) {
         return NULL;
     }
 
+    container->inline_values = size > 0 && size <= ARRAY_INLINE_SIZE;
     container->capacity = size;
     container->cardinality = 0;
+    CROARING_COUNT(array.n_allocs, 1);
+    CROARING_COUNT(array.n_bytes_allocated,
+                   sizeof(array_container_t) +
+                       (size > 0 ? size : 0) * sizeof(uint16_t));
 
     return container;
 }
 
 /* Create a new array. Return NULL in case of failure. */
 array_container_t *array_container_create(void) {
-    return array_container_create_given_capacity(ARRAY_DEFAULT_INIT_SIZE);
+    return array_container_create_given_capacity(ARRAY_INLINE_SIZE);
 }
 
 /* Create a new array containing all values in [min,max). */
@@ -130,7 +142,11 @@ void array_container_offset(const array_container_t *c, container_t **loc,
 
 int array_container_shrink_to_fit(array_container_t *src) {
     if (src->cardinality == src->capacity) return 0;  // nothing to do
+    // Inline values cannot be moved out of the container.
+    if (src->inline_values) return 0;
     int savings = src->capacity - src->cardinality;
+    CROARING_COUNT(array.n_reallocs, 1);
+    CROARING_COUNT(array.n_bytes_freed, savings * sizeof(uint16_t));
     src->capacity = src->cardinality;
     if (src->capacity ==
         0) {  // we do not want to rely on realloc for zero allocs
@@ -148,7 +164,14 @@ int array_container_shrink_to_fit(array_container_t *src) {
 /* Free memory. */
 void array_container_free(array_container_t *arr) {
     if (arr == NULL) return;
-    roaring_free(arr->array);
+    CROARING_COUNT(array.n_frees, 1);
+    CROARING_COUNT(array.n_bytes_freed,
+                   sizeof(array_container_t) +
+                       (arr->capacity > 0 ? arr->capacity : 0) *
+                           sizeof(uint16_t));
+    if (!arr->inline_values) {
+        roaring_free(arr->array);
+    }
     roaring_free(arr);
 }
 
@@ -168,10 +191,25 @@ void array_container_grow(array_container_t *container, int32_t min,
     int32_t max = (min <= DEFAULT_MAX_SIZE ? DEFAULT_MAX_SIZE : 65536);
     int32_t new_capacity = clamp(grow_capacity(container->capacity), min, max);
 
+    CROARING_COUNT(array.n_reallocs, 1);
+    CROARING_COUNT(array.n_bytes_freed, container->capacity * sizeof(uint16_t));
+    CROARING_COUNT(array.n_bytes_allocated, new_capacity * sizeof(uint16_t));
+    CROARING_COUNT(array.n_bytes_overallocated,
+                   (new_capacity > min ? new_capacity - min : 0) *
+                       sizeof(uint16_t));
+    int32_t old_capacity = container->capacity;
     container->capacity = new_capacity;
     uint16_t *array = container->array;
 
-    if (preserve) {
+    if (container->inline_values) {
+        // The inline space stays unused from now on.
+        container->inline_values = false;
+        container->array =
+            (uint16_t *)roaring_malloc(new_capacity * sizeof(uint16_t));
+        if (preserve && container->array != NULL) {
+            memcpy(container->array, array, old_capacity * sizeof(uint16_t));
+        }
+    } else if (preserve) {
         container->array =
             (uint16_t *)roaring_realloc(array, new_capacity * sizeof(uint16_t));
         if (container->array == NULL) roaring_free(array);
@@ -292,9 +330,10 @@ void array_container_intersection(const array_container_t *array1,
             min_card = minimum_int32(card_1, card_2);
     const int threshold = 64;  // subject to tuning
 #if CROARING_IS_X64
-    if (out->capacity < min_card) {
-        array_container_grow(out, min_card + sizeof(__m128i) / sizeof(uint16_t),
-                             false);
+    // intersect_vector16 may write one vector past the result.
+    const int32_t min_capacity = min_card + sizeof(__m128i) / sizeof(uint16_t);
+    if (out->capacity < min_capacity) {
+        array_container_grow(out, min_capacity, false);
     }
 #else
     if (out->capacity < min_card) {
@@ -7,9 +7,11 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <roaring/array_util.h>
 #include <roaring/bitset_util.h>
 #include <roaring/containers/array.h>
 #include <roaring/containers/bitset.h>
+#include <roaring/counters.h>
 #include <roaring/memory.h>
 #include <roaring/portability.h>
 #include <roaring/utilasm.h>
@@ -59,6 +61,11 @@ void bitset_container_set_all(bitset_container_t *bitset) {
     bitset->cardinality = (1 << 16);
 }
 
+// Memory held by a bitset container, for the counters.
+#define CROARING_BITSET_CONTAINER_BYTES \
+    (sizeof(bitset_container_t) +       \
+     sizeof(uint64_t) * BITSET_CONTAINER_SIZE_IN_WORDS)
+
 static bitset_container_t *bitset_container_allocate(void) {
     bitset_container_t *bitset =
         (bitset_container_t *)roaring_malloc(sizeof(bitset_container_t));
@@ -84,6 +91,8 @@ static bitset_container_t *bitset_container_allocate(void) {
         roaring_free(bitset);
         return NULL;
     }
+    CROARING_COUNT(bitset.n_allocs, 1);
+    CROARING_COUNT(bitset.n_bytes_allocated, CROARING_BITSET_CONTAINER_BYTES);
     return bitset;
 }
 
@@ -143,6 +152,8 @@ void bitset_container_add_from_range(bitset_container_t *bitset, uint32_t min,
 /* Free memory. */
 void bitset_container_free(bitset_container_t *bitset) {
     if (bitset == NULL) return;
+    CROARING_COUNT(bitset.n_frees, 1);
+    CROARING_COUNT(bitset.n_bytes_freed, CROARING_BITSET_CONTAINER_BYTES);
     roaring_aligned_free(bitset->words);
     roaring_free(bitset);
 }
@@ -176,6 +187,8 @@ bitset_container_t *bitset_container_clone(const bitset_container_t *src) {
     bitset->cardinality = src->cardinality;
     memcpy(bitset->words, src->words,
            sizeof(uint64_t) * BITSET_CONTAINER_SIZE_IN_WORDS);
+    CROARING_COUNT(bitset.n_allocs, 1);
+    CROARING_COUNT(bitset.n_bytes_allocated, CROARING_BITSET_CONTAINER_BYTES);
     return bitset;
 }
 
@@ -969,6 +982,49 @@ int bitset_container_to_uint32_array(
 #endif
 }
 
+// Values decoded per slice by bitset_container_to_uint64_array: 16 KB of
+// stack.
+#define BITSET_SLICE_WORDS 64
+
+int bitset_container_to_uint64_array(uint64_t *out,
+                                     const bitset_container_t *bc,
+                                     uint64_t base) {
+    uint32_t scratch[BITSET_SLICE_WORDS * 64];
+    int card = 0;
+    for (uint32_t w = 0; w < BITSET_CONTAINER_SIZE_IN_WORDS;
+         w += BITSET_SLICE_WORDS) {
+        const uint64_t *words = bc->words + w;
+        size_t n;
+#if CROARING_IS_X64
+        int support = croaring_hardware_support();
+#if CROARING_COMPILER_SUPPORTS_AVX512
+        if ((support & ROARING_SUPPORTS_AVX512) &&
+            (bc->cardinality >= 8192)) {  // heuristic
+            n = bitset_extract_setbits_avx512(words, BITSET_SLICE_WORDS,
+                                              scratch, BITSET_SLICE_WORDS * 64,
+                                              w * 64);
+        } else
+#endif
+            if ((support & ROARING_SUPPORTS_AVX2) &&
+                (bc->cardinality >= 8192)) {  // heuristic
+            n = bitset_extract_setbits_avx2(words, BITSET_SLICE_WORDS,
+                                            scratch, BITSET_SLICE_WORDS * 64,
+                                            w * 64);
+        } else {
+            n = bitset_extract_setbits(words, BITSET_SLICE_WORDS, scratch,
+                                       w * 64);
+        }
+#else
+        n = bitset_extract_setbits(words, BITSET_SLICE_WORDS, scratch, w * 64);
+#endif
+        widen_uint32_to_uint64(out + card, scratch, n, base);
+        card += (int)n;
+    }
+    return card;
+}
+
+#undef BITSET_SLICE_WORDS
+
 /*
  * Print this container using printf (useful for debugging).
  */
@@ -1,4 +1,5 @@
 #include <roaring/containers/containers.h>
+#include <roaring/counters.h>
 #include <roaring/memory.h>
 
 #ifdef __cplusplus
@@ -179,6 +180,11 @@ extern inline container_t *container_xor(const container_t *c1, uint8_t type1,
 
 container_t *get_copy_of_container(container_t *c, uint8_t *typecode,
                                    bool copy_on_write) {
+    // Immutable and never freed: shared even with bitmaps that are not
+    // copy-on-write, see shared_container_full().
+    if (container_is_shared_full(c, *typecode)) {
+        return c;
+    }
     if (copy_on_write) {
         shared_container_t *shared_container;
         if (*typecode == SHARED_CONTAINER_TYPE) {
@@ -235,23 +241,213 @@ container_t *container_clone(const container_t *c, uint8_t typecode) {
     }
 }
 
+// Allocates, with exact capacity, the smallest container for `card` distinct
+// sorted values forming `n_runs` runs. Same choice as convert_run_optimize.
+static container_t *container_create_for_sorted(int32_t card, int32_t n_runs,
+                                                uint8_t *type) {
+    int32_t size_as_run_container =
+        run_container_serialized_size_in_bytes(n_runs);
+    if (card <= DEFAULT_MAX_SIZE) {
+        if (size_as_run_container <
+            array_container_serialized_size_in_bytes(card)) {
+            *type = RUN_CONTAINER_TYPE;
+            return run_container_create_given_capacity(n_runs);
+        }
+        *type = ARRAY_CONTAINER_TYPE;
+        return array_container_create_given_capacity(card);
+    }
+    if (size_as_run_container < bitset_container_serialized_size_in_bytes()) {
+        *type = RUN_CONTAINER_TYPE;
+        return run_container_create_given_capacity(n_runs);
+    }
+    *type = BITSET_CONTAINER_TYPE;
+    return bitset_container_create();
+}
+
+int container_to_uint64_array(uint64_t *output, const container_t *c,
+                              uint8_t typecode, uint64_t high48) {
+    c = container_unwrap_shared(c, &typecode);
+    switch (typecode) {
+        case BITSET_CONTAINER_TYPE:
+            return bitset_container_to_uint64_array(
+                output, const_CAST_bitset(c), high48);
+        case ARRAY_CONTAINER_TYPE: {
+            const array_container_t *ac = const_CAST_array(c);
+            for (int32_t i = 0; i < ac->cardinality; ++i) {
+                output[i] = high48 | ac->array[i];
+            }
+            return ac->cardinality;
+        }
+        default: {
+            const run_container_t *rc = const_CAST_run(c);
+            int card = 0;
+            for (int32_t i = 0; i < rc->n_runs; ++i) {
+                uint64_t start = high48 | rc->runs[i].value;
+                for (uint32_t j = 0; j <= rc->runs[i].length; ++j) {
+                    output[card++] = start + j;
+                }
+            }
+            return card;
+        }
+    }
+}
+
+container_t *container_from_runs(const rle16_t *runs, int32_t n_runs,
+                                 uint8_t *type) {
+    int32_t card = n_runs;
+    for (int32_t i = 0; i < n_runs; ++i) card += runs[i].length;
+    container_t *c = container_create_for_sorted(card, n_runs, type);
+    if (c == NULL) {
+        return NULL;
+    }
+    switch (*type) {
+        case ARRAY_CONTAINER_TYPE: {
+            array_container_t *array = CAST_array(c);
+            int32_t k = 0;
+            for (int32_t i = 0; i < n_runs; ++i) {
+                for (uint32_t v = runs[i].value;
+                     v <= (uint32_t)runs[i].value + runs[i].length; ++v) {
+                    array->array[k++] = (uint16_t)v;
+                }
+            }
+            array->cardinality = k;
+            break;
+        }
+        case BITSET_CONTAINER_TYPE: {
+            bitset_container_t *bitset = CAST_bitset(c);
+            for (int32_t i = 0; i < n_runs; ++i) {
+                bitset_set_lenrange(bitset->words, runs[i].value,
+                                    runs[i].length);
+            }
+            bitset->cardinality = card;
+            break;
+        }
+        default: {
+            run_container_t *run = CAST_run(c);
+            memcpy(run->runs, runs, n_runs * sizeof(rle16_t));
+            run->n_runs = n_runs;
+            break;
+        }
+    }
+    return c;
+}
+
+// Defines container_from_sorted_<suffix> for values of type value_t.
+// Branch-free counts so that the first loop vectorizes. Unsigned wrap-around
+// makes a decreasing pair count as a run break as well.
+#define CONTAINER_FROM_SORTED_FN(suffix, value_t)                              \
+    container_t *container_from_sorted_##suffix(const value_t *vals,           \
+                                                size_t n, uint8_t *type) {     \
+        size_t card = 1, breaks = 0, unsorted = 0;                             \
+        for (size_t i = 1; i < n; ++i) {                                       \
+            value_t prev = vals[i - 1], cur = vals[i];                         \
+            card += cur != prev;                                               \
+            breaks += cur - prev > 1;                                          \
+            unsorted += cur < prev;                                            \
+        }                                                                      \
+        if (unsorted != 0 || card > (1 << 16)) {                               \
+            return NULL;                                                       \
+        }                                                                      \
+        container_t *c = container_create_for_sorted(                          \
+            (int32_t)card, (int32_t)breaks + 1, type);                         \
+        if (c == NULL) {                                                       \
+            return NULL;                                                       \
+        }                                                                      \
+        switch (*type) {                                                       \
+            case ARRAY_CONTAINER_TYPE: {                                       \
+                array_container_t *array = CAST_array(c);                      \
+                array->array[0] = (uint16_t)vals[0];                           \
+                int32_t k = 1;                                                 \
+                for (size_t i = 1; i < n; ++i) {                               \
+                    if (vals[i] != vals[i - 1]) {                              \
+                        array->array[k++] = (uint16_t)vals[i];                 \
+                    }                                                          \
+                }                                                              \
+                array->cardinality = k;                                        \
+                break;                                                         \
+            }                                                                  \
+            case BITSET_CONTAINER_TYPE: {                                      \
+                bitset_container_t *bitset = CAST_bitset(c);                   \
+                for (size_t i = 0; i < n; ++i) {                               \
+                    uint16_t low = (uint16_t)vals[i];                          \
+                    bitset->words[low >> 6] |= UINT64_C(1) << (low & 63);      \
+                }                                                              \
+                bitset->cardinality = (int32_t)card;                           \
+                break;                                                         \
+            }                                                                  \
+            default: {                                                         \
+                run_container_t *run = CAST_run(c);                            \
+                uint16_t start = (uint16_t)vals[0];                            \
+                for (size_t i = 1; i < n; ++i) {                               \
+                    if (vals[i] - vals[i - 1] > 1) {                           \
+                        uint16_t last = (uint16_t)vals[i - 1];                 \
+                        run->runs[run->n_runs].value = start;                  \
+                        run->runs[run->n_runs].length = last - start;          \
+                        run->n_runs++;                                         \
+                        start = (uint16_t)vals[i];                             \
+                    }                                                          \
+                }                                                              \
+                uint16_t last = (uint16_t)vals[n - 1];                         \
+                run->runs[run->n_runs].value = start;                          \
+                run->runs[run->n_runs].length = last - start;                  \
+                run->n_runs++;                                                 \
+                break;                                                         \
+            }                                                                  \
+        }                                                                      \
+        return c;                                                              \
+    }
+
+CONTAINER_FROM_SORTED_FN(uint32, uint32_t)
+CONTAINER_FROM_SORTED_FN(uint64, uint64_t)
+
+#undef CONTAINER_FROM_SORTED_FN
+
 container_t *shared_container_extract_copy(shared_container_t *sc,
                                            uint8_t *typecode) {
     assert(sc->typecode != SHARED_CONTAINER_TYPE);
     *typecode = sc->typecode;
     container_t *answer;
-    if (croaring_refcount_dec(&sc->counter)) {
+    if (sc == shared_container_full()) {
+        answer = container_clone(sc->container, *typecode);
+    } else if (croaring_refcount_get(&sc->counter) == 1 &&
+        croaring_refcount_dec(&sc->counter)) {
+        // Ours is the only reference, nobody else can be reading.
         answer = sc->container;
         sc->container = NULL;  // paranoid
         roaring_free(sc);
     } else {
+        // Clone before dropping our reference: from then on, another thread
+        // may free the container.
+        CROARING_COUNT(n_shared_clones, 1);
         answer = container_clone(sc->container, *typecode);
+        shared_container_free(sc);
     }
     assert(*typecode != SHARED_CONTAINER_TYPE);
     return answer;
 }
 
+// The shared full container and its run. Its counter is never changed: it
+// stays above 1, so that the container is cloned rather than extracted.
+static rle16_t full_run = {0, UINT16_MAX};
+
+#ifdef __cplusplus
+// Containers derive from container_t in C++, so before C++17 they cannot be
+// initialized as aggregates: their constexpr constructors do it statically.
+static run_container_t full_run_container(1, 1, &full_run);
+static shared_container_t shared_full(&full_run_container, RUN_CONTAINER_TYPE,
+                                      2);
+#else
+static run_container_t full_run_container = {1, 1, &full_run};
+static shared_container_t shared_full = {&full_run_container,
+                                         RUN_CONTAINER_TYPE, 2};
+#endif
+
+container_t *shared_container_full(void) { return &shared_full; }
+
 void shared_container_free(shared_container_t *container) {
+    if (container == &shared_full) {
+        return;
+    }
     if (croaring_refcount_dec(&container->counter)) {
         assert(container->typecode != SHARED_CONTAINER_TYPE);
         container_free(container->container, container->typecode);
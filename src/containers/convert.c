@@ -4,6 +4,7 @@
 #include <roaring/containers/containers.h>
 #include <roaring/containers/convert.h>
 #include <roaring/containers/perfparameters.h>
+#include <roaring/counters.h>
 
 #if CROARING_IS_X64
 #ifndef CROARING_COMPILER_SUPPORTS_AVX512
@@ -20,6 +21,7 @@ namespace internal {
 // file contains grubby stuff that must know impl. details of all container
 // types.
 bitset_container_t *bitset_container_from_array(const array_container_t *ac) {
+    CROARING_COUNT(n_array_to_bitset, 1);
     bitset_container_t *ans = bitset_container_create();
     int limit = array_container_cardinality(ac);
     for (int i = 0; i < limit; ++i) bitset_container_set(ans, ac->array[i]);
@@ -27,6 +29,7 @@ bitset_container_t *bitset_container_from_array(const array_container_t *ac) {
 }
 
 bitset_container_t *bitset_container_from_run(const run_container_t *arr) {
+    CROARING_COUNT(n_run_to_bitset, 1);
     int card = run_container_cardinality(arr);
     bitset_container_t *answer = bitset_container_create();
     for (int rlepos = 0; rlepos < arr->n_runs; ++rlepos) {
@@ -38,6 +41,7 @@ bitset_container_t *bitset_container_from_run(const run_container_t *arr) {
 }
 
 array_container_t *array_container_from_run(const run_container_t *arr) {
+    CROARING_COUNT(n_run_to_array, 1);
     array_container_t *answer =
         array_container_create_given_capacity(run_container_cardinality(arr));
     answer->cardinality = 0;
@@ -53,6 +57,7 @@ array_container_t *array_container_from_run(const run_container_t *arr) {
 }
 
 array_container_t *array_container_from_bitset(const bitset_container_t *bits) {
+    CROARING_COUNT(n_bitset_to_array, 1);
     array_container_t *result =
         array_container_create_given_capacity(bits->cardinality);
     result->cardinality = bits->cardinality;
@@ -88,6 +93,7 @@ static void add_run(run_container_t *rc, int s, int e) {
 }
 
 run_container_t *run_container_from_array(const array_container_t *c) {
+    CROARING_COUNT(n_array_to_run, 1);
     int32_t n_runs = array_container_number_of_runs(c);
     run_container_t *answer = run_container_create_given_capacity(n_runs);
     int prev = -2;
@@ -119,6 +125,7 @@ container_t *convert_to_bitset_or_array_container(run_container_t *rc,
                                                   int32_t card,
                                                   uint8_t *resulttype) {
     if (card <= DEFAULT_MAX_SIZE) {
+        CROARING_COUNT(n_run_to_array, 1);
         array_container_t *answer = array_container_create_given_capacity(card);
         answer->cardinality = 0;
         for (int rlepos = 0; rlepos < rc->n_runs; ++rlepos) {
@@ -135,6 +142,7 @@ container_t *convert_to_bitset_or_array_container(run_container_t *rc,
         // run_container_free(r);
         return answer;
     }
+    CROARING_COUNT(n_run_to_bitset, 1);
     bitset_container_t *answer = bitset_container_create();
     for (int rlepos = 0; rlepos < rc->n_runs; ++rlepos) {
         uint16_t run_start = rc->runs[rlepos].value;
@@ -172,6 +180,7 @@ container_t *convert_run_to_efficient_container(run_container_t *c,
     }
     if (card <= DEFAULT_MAX_SIZE) {
         // to array
+        CROARING_COUNT(n_run_to_array, 1);
         array_container_t *answer = array_container_create_given_capacity(card);
         answer->cardinality = 0;
         for (int rlepos = 0; rlepos < c->n_runs; ++rlepos) {
@@ -187,6 +196,7 @@ container_t *convert_run_to_efficient_container(run_container_t *c,
     }
 
     // else to bitset
+    CROARING_COUNT(n_run_to_bitset, 1);
     bitset_container_t *answer = bitset_container_create();
 
     for (int rlepos = 0; rlepos < c->n_runs; ++rlepos) {
@@ -214,6 +224,48 @@ container_t *convert_run_to_efficient_container_and_free(
 // TODO: split into run-  array-  and bitset-  subfunctions for sanity;
 // a few function calls won't really matter.
 
+run_container_t *run_container_from_bitset(const bitset_container_t *bc,
+                                           int32_t n_runs) {
+    // ported from Java RunContainer(BitmapContainer bc, int nbrRuns)
+    assert(n_runs > 0);  // no empty bitmaps
+    CROARING_COUNT(n_bitset_to_run, 1);
+    run_container_t *answer = run_container_create_given_capacity(n_runs);
+    if (answer == NULL) {
+        return NULL;
+    }
+
+    int long_ctr = 0;
+    uint64_t cur_word = bc->words[0];
+    while (true) {
+        while (cur_word == UINT64_C(0) &&
+               long_ctr < BITSET_CONTAINER_SIZE_IN_WORDS - 1)
+            cur_word = bc->words[++long_ctr];
+
+        if (cur_word == UINT64_C(0)) {
+            return answer;
+        }
+
+        int local_run_start = roaring_trailing_zeroes(cur_word);
+        int run_start = local_run_start + 64 * long_ctr;
+        uint64_t cur_word_with_1s = cur_word | (cur_word - 1);
+
+        int run_end = 0;
+        while (cur_word_with_1s == UINT64_C(0xFFFFFFFFFFFFFFFF) &&
+               long_ctr < BITSET_CONTAINER_SIZE_IN_WORDS - 1)
+            cur_word_with_1s = bc->words[++long_ctr];
+
+        if (cur_word_with_1s == UINT64_C(0xFFFFFFFFFFFFFFFF)) {
+            run_end = 64 + long_ctr * 64;  // exclusive, I guess
+            add_run(answer, run_start, run_end - 1);
+            return answer;
+        }
+        int local_run_end = roaring_trailing_zeroes(~cur_word_with_1s);
+        run_end = local_run_end + long_ctr * 64;
+        add_run(answer, run_start, run_end - 1);
+        cur_word = cur_word_with_1s & (cur_word_with_1s + 1);
+    }
+}
+
 container_t *convert_run_optimize(container_t *c, uint8_t typecode_original,
                                   uint8_t *typecode_after) {
     if (typecode_original == RUN_CONTAINER_TYPE) {
@@ -238,6 +290,7 @@ container_t *convert_run_optimize(container_t *c, uint8_t typecode_original,
             return c;
         }
         // else convert array to run container
+        CROARING_COUNT(n_array_to_run, 1);
         run_container_t *answer = run_container_create_given_capacity(n_runs);
         int prev = -2;
         int run_start = -1;
@@ -273,45 +326,10 @@ container_t *convert_run_optimize(container_t *c, uint8_t typecode_original,
             *typecode_after = BITSET_CONTAINER_TYPE;
             return c;
         }
-        // bitset to runcontainer (ported from Java  RunContainer(
-        // BitmapContainer bc, int nbrRuns))
-        assert(n_runs > 0);  // no empty bitmaps
-        run_container_t *answer = run_container_create_given_capacity(n_runs);
-
-        int long_ctr = 0;
-        uint64_t cur_word = c_qua_bitset->words[0];
-        while (true) {
-            while (cur_word == UINT64_C(0) &&
-                   long_ctr < BITSET_CONTAINER_SIZE_IN_WORDS - 1)
-                cur_word = c_qua_bitset->words[++long_ctr];
-
-            if (cur_word == UINT64_C(0)) {
-                bitset_container_free(c_qua_bitset);
-                *typecode_after = RUN_CONTAINER_TYPE;
-                return answer;
-            }
-
-            int local_run_start = roaring_trailing_zeroes(cur_word);
-            int run_start = local_run_start + 64 * long_ctr;
-            uint64_t cur_word_with_1s = cur_word | (cur_word - 1);
-
-            int run_end = 0;
-            while (cur_word_with_1s == UINT64_C(0xFFFFFFFFFFFFFFFF) &&
-                   long_ctr < BITSET_CONTAINER_SIZE_IN_WORDS - 1)
-                cur_word_with_1s = c_qua_bitset->words[++long_ctr];
-
-            if (cur_word_with_1s == UINT64_C(0xFFFFFFFFFFFFFFFF)) {
-                run_end = 64 + long_ctr * 64;  // exclusive, I guess
-                add_run(answer, run_start, run_end - 1);
-                bitset_container_free(c_qua_bitset);
-                *typecode_after = RUN_CONTAINER_TYPE;
-                return answer;
-            }
-            int local_run_end = roaring_trailing_zeroes(~cur_word_with_1s);
-            run_end = local_run_end + long_ctr * 64;
-            add_run(answer, run_start, run_end - 1);
-            cur_word = cur_word_with_1s & (cur_word_with_1s + 1);
-        }
+        run_container_t *answer =
+            run_container_from_bitset(c_qua_bitset, n_runs);
+        bitset_container_free(c_qua_bitset);
+        *typecode_after = RUN_CONTAINER_TYPE;
         return answer;
     } else {
         assert(false);
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 
 #include <roaring/containers/run.h>
+#include <roaring/counters.h>
 #include <roaring/memory.h>
 #include <roaring/portability.h>
 
@@ -102,12 +103,18 @@ run_container_t *run_container_create_given_capacity(int32_t size) {
     }
     run->capacity = size;
     run->n_runs = 0;
+    CROARING_COUNT(run.n_allocs, 1);
+    CROARING_COUNT(run.n_bytes_allocated,
+                   sizeof(run_container_t) +
+                       (size > 0 ? size : 0) * sizeof(rle16_t));
     return run;
 }
 
 int run_container_shrink_to_fit(run_container_t *src) {
     if (src->n_runs == src->capacity) return 0;  // nothing to do
     int savings = src->capacity - src->n_runs;
+    CROARING_COUNT(run.n_reallocs, 1);
+    CROARING_COUNT(run.n_bytes_freed, savings * sizeof(rle16_t));
     src->capacity = src->n_runs;
     rle16_t *oldruns = src->runs;
     src->runs =
@@ -192,6 +199,11 @@ void run_container_offset(const run_container_t *c, container_t **loc,
 /* Free memory. */
 void run_container_free(run_container_t *run) {
     if (run == NULL) return;
+    CROARING_COUNT(run.n_frees, 1);
+    CROARING_COUNT(run.n_bytes_freed,
+                   sizeof(run_container_t) +
+                       (run->capacity > 0 ? run->capacity : 0) *
+                           sizeof(rle16_t));
     roaring_free(run->runs);
     roaring_free(run);
 }
@@ -202,6 +214,11 @@ void run_container_grow(run_container_t *run, int32_t min, bool copy) {
                           : run->capacity < 1024 ? run->capacity * 3 / 2
                                                  : run->capacity * 5 / 4;
     if (newCapacity < min) newCapacity = min;
+    CROARING_COUNT(run.n_reallocs, 1);
+    CROARING_COUNT(run.n_bytes_freed, run->capacity * sizeof(rle16_t));
+    CROARING_COUNT(run.n_bytes_allocated, newCapacity * sizeof(rle16_t));
+    CROARING_COUNT(run.n_bytes_overallocated,
+                   (newCapacity - min) * sizeof(rle16_t));
     run->capacity = newCapacity;
     assert(run->capacity >= min);
     if (copy) {
@@ -0,0 +1,237 @@
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <roaring/counters.h>
+#include <roaring/memory.h>
+#include <roaring/portability.h>
+#include <roaring/roaring.h>
+
+#ifdef __cplusplus
+using namespace ::roaring::internal;
+
+extern "C" {
+namespace roaring {
+namespace internal {
+#endif
+
+// roaring_counters_t only holds uint64_t counters, which lets us combine them
+// as arrays.
+#define COUNTERS_SIZE (sizeof(roaring_counters_t) / sizeof(uint64_t))
+
+#if CROARING_COUNTERS
+
+// A counter is only written by its thread, so it is updated with a relaxed
+// load and store rather than a read-modify-write; other threads read it with
+// relaxed loads.
+#if CROARING_ATOMIC_IMPL == CROARING_ATOMIC_IMPL_C
+typedef _Atomic(uint64_t) counter_value_t;
+
+static inline void counter_add(counter_value_t *c, uint64_t n) {
+    atomic_store_explicit(
+        c, atomic_load_explicit(c, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+static inline uint64_t counter_get(const counter_value_t *c) {
+    return atomic_load_explicit((counter_value_t *)c, memory_order_relaxed);
+}
+#elif CROARING_ATOMIC_IMPL == CROARING_ATOMIC_IMPL_CPP
+typedef std::atomic<uint64_t> counter_value_t;
+
+static inline void counter_add(counter_value_t *c, uint64_t n) {
+    c->store(c->load(std::memory_order_relaxed) + n,
+             std::memory_order_relaxed);
+}
+
+static inline uint64_t counter_get(const counter_value_t *c) {
+    return c->load(std::memory_order_relaxed);
+}
+#elif CROARING_ATOMIC_IMPL == CROARING_ATOMIC_IMPL_C_WINDOWS
+// Aligned 64-bit reads and writes are atomic on 64-bit Windows targets.
+typedef volatile uint64_t counter_value_t;
+
+static inline void counter_add(counter_value_t *c, uint64_t n) { *c += n; }
+
+static inline uint64_t counter_get(const counter_value_t *c) { return *c; }
+#else  // CROARING_ATOMIC_IMPL_NONE
+typedef uint64_t counter_value_t;
+
+static inline void counter_add(counter_value_t *c, uint64_t n) { *c += n; }
+
+static inline uint64_t counter_get(const counter_value_t *c) { return *c; }
+#endif
+
+// The counters of every thread that used the library. A thread pushes its
+// block onto the list on first use and the block is never removed, so the
+// events of finished threads still count.
+typedef struct counters_block_s {
+    counter_value_t values[COUNTERS_SIZE];
+    struct counters_block_s *next;
+} counters_block_t;
+
+#if CROARING_ATOMIC_IMPL == CROARING_ATOMIC_IMPL_C
+static _Atomic(counters_block_t *) counters_blocks;
+
+static void counters_push(counters_block_t *b) {
+    b->next = atomic_load_explicit(&counters_blocks, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&counters_blocks, &b->next, b,
+                                                  memory_order_release,
+                                                  memory_order_relaxed)) {
+    }
+}
+
+static counters_block_t *counters_first(void) {
+    return atomic_load_explicit(&counters_blocks, memory_order_acquire);
+}
+#elif CROARING_ATOMIC_IMPL == CROARING_ATOMIC_IMPL_CPP
+static std::atomic<counters_block_t *> counters_blocks{nullptr};
+
+static void counters_push(counters_block_t *b) {
+    b->next = counters_blocks.load(std::memory_order_relaxed);
+    while (!counters_blocks.compare_exchange_weak(
+        b->next, b, std::memory_order_release, std::memory_order_relaxed)) {
+    }
+}
+
+static counters_block_t *counters_first(void) {
+    return counters_blocks.load(std::memory_order_acquire);
+}
+#elif CROARING_ATOMIC_IMPL == CROARING_ATOMIC_IMPL_C_WINDOWS
+#pragma intrinsic(_InterlockedCompareExchangePointer)
+static counters_block_t *volatile counters_blocks;
+
+static void counters_push(counters_block_t *b) {
+    do {
+        b->next = counters_blocks;
+    } while (_InterlockedCompareExchangePointer(
+                 (void *volatile *)&counters_blocks, b, b->next) != b->next);
+}
+
+static counters_block_t *counters_first(void) { return counters_blocks; }
+#else  // CROARING_ATOMIC_IMPL_NONE
+static counters_block_t *counters_blocks;
+
+static void counters_push(counters_block_t *b) {
+    b->next = counters_blocks;
+    counters_blocks = b;
+}
+
+static counters_block_t *counters_first(void) { return counters_blocks; }
+#endif
+
+static CROARING_THREAD_LOCAL counters_block_t *local_block;
+
+static counters_block_t *counters_local(void) {
+    counters_block_t *b = local_block;
+    if (b == NULL) {
+        // The block outlives any allocator scope of the caller, e.g., an
+        // arena that gets reset: take it from the memory hook.
+        const roaring_allocator_t *previous = roaring_allocator_enter(NULL);
+        b = (counters_block_t *)roaring_calloc(1, sizeof(counters_block_t));
+        roaring_allocator_leave(previous);
+        if (b == NULL) {
+            return NULL;
+        }
+        counters_push(b);
+        local_block = b;
+    }
+    return b;
+}
+
+void roaring_counters_add(size_t index, uint64_t n) {
+    counters_block_t *b = counters_local();
+    if (b != NULL) {  // otherwise the event is dropped
+        counter_add(&b->values[index], n);
+    }
+}
+
+// Adds the counters of `b` to `counters`.
+static void counters_collect(roaring_counters_t *counters,
+                             const counters_block_t *b) {
+    uint64_t d[COUNTERS_SIZE];
+    memcpy(d, counters, sizeof(d));
+    for (size_t i = 0; i < COUNTERS_SIZE; i++) {
+        d[i] += counter_get(&b->values[i]);
+    }
+    memcpy(counters, d, sizeof(d));
+}
+
+#endif  // CROARING_COUNTERS
+
+#ifdef __cplusplus
+}
+}
+}  // extern "C" { namespace roaring { namespace internal {
+
+extern "C" {
+namespace roaring {
+namespace api {
+#endif
+
+void roaring_counters_get(roaring_counters_t *counters) {
+    memset(counters, 0, sizeof(*counters));
+#if CROARING_COUNTERS
+    for (const counters_block_t *b = counters_first(); b != NULL;
+         b = b->next) {
+        counters_collect(counters, b);
+    }
+#endif
+}
+
+void roaring_counters_get_thread(roaring_counters_t *counters) {
+    memset(counters, 0, sizeof(*counters));
+#if CROARING_COUNTERS
+    if (local_block != NULL) {
+        counters_collect(counters, local_block);
+    }
+#endif
+}
+
+void roaring_counters_subtract(roaring_counters_t *counters,
+                               const roaring_counters_t *since) {
+    uint64_t d[COUNTERS_SIZE], s[COUNTERS_SIZE];
+    memcpy(d, counters, sizeof(d));
+    memcpy(s, since, sizeof(s));
+    for (size_t i = 0; i < COUNTERS_SIZE; i++) {
+        d[i] -= s[i];
+    }
+    memcpy(counters, d, sizeof(d));
+}
+
+void roaring_counters_printf(const roaring_counters_t *counters) {
+#if !CROARING_COUNTERS
+    printf("(counters are disabled, build with CROARING_COUNTERS=1)\n");
+#endif
+    const char *names[] = {"array", "bitset", "run"};
+    const roaring_container_counters_t *types[] = {
+        &counters->array, &counters->bitset, &counters->run};
+    for (int i = 0; i < 3; i++) {
+        const roaring_container_counters_t *c = types[i];
+        printf("%-6s: %" PRIu64 " allocs, %" PRIu64 " frees, %" PRIu64
+               " reallocs, %" PRId64 " bytes live (%" PRIu64
+               " allocated, %" PRIu64 " freed), %" PRIu64
+               " bytes overallocated\n",
+               names[i], c->n_allocs, c->n_frees, c->n_reallocs,
+               (int64_t)(c->n_bytes_allocated - c->n_bytes_freed),
+               c->n_bytes_allocated, c->n_bytes_freed,
+               c->n_bytes_overallocated);
+    }
+    printf("conversions: array->bitset %" PRIu64 ", array->run %" PRIu64
+           ", bitset->array %" PRIu64 ", bitset->run %" PRIu64
+           ", run->array %" PRIu64 ", run->bitset %" PRIu64 "\n",
+           counters->n_array_to_bitset, counters->n_array_to_run,
+           counters->n_bitset_to_array, counters->n_bitset_to_run,
+           counters->n_run_to_array, counters->n_run_to_bitset);
+    printf("shared clones: %" PRIu64 "\n", counters->n_shared_clones);
+}
+
+#undef COUNTERS_SIZE
+
+#ifdef __cplusplus
+}
+}
+}  // extern "C" { namespace roaring { namespace api {
+#endif
@@ -0,0 +1,215 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <roaring/containers/containers.h>
+#include <roaring/interner.h>
+#include <roaring/memory.h>
+#include <roaring/portability.h>
+#include <roaring/roaring.h>
+
+#ifdef __cplusplus
+using namespace ::roaring::internal;
+
+extern "C" {
+namespace roaring {
+namespace api {
+#endif
+
+// An open-addressing table of the interned containers, indexed by their hash.
+// Each entry holds one reference to its shared container.
+typedef struct interner_entry_s {
+    uint64_t hash;
+    shared_container_t *shared;  // NULL for an empty slot
+} interner_entry_t;
+
+struct roaring_interner_s {
+    interner_entry_t *entries;
+    size_t capacity;  // a power of two, or 0
+    const roaring_allocator_t *allocator;
+    roaring_interner_statistics_t stats;
+};
+
+roaring_interner_t *roaring_interner_create(void) {
+    roaring_interner_t *in =
+        (roaring_interner_t *)roaring_calloc(1, sizeof(roaring_interner_t));
+    if (in == NULL) {
+        return NULL;
+    }
+    in->allocator = roaring_allocator_current();
+    return in;
+}
+
+void roaring_interner_free(roaring_interner_t *in) {
+    if (in == NULL) {
+        return;
+    }
+    const roaring_allocator_t *previous =
+        roaring_allocator_enter(in->allocator);
+    for (size_t i = 0; i < in->capacity; i++) {
+        if (in->entries[i].shared != NULL) {
+            shared_container_free(in->entries[i].shared);
+        }
+    }
+    roaring_free(in->entries);
+    roaring_free(in);
+    roaring_allocator_leave(previous);
+}
+
+void roaring_interner_get_statistics(const roaring_interner_t *in,
+                                     roaring_interner_statistics_t *stats) {
+    *stats = in->stats;
+}
+
+#ifdef __cplusplus
+}
+}
+}  // extern "C" { namespace roaring { namespace api {
+
+extern "C" {
+namespace roaring {
+namespace internal {
+#endif
+
+#define INTERNER_HASH_MULTIPLIER UINT64_C(0x9E3779B97F4A7C15)
+
+static uint64_t interner_hash_bytes(uint64_t h, const void *data, size_t n) {
+    const char *p = (const char *)data;
+    for (; n >= sizeof(uint64_t); n -= sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        p += sizeof(word);
+        h = (h ^ word) * INTERNER_HASH_MULTIPLIER;
+        h ^= h >> 29;
+    }
+    uint64_t tail = 0;
+    if (n > 0) {
+        memcpy(&tail, p, n);
+    }
+    h = (h ^ tail ^ n) * INTERNER_HASH_MULTIPLIER;
+    return h ^ (h >> 32);
+}
+
+// Containers only compare equal to containers of the same type, which is
+// what their content hashes to.
+static uint64_t interner_hash_container(const container_t *c, uint8_t type) {
+    uint64_t h = (uint64_t)type * INTERNER_HASH_MULTIPLIER;
+    switch (type) {
+        case BITSET_CONTAINER_TYPE:
+            return interner_hash_bytes(
+                h, const_CAST_bitset(c)->words,
+                BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t));
+        case ARRAY_CONTAINER_TYPE: {
+            const array_container_t *ac = const_CAST_array(c);
+            return interner_hash_bytes(h, ac->array,
+                                       ac->cardinality * sizeof(uint16_t));
+        }
+        case RUN_CONTAINER_TYPE: {
+            const run_container_t *rc = const_CAST_run(c);
+            return interner_hash_bytes(h, rc->runs,
+                                       rc->n_runs * sizeof(rle16_t));
+        }
+        default:
+            assert(false);
+            roaring_unreachable;
+            return 0;
+    }
+}
+
+#undef INTERNER_HASH_MULTIPLIER
+
+// Keeps the table at most half full.
+static bool interner_reserve(roaring_interner_t *in) {
+    if ((in->stats.n_distinct + 1) * 2 <= in->capacity) {
+        return true;
+    }
+    size_t capacity = in->capacity == 0 ? 64 : 2 * in->capacity;
+    const roaring_allocator_t *previous =
+        roaring_allocator_enter(in->allocator);
+    interner_entry_t *entries =
+        (interner_entry_t *)roaring_calloc(capacity, sizeof(interner_entry_t));
+    if (entries != NULL) {
+        for (size_t i = 0; i < in->capacity; i++) {
+            interner_entry_t e = in->entries[i];
+            if (e.shared == NULL) continue;
+            size_t j = (size_t)e.hash & (capacity - 1);
+            while (entries[j].shared != NULL) j = (j + 1) & (capacity - 1);
+            entries[j] = e;
+        }
+        roaring_free(in->entries);
+        in->entries = entries;
+        in->capacity = capacity;
+    }
+    roaring_allocator_leave(previous);
+    return entries != NULL;
+}
+
+container_t *interner_intern_container(roaring_interner_t *in, container_t *c,
+                                       uint8_t *typecode, size_t *bytes_saved) {
+    uint8_t type = *typecode;
+    const container_t *actual = container_unwrap_shared(c, &type);
+    if (container_is_full(actual, type)) {
+        // Full containers are shared by every bitmap without the table.
+        in->stats.n_containers++;
+        if (container_is_shared_full(c, *typecode)) {
+            return c;
+        }
+        in->stats.n_deduplicated++;
+        if (*typecode != SHARED_CONTAINER_TYPE ||
+            croaring_refcount_get(&const_CAST_shared(c)->counter) == 1) {
+            size_t bytes = (size_t)container_size_in_bytes(actual, type);
+            *bytes_saved += bytes;
+            in->stats.n_bytes_saved += bytes;
+        }
+        container_free(c, *typecode);
+        *typecode = SHARED_CONTAINER_TYPE;
+        return shared_container_full();
+    }
+    if (!interner_reserve(in)) {
+        return NULL;
+    }
+    in->stats.n_containers++;
+    uint64_t hash = interner_hash_container(actual, type);
+    size_t mask = in->capacity - 1;
+    size_t i = (size_t)hash & mask;
+    for (; in->entries[i].shared != NULL; i = (i + 1) & mask) {
+        shared_container_t *shared = in->entries[i].shared;
+        if (in->entries[i].hash != hash || shared->typecode != type ||
+            !container_equals(shared->container, type, actual, type)) {
+            continue;
+        }
+        if (shared == c) {
+            return c;  // interned already
+        }
+        // Our container is released unless other bitmaps still share it.
+        if (*typecode != SHARED_CONTAINER_TYPE ||
+            croaring_refcount_get(&const_CAST_shared(c)->counter) == 1) {
+            size_t bytes = (size_t)container_size_in_bytes(actual, type);
+            *bytes_saved += bytes;
+            in->stats.n_bytes_saved += bytes;
+        }
+        croaring_refcount_inc(&shared->counter);
+        container_free(c, *typecode);
+        in->stats.n_deduplicated++;
+        *typecode = SHARED_CONTAINER_TYPE;
+        return shared;
+    }
+    // A new container: wrapping it (or taking a reference to its wrapper)
+    // gives the interner its reference.
+    container_t *shared = get_copy_of_container(c, typecode,
+                                                /*copy_on_write=*/true);
+    if (shared == NULL) {
+        return NULL;
+    }
+    in->entries[i].hash = hash;
+    in->entries[i].shared = CAST_shared(shared);
+    in->stats.n_distinct++;
+    return shared;
+}
+
+#ifdef __cplusplus
+}
+}
+}  // extern "C" { namespace roaring { namespace internal {
+#endif
@@ -1,6 +1,10 @@
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <roaring/memory.h>
+#include <roaring/portability.h>
 
 // without the following, we get lots of warnings about posix_memalign
 #ifndef __cplusplus
@@ -45,20 +49,418 @@ void roaring_init_memory_hook(roaring_memory_t memory_hook) {
     global_memory_hook = memory_hook;
 }
 
-void* roaring_malloc(size_t n) { return global_memory_hook.malloc(n); }
+static CROARING_THREAD_LOCAL const roaring_allocator_t* current_allocator =
+    NULL;
+
+const roaring_allocator_t* roaring_allocator_enter(
+    const roaring_allocator_t* allocator) {
+    const roaring_allocator_t* previous = current_allocator;
+    current_allocator = allocator;
+    return previous;
+}
+
+void roaring_allocator_leave(const roaring_allocator_t* previous) {
+    current_allocator = previous;
+}
+
+const roaring_allocator_t* roaring_allocator_current(void) {
+    return current_allocator;
+}
+
+// Arenas: slab chunks are aligned on their size, so the slab holding a block
+// is found by masking the block address. Large blocks are allocated with their
+// own header just before them and looked up by their exact address. A hash set
+// of slab addresses and large block addresses tells arena blocks from hook
+// blocks; large block addresses are tagged with their low bit.
+#define ARENA_CHUNK_SIZE ((size_t)1 << 18)
+#define ARENA_HEADER_SIZE 64
+#define ARENA_NUM_CLASSES 22
+#define ARENA_LARGE ARENA_NUM_CLASSES
+#define ARENA_MAX_SLAB_BLOCK ((size_t)32768)
+
+// Header at the start of every slab, and just before every large block.
+typedef struct arena_chunk_s {
+    struct arena_chunk_s* next;
+    struct arena_chunk_s* prev;  // large blocks only
+    void* base;                  // large blocks only: the hook's allocation
+    size_t bytes;                // header included
+    uint32_t size_class;         // ARENA_LARGE for a large block
+} arena_chunk_t;
+
+typedef struct arena_block_s {
+    struct arena_block_s* next;
+} arena_block_t;
+
+struct roaring_arena_s {
+    roaring_allocator_t allocator;
+    arena_block_t* free_blocks[ARENA_NUM_CLASSES];
+    char* bump[ARENA_NUM_CLASSES];
+    size_t bump_left[ARENA_NUM_CLASSES];
+    arena_chunk_t* slabs;
+    arena_chunk_t* spare_slabs;  // kept by roaring_arena_reset
+    arena_chunk_t* large;
+    uintptr_t* chunk_set;  // open addressing, 0 marks an empty slot
+    size_t chunk_set_capacity;
+    size_t chunk_set_count;
+    size_t bytes;
+};
+
+// 16, 32, then 2^k * 3/2 and 2^(k+1) for k = 5..14 (48, 64, 96, ..., 32768):
+// never more than 1/3 of a block is wasted past 32 bytes.
+static const uint32_t arena_class_size[ARENA_NUM_CLASSES] = {
+    16,   32,   48,   64,    96,    128,   192,   256,   384,   512,   768,
+    1024, 1536, 2048, 3072,  4096,  6144,  8192,  12288, 16384, 24576, 32768};
+
+static inline uint32_t arena_size_class(size_t n) {
+    if (n <= 16) return 0;
+    if (n <= 32) return 1;
+    int k = 63 - roaring_leading_zeroes((unsigned long long)(n - 1));
+    uint32_t c = 2 + 2 * (uint32_t)(k - 5);
+    return n <= ((size_t)3 << (k - 1)) ? c : c + 1;
+}
+
+static inline size_t arena_hash(uintptr_t key, size_t mask) {
+    return (size_t)(((uint64_t)key * UINT64_C(0x9E3779B97F4A7C15)) >> 32) &
+           mask;
+}
+
+static inline uintptr_t arena_large_key(const void* p) {
+    return (uintptr_t)p | 1;
+}
+
+static bool arena_chunk_set_insert(roaring_arena_t* arena, uintptr_t key) {
+    if ((arena->chunk_set_count + 1) * 2 > arena->chunk_set_capacity) {
+        size_t capacity = arena->chunk_set_capacity == 0
+                              ? 64
+                              : 2 * arena->chunk_set_capacity;
+        uintptr_t* set = (uintptr_t*)global_memory_hook.calloc(
+            capacity, sizeof(uintptr_t));
+        if (set == NULL) return false;
+        for (size_t i = 0; i < arena->chunk_set_capacity; i++) {
+            uintptr_t old = arena->chunk_set[i];
+            if (old == 0) continue;
+            size_t j = arena_hash(old, capacity - 1);
+            while (set[j] != 0) j = (j + 1) & (capacity - 1);
+            set[j] = old;
+        }
+        if (arena->chunk_set != NULL) {
+            global_memory_hook.free(arena->chunk_set);
+        }
+        arena->chunk_set = set;
+        arena->chunk_set_capacity = capacity;
+    }
+    size_t mask = arena->chunk_set_capacity - 1;
+    size_t i = arena_hash(key, mask);
+    while (arena->chunk_set[i] != 0) i = (i + 1) & mask;
+    arena->chunk_set[i] = key;
+    arena->chunk_set_count++;
+    return true;
+}
+
+static void arena_chunk_set_remove(roaring_arena_t* arena, uintptr_t key) {
+    size_t mask = arena->chunk_set_capacity - 1;
+    size_t i = arena_hash(key, mask);
+    while (arena->chunk_set[i] != key) i = (i + 1) & mask;
+    // Backward-shift deletion keeps the probe sequences unbroken.
+    for (size_t j = (i + 1) & mask; arena->chunk_set[j] != 0;
+         j = (j + 1) & mask) {
+        size_t k = arena_hash(arena->chunk_set[j], mask);
+        bool stays = (i < j) ? (i < k && k <= j) : (i < k || k <= j);
+        if (!stays) {
+            arena->chunk_set[i] = arena->chunk_set[j];
+            i = j;
+        }
+    }
+    arena->chunk_set[i] = 0;
+    arena->chunk_set_count--;
+}
+
+static inline bool arena_chunk_set_contains(const roaring_arena_t* arena,
+                                            uintptr_t key) {
+    size_t mask = arena->chunk_set_capacity - 1;
+    for (size_t i = arena_hash(key, mask); arena->chunk_set[i] != 0;
+         i = (i + 1) & mask) {
+        if (arena->chunk_set[i] == key) return true;
+    }
+    return false;
+}
+
+// Returns the slab holding `p`, or the header of the large block `p`, or NULL
+// if `p` does not come from the arena.
+static inline arena_chunk_t* arena_find_chunk(const roaring_arena_t* arena,
+                                              const void* p) {
+    if (arena->chunk_set_count == 0) return NULL;
+    uintptr_t base = (uintptr_t)p & ~(uintptr_t)(ARENA_CHUNK_SIZE - 1);
+    if (arena_chunk_set_contains(arena, base)) {
+        arena_chunk_t* chunk = (arena_chunk_t*)base;
+        if ((uintptr_t)p < base + chunk->bytes) return chunk;
+    }
+    if (arena_chunk_set_contains(arena, arena_large_key(p))) {
+        return (arena_chunk_t*)p - 1;
+    }
+    return NULL;
+}
+
+static void* arena_slab_malloc(roaring_arena_t* arena, uint32_t c) {
+    arena_block_t* block = arena->free_blocks[c];
+    if (block != NULL) {
+        arena->free_blocks[c] = block->next;
+        return block;
+    }
+    size_t size = arena_class_size[c];
+    if (arena->bump_left[c] < size) {
+        arena_chunk_t* chunk = arena->spare_slabs;
+        if (chunk != NULL) {
+            arena->spare_slabs = chunk->next;
+        } else {
+            chunk = (arena_chunk_t*)global_memory_hook.aligned_malloc(
+                ARENA_CHUNK_SIZE, ARENA_CHUNK_SIZE);
+            if (chunk == NULL) return NULL;
+            if (!arena_chunk_set_insert(arena, (uintptr_t)chunk)) {
+                global_memory_hook.aligned_free(chunk);
+                return NULL;
+            }
+            chunk->bytes = ARENA_CHUNK_SIZE;
+            arena->bytes += ARENA_CHUNK_SIZE;
+        }
+        chunk->size_class = c;
+        chunk->next = arena->slabs;
+        arena->slabs = chunk;
+        arena->bump[c] = (char*)chunk + ARENA_HEADER_SIZE;
+        arena->bump_left[c] = ARENA_CHUNK_SIZE - ARENA_HEADER_SIZE;
+    }
+    void* p = arena->bump[c];
+    arena->bump[c] += size;
+    arena->bump_left[c] -= size;
+    return p;
+}
+
+static void* arena_large_malloc(roaring_arena_t* arena, size_t alignment,
+                                size_t size) {
+    if (alignment < 16) alignment = 16;
+    // The header goes right before the block, at the end of `offset` bytes.
+    size_t offset = (sizeof(arena_chunk_t) + alignment - 1) & ~(alignment - 1);
+    if (size > SIZE_MAX - offset) return NULL;
+    char* base = (char*)global_memory_hook.aligned_malloc(alignment,
+                                                          offset + size);
+    if (base == NULL) return NULL;
+    char* p = base + offset;
+    if (!arena_chunk_set_insert(arena, arena_large_key(p))) {
+        global_memory_hook.aligned_free(base);
+        return NULL;
+    }
+    arena_chunk_t* chunk = (arena_chunk_t*)p - 1;
+    chunk->base = base;
+    chunk->bytes = offset + size;
+    chunk->size_class = ARENA_LARGE;
+    chunk->prev = NULL;
+    chunk->next = arena->large;
+    if (arena->large != NULL) arena->large->prev = chunk;
+    arena->large = chunk;
+    arena->bytes += chunk->bytes;
+    return p;
+}
+
+static void arena_large_free(roaring_arena_t* arena, arena_chunk_t* chunk) {
+    if (chunk->prev != NULL) {
+        chunk->prev->next = chunk->next;
+    } else {
+        arena->large = chunk->next;
+    }
+    if (chunk->next != NULL) chunk->next->prev = chunk->prev;
+    arena_chunk_set_remove(arena, arena_large_key(chunk + 1));
+    arena->bytes -= chunk->bytes;
+    global_memory_hook.aligned_free(chunk->base);
+}
+
+static void* arena_malloc(roaring_arena_t* arena, size_t n) {
+    if (n > ARENA_MAX_SLAB_BLOCK) return arena_large_malloc(arena, 16, n);
+    return arena_slab_malloc(arena, arena_size_class(n));
+}
+
+static void* arena_aligned_malloc(roaring_arena_t* arena, size_t alignment,
+                                  size_t n) {
+    if (alignment > ARENA_HEADER_SIZE || n > ARENA_MAX_SLAB_BLOCK) {
+        return arena_large_malloc(arena, alignment, n);
+    }
+    // A slab's blocks follow its header, which is aligned on
+    // ARENA_HEADER_SIZE, back to back: they are aligned on `alignment` when
+    // their size is a multiple of it. Take the smallest such class that fits.
+    uint32_t c = arena_size_class(n < alignment ? alignment : n);
+    while (arena_class_size[c] % alignment != 0) c++;
+    return arena_slab_malloc(arena, c);
+}
+
+static void arena_release(roaring_arena_t* arena, arena_chunk_t* chunk,
+                          void* p) {
+    if (chunk->size_class == ARENA_LARGE) {
+        arena_large_free(arena, chunk);
+        return;
+    }
+    arena_block_t* block = (arena_block_t*)p;
+    block->next = arena->free_blocks[chunk->size_class];
+    arena->free_blocks[chunk->size_class] = block;
+}
+
+static void* arena_realloc(roaring_arena_t* arena, arena_chunk_t* chunk,
+                           void* p, size_t n) {
+    size_t usable = chunk->size_class == ARENA_LARGE
+                        ? chunk->bytes - (size_t)((char*)p - (char*)chunk->base)
+                        : arena_class_size[chunk->size_class];
+    if (n <= usable) return p;
+    void* q = arena_malloc(arena, n);
+    if (q == NULL) return NULL;
+    memcpy(q, p, usable);
+    arena_release(arena, chunk, p);
+    return q;
+}
+
+// The arena's allocator, which hands foreign blocks back to the hook.
+static void* arena_allocator_malloc(void* context, size_t n) {
+    return arena_malloc((roaring_arena_t*)context, n);
+}
+
+static void* arena_allocator_realloc(void* context, void* p, size_t n) {
+    roaring_arena_t* arena = (roaring_arena_t*)context;
+    if (p == NULL) return arena_malloc(arena, n);
+    arena_chunk_t* chunk = arena_find_chunk(arena, p);
+    if (chunk == NULL) return global_memory_hook.realloc(p, n);
+    return arena_realloc(arena, chunk, p, n);
+}
+
+static void* arena_allocator_calloc(void* context, size_t n_elements,
+                                    size_t element_size) {
+    if (element_size != 0 && n_elements > SIZE_MAX / element_size) {
+        return NULL;
+    }
+    size_t n = n_elements * element_size;
+    void* p = arena_malloc((roaring_arena_t*)context, n);
+    if (p != NULL) memset(p, 0, n);
+    return p;
+}
+
+static void arena_allocator_free(void* context, void* p) {
+    if (p == NULL) return;
+    roaring_arena_t* arena = (roaring_arena_t*)context;
+    arena_chunk_t* chunk = arena_find_chunk(arena, p);
+    if (chunk == NULL) {
+        global_memory_hook.free(p);
+        return;
+    }
+    arena_release(arena, chunk, p);
+}
+
+static void* arena_allocator_aligned_malloc(void* context, size_t alignment,
+                                            size_t n) {
+    return arena_aligned_malloc((roaring_arena_t*)context, alignment, n);
+}
+
+static void arena_allocator_aligned_free(void* context, void* p) {
+    if (p == NULL) return;
+    roaring_arena_t* arena = (roaring_arena_t*)context;
+    arena_chunk_t* chunk = arena_find_chunk(arena, p);
+    if (chunk == NULL) {
+        global_memory_hook.aligned_free(p);
+        return;
+    }
+    arena_release(arena, chunk, p);
+}
+
+roaring_arena_t* roaring_arena_create(void) {
+    roaring_arena_t* arena =
+        (roaring_arena_t*)global_memory_hook.calloc(1, sizeof(roaring_arena_t));
+    if (arena == NULL) return NULL;
+    arena->allocator.context = arena;
+    arena->allocator.malloc = arena_allocator_malloc;
+    arena->allocator.realloc = arena_allocator_realloc;
+    arena->allocator.calloc = arena_allocator_calloc;
+    arena->allocator.free = arena_allocator_free;
+    arena->allocator.aligned_malloc = arena_allocator_aligned_malloc;
+    arena->allocator.aligned_free = arena_allocator_aligned_free;
+    return arena;
+}
+
+void roaring_arena_reset(roaring_arena_t* arena) {
+    while (arena->large != NULL) {
+        arena_large_free(arena, arena->large);
+    }
+    while (arena->slabs != NULL) {
+        arena_chunk_t* chunk = arena->slabs;
+        arena->slabs = chunk->next;
+        chunk->next = arena->spare_slabs;
+        arena->spare_slabs = chunk;
+    }
+    memset(arena->free_blocks, 0, sizeof(arena->free_blocks));
+    memset(arena->bump, 0, sizeof(arena->bump));
+    memset(arena->bump_left, 0, sizeof(arena->bump_left));
+}
+
+void roaring_arena_free(roaring_arena_t* arena) {
+    if (arena == NULL) return;
+    if (current_allocator == &arena->allocator) current_allocator = NULL;
+    roaring_arena_reset(arena);
+    while (arena->spare_slabs != NULL) {
+        arena_chunk_t* chunk = arena->spare_slabs;
+        arena->spare_slabs = chunk->next;
+        global_memory_hook.aligned_free(chunk);
+    }
+    if (arena->chunk_set != NULL) global_memory_hook.free(arena->chunk_set);
+    global_memory_hook.free(arena);
+}
+
+size_t roaring_arena_size_in_bytes(const roaring_arena_t* arena) {
+    return sizeof(roaring_arena_t) + arena->bytes +
+           arena->chunk_set_capacity * sizeof(uintptr_t);
+}
+
+const roaring_allocator_t* roaring_arena_allocator(roaring_arena_t* arena) {
+    return &arena->allocator;
+}
+
+void* roaring_malloc(size_t n) {
+    const roaring_allocator_t* allocator = current_allocator;
+    if (allocator != NULL) return allocator->malloc(allocator->context, n);
+    return global_memory_hook.malloc(n);
+}
 
 void* roaring_realloc(void* p, size_t new_sz) {
+    const roaring_allocator_t* allocator = current_allocator;
+    if (allocator != NULL) {
+        return allocator->realloc(allocator->context, p, new_sz);
+    }
     return global_memory_hook.realloc(p, new_sz);
 }
 
 void* roaring_calloc(size_t n_elements, size_t element_size) {
+    const roaring_allocator_t* allocator = current_allocator;
+    if (allocator != NULL) {
+        return allocator->calloc(allocator->context, n_elements, element_size);
+    }
     return global_memory_hook.calloc(n_elements, element_size);
 }
 
-void roaring_free(void* p) { global_memory_hook.free(p); }
+void roaring_free(void* p) {
+    const roaring_allocator_t* allocator = current_allocator;
+    if (allocator != NULL) {
+        allocator->free(allocator->context, p);
+        return;
+    }
+    global_memory_hook.free(p);
+}
 
 void* roaring_aligned_malloc(size_t alignment, size_t size) {
+    const roaring_allocator_t* allocator = current_allocator;
+    if (allocator != NULL) {
+        return allocator->aligned_malloc(allocator->context, alignment, size);
+    }
     return global_memory_hook.aligned_malloc(alignment, size);
 }
 
-void roaring_aligned_free(void* p) { global_memory_hook.aligned_free(p); }
+void roaring_aligned_free(void* p) {
+    const roaring_allocator_t* allocator = current_allocator;
+    if (allocator != NULL) {
+        allocator->aligned_free(allocator->context, p);
+        return;
+    }
+    global_memory_hook.aligned_free(p);
+}
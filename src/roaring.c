@@ -9,9 +9,11 @@
 #include <roaring/roaring.h>
 
 // Include after roaring.h
+#include <roaring/allocator_switch.h>
 #include <roaring/array_util.h>
 #include <roaring/bitset_util.h>
 #include <roaring/containers/containers.h>
+#include <roaring/interner.h>
 #include <roaring/roaring_array.h>
 
 #ifdef __cplusplus
@@ -38,12 +40,213 @@ extern inline void roaring_bitmap_add_range(roaring_bitmap_t *r, uint64_t min,
 extern inline void roaring_bitmap_remove_range(roaring_bitmap_t *r,
                                                uint64_t min, uint64_t max);
 
+// The containers of a sealed bitmap live in its block: they are always cloned.
 static inline bool is_cow(const roaring_bitmap_t *r) {
-    return r->high_low_container.flags & ROARING_FLAG_COW;
+    return (r->high_low_container.flags &
+            (ROARING_FLAG_COW | ROARING_FLAG_SEALED)) == ROARING_FLAG_COW;
 }
 static inline bool is_frozen(const roaring_bitmap_t *r) {
     return r->high_low_container.flags & ROARING_FLAG_FROZEN;
 }
+// Whether results computed from r should be copy-on-write: unlike is_cow(),
+// this holds for sealed bitmaps too.
+static inline bool has_cow_flag(const roaring_bitmap_t *r) {
+    return r->high_low_container.flags & ROARING_FLAG_COW;
+}
+
+static inline bool is_sealed(const roaring_bitmap_t *r) {
+    return r->high_low_container.flags & ROARING_FLAG_SEALED;
+}
+
+// Makes the allocator of `r` current, see allocator_switch.h.
+static inline const roaring_allocator_t *enter_allocator_of(
+    const roaring_bitmap_t *r) {
+    return switch_allocator(ra_get_allocator(&r->high_low_container));
+}
+
+// For the results of the public functions, `r` being their first argument
+// (NULL when there is none).
+static inline const roaring_allocator_t *enter_result_allocator_of(
+    const roaring_bitmap_t *r) {
+    return enter_result_allocator(
+        r != NULL ? ra_get_allocator(&r->high_low_container) : NULL);
+}
+
+static inline size_t sealed_align(size_t offset, size_t alignment) {
+    return (offset + alignment - 1) & ~(alignment - 1);
+}
+
+// Repacks the containers of `r` into one block: its allocator if any, the
+// keys, container pointers and typecodes, then the container structs, then the
+// payloads in key order, with bitsets on cache-line boundaries.
+static bool roaring_bitmap_seal_impl(roaring_bitmap_t *r) {
+    roaring_array_t *ra = &r->high_low_container;
+    const int32_t n = ra->size;
+    if (n == 0) {
+        return true;  // nothing to pack
+    }
+    const roaring_allocator_t *allocator = ra_get_allocator(ra);
+    const size_t slot = allocator != NULL ? sizeof(allocator) : 0;
+    const size_t directory_size = sealed_align(
+        slot + n * (sizeof(container_t *) + sizeof(uint16_t) + sizeof(uint8_t)),
+        8);
+    size_t size = directory_size;
+    for (int32_t i = 0; i < n; i++) {
+        uint8_t type = ra->typecodes[i];
+        container_unwrap_shared(ra->containers[i], &type);
+        size += sealed_align(type == BITSET_CONTAINER_TYPE
+                                 ? sizeof(bitset_container_t)
+                             : type == ARRAY_CONTAINER_TYPE
+                                 ? sizeof(array_container_t)
+                                 : sizeof(run_container_t),
+                             8);
+    }
+    const size_t headers_end = size;
+    size = sealed_align(size, 64);
+    for (int32_t i = 0; i < n; i++) {
+        uint8_t type = ra->typecodes[i];
+        const container_t *c =
+            container_unwrap_shared(ra->containers[i], &type);
+        if (type == BITSET_CONTAINER_TYPE) {
+            size = sealed_align(size, 64) +
+                   BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+        } else if (type == ARRAY_CONTAINER_TYPE) {
+            size += const_CAST_array(c)->cardinality * sizeof(uint16_t);
+        } else {
+            size += const_CAST_run(c)->n_runs * sizeof(rle16_t);
+        }
+    }
+    char *block = (char *)roaring_aligned_malloc(64, size);
+    if (block == NULL) {
+        return false;
+    }
+    if (allocator != NULL) {
+        memcpy(block, &allocator, sizeof(allocator));
+    }
+    container_t **containers = (container_t **)(block + slot);
+    uint16_t *keys = (uint16_t *)(containers + n);
+    uint8_t *typecodes = (uint8_t *)(keys + n);
+    char *header = block + directory_size;
+    char *payload = block + sealed_align(headers_end, 64);
+    for (int32_t i = 0; i < n; i++) {
+        uint8_t type = ra->typecodes[i];
+        const container_t *c =
+            container_unwrap_shared(ra->containers[i], &type);
+        keys[i] = ra->keys[i];
+        typecodes[i] = type;
+        containers[i] = (container_t *)header;
+        if (type == BITSET_CONTAINER_TYPE) {
+            const bitset_container_t *src = const_CAST_bitset(c);
+            bitset_container_t *dst = (bitset_container_t *)header;
+            payload = block + sealed_align(payload - block, 64);
+            dst->cardinality = src->cardinality;
+            if (dst->cardinality == BITSET_UNKNOWN_CARDINALITY) {
+                dst->cardinality = bitset_container_compute_cardinality(src);
+            }
+            dst->words = (uint64_t *)payload;
+            memcpy(payload, src->words,
+                   BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t));
+            payload += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+            header += sealed_align(sizeof(bitset_container_t), 8);
+        } else if (type == ARRAY_CONTAINER_TYPE) {
+            const array_container_t *src = const_CAST_array(c);
+            array_container_t *dst = (array_container_t *)header;
+            dst->cardinality = dst->capacity = src->cardinality;
+            dst->array = (uint16_t *)payload;
+            dst->inline_values = false;  // freed with the block
+            memcpy(payload, src->array, src->cardinality * sizeof(uint16_t));
+            payload += src->cardinality * sizeof(uint16_t);
+            header += sealed_align(sizeof(array_container_t), 8);
+        } else {
+            const run_container_t *src = const_CAST_run(c);
+            run_container_t *dst = (run_container_t *)header;
+            dst->n_runs = dst->capacity = src->n_runs;
+            dst->runs = (rle16_t *)payload;
+            memcpy(payload, src->runs, src->n_runs * sizeof(rle16_t));
+            payload += src->n_runs * sizeof(rle16_t);
+            header += sealed_align(sizeof(run_container_t), 8);
+        }
+    }
+    assert(payload == block + size);
+    ra_clear(ra);
+    ra->containers = containers;
+    ra->keys = keys;
+    ra->typecodes = typecodes;
+    ra->size = n;
+    ra->allocation_size = n;
+    ra->flags |= ROARING_FLAG_SEALED;
+    if (allocator != NULL) {
+        ra->flags |= ROARING_FLAG_ALLOCATOR;
+    }
+    return true;
+}
+
+// Moves the containers of a sealed bitmap back to their own allocations.
+static bool roaring_bitmap_unseal_impl(roaring_bitmap_t *r) {
+    roaring_array_t *ra = &r->high_low_container;
+    roaring_array_t unsealed;
+    if (!ra_init_with_allocator(&unsealed, ra_get_allocator(ra),
+                                (uint32_t)ra->size)) {
+        return false;
+    }
+    for (int32_t i = 0; i < ra->size; i++) {
+        container_t *c = container_clone(ra->containers[i], ra->typecodes[i]);
+        if (c == NULL) {
+            ra_clear(&unsealed);
+            return false;
+        }
+        ra_append(&unsealed, ra->keys[i], c, ra->typecodes[i]);
+    }
+    ra_clear(ra);  // frees the block and drops ROARING_FLAG_SEALED
+    unsealed.flags |= ra->flags;
+    *ra = unsealed;
+    return true;
+}
+
+// Like enter_allocator_of(), for the public functions that modify `r`: a sealed
+// bitmap is unsealed first. Returns false, with the allocator left already, if
+// that fails: the bitmap is still sealed and must not be modified.
+static inline bool enter_allocator_to_modify(
+    roaring_bitmap_t *r, const roaring_allocator_t **previous) {
+    *previous = enter_allocator_of(r);
+    if (is_sealed(r) && !roaring_bitmap_unseal_impl(r)) {
+        leave_allocator(*previous);
+        return false;
+    }
+    return true;
+}
+
+bool roaring_bitmap_seal(roaring_bitmap_t *r) {
+    if (is_frozen(r)) {
+        return false;
+    }
+    if (is_sealed(r)) {
+        return true;
+    }
+    const roaring_allocator_t *previous = enter_allocator_of(r);
+    bool answer = roaring_bitmap_seal_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+bool roaring_bitmap_unseal(roaring_bitmap_t *r) {
+    if (!is_sealed(r)) {
+        return true;
+    }
+    const roaring_allocator_t *previous = enter_allocator_of(r);
+    bool answer = roaring_bitmap_unseal_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+bool roaring_bitmap_is_sealed(const roaring_bitmap_t *r) {
+    return is_sealed(r);
+}
+
+const roaring_allocator_t *roaring_bitmap_get_allocator(
+    const roaring_bitmap_t *r) {
+    return ra_get_allocator(&r->high_low_container);
+}
 
 // this is like roaring_bitmap_add, but it populates pointer arguments in such a
 // way
@@ -131,8 +334,8 @@ static inline void add_bulk_impl(roaring_bitmap_t *r,
     }
 }
 
-void roaring_bitmap_add_many(roaring_bitmap_t *r, size_t n_args,
-                             const uint32_t *vals) {
+static void roaring_bitmap_add_many_impl(roaring_bitmap_t *r, size_t n_args,
+                                         const uint32_t *vals) {
     uint32_t val;
     const uint32_t *start = vals;
     const uint32_t *end = vals + n_args;
@@ -156,9 +359,24 @@ void roaring_bitmap_add_many(roaring_bitmap_t *r, size_t n_args,
     }
 }
 
+void roaring_bitmap_add_many(roaring_bitmap_t *r, size_t n_args,
+                             const uint32_t *vals) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return;
+    }
+    roaring_bitmap_add_many_impl(r, n_args, vals);
+    leave_allocator(previous);
+}
+
 void roaring_bitmap_add_bulk(roaring_bitmap_t *r,
                              roaring_bulk_context_t *context, uint32_t val) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return;
+    }
     add_bulk_impl(r, context, val);
+    leave_allocator(previous);
 }
 
 bool roaring_bitmap_contains_bulk(const roaring_bitmap_t *r,
@@ -198,6 +416,293 @@ roaring_bitmap_t *roaring_bitmap_of_ptr(size_t n_args, const uint32_t *vals) {
     return answer;
 }
 
+// Returns the index of the first value at or after `begin` that is >= bound,
+// or n if there is none, assuming vals is sorted. Gallops first since key
+// segments are usually short compared to the input.
+static size_t sorted_uint32_lower_bound(const uint32_t *vals, size_t begin,
+                                        size_t n, uint64_t bound) {
+    size_t lo = begin;  // vals[lo] < bound
+    size_t step = 1;
+    while (lo + step < n && vals[lo + step] < bound) {
+        lo += step;
+        step *= 2;
+    }
+    size_t hi = lo + step < n ? lo + step : n;  // vals[hi] >= bound or hi == n
+    while (lo + 1 < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (vals[mid] < bound) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return hi;
+}
+
+roaring_bitmap_t *roaring_bitmap_from_sorted(const uint32_t *vals, size_t n) {
+    uint32_t capacity = 0;
+    if (n > 0) {
+        uint32_t span = (vals[n - 1] >> 16) - (vals[0] >> 16) + 1;
+        capacity = n < span ? (uint32_t)n : span;
+        if (capacity > (1 << 16)) capacity = 1 << 16;
+    }
+    roaring_bitmap_t *answer = roaring_bitmap_create_with_capacity(capacity);
+    if (answer == NULL) {
+        return NULL;
+    }
+    roaring_array_t *ra = &answer->high_low_container;
+    size_t i = 0;
+    while (i < n) {
+        uint32_t key = vals[i] >> 16;
+        size_t end = sorted_uint32_lower_bound(vals, i, n,
+                                               ((uint64_t)key + 1) << 16);
+        // The values of each segment are checked to be sorted by
+        // container_from_sorted_uint32, check that segments are too.
+        if ((vals[end - 1] >> 16) != key ||
+            (end < n && vals[end] >> 16 <= key)) {
+            roaring_bitmap_free(answer);
+            return NULL;
+        }
+        uint8_t typecode;
+        container_t *c = container_from_sorted_uint32(vals + i, end - i,
+                                                      &typecode);
+        if (c == NULL) {
+            roaring_bitmap_free(answer);
+            return NULL;
+        }
+        ra_append(ra, (uint16_t)key, c, typecode);
+        i = end;
+    }
+    return answer;
+}
+
+struct roaring_bulk_loader_s {
+    const uint32_t *vals;
+    size_t n;
+    uint32_t num_parts;
+    // Per-part key histograms, turned into per-part write offsets by
+    // roaring_bulk_loader_plan: counts[part * 65536 + key].
+    size_t *counts;
+    // Low 16 bits of the values, grouped by key: the values of key k are at
+    // [starts[k], starts[k + 1]).
+    uint16_t *low;
+    size_t *starts;
+    uint32_t num_keys;
+    uint16_t *keys;
+    container_t **containers;
+    uint8_t *typecodes;
+    bool planned;
+    const roaring_allocator_t *allocator;  // of the bitmap being built
+};
+
+// Values of part `part`, as [*begin, *end).
+static void bulk_loader_part_range(size_t n, uint32_t num_parts, uint32_t part,
+                                   size_t *begin, size_t *end) {
+    *begin = (size_t)((uint64_t)n * part / num_parts);
+    *end = (size_t)((uint64_t)n * (part + 1) / num_parts);
+}
+
+roaring_bulk_loader_t *roaring_bulk_loader_create(const uint32_t *vals,
+                                                  size_t n,
+                                                  uint32_t num_parts) {
+    if (num_parts == 0) num_parts = 1;
+    roaring_bulk_loader_t *l =
+        (roaring_bulk_loader_t *)roaring_calloc(1, sizeof(*l));
+    if (l == NULL) {
+        return NULL;
+    }
+    l->vals = vals;
+    l->n = n;
+    l->num_parts = num_parts;
+    l->allocator = roaring_allocator_current();
+    l->counts = (size_t *)roaring_calloc((size_t)num_parts << 16,
+                                         sizeof(size_t));
+    if (l->counts == NULL) {
+        roaring_free(l);
+        return NULL;
+    }
+    return l;
+}
+
+void roaring_bulk_loader_count(roaring_bulk_loader_t *l, uint32_t part) {
+    size_t begin, end;
+    bulk_loader_part_range(l->n, l->num_parts, part, &begin, &end);
+    size_t *counts = l->counts + ((size_t)part << 16);
+    for (size_t i = begin; i < end; ++i) {
+        counts[l->vals[i] >> 16]++;
+    }
+}
+
+static bool roaring_bulk_loader_plan_impl(roaring_bulk_loader_t *l,
+                                          uint32_t *num_keys) {
+    l->low = (uint16_t *)roaring_malloc(l->n * sizeof(uint16_t) + 1);
+    l->starts = (size_t *)roaring_malloc(((1 << 16) + 1) * sizeof(size_t));
+    l->keys = (uint16_t *)roaring_malloc((1 << 16) * sizeof(uint16_t));
+    if (l->low == NULL || l->starts == NULL || l->keys == NULL) {
+        return false;
+    }
+    size_t offset = 0;
+    uint32_t k = 0;
+    for (uint32_t key = 0; key < (1 << 16); ++key) {
+        l->starts[key] = offset;
+        for (uint32_t part = 0; part < l->num_parts; ++part) {
+            size_t *count = l->counts + ((size_t)part << 16) + key;
+            size_t c = *count;
+            *count = offset;
+            offset += c;
+        }
+        if (offset != l->starts[key]) {
+            l->keys[k++] = (uint16_t)key;
+        }
+    }
+    l->starts[1 << 16] = offset;
+    l->num_keys = k;
+    l->containers =
+        (container_t **)roaring_calloc(k + 1, sizeof(container_t *));
+    l->typecodes = (uint8_t *)roaring_malloc(k + 1);
+    if (l->containers == NULL || l->typecodes == NULL) {
+        return false;
+    }
+    l->planned = true;
+    *num_keys = k;
+    return true;
+}
+
+bool roaring_bulk_loader_plan(roaring_bulk_loader_t *l, uint32_t *num_keys) {
+    const roaring_allocator_t *previous = switch_allocator(l->allocator);
+    bool answer = roaring_bulk_loader_plan_impl(l, num_keys);
+    leave_allocator(previous);
+    return answer;
+}
+
+void roaring_bulk_loader_scatter(roaring_bulk_loader_t *l, uint32_t part) {
+    size_t begin, end;
+    bulk_loader_part_range(l->n, l->num_parts, part, &begin, &end);
+    size_t *offsets = l->counts + ((size_t)part << 16);
+    uint16_t *low = l->low;
+    for (size_t i = begin; i < end; ++i) {
+        uint32_t val = l->vals[i];
+        low[offsets[val >> 16]++] = (uint16_t)val;
+    }
+}
+
+// Builds a container holding `list`, using `words` (all zeros, left all zeros)
+// to sort and deduplicate the values.
+static container_t *bulk_loader_build_container(uint64_t *words,
+                                                const uint16_t *list,
+                                                size_t length, uint8_t *type) {
+    uint64_t card = bitset_set_list_withcard(words, 0, list, length);
+    container_t *c;
+    if (card <= DEFAULT_MAX_SIZE) {
+        array_container_t *array =
+            array_container_create_given_capacity((int32_t)card);
+        if (array != NULL) {
+            bitset_extract_setbits_uint16(words, BITSET_CONTAINER_SIZE_IN_WORDS,
+                                          array->array, 0);
+            array->cardinality = (int32_t)card;
+        }
+        bitset_clear_list(words, card, list, length);
+        c = array;
+        *type = ARRAY_CONTAINER_TYPE;
+    } else {
+        bitset_container_t *bitset = bitset_container_create_uninitialized();
+        if (bitset != NULL) {
+            memcpy(bitset->words, words,
+                   BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t));
+            bitset->cardinality = (int32_t)card;
+        }
+        memset(words, 0, BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t));
+        c = bitset;
+        *type = BITSET_CONTAINER_TYPE;
+    }
+    if (c == NULL) {
+        return NULL;
+    }
+    return convert_run_optimize(c, *type, type);
+}
+
+static void roaring_bulk_loader_build_impl(roaring_bulk_loader_t *l,
+                                           uint32_t begin, uint32_t end) {
+    if (end > l->num_keys) end = l->num_keys;
+    if (begin >= end) {
+        return;
+    }
+    uint64_t *words = (uint64_t *)roaring_calloc(
+        BITSET_CONTAINER_SIZE_IN_WORDS, sizeof(uint64_t));
+    if (words == NULL) {
+        return;  // the NULL containers are reported by finish
+    }
+    for (uint32_t i = begin; i < end; ++i) {
+        uint16_t key = l->keys[i];
+        size_t start = l->starts[key];
+        l->containers[i] = bulk_loader_build_container(
+            words, l->low + start, l->starts[key + 1] - start,
+            &l->typecodes[i]);
+    }
+    roaring_free(words);
+}
+
+void roaring_bulk_loader_build(roaring_bulk_loader_t *l, uint32_t begin,
+                               uint32_t end) {
+    const roaring_allocator_t *previous = switch_allocator(l->allocator);
+    roaring_bulk_loader_build_impl(l, begin, end);
+    leave_allocator(previous);
+}
+
+static roaring_bitmap_t *roaring_bulk_loader_finish_impl(
+    roaring_bulk_loader_t *l) {
+    roaring_bitmap_t *answer = NULL;
+    bool complete = l->planned;
+    for (uint32_t i = 0; complete && i < l->num_keys; ++i) {
+        complete = l->containers[i] != NULL;
+    }
+    if (complete) {
+        answer = roaring_bitmap_create_with_capacity(l->num_keys);
+    }
+    if (answer != NULL) {
+        for (uint32_t i = 0; i < l->num_keys; ++i) {
+            ra_append(&answer->high_low_container, l->keys[i],
+                      l->containers[i], l->typecodes[i]);
+        }
+    } else if (l->containers != NULL) {
+        for (uint32_t i = 0; i < l->num_keys; ++i) {
+            if (l->containers[i] != NULL) {
+                container_free(l->containers[i], l->typecodes[i]);
+            }
+        }
+    }
+    roaring_free(l->counts);
+    roaring_free(l->low);
+    roaring_free(l->starts);
+    roaring_free(l->keys);
+    roaring_free(l->containers);
+    roaring_free(l->typecodes);
+    roaring_free(l);
+    return answer;
+}
+
+roaring_bitmap_t *roaring_bulk_loader_finish(roaring_bulk_loader_t *l) {
+    const roaring_allocator_t *previous = switch_allocator(l->allocator);
+    roaring_bitmap_t *answer = roaring_bulk_loader_finish_impl(l);
+    leave_allocator(previous);
+    return answer;
+}
+
+roaring_bitmap_t *roaring_bitmap_from_unsorted(const uint32_t *vals,
+                                               size_t n) {
+    roaring_bulk_loader_t *l = roaring_bulk_loader_create(vals, n, 1);
+    if (l == NULL) {
+        return NULL;
+    }
+    uint32_t num_keys;
+    roaring_bulk_loader_count(l, 0);
+    if (roaring_bulk_loader_plan(l, &num_keys)) {
+        roaring_bulk_loader_scatter(l, 0);
+        roaring_bulk_loader_build(l, 0, num_keys);
+    }
+    return roaring_bulk_loader_finish(l);
+}
+
 roaring_bitmap_t *roaring_bitmap_of(size_t n_args, ...) {
     // todo: could be greatly optimized but we do not expect this call to ever
     // include long lists
@@ -248,8 +753,8 @@ roaring_bitmap_t *roaring_bitmap_from_range(uint64_t min, uint64_t max,
     return answer;
 }
 
-void roaring_bitmap_add_range_closed(roaring_bitmap_t *r, uint32_t min,
-                                     uint32_t max) {
+static void roaring_bitmap_add_range_closed_impl(roaring_bitmap_t *r,
+                                                 uint32_t min, uint32_t max) {
     if (min > max) {
         return;
     }
@@ -299,8 +804,19 @@ void roaring_bitmap_add_range_closed(roaring_bitmap_t *r, uint32_t min,
     }
 }
 
-void roaring_bitmap_remove_range_closed(roaring_bitmap_t *r, uint32_t min,
-                                        uint32_t max) {
+void roaring_bitmap_add_range_closed(roaring_bitmap_t *r, uint32_t min,
+                                     uint32_t max) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return;
+    }
+    roaring_bitmap_add_range_closed_impl(r, min, max);
+    leave_allocator(previous);
+}
+
+static void roaring_bitmap_remove_range_closed_impl(roaring_bitmap_t *r,
+                                                    uint32_t min,
+                                                    uint32_t max) {
     if (min > max) {
         return;
     }
@@ -338,6 +854,16 @@ void roaring_bitmap_remove_range_closed(roaring_bitmap_t *r, uint32_t min,
     }
 }
 
+void roaring_bitmap_remove_range_closed(roaring_bitmap_t *r, uint32_t min,
+                                        uint32_t max) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return;
+    }
+    roaring_bitmap_remove_range_closed_impl(r, min, max);
+    leave_allocator(previous);
+}
+
 void roaring_bitmap_printf(const roaring_bitmap_t *r) {
     const roaring_array_t *ra = &r->high_low_container;
 
@@ -428,7 +954,7 @@ bool roaring_contains_shared(const roaring_bitmap_t *r) {
     return false;
 }
 
-bool roaring_unshare_all(roaring_bitmap_t *r) {
+static bool roaring_unshare_all_impl(roaring_bitmap_t *r) {
     const roaring_array_t *ra = &r->high_low_container;
     bool unshared = false;
     for (int i = 0; i < ra->size; ++i) {
@@ -442,6 +968,53 @@ bool roaring_unshare_all(roaring_bitmap_t *r) {
     return unshared;
 }
 
+bool roaring_unshare_all(roaring_bitmap_t *r) {
+    const roaring_allocator_t *previous = enter_allocator_of(r);
+    bool answer = roaring_unshare_all_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+static size_t roaring_bitmap_intern_impl(roaring_bitmap_t *r,
+                                         roaring_interner_t *in) {
+    roaring_array_t *ra = &r->high_low_container;
+    size_t bytes_saved = 0;
+    ra->flags |= ROARING_FLAG_COW;
+    for (int i = 0; i < ra->size; ++i) {
+        uint8_t typecode = ra->typecodes[i];
+        container_t *c = interner_intern_container(in, ra->containers[i],
+                                                   &typecode, &bytes_saved);
+        if (c == NULL) {
+            break;
+        }
+        ra->containers[i] = c;
+        ra->typecodes[i] = typecode;
+    }
+    return bytes_saved;
+}
+
+size_t roaring_bitmap_intern(roaring_bitmap_t *r, roaring_interner_t *in) {
+    if (is_frozen(r)) {
+        return 0;
+    }
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return 0;
+    }
+    size_t answer = roaring_bitmap_intern_impl(r, in);
+    leave_allocator(previous);
+    return answer;
+}
+
+size_t roaring_bitmap_intern_many(size_t number, roaring_bitmap_t **x,
+                                  roaring_interner_t *in) {
+    size_t bytes_saved = 0;
+    for (size_t i = 0; i < number; i++) {
+        bytes_saved += roaring_bitmap_intern(x[i], in);
+    }
+    return bytes_saved;
+}
+
 /*
  * Checks that:
  * - Array containers are sorted and contain no duplicates
@@ -472,7 +1045,9 @@ bool roaring_bitmap_internal_validate(const roaring_bitmap_t *r,
         *reason = "more containers than allocated space";
         return false;
     }
-    if (ra->flags & ~(ROARING_FLAG_COW | ROARING_FLAG_FROZEN)) {
+    if (ra->flags &
+        ~(ROARING_FLAG_COW | ROARING_FLAG_FROZEN | ROARING_FLAG_SEALED |
+          ROARING_FLAG_ALLOCATOR)) {
         *reason = "invalid flags";
         return false;
     }
@@ -522,7 +1097,7 @@ bool roaring_bitmap_internal_validate(const roaring_bitmap_t *r,
     return true;
 }
 
-roaring_bitmap_t *roaring_bitmap_copy(const roaring_bitmap_t *r) {
+static roaring_bitmap_t *roaring_bitmap_copy_impl(const roaring_bitmap_t *r) {
     roaring_bitmap_t *ans =
         (roaring_bitmap_t *)roaring_malloc(sizeof(roaring_bitmap_t));
     if (!ans) {
@@ -538,32 +1113,65 @@ roaring_bitmap_t *roaring_bitmap_copy(const roaring_bitmap_t *r) {
         roaring_bitmap_free(ans);  // overwrite should leave in freeable state
         return NULL;
     }
-    roaring_bitmap_set_copy_on_write(ans, is_cow(r));
+    roaring_bitmap_set_copy_on_write(ans, has_cow_flag(r));
     return ans;
 }
 
-bool roaring_bitmap_overwrite(roaring_bitmap_t *dest,
-                              const roaring_bitmap_t *src) {
-    roaring_bitmap_set_copy_on_write(dest, is_cow(src));
+roaring_bitmap_t *roaring_bitmap_copy(const roaring_bitmap_t *r) {
+    const roaring_allocator_t *previous = enter_result_allocator_of(r);
+    roaring_bitmap_t *answer = roaring_bitmap_copy_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+static bool roaring_bitmap_overwrite_impl(roaring_bitmap_t *dest,
+                                          const roaring_bitmap_t *src) {
+    roaring_bitmap_set_copy_on_write(dest, has_cow_flag(src));
     return ra_overwrite(&src->high_low_container, &dest->high_low_container,
                         is_cow(src));
 }
 
-void roaring_bitmap_free(const roaring_bitmap_t *r) {
-    if (r == NULL) {
-        return;
-    }
+bool roaring_bitmap_overwrite(roaring_bitmap_t *dest,
+                              const roaring_bitmap_t *src) {
+    const roaring_allocator_t *previous = enter_allocator_of(dest);
+    bool answer = roaring_bitmap_overwrite_impl(dest, src);
+    leave_allocator(previous);
+    return answer;
+}
+
+static void roaring_bitmap_free_impl(const roaring_bitmap_t *r) {
     if (!is_frozen(r)) {
         ra_clear((roaring_array_t *)&r->high_low_container);
     }
     roaring_free((roaring_bitmap_t *)r);
 }
 
-void roaring_bitmap_clear(roaring_bitmap_t *r) {
+void roaring_bitmap_free(const roaring_bitmap_t *r) {
+    if (r == NULL) {
+        return;
+    }
+    const roaring_allocator_t *previous = enter_allocator_of(r);
+    roaring_bitmap_free_impl(r);
+    leave_allocator(previous);
+}
+
+static void roaring_bitmap_clear_impl(roaring_bitmap_t *r) {
     ra_reset(&r->high_low_container);
 }
 
-void roaring_bitmap_add(roaring_bitmap_t *r, uint32_t val) {
+void roaring_bitmap_clear(roaring_bitmap_t *r) {
+    const roaring_allocator_t *previous = enter_allocator_of(r);
+    roaring_bitmap_clear_impl(r);
+    leave_allocator(previous);
+}
+
+void roaring_bitmap_release(roaring_bitmap_t *r) {
+    const roaring_allocator_t *previous = enter_allocator_of(r);
+    ra_clear(&r->high_low_container);  // drops ROARING_FLAG_ALLOCATOR
+    leave_allocator(previous);
+}
+
+static void roaring_bitmap_add_impl(roaring_bitmap_t *r, uint32_t val) {
     roaring_array_t *ra = &r->high_low_container;
 
     const uint16_t hb = val >> 16;
@@ -591,7 +1199,16 @@ void roaring_bitmap_add(roaring_bitmap_t *r, uint32_t val) {
     }
 }
 
-bool roaring_bitmap_add_checked(roaring_bitmap_t *r, uint32_t val) {
+void roaring_bitmap_add(roaring_bitmap_t *r, uint32_t val) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return;
+    }
+    roaring_bitmap_add_impl(r, val);
+    leave_allocator(previous);
+}
+
+static bool roaring_bitmap_add_checked_impl(roaring_bitmap_t *r, uint32_t val) {
     const uint16_t hb = val >> 16;
     const int i = ra_get_index(&r->high_low_container, hb);
     uint8_t typecode;
@@ -631,7 +1248,17 @@ bool roaring_bitmap_add_checked(roaring_bitmap_t *r, uint32_t val) {
     return result;
 }
 
-void roaring_bitmap_remove(roaring_bitmap_t *r, uint32_t val) {
+bool roaring_bitmap_add_checked(roaring_bitmap_t *r, uint32_t val) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return false;
+    }
+    bool answer = roaring_bitmap_add_checked_impl(r, val);
+    leave_allocator(previous);
+    return answer;
+}
+
+static void roaring_bitmap_remove_impl(roaring_bitmap_t *r, uint32_t val) {
     const uint16_t hb = val >> 16;
     const int i = ra_get_index(&r->high_low_container, hb);
     uint8_t typecode;
@@ -656,7 +1283,17 @@ void roaring_bitmap_remove(roaring_bitmap_t *r, uint32_t val) {
     }
 }
 
-bool roaring_bitmap_remove_checked(roaring_bitmap_t *r, uint32_t val) {
+void roaring_bitmap_remove(roaring_bitmap_t *r, uint32_t val) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return;
+    }
+    roaring_bitmap_remove_impl(r, val);
+    leave_allocator(previous);
+}
+
+static bool roaring_bitmap_remove_checked_impl(roaring_bitmap_t *r,
+                                               uint32_t val) {
     const uint16_t hb = val >> 16;
     const int i = ra_get_index(&r->high_low_container, hb);
     uint8_t typecode;
@@ -693,8 +1330,18 @@ bool roaring_bitmap_remove_checked(roaring_bitmap_t *r, uint32_t val) {
     return result;
 }
 
-void roaring_bitmap_remove_many(roaring_bitmap_t *r, size_t n_args,
-                                const uint32_t *vals) {
+bool roaring_bitmap_remove_checked(roaring_bitmap_t *r, uint32_t val) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return false;
+    }
+    bool answer = roaring_bitmap_remove_checked_impl(r, val);
+    leave_allocator(previous);
+    return answer;
+}
+
+static void roaring_bitmap_remove_many_impl(roaring_bitmap_t *r, size_t n_args,
+                                            const uint32_t *vals) {
     if (n_args == 0 || r->high_low_container.size == 0) {
         return;
     }
@@ -727,15 +1374,26 @@ void roaring_bitmap_remove_many(roaring_bitmap_t *r, size_t n_args,
     }
 }
 
+void roaring_bitmap_remove_many(roaring_bitmap_t *r, size_t n_args,
+                                const uint32_t *vals) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return;
+    }
+    roaring_bitmap_remove_many_impl(r, n_args, vals);
+    leave_allocator(previous);
+}
+
 // there should be some SIMD optimizations possible here
-roaring_bitmap_t *roaring_bitmap_and(const roaring_bitmap_t *x1,
-                                     const roaring_bitmap_t *x2) {
+static roaring_bitmap_t *roaring_bitmap_and_impl(const roaring_bitmap_t *x1,
+                                                 const roaring_bitmap_t *x2) {
     uint8_t result_type = 0;
     const int length1 = x1->high_low_container.size,
               length2 = x2->high_low_container.size;
     uint32_t neededcap = length1 > length2 ? length2 : length1;
     roaring_bitmap_t *answer = roaring_bitmap_create_with_capacity(neededcap);
-    roaring_bitmap_set_copy_on_write(answer, is_cow(x1) || is_cow(x2));
+    roaring_bitmap_set_copy_on_write(answer,
+                                     has_cow_flag(x1) || has_cow_flag(x2));
 
     int pos1 = 0, pos2 = 0;
 
@@ -769,11 +1427,19 @@ roaring_bitmap_t *roaring_bitmap_and(const roaring_bitmap_t *x1,
     return answer;
 }
 
+roaring_bitmap_t *roaring_bitmap_and(const roaring_bitmap_t *x1,
+                                     const roaring_bitmap_t *x2) {
+    const roaring_allocator_t *previous = enter_result_allocator_of(x1);
+    roaring_bitmap_t *answer = roaring_bitmap_and_impl(x1, x2);
+    leave_allocator(previous);
+    return answer;
+}
+
 /**
  * Compute the union of 'number' bitmaps.
  */
-roaring_bitmap_t *roaring_bitmap_or_many(size_t number,
-                                         const roaring_bitmap_t **x) {
+static roaring_bitmap_t *roaring_bitmap_or_many_impl(
+    size_t number, const roaring_bitmap_t **x) {
     if (number == 0) {
         return roaring_bitmap_create();
     }
@@ -789,11 +1455,20 @@ roaring_bitmap_t *roaring_bitmap_or_many(size_t number,
     return answer;
 }
 
+roaring_bitmap_t *roaring_bitmap_or_many(size_t number,
+                                         const roaring_bitmap_t **x) {
+    const roaring_allocator_t *previous =
+        enter_result_allocator_of(number > 0 ? x[0] : NULL);
+    roaring_bitmap_t *answer = roaring_bitmap_or_many_impl(number, x);
+    leave_allocator(previous);
+    return answer;
+}
+
 /**
  * Compute the xor of 'number' bitmaps.
  */
-roaring_bitmap_t *roaring_bitmap_xor_many(size_t number,
-                                          const roaring_bitmap_t **x) {
+static roaring_bitmap_t *roaring_bitmap_xor_many_impl(
+    size_t number, const roaring_bitmap_t **x) {
     if (number == 0) {
         return roaring_bitmap_create();
     }
@@ -808,9 +1483,18 @@ roaring_bitmap_t *roaring_bitmap_xor_many(size_t number,
     return answer;
 }
 
+roaring_bitmap_t *roaring_bitmap_xor_many(size_t number,
+                                          const roaring_bitmap_t **x) {
+    const roaring_allocator_t *previous =
+        enter_result_allocator_of(number > 0 ? x[0] : NULL);
+    roaring_bitmap_t *answer = roaring_bitmap_xor_many_impl(number, x);
+    leave_allocator(previous);
+    return answer;
+}
+
 // inplace and (modifies its first argument).
-void roaring_bitmap_and_inplace(roaring_bitmap_t *x1,
-                                const roaring_bitmap_t *x2) {
+static void roaring_bitmap_and_inplace_impl(roaring_bitmap_t *x1,
+                                            const roaring_bitmap_t *x2) {
     if (x1 == x2) return;
     int pos1 = 0, pos2 = 0, intersection_size = 0;
     const int length1 = ra_get_size(&x1->high_low_container);
@@ -874,8 +1558,18 @@ void roaring_bitmap_and_inplace(roaring_bitmap_t *x1,
     ra_downsize(&x1->high_low_container, intersection_size);
 }
 
-roaring_bitmap_t *roaring_bitmap_or(const roaring_bitmap_t *x1,
-                                    const roaring_bitmap_t *x2) {
+void roaring_bitmap_and_inplace(roaring_bitmap_t *x1,
+                                const roaring_bitmap_t *x2) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(x1, &previous)) {
+        return;
+    }
+    roaring_bitmap_and_inplace_impl(x1, x2);
+    leave_allocator(previous);
+}
+
+static roaring_bitmap_t *roaring_bitmap_or_impl(const roaring_bitmap_t *x1,
+                                                const roaring_bitmap_t *x2) {
     uint8_t result_type = 0;
     const int length1 = x1->high_low_container.size,
               length2 = x2->high_low_container.size;
@@ -887,7 +1581,8 @@ roaring_bitmap_t *roaring_bitmap_or(const roaring_bitmap_t *x1,
     }
     roaring_bitmap_t *answer =
         roaring_bitmap_create_with_capacity(length1 + length2);
-    roaring_bitmap_set_copy_on_write(answer, is_cow(x1) || is_cow(x2));
+    roaring_bitmap_set_copy_on_write(answer,
+                                     has_cow_flag(x1) || has_cow_flag(x2));
     int pos1 = 0, pos2 = 0;
     uint8_t type1, type2;
     uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, (uint16_t)pos1);
@@ -952,6 +1647,14 @@ roaring_bitmap_t *roaring_bitmap_or(const roaring_bitmap_t *x1,
     return answer;
 }
 
+roaring_bitmap_t *roaring_bitmap_or(const roaring_bitmap_t *x1,
+                                    const roaring_bitmap_t *x2) {
+    const roaring_allocator_t *previous = enter_result_allocator_of(x1);
+    roaring_bitmap_t *answer = roaring_bitmap_or_impl(x1, x2);
+    leave_allocator(previous);
+    return answer;
+}
+
 static void roaring_inplace_merge_bulk(roaring_bitmap_t *x1,
                                        const roaring_bitmap_t *x2, int dst,
                                        int left, int right, bool is_xor) {
@@ -982,7 +1685,8 @@ static void roaring_inplace_merge_bulk(roaring_bitmap_t *x1,
     const int total = dst + distinct;
 
     roaring_array_t merged;
-    ra_init_with_capacity(&merged, total > 0 ? (uint32_t)total : 1);
+    ra_init_with_allocator(&merged, ra_get_allocator(ra1),
+                           total > 0 ? (uint32_t)total : 1);
 
     for (int i = 0; i < dst; i++) {
         ra_append(&merged, ra1->keys[i], ra1->containers[i], ra1->typecodes[i]);
@@ -1054,14 +1758,14 @@ static void roaring_inplace_merge_bulk(roaring_bitmap_t *x1,
         ra_append(&merged, ra2->keys[right], c2, type2);
     }
 
-    merged.flags = ra1->flags;
-    ra_clear_without_containers(ra1);
+    ra_clear_without_containers(ra1);  // drops ROARING_FLAG_ALLOCATOR
+    merged.flags |= ra1->flags;
     *ra1 = merged;
 }
 
 // inplace or (modifies its first argument).
-void roaring_bitmap_or_inplace(roaring_bitmap_t *x1,
-                               const roaring_bitmap_t *x2) {
+static void roaring_bitmap_or_inplace_impl(roaring_bitmap_t *x1,
+                                           const roaring_bitmap_t *x2) {
     uint8_t result_type = 0;
     int length1 = x1->high_low_container.size;
     const int length2 = x2->high_low_container.size;
@@ -1118,8 +1822,18 @@ void roaring_bitmap_or_inplace(roaring_bitmap_t *x1,
     }
 }
 
-roaring_bitmap_t *roaring_bitmap_xor(const roaring_bitmap_t *x1,
-                                     const roaring_bitmap_t *x2) {
+void roaring_bitmap_or_inplace(roaring_bitmap_t *x1,
+                               const roaring_bitmap_t *x2) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(x1, &previous)) {
+        return;
+    }
+    roaring_bitmap_or_inplace_impl(x1, x2);
+    leave_allocator(previous);
+}
+
+static roaring_bitmap_t *roaring_bitmap_xor_impl(const roaring_bitmap_t *x1,
+                                                 const roaring_bitmap_t *x2) {
     uint8_t result_type = 0;
     const int length1 = x1->high_low_container.size,
               length2 = x2->high_low_container.size;
@@ -1131,7 +1845,8 @@ roaring_bitmap_t *roaring_bitmap_xor(const roaring_bitmap_t *x1,
     }
     roaring_bitmap_t *answer =
         roaring_bitmap_create_with_capacity(length1 + length2);
-    roaring_bitmap_set_copy_on_write(answer, is_cow(x1) || is_cow(x2));
+    roaring_bitmap_set_copy_on_write(answer,
+                                     has_cow_flag(x1) || has_cow_flag(x2));
     int pos1 = 0, pos2 = 0;
     uint8_t type1, type2;
     uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, (uint16_t)pos1);
@@ -1195,10 +1910,18 @@ roaring_bitmap_t *roaring_bitmap_xor(const roaring_bitmap_t *x1,
     return answer;
 }
 
+roaring_bitmap_t *roaring_bitmap_xor(const roaring_bitmap_t *x1,
+                                     const roaring_bitmap_t *x2) {
+    const roaring_allocator_t *previous = enter_result_allocator_of(x1);
+    roaring_bitmap_t *answer = roaring_bitmap_xor_impl(x1, x2);
+    leave_allocator(previous);
+    return answer;
+}
+
 // inplace xor (modifies its first argument).
 
-void roaring_bitmap_xor_inplace(roaring_bitmap_t *x1,
-                                const roaring_bitmap_t *x2) {
+static void roaring_bitmap_xor_inplace_impl(roaring_bitmap_t *x1,
+                                            const roaring_bitmap_t *x2) {
     assert(x1 != x2);
     uint8_t result_type = 0;
     int length1 = x1->high_low_container.size;
@@ -1272,22 +1995,33 @@ void roaring_bitmap_xor_inplace(roaring_bitmap_t *x1,
     }
 }
 
-roaring_bitmap_t *roaring_bitmap_andnot(const roaring_bitmap_t *x1,
-                                        const roaring_bitmap_t *x2) {
+void roaring_bitmap_xor_inplace(roaring_bitmap_t *x1,
+                                const roaring_bitmap_t *x2) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(x1, &previous)) {
+        return;
+    }
+    roaring_bitmap_xor_inplace_impl(x1, x2);
+    leave_allocator(previous);
+}
+
+static roaring_bitmap_t *roaring_bitmap_andnot_impl(
+    const roaring_bitmap_t *x1, const roaring_bitmap_t *x2) {
     uint8_t result_type = 0;
     const int length1 = x1->high_low_container.size,
               length2 = x2->high_low_container.size;
     if (0 == length1) {
         roaring_bitmap_t *empty_bitmap = roaring_bitmap_create();
         roaring_bitmap_set_copy_on_write(empty_bitmap,
-                                         is_cow(x1) || is_cow(x2));
+                                         has_cow_flag(x1) || has_cow_flag(x2));
         return empty_bitmap;
     }
     if (0 == length2) {
         return roaring_bitmap_copy(x1);
     }
     roaring_bitmap_t *answer = roaring_bitmap_create_with_capacity(length1);
-    roaring_bitmap_set_copy_on_write(answer, is_cow(x1) || is_cow(x2));
+    roaring_bitmap_set_copy_on_write(answer,
+                                     has_cow_flag(x1) || has_cow_flag(x2));
 
     int pos1 = 0, pos2 = 0;
     uint8_t type1, type2;
@@ -1337,10 +2071,18 @@ roaring_bitmap_t *roaring_bitmap_andnot(const roaring_bitmap_t *x1,
     return answer;
 }
 
+roaring_bitmap_t *roaring_bitmap_andnot(const roaring_bitmap_t *x1,
+                                        const roaring_bitmap_t *x2) {
+    const roaring_allocator_t *previous = enter_result_allocator_of(x1);
+    roaring_bitmap_t *answer = roaring_bitmap_andnot_impl(x1, x2);
+    leave_allocator(previous);
+    return answer;
+}
+
 // inplace andnot (modifies its first argument).
 
-void roaring_bitmap_andnot_inplace(roaring_bitmap_t *x1,
-                                   const roaring_bitmap_t *x2) {
+static void roaring_bitmap_andnot_inplace_impl(roaring_bitmap_t *x1,
+                                               const roaring_bitmap_t *x2) {
     assert(x1 != x2);
 
     uint8_t result_type = 0;
@@ -1433,6 +2175,16 @@ void roaring_bitmap_andnot_inplace(roaring_bitmap_t *x1,
     ra_downsize(&x1->high_low_container, intersection_size);
 }
 
+void roaring_bitmap_andnot_inplace(roaring_bitmap_t *x1,
+                                   const roaring_bitmap_t *x2) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(x1, &previous)) {
+        return;
+    }
+    roaring_bitmap_andnot_inplace_impl(x1, x2);
+    leave_allocator(previous);
+}
+
 uint64_t roaring_bitmap_get_cardinality(const roaring_bitmap_t *r) {
     const roaring_array_t *ra = &r->high_low_container;
 
@@ -1513,10 +2265,38 @@ void roaring_bitmap_to_uint32_array(const roaring_bitmap_t *r, uint32_t *ans) {
 
 bool roaring_bitmap_range_uint32_array(const roaring_bitmap_t *r, size_t offset,
                                        size_t limit, uint32_t *ans) {
-    roaring_uint32_iterator_t it;
-    roaring_iterator_init(r, &it);
-    roaring_uint32_iterator_skip(&it, offset);
-    roaring_uint32_iterator_read(&it, ans, limit);
+    const roaring_array_t *ra = &r->high_low_container;
+    size_t written = 0;
+    for (int32_t i = 0; i < ra->size && written < limit; ++i) {
+        uint8_t type = ra->typecodes[i];
+        const container_t *c =
+            container_unwrap_shared(ra->containers[i], &type);
+        uint32_t card = (uint32_t)container_get_cardinality(c, type);
+        if (offset >= card) {
+            offset -= card;
+            continue;
+        }
+        uint32_t base = (uint32_t)ra->keys[i] << 16;
+        if (offset == 0 && card <= limit - written) {
+            // Whole containers go through the SIMD decoders.
+            written += container_to_uint32_array(ans + written, c, type, base);
+            continue;
+        }
+        uint16_t value;
+        uint32_t consumed;
+        roaring_container_iterator_t it =
+            container_init_iterator(c, type, &value);
+        if (offset > 0) {
+            container_iterator_skip(c, type, &it, (uint32_t)offset, &consumed,
+                                    &value);
+        }
+        uint32_t count = card - (uint32_t)offset;
+        if (count > limit - written) count = (uint32_t)(limit - written);
+        container_iterator_read_into_uint32(c, type, &it, base, ans + written,
+                                            count, &consumed, &value);
+        written += consumed;
+        offset = 0;
+    }
 
     // This function always succeeds
     return true;
@@ -1527,7 +2307,7 @@ bool roaring_bitmap_range_uint32_array(const roaring_bitmap_t *r, size_t offset,
  * also convert from run containers when more space efficient.  Returns
  * true if the result has at least one run container.
  */
-bool roaring_bitmap_run_optimize(roaring_bitmap_t *r) {
+static bool roaring_bitmap_run_optimize_impl(roaring_bitmap_t *r) {
     bool answer = false;
     for (int i = 0; i < r->high_low_container.size; i++) {
         uint8_t type_original, type_after;
@@ -1545,7 +2325,17 @@ bool roaring_bitmap_run_optimize(roaring_bitmap_t *r) {
     return answer;
 }
 
-size_t roaring_bitmap_shrink_to_fit(roaring_bitmap_t *r) {
+bool roaring_bitmap_run_optimize(roaring_bitmap_t *r) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return false;
+    }
+    bool answer = roaring_bitmap_run_optimize_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+static size_t roaring_bitmap_shrink_to_fit_impl(roaring_bitmap_t *r) {
     size_t answer = 0;
     for (int i = 0; i < r->high_low_container.size; i++) {
         uint8_t type_original;
@@ -1557,11 +2347,21 @@ size_t roaring_bitmap_shrink_to_fit(roaring_bitmap_t *r) {
     return answer;
 }
 
+size_t roaring_bitmap_shrink_to_fit(roaring_bitmap_t *r) {
+    if (is_sealed(r)) {
+        return 0;  // packed already
+    }
+    const roaring_allocator_t *previous = enter_allocator_of(r);
+    size_t answer = roaring_bitmap_shrink_to_fit_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
 /**
  *  Remove run-length encoding even when it is more space efficient
  *  return whether a change was applied
  */
-bool roaring_bitmap_remove_run_compression(roaring_bitmap_t *r) {
+static bool roaring_bitmap_remove_run_compression_impl(roaring_bitmap_t *r) {
     bool answer = false;
     for (int i = 0; i < r->high_low_container.size; i++) {
         uint8_t type_original, type_after;
@@ -1591,6 +2391,16 @@ bool roaring_bitmap_remove_run_compression(roaring_bitmap_t *r) {
     return answer;
 }
 
+bool roaring_bitmap_remove_run_compression(roaring_bitmap_t *r) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return false;
+    }
+    bool answer = roaring_bitmap_remove_run_compression_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
 size_t roaring_bitmap_serialize(const roaring_bitmap_t *r, char *buf) {
     size_t portablesize = roaring_bitmap_portable_size_in_bytes(r);
     uint64_t cardinality = roaring_bitmap_get_cardinality(r);
@@ -1612,55 +2422,475 @@ size_t roaring_bitmap_serialize(const roaring_bitmap_t *r, char *buf) {
             memcpy(out + i, &v, sizeof(uint32_t));
         }
 #endif
-        return 1 + (size_t)sizeasarray;
+        return 1 + (size_t)sizeasarray;
+    }
+}
+
+size_t roaring_bitmap_size_in_bytes(const roaring_bitmap_t *r) {
+    size_t portablesize = roaring_bitmap_portable_size_in_bytes(r);
+    uint64_t sizeasarray =
+        roaring_bitmap_get_cardinality(r) * sizeof(uint32_t) + sizeof(uint32_t);
+    return portablesize < sizeasarray ? portablesize + 1
+                                      : (size_t)sizeasarray + 1;
+}
+
+size_t roaring_bitmap_portable_size_in_bytes(const roaring_bitmap_t *r) {
+    return ra_portable_size_in_bytes(&r->high_low_container);
+}
+
+roaring_bitmap_t *roaring_bitmap_portable_deserialize_safe(const char *buf,
+                                                           size_t maxbytes) {
+    roaring_bitmap_t *ans =
+        (roaring_bitmap_t *)roaring_malloc(sizeof(roaring_bitmap_t));
+    if (ans == NULL) {
+        return NULL;
+    }
+    size_t bytesread;
+    bool is_ok = ra_portable_deserialize(&ans->high_low_container, buf,
+                                         maxbytes, &bytesread);
+    if (!is_ok) {
+        roaring_free(ans);
+        return NULL;
+    }
+    roaring_bitmap_set_copy_on_write(ans, false);
+    if (!is_ok) {
+        roaring_free(ans);
+        return NULL;
+    }
+    return ans;
+}
+
+roaring_bitmap_t *roaring_bitmap_portable_deserialize_interned(
+    const char *buf, size_t maxbytes, roaring_interner_t *in) {
+    roaring_bitmap_t *ans = roaring_bitmap_portable_deserialize_safe(buf,
+                                                                    maxbytes);
+    if (ans != NULL) {
+        roaring_bitmap_intern(ans, in);
+    }
+    return ans;
+}
+
+roaring_bitmap_t *roaring_bitmap_portable_deserialize_prepare(
+    const char *buf, size_t maxbytes, uint32_t *container_count) {
+    ra_portable_header_t header;
+    if (!ra_portable_parse_header(buf, maxbytes, &header)) {
+        return NULL;
+    }
+    roaring_bitmap_t *ans =
+        (roaring_bitmap_t *)roaring_malloc(sizeof(roaring_bitmap_t));
+    if (ans == NULL) {
+        return NULL;
+    }
+    if (!ra_portable_deserialize_prepare(&ans->high_low_container, &header)) {
+        roaring_free(ans);
+        return NULL;
+    }
+    roaring_bitmap_set_copy_on_write(ans, false);
+    *container_count = (uint32_t)header.size;
+    return ans;
+}
+
+static bool roaring_bitmap_portable_deserialize_range_impl(roaring_bitmap_t *r,
+                                                           const char *buf,
+                                                           size_t maxbytes,
+                                                           uint32_t begin,
+                                                           uint32_t end) {
+    ra_portable_header_t header;
+    if (!ra_portable_parse_header(buf, maxbytes, &header) ||
+        header.size != r->high_low_container.size ||
+        end > (uint32_t)header.size || begin > end) {
+        return false;
+    }
+    return ra_portable_deserialize_range(&r->high_low_container, &header,
+                                         maxbytes, (int32_t)begin,
+                                         (int32_t)end);
+}
+
+bool roaring_bitmap_portable_deserialize_range(roaring_bitmap_t *r,
+                                               const char *buf, size_t maxbytes,
+                                               uint32_t begin, uint32_t end) {
+    const roaring_allocator_t *previous = enter_allocator_of(r);
+    bool answer = roaring_bitmap_portable_deserialize_range_impl(
+        r, buf, maxbytes, begin, end);
+    leave_allocator(previous);
+    return answer;
+}
+
+static roaring_bitmap_t *roaring_bitmap_portable_deserialize_finish_impl(
+    roaring_bitmap_t *r) {
+    roaring_array_t *ra = &r->high_low_container;
+    bool is_ok = true;
+    for (int32_t i = 0; i < ra->size; ++i) {
+        if (ra->containers[i] == NULL) {
+            is_ok = false;
+            break;
+        }
+    }
+    if (is_ok) {
+        return r;
+    }
+    for (int32_t i = 0; i < ra->size; ++i) {
+        if (ra->containers[i] != NULL) {
+            container_free(ra->containers[i], ra->typecodes[i]);
+        }
+    }
+    ra_clear_without_containers(ra);
+    roaring_free(r);
+    return NULL;
+}
+
+roaring_bitmap_t *roaring_bitmap_portable_deserialize_finish(
+    roaring_bitmap_t *r) {
+    const roaring_allocator_t *previous = enter_allocator_of(r);
+    roaring_bitmap_t *answer =
+        roaring_bitmap_portable_deserialize_finish_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+roaring_bitmap_t *roaring_bitmap_portable_deserialize(const char *buf) {
+    return roaring_bitmap_portable_deserialize_safe(buf, SIZE_MAX);
+}
+
+size_t roaring_bitmap_portable_deserialize_size(const char *buf,
+                                                size_t maxbytes) {
+    return ra_portable_deserialize_size(buf, maxbytes);
+}
+
+size_t roaring_bitmap_portable_serialize(const roaring_bitmap_t *r, char *buf) {
+    return ra_portable_serialize(&r->high_low_container, buf);
+}
+
+struct roaring_portable_writer_s {
+    char *buf;
+    size_t capacity;
+    size_t payload_bytes;  // container bytes written so far, from buf
+    bool failed;
+    bool has_run;
+    // Container being accumulated: key (-1 if none), cardinality, and the
+    // range of words that may be non-zero.
+    int32_t key;
+    uint32_t card;
+    uint32_t first_word;
+    uint32_t last_word;
+    // Completed containers, in key order.
+    int32_t size;
+    int32_t meta_capacity;
+    uint16_t *keys;
+    uint16_t *cards;     // cardinality - 1, as serialized
+    uint32_t *offsets;   // relative to the first container
+    uint8_t *run_flags;  // one byte per container
+    uint64_t words[BITSET_CONTAINER_SIZE_IN_WORDS];
+    // Array values or (value, length) run pairs of the container being
+    // written. Runs are only chosen when smaller than an array or bitset,
+    // which bounds them to DEFAULT_MAX_SIZE / 2 pairs.
+    uint16_t scratch[DEFAULT_MAX_SIZE];
+};
+
+roaring_portable_writer_t *roaring_portable_writer_create(char *buf,
+                                                          size_t capacity) {
+    roaring_portable_writer_t *w = (roaring_portable_writer_t *)roaring_malloc(
+        sizeof(roaring_portable_writer_t));
+    if (w == NULL) {
+        return NULL;
+    }
+    w->buf = buf;
+    w->capacity = capacity;
+    w->payload_bytes = 0;
+    w->failed = false;
+    w->has_run = false;
+    w->key = -1;
+    w->card = 0;
+    w->first_word = BITSET_CONTAINER_SIZE_IN_WORDS;
+    w->last_word = 0;
+    w->size = 0;
+    w->meta_capacity = 0;
+    w->keys = NULL;
+    w->cards = NULL;
+    w->offsets = NULL;
+    w->run_flags = NULL;
+    memset(w->words, 0, sizeof(w->words));
+    return w;
+}
+
+void roaring_portable_writer_free(roaring_portable_writer_t *w) {
+    if (w == NULL) {
+        return;
+    }
+    roaring_free(w->keys);
+    roaring_free(w->cards);
+    roaring_free(w->offsets);
+    roaring_free(w->run_flags);
+    roaring_free(w);
+}
+
+static bool portable_writer_grow(roaring_portable_writer_t *w) {
+    int32_t new_capacity = w->meta_capacity < 64 ? 64 : 2 * w->meta_capacity;
+    if (new_capacity > (1 << 16)) {
+        new_capacity = 1 << 16;
+    }
+    uint16_t *keys =
+        (uint16_t *)roaring_realloc(w->keys, new_capacity * sizeof(uint16_t));
+    if (keys != NULL) w->keys = keys;
+    uint16_t *cards =
+        (uint16_t *)roaring_realloc(w->cards, new_capacity * sizeof(uint16_t));
+    if (cards != NULL) w->cards = cards;
+    uint32_t *offsets = (uint32_t *)roaring_realloc(
+        w->offsets, new_capacity * sizeof(uint32_t));
+    if (offsets != NULL) w->offsets = offsets;
+    uint8_t *run_flags = (uint8_t *)roaring_realloc(
+        w->run_flags, new_capacity * sizeof(uint8_t));
+    if (run_flags != NULL) w->run_flags = run_flags;
+    if (keys == NULL || cards == NULL || offsets == NULL || run_flags == NULL) {
+        return false;
+    }
+    w->meta_capacity = new_capacity;
+    return true;
+}
+
+// Writes the (value, length) pairs of the runs found in words[first, last]
+// to out and returns how many runs were written.
+static int32_t portable_writer_extract_runs(const uint64_t *words,
+                                            uint32_t first, uint32_t last,
+                                            uint16_t *out) {
+    int32_t n_runs = 0;
+    uint32_t i = first;
+    uint64_t cur_word = words[i];
+    while (true) {
+        while (cur_word == UINT64_C(0) && i < last) cur_word = words[++i];
+        if (cur_word == UINT64_C(0)) {
+            return n_runs;
+        }
+        uint32_t run_start = 64 * i + roaring_trailing_zeroes(cur_word);
+        uint64_t cur_word_with_1s = cur_word | (cur_word - 1);
+        while (cur_word_with_1s == UINT64_C(0xFFFFFFFFFFFFFFFF) && i < last) {
+            cur_word_with_1s = words[++i];
+        }
+        uint32_t run_end;  // exclusive
+        if (cur_word_with_1s == UINT64_C(0xFFFFFFFFFFFFFFFF)) {
+            run_end = 64 * i + 64;
+            cur_word = UINT64_C(0);
+        } else {
+            run_end = 64 * i + roaring_trailing_zeroes(~cur_word_with_1s);
+            cur_word = cur_word_with_1s & (cur_word_with_1s + 1);
+        }
+        out[2 * n_runs] = (uint16_t)run_start;
+        out[2 * n_runs + 1] = (uint16_t)(run_end - run_start - 1);
+        n_runs++;
+    }
+}
+
+static inline void portable_writer_put16(char *out, uint16_t v) {
+    uint16_t v_le = croaring_htole16(v);
+    memcpy(out, &v_le, sizeof(v_le));
+}
+
+// Serializes the container being accumulated, if any, picking the smallest
+// of the array, bitset and run representations as run_optimize would.
+static bool portable_writer_flush(roaring_portable_writer_t *w) {
+    if (w->key < 0) {
+        return true;
+    }
+    if (w->size == w->meta_capacity && !portable_writer_grow(w)) {
+        w->failed = true;
+        return false;
+    }
+    const uint64_t *words = w->words;
+    uint32_t first = w->first_word, last = w->last_word;
+    int32_t n_runs = 0;
+    for (uint32_t i = first; i < last; ++i) {
+        uint64_t word = words[i];
+        n_runs += roaring_hamming((~word) & (word << 1)) +
+                  ((word >> 63) & ~words[i + 1]);
+    }
+    n_runs += roaring_hamming((~words[last]) & (words[last] << 1)) +
+              (int32_t)(words[last] >> 63);
+
+    int32_t run_size = run_container_serialized_size_in_bytes(n_runs);
+    bool is_array = w->card <= DEFAULT_MAX_SIZE;
+    bool is_run =
+        is_array
+            ? run_size < array_container_serialized_size_in_bytes(w->card)
+            : run_size < bitset_container_serialized_size_in_bytes();
+    size_t bytes = is_run     ? (size_t)run_size
+                   : is_array ? w->card * sizeof(uint16_t)
+                              : BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+    if (w->payload_bytes + bytes > w->capacity ||
+        w->payload_bytes > UINT32_MAX) {
+        w->failed = true;
+        return false;
+    }
+    char *out = w->buf + w->payload_bytes;
+    if (is_run) {
+        int32_t written =
+            portable_writer_extract_runs(words, first, last, w->scratch);
+        assert(written == n_runs);
+        (void)written;
+        portable_writer_put16(out, (uint16_t)n_runs);
+        for (int32_t i = 0; i < 2 * n_runs; ++i) {
+            portable_writer_put16(out + 2 + 2 * i, w->scratch[i]);
+        }
+    } else if (is_array) {
+        bitset_extract_setbits_uint16(words + first, last - first + 1,
+                                      w->scratch, (uint16_t)(64 * first));
+#if CROARING_IS_BIG_ENDIAN
+        for (uint32_t i = 0; i < w->card; ++i) {
+            portable_writer_put16(out + 2 * i, w->scratch[i]);
+        }
+#else
+        memcpy(out, w->scratch, bytes);
+#endif
+    } else {
+#if CROARING_IS_BIG_ENDIAN
+        for (int32_t i = 0; i < BITSET_CONTAINER_SIZE_IN_WORDS; ++i) {
+            uint64_t w_le = croaring_htole64(words[i]);
+            memcpy(out + i * sizeof(uint64_t), &w_le, sizeof(uint64_t));
+        }
+#else
+        memcpy(out, words, bytes);
+#endif
     }
+    w->keys[w->size] = (uint16_t)w->key;
+    w->cards[w->size] = (uint16_t)(w->card - 1);
+    w->offsets[w->size] = (uint32_t)w->payload_bytes;
+    w->run_flags[w->size] = is_run;
+    w->has_run |= is_run;
+    w->size++;
+    w->payload_bytes += bytes;
+
+    memset(w->words + first, 0, (last - first + 1) * sizeof(uint64_t));
+    w->key = -1;
+    w->card = 0;
+    w->first_word = BITSET_CONTAINER_SIZE_IN_WORDS;
+    w->last_word = 0;
+    return true;
 }
 
-size_t roaring_bitmap_size_in_bytes(const roaring_bitmap_t *r) {
-    size_t portablesize = roaring_bitmap_portable_size_in_bytes(r);
-    uint64_t sizeasarray =
-        roaring_bitmap_get_cardinality(r) * sizeof(uint32_t) + sizeof(uint32_t);
-    return portablesize < sizeasarray ? portablesize + 1
-                                      : (size_t)sizeasarray + 1;
-}
-
-size_t roaring_bitmap_portable_size_in_bytes(const roaring_bitmap_t *r) {
-    return ra_portable_size_in_bytes(&r->high_low_container);
-}
-
-roaring_bitmap_t *roaring_bitmap_portable_deserialize_safe(const char *buf,
-                                                           size_t maxbytes) {
-    roaring_bitmap_t *ans =
-        (roaring_bitmap_t *)roaring_malloc(sizeof(roaring_bitmap_t));
-    if (ans == NULL) {
-        return NULL;
+// Makes `key` the container being accumulated, completing the previous one.
+static inline bool portable_writer_seek(roaring_portable_writer_t *w,
+                                        int32_t key) {
+    if (key == w->key) {
+        return true;
     }
-    size_t bytesread;
-    bool is_ok = ra_portable_deserialize(&ans->high_low_container, buf,
-                                         maxbytes, &bytesread);
-    if (!is_ok) {
-        roaring_free(ans);
-        return NULL;
+    if (key < w->key || (w->size > 0 && key <= w->keys[w->size - 1])) {
+        w->failed = true;  // input is not sorted
+        return false;
     }
-    roaring_bitmap_set_copy_on_write(ans, false);
-    if (!is_ok) {
-        roaring_free(ans);
-        return NULL;
+    if (!portable_writer_flush(w)) {
+        return false;
     }
-    return ans;
+    w->key = key;
+    return true;
 }
 
-roaring_bitmap_t *roaring_bitmap_portable_deserialize(const char *buf) {
-    return roaring_bitmap_portable_deserialize_safe(buf, SIZE_MAX);
+bool roaring_portable_writer_add_many(roaring_portable_writer_t *w,
+                                      size_t n_args, const uint32_t *vals) {
+    if (w->failed) {
+        return false;
+    }
+    for (size_t i = 0; i < n_args; ++i) {
+        uint32_t val = vals[i];
+        if ((int32_t)(val >> 16) != w->key &&
+            !portable_writer_seek(w, (int32_t)(val >> 16))) {
+            return false;
+        }
+        uint32_t low = val & 0xFFFF;
+        uint32_t index = low / 64;
+        uint64_t mask = UINT64_C(1) << (low % 64);
+        w->card += (w->words[index] & mask) == 0;
+        w->words[index] |= mask;
+        if (index < w->first_word) w->first_word = index;
+        if (index > w->last_word) w->last_word = index;
+    }
+    return true;
 }
 
-size_t roaring_bitmap_portable_deserialize_size(const char *buf,
-                                                size_t maxbytes) {
-    return ra_portable_deserialize_size(buf, maxbytes);
+bool roaring_portable_writer_add_range(roaring_portable_writer_t *w,
+                                       uint64_t min, uint64_t max) {
+    if (w->failed) {
+        return false;
+    }
+    if (max > (uint64_t)UINT32_MAX + 1) {
+        max = (uint64_t)UINT32_MAX + 1;
+    }
+    if (min >= max) {
+        return true;
+    }
+    uint32_t min_key = (uint32_t)(min >> 16);
+    uint32_t max_key = (uint32_t)((max - 1) >> 16);
+    for (uint32_t key = min_key; key <= max_key; ++key) {
+        if (!portable_writer_seek(w, (int32_t)key)) {
+            return false;
+        }
+        uint32_t lo = key == min_key ? (uint32_t)(min & 0xFFFF) : 0;
+        uint32_t hi = key == max_key ? (uint32_t)((max - 1) & 0xFFFF) : 0xFFFF;
+        w->card += (hi - lo + 1) -
+                   bitset_lenrange_cardinality(w->words, lo, hi - lo);
+        bitset_set_lenrange(w->words, lo, hi - lo);
+        if (lo / 64 < w->first_word) w->first_word = lo / 64;
+        if (hi / 64 > w->last_word) w->last_word = hi / 64;
+    }
+    return true;
 }
 
-size_t roaring_bitmap_portable_serialize(const roaring_bitmap_t *r, char *buf) {
-    return ra_portable_serialize(&r->high_low_container, buf);
+size_t roaring_portable_writer_finish(roaring_portable_writer_t *w) {
+    if (w->failed || !portable_writer_flush(w)) {
+        return 0;
+    }
+    w->failed = true;  // no more input is accepted
+    int32_t size = w->size;
+    bool has_offsets = !w->has_run || size >= NO_OFFSET_THRESHOLD;
+    size_t header_bytes;
+    if (w->has_run) {
+        header_bytes = 4 + (size + 7) / 8 + 4 * size;
+    } else {
+        header_bytes = 4 + 4 + 4 * size;
+    }
+    if (has_offsets) {
+        header_bytes += 4 * size;
+    }
+    if (header_bytes + w->payload_bytes > w->capacity ||
+        header_bytes + w->payload_bytes > UINT32_MAX) {
+        return 0;
+    }
+    // The header is only known now: shift the containers to make room.
+    memmove(w->buf + header_bytes, w->buf, w->payload_bytes);
+    char *buf = w->buf;
+    if (w->has_run) {
+        uint32_t cookie = SERIAL_COOKIE | ((uint32_t)(size - 1) << 16);
+        uint32_t cookie_le = croaring_htole32(cookie);
+        memcpy(buf, &cookie_le, sizeof(cookie_le));
+        buf += sizeof(cookie_le);
+        uint32_t s = (size + 7) / 8;
+        memset(buf, 0, s);
+        for (int32_t i = 0; i < size; ++i) {
+            if (w->run_flags[i]) {
+                buf[i / 8] |= 1 << (i % 8);
+            }
+        }
+        buf += s;
+    } else {
+        uint32_t cookie_le = croaring_htole32(SERIAL_COOKIE_NO_RUNCONTAINER);
+        memcpy(buf, &cookie_le, sizeof(cookie_le));
+        buf += sizeof(cookie_le);
+        uint32_t size_le = croaring_htole32((uint32_t)size);
+        memcpy(buf, &size_le, sizeof(size_le));
+        buf += sizeof(size_le);
+    }
+    for (int32_t k = 0; k < size; ++k) {
+        portable_writer_put16(buf, w->keys[k]);
+        portable_writer_put16(buf + 2, w->cards[k]);
+        buf += 4;
+    }
+    if (has_offsets) {
+        for (int32_t k = 0; k < size; ++k) {
+            uint32_t off_le =
+                croaring_htole32((uint32_t)header_bytes + w->offsets[k]);
+            memcpy(buf, &off_le, sizeof(off_le));
+            buf += sizeof(off_le);
+        }
+    }
+    return header_bytes + w->payload_bytes;
 }
 
 roaring_bitmap_t *roaring_bitmap_deserialize(const void *buf) {
@@ -2117,6 +3347,134 @@ size_t roaring_uint32_iterator_read_prev_ranges(
     return ret;
 }
 
+// Checks that ranges are sorted by their minimum and not inverted.
+static bool ranges_are_valid(const roaring_uint32_range_closed_t *ranges,
+                             size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (ranges[i].min > ranges[i].max ||
+            (i > 0 && ranges[i].min < ranges[i - 1].min)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ranges_append_container(roaring_array_t *ra, uint16_t key,
+                                    const rle16_t *runs, int32_t n_runs) {
+    uint8_t typecode;
+    container_t *c = container_from_runs(runs, n_runs, &typecode);
+    if (c == NULL) {
+        return false;
+    }
+    ra_append(ra, key, c, typecode);
+    return true;
+}
+
+roaring_bitmap_t *roaring_bitmap_from_ranges(
+    const roaring_uint32_range_closed_t *ranges, size_t n) {
+    if (!ranges_are_valid(ranges, n)) {
+        return NULL;
+    }
+    roaring_bitmap_t *answer = roaring_bitmap_create();
+    // The runs of the current key; a container has at most 2^15 runs.
+    rle16_t *runs = (rle16_t *)roaring_malloc((1 << 15) * sizeof(rle16_t));
+    if (answer == NULL || runs == NULL) {
+        roaring_free(runs);
+        if (answer != NULL) roaring_bitmap_free(answer);
+        return NULL;
+    }
+    roaring_array_t *ra = &answer->high_low_container;
+    int32_t n_runs = 0;
+    uint16_t key = 0;
+    bool ok = true;
+    size_t i = 0;
+    while (ok && i < n) {
+        uint32_t min = ranges[i].min, max = ranges[i].max;
+        // Merge the following ranges that overlap or touch this one.
+        for (++i; i < n && ranges[i].min <= (uint64_t)max + 1; ++i) {
+            if (ranges[i].max > max) max = ranges[i].max;
+        }
+        uint32_t first_key = min >> 16, last_key = max >> 16;
+        for (uint32_t k = first_key; ok && k <= last_key; ++k) {
+            uint16_t lo = k == first_key ? (uint16_t)min : 0;
+            uint16_t hi = k == last_key ? (uint16_t)max : 0xFFFF;
+            if (n_runs > 0 && k != key) {
+                ok = ranges_append_container(ra, key, runs, n_runs);
+                n_runs = 0;
+            }
+            if (ok && lo == 0 && hi == 0xFFFF) {
+                // Full container, no need to go through the runs.
+                run_container_t *full = run_container_create_range(0, 1 << 16);
+                ok = full != NULL;
+                if (ok) ra_append(ra, (uint16_t)k, full, RUN_CONTAINER_TYPE);
+                continue;
+            }
+            key = (uint16_t)k;
+            runs[n_runs].value = lo;
+            runs[n_runs].length = hi - lo;
+            n_runs++;
+        }
+    }
+    if (ok && n_runs > 0) {
+        ok = ranges_append_container(ra, key, runs, n_runs);
+    }
+    roaring_free(runs);
+    if (!ok) {
+        roaring_bitmap_free(answer);
+        return NULL;
+    }
+    return answer;
+}
+
+static bool roaring_bitmap_add_ranges_impl(
+    roaring_bitmap_t *r, const roaring_uint32_range_closed_t *ranges,
+    size_t n) {
+    roaring_bitmap_t *added = roaring_bitmap_from_ranges(ranges, n);
+    if (added == NULL) {
+        return false;
+    }
+    roaring_bitmap_or_inplace(r, added);
+    roaring_bitmap_free(added);
+    return true;
+}
+
+bool roaring_bitmap_add_ranges(roaring_bitmap_t *r,
+                               const roaring_uint32_range_closed_t *ranges,
+                               size_t n) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return false;
+    }
+    bool answer = roaring_bitmap_add_ranges_impl(r, ranges, n);
+    leave_allocator(previous);
+    return answer;
+}
+
+size_t roaring_bitmap_range_count(const roaring_bitmap_t *r) {
+    const roaring_array_t *ra = &r->high_low_container;
+    size_t count = 0;
+    for (int32_t i = 0; i < ra->size; ++i) {
+        count += container_number_of_runs(ra->containers[i], ra->typecodes[i]);
+        // A run reaching the end of a container goes on in the next one if
+        // that one starts with 0.
+        if (i > 0 && ra->keys[i] == ra->keys[i - 1] + 1 &&
+            container_contains(ra->containers[i], 0, ra->typecodes[i]) &&
+            container_contains(ra->containers[i - 1], 0xFFFF,
+                               ra->typecodes[i - 1])) {
+            count--;
+        }
+    }
+    return count;
+}
+
+size_t roaring_bitmap_to_ranges(const roaring_bitmap_t *r,
+                                roaring_uint32_range_closed_t *buf,
+                                size_t count) {
+    roaring_uint32_iterator_t it;
+    roaring_iterator_init(r, &it);
+    return roaring_uint32_iterator_read_ranges(&it, buf, count);
+}
+
 void roaring_uint32_iterator_free(roaring_uint32_iterator_t *it) {
     roaring_free(it);
 }
@@ -2286,9 +3644,9 @@ static void inplace_fully_flip_container(roaring_array_t *x1_arr, uint16_t hb) {
     }
 }
 
-roaring_bitmap_t *roaring_bitmap_flip(const roaring_bitmap_t *x1,
-                                      uint64_t range_start,
-                                      uint64_t range_end) {
+static roaring_bitmap_t *roaring_bitmap_flip_impl(const roaring_bitmap_t *x1,
+                                                  uint64_t range_start,
+                                                  uint64_t range_end) {
     if (range_start >= range_end || range_start > (uint64_t)UINT32_MAX + 1) {
         return roaring_bitmap_copy(x1);
     }
@@ -2296,15 +3654,24 @@ roaring_bitmap_t *roaring_bitmap_flip(const roaring_bitmap_t *x1,
                                       (uint32_t)(range_end - 1));
 }
 
-roaring_bitmap_t *roaring_bitmap_flip_closed(const roaring_bitmap_t *x1,
-                                             uint32_t range_start,
-                                             uint32_t range_end) {
+roaring_bitmap_t *roaring_bitmap_flip(const roaring_bitmap_t *x1,
+                                      uint64_t range_start,
+                                      uint64_t range_end) {
+    const roaring_allocator_t *previous = enter_result_allocator_of(x1);
+    roaring_bitmap_t *answer = roaring_bitmap_flip_impl(x1, range_start,
+                                                        range_end);
+    leave_allocator(previous);
+    return answer;
+}
+
+static roaring_bitmap_t *roaring_bitmap_flip_closed_impl(
+    const roaring_bitmap_t *x1, uint32_t range_start, uint32_t range_end) {
     if (range_start > range_end) {
         return roaring_bitmap_copy(x1);
     }
 
     roaring_bitmap_t *ans = roaring_bitmap_create();
-    roaring_bitmap_set_copy_on_write(ans, is_cow(x1));
+    roaring_bitmap_set_copy_on_write(ans, has_cow_flag(x1));
 
     uint16_t hb_start = (uint16_t)(range_start >> 16);
     const uint16_t lb_start = (uint16_t)range_start;  // & 0xFFFF;
@@ -2348,8 +3715,19 @@ roaring_bitmap_t *roaring_bitmap_flip_closed(const roaring_bitmap_t *x1,
     return ans;
 }
 
-void roaring_bitmap_flip_inplace(roaring_bitmap_t *x1, uint64_t range_start,
-                                 uint64_t range_end) {
+roaring_bitmap_t *roaring_bitmap_flip_closed(const roaring_bitmap_t *x1,
+                                             uint32_t range_start,
+                                             uint32_t range_end) {
+    const roaring_allocator_t *previous = enter_result_allocator_of(x1);
+    roaring_bitmap_t *answer = roaring_bitmap_flip_closed_impl(x1, range_start,
+                                                               range_end);
+    leave_allocator(previous);
+    return answer;
+}
+
+static void roaring_bitmap_flip_inplace_impl(roaring_bitmap_t *x1,
+                                             uint64_t range_start,
+                                             uint64_t range_end) {
     if (range_start >= range_end || range_start > (uint64_t)UINT32_MAX + 1) {
         return;
     }
@@ -2357,9 +3735,19 @@ void roaring_bitmap_flip_inplace(roaring_bitmap_t *x1, uint64_t range_start,
                                        (uint32_t)(range_end - 1));
 }
 
-void roaring_bitmap_flip_inplace_closed(roaring_bitmap_t *x1,
-                                        uint32_t range_start,
-                                        uint32_t range_end) {
+void roaring_bitmap_flip_inplace(roaring_bitmap_t *x1, uint64_t range_start,
+                                 uint64_t range_end) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(x1, &previous)) {
+        return;
+    }
+    roaring_bitmap_flip_inplace_impl(x1, range_start, range_end);
+    leave_allocator(previous);
+}
+
+static void roaring_bitmap_flip_inplace_closed_impl(roaring_bitmap_t *x1,
+                                                    uint32_t range_start,
+                                                    uint32_t range_end) {
     if (range_start > range_end) {
         return;  // empty range
     }
@@ -2395,6 +3783,17 @@ void roaring_bitmap_flip_inplace_closed(roaring_bitmap_t *x1,
     }
 }
 
+void roaring_bitmap_flip_inplace_closed(roaring_bitmap_t *x1,
+                                        uint32_t range_start,
+                                        uint32_t range_end) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(x1, &previous)) {
+        return;
+    }
+    roaring_bitmap_flip_inplace_closed_impl(x1, range_start, range_end);
+    leave_allocator(previous);
+}
+
 static void offset_append_with_merge(roaring_array_t *ra, int k, container_t *c,
                                      uint8_t t) {
     int size = ra_get_size(ra);
@@ -2428,8 +3827,8 @@ static void offset_append_with_merge(roaring_array_t *ra, int k, container_t *c,
 // outside of the range [0,2^32), that the element will be dropped.
 // We need "offset" to be 64 bits because we want to support values
 // between -0xFFFFFFFF up to +0xFFFFFFFF.
-roaring_bitmap_t *roaring_bitmap_add_offset(const roaring_bitmap_t *bm,
-                                            int64_t offset) {
+static roaring_bitmap_t *roaring_bitmap_add_offset_impl(
+    const roaring_bitmap_t *bm, int64_t offset) {
     roaring_bitmap_t *answer;
     roaring_array_t *ans_ra;
     int64_t container_offset;
@@ -2506,9 +3905,17 @@ roaring_bitmap_t *roaring_bitmap_add_offset(const roaring_bitmap_t *bm,
     return answer;
 }
 
-roaring_bitmap_t *roaring_bitmap_lazy_or(const roaring_bitmap_t *x1,
-                                         const roaring_bitmap_t *x2,
-                                         const bool bitsetconversion) {
+roaring_bitmap_t *roaring_bitmap_add_offset(const roaring_bitmap_t *bm,
+                                            int64_t offset) {
+    const roaring_allocator_t *previous = enter_result_allocator_of(bm);
+    roaring_bitmap_t *answer = roaring_bitmap_add_offset_impl(bm, offset);
+    leave_allocator(previous);
+    return answer;
+}
+
+static roaring_bitmap_t *roaring_bitmap_lazy_or_impl(
+    const roaring_bitmap_t *x1, const roaring_bitmap_t *x2,
+    const bool bitsetconversion) {
     uint8_t result_type = 0;
     const int length1 = x1->high_low_container.size,
               length2 = x2->high_low_container.size;
@@ -2520,7 +3927,8 @@ roaring_bitmap_t *roaring_bitmap_lazy_or(const roaring_bitmap_t *x1,
     }
     roaring_bitmap_t *answer =
         roaring_bitmap_create_with_capacity(length1 + length2);
-    roaring_bitmap_set_copy_on_write(answer, is_cow(x1) || is_cow(x2));
+    roaring_bitmap_set_copy_on_write(answer,
+                                     has_cow_flag(x1) || has_cow_flag(x2));
     int pos1 = 0, pos2 = 0;
     uint8_t type1, type2;
     uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, (uint16_t)pos1);
@@ -2597,9 +4005,19 @@ roaring_bitmap_t *roaring_bitmap_lazy_or(const roaring_bitmap_t *x1,
     return answer;
 }
 
-void roaring_bitmap_lazy_or_inplace(roaring_bitmap_t *x1,
-                                    const roaring_bitmap_t *x2,
-                                    const bool bitsetconversion) {
+roaring_bitmap_t *roaring_bitmap_lazy_or(const roaring_bitmap_t *x1,
+                                         const roaring_bitmap_t *x2,
+                                         const bool bitsetconversion) {
+    const roaring_allocator_t *previous = enter_result_allocator_of(x1);
+    roaring_bitmap_t *answer = roaring_bitmap_lazy_or_impl(x1, x2,
+                                                           bitsetconversion);
+    leave_allocator(previous);
+    return answer;
+}
+
+static void roaring_bitmap_lazy_or_inplace_impl(roaring_bitmap_t *x1,
+                                                const roaring_bitmap_t *x2,
+                                                const bool bitsetconversion) {
     uint8_t result_type = 0;
     int length1 = x1->high_low_container.size;
     const int length2 = x2->high_low_container.size;
@@ -2681,8 +4099,19 @@ void roaring_bitmap_lazy_or_inplace(roaring_bitmap_t *x1,
     }
 }
 
-roaring_bitmap_t *roaring_bitmap_lazy_xor(const roaring_bitmap_t *x1,
-                                          const roaring_bitmap_t *x2) {
+void roaring_bitmap_lazy_or_inplace(roaring_bitmap_t *x1,
+                                    const roaring_bitmap_t *x2,
+                                    const bool bitsetconversion) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(x1, &previous)) {
+        return;
+    }
+    roaring_bitmap_lazy_or_inplace_impl(x1, x2, bitsetconversion);
+    leave_allocator(previous);
+}
+
+static roaring_bitmap_t *roaring_bitmap_lazy_xor_impl(
+    const roaring_bitmap_t *x1, const roaring_bitmap_t *x2) {
     uint8_t result_type = 0;
     const int length1 = x1->high_low_container.size,
               length2 = x2->high_low_container.size;
@@ -2694,7 +4123,8 @@ roaring_bitmap_t *roaring_bitmap_lazy_xor(const roaring_bitmap_t *x1,
     }
     roaring_bitmap_t *answer =
         roaring_bitmap_create_with_capacity(length1 + length2);
-    roaring_bitmap_set_copy_on_write(answer, is_cow(x1) || is_cow(x2));
+    roaring_bitmap_set_copy_on_write(answer,
+                                     has_cow_flag(x1) || has_cow_flag(x2));
     int pos1 = 0, pos2 = 0;
     uint8_t type1, type2;
     uint16_t s1 = ra_get_key_at_index(&x1->high_low_container, (uint16_t)pos1);
@@ -2760,8 +4190,16 @@ roaring_bitmap_t *roaring_bitmap_lazy_xor(const roaring_bitmap_t *x1,
     return answer;
 }
 
-void roaring_bitmap_lazy_xor_inplace(roaring_bitmap_t *x1,
-                                     const roaring_bitmap_t *x2) {
+roaring_bitmap_t *roaring_bitmap_lazy_xor(const roaring_bitmap_t *x1,
+                                          const roaring_bitmap_t *x2) {
+    const roaring_allocator_t *previous = enter_result_allocator_of(x1);
+    roaring_bitmap_t *answer = roaring_bitmap_lazy_xor_impl(x1, x2);
+    leave_allocator(previous);
+    return answer;
+}
+
+static void roaring_bitmap_lazy_xor_inplace_impl(roaring_bitmap_t *x1,
+                                                 const roaring_bitmap_t *x2) {
     assert(x1 != x2);
     uint8_t result_type = 0;
     int length1 = x1->high_low_container.size;
@@ -2842,7 +4280,17 @@ void roaring_bitmap_lazy_xor_inplace(roaring_bitmap_t *x1,
     }
 }
 
-void roaring_bitmap_repair_after_lazy(roaring_bitmap_t *r) {
+void roaring_bitmap_lazy_xor_inplace(roaring_bitmap_t *x1,
+                                     const roaring_bitmap_t *x2) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(x1, &previous)) {
+        return;
+    }
+    roaring_bitmap_lazy_xor_inplace_impl(x1, x2);
+    leave_allocator(previous);
+}
+
+static void roaring_bitmap_repair_after_lazy_impl(roaring_bitmap_t *r) {
     roaring_array_t *ra = &r->high_low_container;
 
     for (int i = 0; i < ra->size; ++i) {
@@ -2855,6 +4303,15 @@ void roaring_bitmap_repair_after_lazy(roaring_bitmap_t *r) {
     }
 }
 
+void roaring_bitmap_repair_after_lazy(roaring_bitmap_t *r) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify(r, &previous)) {
+        return;
+    }
+    roaring_bitmap_repair_after_lazy_impl(r);
+    leave_allocator(previous);
+}
+
 /**
  * roaring_bitmap_rank returns the number of integers that are smaller or equal
  * to x.
@@ -3208,19 +4665,21 @@ size_t roaring_bitmap_frozen_size_in_bytes(const roaring_bitmap_t *rb) {
     const roaring_array_t *ra = &rb->high_low_container;
     size_t num_bytes = 0;
     for (int32_t i = 0; i < ra->size; i++) {
-        switch (ra->typecodes[i]) {
+        uint8_t typecode = ra->typecodes[i];
+        const container_t *c =
+            container_unwrap_shared(ra->containers[i], &typecode);
+        switch (typecode) {
             case BITSET_CONTAINER_TYPE: {
                 num_bytes += BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
                 break;
             }
             case RUN_CONTAINER_TYPE: {
-                const run_container_t *rc = const_CAST_run(ra->containers[i]);
+                const run_container_t *rc = const_CAST_run(c);
                 num_bytes += rc->n_runs * sizeof(rle16_t);
                 break;
             }
             case ARRAY_CONTAINER_TYPE: {
-                const array_container_t *ac =
-                    const_CAST_array(ra->containers[i]);
+                const array_container_t *ac = const_CAST_array(c);
                 num_bytes += ac->cardinality * sizeof(uint16_t);
                 break;
             }
@@ -3251,20 +4710,22 @@ void roaring_bitmap_frozen_serialize(const roaring_bitmap_t *rb, char *buf) {
     size_t run_zone_size = 0;
     size_t array_zone_size = 0;
     for (int32_t i = 0; i < ra->size; i++) {
-        switch (ra->typecodes[i]) {
+        uint8_t typecode = ra->typecodes[i];
+        const container_t *c =
+            container_unwrap_shared(ra->containers[i], &typecode);
+        switch (typecode) {
             case BITSET_CONTAINER_TYPE: {
                 bitset_zone_size +=
                     BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
                 break;
             }
             case RUN_CONTAINER_TYPE: {
-                const run_container_t *rc = const_CAST_run(ra->containers[i]);
+                const run_container_t *rc = const_CAST_run(c);
                 run_zone_size += rc->n_runs * sizeof(rle16_t);
                 break;
             }
             case ARRAY_CONTAINER_TYPE: {
-                const array_container_t *ac =
-                    const_CAST_array(ra->containers[i]);
+                const array_container_t *ac = const_CAST_array(c);
                 array_zone_size += ac->cardinality * sizeof(uint16_t);
                 break;
             }
@@ -3283,10 +4744,13 @@ void roaring_bitmap_frozen_serialize(const roaring_bitmap_t *rb, char *buf) {
 
     for (int32_t i = 0; i < ra->size; i++) {
         uint16_t count;
-        switch (ra->typecodes[i]) {
+        // Shared containers are written out in full.
+        uint8_t typecode = ra->typecodes[i];
+        const container_t *c =
+            container_unwrap_shared(ra->containers[i], &typecode);
+        switch (typecode) {
             case BITSET_CONTAINER_TYPE: {
-                const bitset_container_t *bc =
-                    const_CAST_bitset(ra->containers[i]);
+                const bitset_container_t *bc = const_CAST_bitset(c);
                 memcpy(bitset_zone, bc->words,
                        BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t));
                 bitset_zone += BITSET_CONTAINER_SIZE_IN_WORDS;
@@ -3300,7 +4764,7 @@ void roaring_bitmap_frozen_serialize(const roaring_bitmap_t *rb, char *buf) {
                 break;
             }
             case RUN_CONTAINER_TYPE: {
-                const run_container_t *rc = const_CAST_run(ra->containers[i]);
+                const run_container_t *rc = const_CAST_run(c);
                 size_t num_bytes = rc->n_runs * sizeof(rle16_t);
                 memcpy(run_zone, rc->runs, num_bytes);
                 run_zone += rc->n_runs;
@@ -3308,8 +4772,7 @@ void roaring_bitmap_frozen_serialize(const roaring_bitmap_t *rb, char *buf) {
                 break;
             }
             case ARRAY_CONTAINER_TYPE: {
-                const array_container_t *ac =
-                    const_CAST_array(ra->containers[i]);
+                const array_container_t *ac = const_CAST_array(c);
                 size_t num_bytes = ac->cardinality * sizeof(uint16_t);
                 memcpy(array_zone, ac->array, num_bytes);
                 array_zone += ac->cardinality;
@@ -3320,9 +4783,9 @@ void roaring_bitmap_frozen_serialize(const roaring_bitmap_t *rb, char *buf) {
                 roaring_unreachable;
         }
         memcpy(&count_zone[i], &count, 2);
+        typecode_zone[i] = typecode;
     }
     memcpy(key_zone, ra->keys, ra->size * sizeof(uint16_t));
-    memcpy(typecode_zone, ra->typecodes, ra->size * sizeof(uint8_t));
     uint32_t header = ((uint32_t)ra->size << 15) | FROZEN_COOKIE;
     memcpy(header_zone, &header, 4);
 }
@@ -3386,8 +4849,12 @@ const roaring_bitmap_t *roaring_bitmap_frozen_view(const char *buf,
     rle16_t *run_zone = (rle16_t *)(buf + bitset_zone_size);
     uint16_t *array_zone = (uint16_t *)(buf + bitset_zone_size + run_zone_size);
 
+    const roaring_allocator_t *allocator = roaring_allocator_current();
     size_t alloc_size = 0;
     alloc_size += sizeof(roaring_bitmap_t);
+    if (allocator != NULL) {
+        alloc_size += sizeof(allocator);
+    }
     alloc_size += num_containers * sizeof(container_t *);
     alloc_size += num_bitset_containers * sizeof(bitset_container_t);
     alloc_size += num_run_containers * sizeof(run_container_t);
@@ -3401,6 +4868,11 @@ const roaring_bitmap_t *roaring_bitmap_frozen_view(const char *buf,
     roaring_bitmap_t *rb =
         (roaring_bitmap_t *)arena_alloc(&arena, sizeof(roaring_bitmap_t));
     rb->high_low_container.flags = ROARING_FLAG_FROZEN;
+    if (allocator != NULL) {  // see ra_get_allocator()
+        memcpy(arena_alloc(&arena, sizeof(allocator)), &allocator,
+               sizeof(allocator));
+        rb->high_low_container.flags |= ROARING_FLAG_ALLOCATOR;
+    }
     rb->high_low_container.allocation_size = num_containers;
     rb->high_low_container.size = num_containers;
     rb->high_low_container.keys = (uint16_t *)keys;
@@ -3408,13 +4880,15 @@ const roaring_bitmap_t *roaring_bitmap_frozen_view(const char *buf,
     rb->high_low_container.containers = (container_t **)arena_alloc(
         &arena, sizeof(container_t *) * num_containers);
     // Ensure offset of high_low_container.containers is known distance used in
-    // C++ wrapper. sizeof(roaring_bitmap_t) is used as it is the size of the
-    // only allocation that precedes high_low_container.containers. If this is
+    // C++ wrapper. sizeof(roaring_bitmap_t), plus the allocator slot with
+    // ROARING_FLAG_ALLOCATOR, is used as they are the sizes of the only
+    // allocations that precede high_low_container.containers. If this is
     // changed (new allocation or changed order), this offset will also need to
     // be changed in the C++ wrapper.
     assert(rb ==
            (roaring_bitmap_t *)((char *)rb->high_low_container.containers -
-                                sizeof(roaring_bitmap_t)));
+                                sizeof(roaring_bitmap_t) -
+                                (allocator != NULL ? sizeof(allocator) : 0)));
     for (int32_t i = 0; i < num_containers; i++) {
         switch (typecodes[i]) {
             case BITSET_CONTAINER_TYPE: {
@@ -3442,6 +4916,7 @@ const roaring_bitmap_t *roaring_bitmap_frozen_view(const char *buf,
                 array->capacity = counts[i] + UINT32_C(1);
                 array->cardinality = counts[i] + UINT32_C(1);
                 array->array = array_zone;
+                array->inline_values = false;
                 rb->high_low_container.containers[i] = array;
                 array_zone += counts[i] + UINT32_C(1);
                 break;
@@ -3527,8 +5002,12 @@ roaring_bitmap_t *roaring_bitmap_portable_deserialize_frozen(const char *buf) {
         }
     }
 
+    const roaring_allocator_t *allocator = roaring_allocator_current();
     size_t alloc_size = 0;
     alloc_size += sizeof(roaring_bitmap_t);
+    if (allocator != NULL) {
+        alloc_size += sizeof(allocator);
+    }
     alloc_size += num_containers * sizeof(container_t *);
     alloc_size += num_bitset_containers * sizeof(bitset_container_t);
     alloc_size += num_run_containers * sizeof(run_container_t);
@@ -3545,6 +5024,11 @@ roaring_bitmap_t *roaring_bitmap_portable_deserialize_frozen(const char *buf) {
     roaring_bitmap_t *rb =
         (roaring_bitmap_t *)arena_alloc(&arena, sizeof(roaring_bitmap_t));
     rb->high_low_container.flags = ROARING_FLAG_FROZEN;
+    if (allocator != NULL) {  // see ra_get_allocator()
+        memcpy(arena_alloc(&arena, sizeof(allocator)), &allocator,
+               sizeof(allocator));
+        rb->high_low_container.flags |= ROARING_FLAG_ALLOCATOR;
+    }
     rb->high_low_container.allocation_size = num_containers;
     rb->high_low_container.size = num_containers;
     rb->high_low_container.containers = (container_t **)arena_alloc(
@@ -3611,6 +5095,7 @@ roaring_bitmap_t *roaring_bitmap_portable_deserialize_frozen(const char *buf) {
                 &arena, sizeof(array_container_t));
             c->cardinality = cardinality;
             c->capacity = cardinality;
+            c->inline_values = false;
             if (offset_headers != NULL) {
                 c->array = (uint16_t *)(start_of_buf + offset_headers[i]);
             } else {
@@ -3667,6 +5152,140 @@ bool roaring_bitmap_to_bitset(const roaring_bitmap_t *r, bitset_t *bitset) {
     return true;
 }
 
+roaring_bitmap_t *roaring_bitmap_from_bitset(const bitset_t *bitset) {
+    size_t num_words = bitset->arraysize;
+    const size_t max_words = (size_t)1 << 26;  // 2^32 bits
+    for (size_t i = max_words; i < num_words; ++i) {
+        if (bitset->array[i] != 0) {
+            return NULL;
+        }
+    }
+    if (num_words > max_words) num_words = max_words;
+    uint32_t num_windows =
+        (uint32_t)((num_words + BITSET_CONTAINER_SIZE_IN_WORDS - 1) /
+                   BITSET_CONTAINER_SIZE_IN_WORDS);
+    roaring_bitmap_t *answer = roaring_bitmap_create_with_capacity(num_windows);
+    if (answer == NULL) {
+        return NULL;
+    }
+    roaring_array_t *ra = &answer->high_low_container;
+    // Each window is copied into `bc`, which becomes the container when the
+    // window stays a bitset and is reused otherwise.
+    bitset_container_t *bc = NULL;
+    for (uint32_t key = 0; key < num_windows; ++key) {
+        if (bc == NULL) {
+            bc = bitset_container_create_uninitialized();
+            if (bc == NULL) {
+                roaring_bitmap_free(answer);
+                return NULL;
+            }
+        }
+        size_t first = (size_t)key * BITSET_CONTAINER_SIZE_IN_WORDS;
+        size_t len = num_words - first;
+        if (len >= BITSET_CONTAINER_SIZE_IN_WORDS) {
+            len = BITSET_CONTAINER_SIZE_IN_WORDS;
+        } else {
+            memset(bc->words + len, 0,
+                   (BITSET_CONTAINER_SIZE_IN_WORDS - len) * sizeof(uint64_t));
+        }
+        memcpy(bc->words, bitset->array + first, len * sizeof(uint64_t));
+        int32_t card = bitset_container_compute_cardinality(bc);
+        if (card == 0) {
+            continue;
+        }
+        bc->cardinality = card;
+        // Same choice as run_optimize.
+        int32_t n_runs = bitset_container_number_of_runs(bc);
+        int32_t size_as_run = run_container_serialized_size_in_bytes(n_runs);
+        container_t *c;
+        uint8_t type;
+        if (card <= DEFAULT_MAX_SIZE &&
+            array_container_serialized_size_in_bytes(card) <= size_as_run) {
+            c = array_container_from_bitset(bc);
+            type = ARRAY_CONTAINER_TYPE;
+        } else if (bitset_container_serialized_size_in_bytes() <=
+                   size_as_run) {
+            c = bc;
+            bc = NULL;
+            type = BITSET_CONTAINER_TYPE;
+        } else {
+            c = run_container_from_bitset(bc, n_runs);
+            type = RUN_CONTAINER_TYPE;
+        }
+        if (c == NULL) {
+            if (bc != NULL) bitset_container_free(bc);
+            roaring_bitmap_free(answer);
+            return NULL;
+        }
+        ra_append(ra, (uint16_t)key, c, type);
+    }
+    if (bc != NULL) {
+        bitset_container_free(bc);
+    }
+    return answer;
+}
+
+void roaring_bitmap_to_bitset_window(const roaring_bitmap_t *r,
+                                     uint64_t *words, uint32_t first_word,
+                                     size_t num_words) {
+    memset(words, 0, num_words * sizeof(uint64_t));
+    uint64_t end_word = (uint64_t)first_word + num_words;
+    if (end_word > ((uint64_t)1 << 26)) end_word = (uint64_t)1 << 26;
+    if (end_word <= first_word) {
+        return;
+    }
+    // Values [begin, end) land in words.
+    uint64_t begin = (uint64_t)first_word * 64, end = end_word * 64;
+    const roaring_array_t *ra = &r->high_low_container;
+    for (int32_t i = ra_advance_until(ra, (uint16_t)(begin >> 16), -1);
+         i < ra->size && ra->keys[i] <= (end - 1) >> 16; ++i) {
+        uint64_t base = (uint64_t)ra->keys[i] << 16;
+        uint8_t type = ra->typecodes[i];
+        const container_t *c =
+            container_unwrap_shared(ra->containers[i], &type);
+        // Container values [lo, hi] are inside the window.
+        uint32_t lo = base < begin ? (uint32_t)(begin - base) : 0;
+        uint32_t hi =
+            base + 0xFFFF >= end ? (uint32_t)(end - 1 - base) : 0xFFFF;
+        // Bit of container value v: v + shift in words.
+        uint64_t shift = base - begin;
+        switch (type) {
+            case BITSET_CONTAINER_TYPE:
+                memcpy(words + (shift + lo) / 64,
+                       const_CAST_bitset(c)->words + lo / 64,
+                       ((hi - lo) / 64 + 1) * sizeof(uint64_t));
+                break;
+            case ARRAY_CONTAINER_TYPE: {
+                const array_container_t *array = const_CAST_array(c);
+                for (int32_t j = 0; j < array->cardinality; ++j) {
+                    uint32_t v = array->array[j];
+                    if (v >= lo && v <= hi) {
+                        uint64_t bit = shift + v;
+                        words[bit / 64] |= UINT64_C(1) << (bit % 64);
+                    }
+                }
+                break;
+            }
+            case RUN_CONTAINER_TYPE: {
+                const run_container_t *run = const_CAST_run(c);
+                for (int32_t j = 0; j < run->n_runs; ++j) {
+                    uint32_t start = run->runs[j].value;
+                    uint32_t last = start + run->runs[j].length;
+                    if (start < lo) start = lo;
+                    if (last > hi) last = hi;
+                    if (start <= last) {
+                        bitset_set_lenrange(words, (uint32_t)(shift + start),
+                                            last - start);
+                    }
+                }
+                break;
+            }
+            default:
+                roaring_unreachable;
+        }
+    }
+}
+
 #ifdef __cplusplus
 }
 }
@@ -2,8 +2,10 @@
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include <roaring/allocator_switch.h>
 #include <roaring/art/art.h>
 #include <roaring/portability.h>
 #include <roaring/roaring64.h>
@@ -16,6 +18,7 @@
 #include <roaring/roaring_array.h>
 // containers.h last to avoid conflict with ROARING_CONTAINER_T.
 #include <roaring/containers/containers.h>
+#include <roaring/interner.h>
 
 #define CROARING_ALIGN_BUF(buf, alignment)          \
     (char *)(((uintptr_t)(buf) + ((alignment)-1)) & \
@@ -31,7 +34,6 @@ namespace roaring {
 namespace api {
 #endif
 
-// TODO: Copy on write.
 // TODO: Error on failed allocation.
 
 typedef struct roaring64_bitmap_s {
@@ -43,13 +45,38 @@ typedef struct roaring64_bitmap_s {
     // Parallel to containers[]. Live slots (non-NULL pointers) have the
     // matching typecode; NULL slots are skipped and their typecodes ignored.
     uint8_t *typecodes;
+    // The number of slots of containers[] in use, i.e., of non-inline leaves.
+    uint64_t live_containers;
+    // The number of values held by inline leaves, which containers[] misses.
+    uint64_t inline_cardinality;
+    // Sealed bitmaps only, NULL otherwise: the number of values before each
+    // leaf of the compacted ART, by leaf number (i.e., in key order), then the
+    // cardinality. Turns rank and select into lookups.
+    const uint64_t *cumulative_cardinalities;
+    const roaring_allocator_t *allocator;  // NULL for the memory hook
 } roaring64_bitmap_t;
 
 // Leaf type of the ART used to keep the high 48 bits of each entry.
 // Low 8 bits: typecode
 // High 56 bits: container index
+//
+// Chunks of at most INLINE_LEAF_CAPACITY values have no container: their leaf
+// is an inline leaf instead, with INLINE_LEAF_FLAG and the number of values in
+// the low 8 bits, and the values in increasing order from bit 16 up. Sparse
+// bitmaps, e.g., of hashed 64-bit ids, then cost a leaf per value rather than
+// a leaf, a container slot and an array container.
 typedef roaring64_leaf_t leaf_t;
 
+#define INLINE_LEAF_FLAG 0x80
+#define INLINE_LEAF_CAPACITY 3
+
+// The values of an inline leaf as an array container, for code that reads
+// containers.
+typedef struct leaf_view_s {
+    array_container_t array;
+    uint16_t values[INLINE_LEAF_CAPACITY];
+} leaf_view_t;
+
 // Iterator struct to hold iteration state.
 typedef struct roaring64_iterator_s {
     // The order here is deliberate: everything `roaring64_iterator_advance`
@@ -93,12 +120,55 @@ typedef struct roaring64_iterator_s {
 
     const roaring64_bitmap_t *r;
     art_iterator_t art_it;
+    // Holds the values of the current leaf if it is an inline leaf.
+    leaf_view_t view;
 } roaring64_iterator_t;
 
 static inline bool is_frozen64(const roaring64_bitmap_t *r) {
     return r->flags & ROARING_FLAG_FROZEN;
 }
 
+static inline bool is_sealed64(const roaring64_bitmap_t *r) {
+    return r->flags & ROARING_FLAG_SEALED;
+}
+
+// Whether copies share the containers of `r` (see
+// roaring64_bitmap_set_copy_on_write). The containers of a frozen bitmap alias
+// a caller buffer, those of a sealed bitmap live in its block: they are always
+// cloned.
+static inline bool is_cow64(const roaring64_bitmap_t *r) {
+    return (r->flags & (ROARING_FLAG_COW | ROARING_FLAG_FROZEN |
+                        ROARING_FLAG_SEALED)) == ROARING_FLAG_COW;
+}
+
+// Makes the allocator of `r` current, see allocator_switch.h.
+static inline const roaring_allocator_t *enter_allocator_of64(
+    const roaring64_bitmap_t *r) {
+    return switch_allocator(r->allocator);
+}
+
+static bool roaring64_bitmap_unseal_impl(roaring64_bitmap_t *r);
+
+// Like enter_allocator_of64(), for the public functions that modify `r`: a
+// sealed bitmap is unsealed first. Returns false, with the allocator left
+// already, if that fails: the bitmap is still sealed and must not be modified.
+static inline bool enter_allocator_to_modify64(
+    roaring64_bitmap_t *r, const roaring_allocator_t **previous) {
+    *previous = enter_allocator_of64(r);
+    if (is_sealed64(r) && !roaring64_bitmap_unseal_impl(r)) {
+        leave_allocator(*previous);
+        return false;
+    }
+    return true;
+}
+
+// For the results of the public functions, `r` being their first argument
+// (NULL when there is none).
+static inline const roaring_allocator_t *enter_result_allocator_of64(
+    const roaring64_bitmap_t *r) {
+    return enter_result_allocator(r != NULL ? r->allocator : NULL);
+}
+
 static inline bool is_frozen_art64(const roaring64_bitmap_t *r) {
     return r->flags & ROARING_FLAG_FROZEN_ART;
 }
@@ -146,15 +216,108 @@ static inline leaf_t create_leaf(uint64_t container_index, uint8_t typecode) {
     return (container_index << 8) | typecode;
 }
 
+// Stored in a bulk context by `roaring64_bitmap_contains_bulk` when the high
+// 48 bits of the context are absent from the bitmap. Never dereferenced.
+static leaf_t absent_leaf;
+#define ABSENT_LEAF (&absent_leaf)
+
 static inline uint8_t get_typecode(leaf_t leaf) { return (uint8_t)leaf; }
 
 static inline uint64_t get_index(leaf_t leaf) { return leaf >> 8; }
 
+static inline bool is_inline_leaf(leaf_t leaf) {
+    return (leaf & INLINE_LEAF_FLAG) != 0;
+}
+
+static inline int inline_leaf_cardinality(leaf_t leaf) {
+    return (int)(leaf & (INLINE_LEAF_FLAG - 1));
+}
+
+static inline uint16_t inline_leaf_value(leaf_t leaf, int i) {
+    return (uint16_t)(leaf >> (16 * (i + 1)));
+}
+
+// `values` must be sorted, and hold at most INLINE_LEAF_CAPACITY values.
+static inline leaf_t create_inline_leaf(const uint16_t *values, int n) {
+    leaf_t leaf = INLINE_LEAF_FLAG | (leaf_t)n;
+    for (int i = 0; i < n; ++i) {
+        leaf |= (leaf_t)values[i] << (16 * (i + 1));
+    }
+    return leaf;
+}
+
+static inline int inline_leaf_values(leaf_t leaf, uint16_t *values) {
+    int n = inline_leaf_cardinality(leaf);
+    for (int i = 0; i < n; ++i) {
+        values[i] = inline_leaf_value(leaf, i);
+    }
+    return n;
+}
+
+static inline bool inline_leaf_contains(leaf_t leaf, uint16_t low16) {
+    int n = inline_leaf_cardinality(leaf);
+    for (int i = 0; i < n; ++i) {
+        if (inline_leaf_value(leaf, i) == low16) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static inline const container_t *view_inline_leaf(leaf_t leaf,
+                                                  leaf_view_t *view) {
+    int n = inline_leaf_values(leaf, view->values);
+    view->array.cardinality = n;
+    view->array.capacity = n;
+    view->array.array = view->values;
+    view->array.inline_values = false;
+    return &view->array;
+}
+
+// Must not be called with an inline leaf, see get_leaf_container.
 static inline container_t *get_container(const roaring64_bitmap_t *r,
                                          leaf_t leaf) {
+    assert(!is_inline_leaf(leaf));
     return r->containers[get_index(leaf)];
 }
 
+// Returns the container holding the values of `leaf`, and its typecode. The
+// values of an inline leaf are read into `view`.
+static inline const container_t *get_leaf_container(const roaring64_bitmap_t *r,
+                                                    leaf_t leaf,
+                                                    uint8_t *typecode,
+                                                    leaf_view_t *view) {
+    if (is_inline_leaf(leaf)) {
+        *typecode = ARRAY_CONTAINER_TYPE;
+        return view_inline_leaf(leaf, view);
+    }
+    *typecode = get_typecode(leaf);
+    return get_container(r, leaf);
+}
+
+static inline uint64_t leaf_cardinality(const roaring64_bitmap_t *r,
+                                        leaf_t leaf) {
+    if (is_inline_leaf(leaf)) {
+        return inline_leaf_cardinality(leaf);
+    }
+    return container_get_cardinality(get_container(r, leaf),
+                                      get_typecode(leaf));
+}
+
+static inline bool is_shared_full_leaf(const roaring64_bitmap_t *r,
+                                       leaf_t leaf) {
+    return get_typecode(leaf) == SHARED_CONTAINER_TYPE &&
+           get_container(r, leaf) == shared_container_full();
+}
+
+// Frees the container of `leaf`, if it has one.
+static inline void free_leaf_container(const roaring64_bitmap_t *r,
+                                       leaf_t leaf) {
+    if (!is_inline_leaf(leaf)) {
+        container_free(get_container(r, leaf), get_typecode(leaf));
+    }
+}
+
 // Writes the pointer and its typecode together so they cannot drift.
 static inline void set_container_at(roaring64_bitmap_t *r, uint64_t index,
                                     container_t *container, uint8_t typecode) {
@@ -162,12 +325,20 @@ static inline void set_container_at(roaring64_bitmap_t *r, uint64_t index,
     r->typecodes[index] = typecode;
 }
 
+static uint64_t allocate_index(roaring64_bitmap_t *r);
+
 // Replaces the container of `leaf` with the given container. Returns the
-// modified leaf for convenience.
+// modified leaf for convenience. An inline leaf gets a container slot.
 static inline leaf_t replace_container(roaring64_bitmap_t *r, leaf_t *leaf,
                                        container_t *container,
                                        uint8_t typecode) {
-    uint64_t index = get_index(*leaf);
+    uint64_t index;
+    if (is_inline_leaf(*leaf)) {
+        r->inline_cardinality -= inline_leaf_cardinality(*leaf);
+        index = allocate_index(r);
+    } else {
+        index = get_index(*leaf);
+    }
     set_container_at(r, index, container, typecode);
     *leaf = create_leaf(index, typecode);
     return *leaf;
@@ -213,11 +384,23 @@ static uint64_t allocate_index(roaring64_bitmap_t *r) {
         extend_containers(r);
     }
     r->first_free = next_free_container_idx(r);
+    r->live_containers++;
     return first_free;
 }
 
+// Takes ownership of the container. Tiny array containers are freed and their
+// values kept inline, so callers must not use the container afterwards.
 static leaf_t add_container(roaring64_bitmap_t *r, container_t *container,
                             uint8_t typecode) {
+    if (typecode == ARRAY_CONTAINER_TYPE && container != NULL) {
+        const array_container_t *ac = const_CAST_array(container);
+        if (ac->cardinality > 0 && ac->cardinality <= INLINE_LEAF_CAPACITY) {
+            leaf_t leaf = create_inline_leaf(ac->array, ac->cardinality);
+            r->inline_cardinality += ac->cardinality;
+            container_free(container, typecode);
+            return leaf;
+        }
+    }
     uint64_t index = allocate_index(r);
     set_container_at(r, index, container, typecode);
     return create_leaf(index, typecode);
@@ -254,24 +437,201 @@ static void ensure_container_capacity(roaring64_bitmap_t *r, uint64_t extra) {
     r->capacity = new_capacity;
 }
 
+// Releases the container slot of `leaf`, without freeing the container.
 static void remove_container(roaring64_bitmap_t *r, leaf_t leaf) {
+    if (is_inline_leaf(leaf)) {
+        r->inline_cardinality -= inline_leaf_cardinality(leaf);
+        return;
+    }
     uint64_t index = get_index(leaf);
     r->containers[index] = NULL;
+    r->live_containers--;
     if (index < r->first_free) {
         r->first_free = index;
     }
 }
 
+// Moves the live containers to the front of containers[] in key order, and
+// releases the free slots. Each leaf is rewritten in place, so pointers to
+// leaves (as in bulk contexts) stay valid. Returns false on allocation
+// failure, in which case nothing changed.
+static bool compact_containers(roaring64_bitmap_t *r) {
+    uint64_t n = r->live_containers;
+    container_t **containers = NULL;
+    uint8_t *typecodes = NULL;
+    if (n > 0) {
+        containers = (container_t **)roaring_malloc(n * sizeof(container_t *));
+        typecodes = (uint8_t *)roaring_malloc(n * sizeof(uint8_t));
+        if (containers == NULL || typecodes == NULL) {
+            roaring_free(containers);
+            roaring_free(typecodes);
+            return false;
+        }
+    }
+    uint64_t k = 0;
+    art_iterator_t it = art_init_iterator(&r->art, /*first=*/true);
+    while (it.value != NULL) {
+        leaf_t *leaf = (leaf_t *)it.value;
+        if (!is_inline_leaf(*leaf)) {
+            uint64_t index = get_index(*leaf);
+            containers[k] = r->containers[index];
+            typecodes[k] = r->typecodes[index];
+            *leaf = create_leaf(k, get_typecode(*leaf));
+            k++;
+        }
+        art_iterator_next(&it);
+    }
+    assert(k == n);
+    roaring_free(r->containers);
+    roaring_free(r->typecodes);
+    r->containers = containers;
+    r->typecodes = typecodes;
+    r->capacity = n;
+    r->first_free = n;
+    return true;
+}
+
+// Bitmaps that shrank a lot are compacted by the functions that remove
+// containers, so that containers[] does not stay mostly empty.
+#define COMPACT_MIN_CAPACITY 64
+
+static inline void compact_if_sparse(roaring64_bitmap_t *r) {
+    if (r->capacity >= COMPACT_MIN_CAPACITY &&
+        r->live_containers < r->capacity / 4 && !is_frozen64(r) &&
+        !is_sealed64(r)) {
+        compact_containers(r);
+    }
+}
+
+// Containers shared by copy-on-write bitmaps are wrapped in a
+// shared_container_t. Returns the container holding the values of `leaf`, and
+// its actual typecode, for code that reads containers directly.
+static inline const container_t *get_actual_container(
+    const roaring64_bitmap_t *r, leaf_t leaf, uint8_t *typecode,
+    leaf_view_t *view) {
+    const container_t *c = get_leaf_container(r, leaf, typecode, view);
+    return container_unwrap_shared(c, typecode);
+}
+
+// Replaces the container of `leaf` with a private copy if it is shared with
+// other bitmaps, so that it can be modified in place. Returns the container.
+static inline container_t *unshare_container(roaring64_bitmap_t *r,
+                                             leaf_t *leaf) {
+    container_t *container = get_container(r, *leaf);
+    uint8_t typecode = get_typecode(*leaf);
+    if (typecode == SHARED_CONTAINER_TYPE) {
+        container =
+            shared_container_extract_copy(CAST_shared(container), &typecode);
+        replace_container(r, leaf, container, typecode);
+    }
+    return container;
+}
+
+// Like unshare_container, but also gives an inline leaf a container of its
+// own.
+static inline container_t *get_writable_container(roaring64_bitmap_t *r,
+                                                  leaf_t *leaf) {
+    if (!is_inline_leaf(*leaf)) {
+        return unshare_container(r, leaf);
+    }
+    int n = inline_leaf_cardinality(*leaf);
+    array_container_t *ac = array_container_create_given_capacity(n);
+    ac->cardinality = inline_leaf_values(*leaf, ac->array);
+    replace_container(r, leaf, ac, ARRAY_CONTAINER_TYPE);
+    return ac;
+}
+
+// Keeps the values of `leaf` inline if there are few enough of them.
+static inline void inline_if_tiny(roaring64_bitmap_t *r, leaf_t *leaf) {
+    if (is_inline_leaf(*leaf) || get_typecode(*leaf) != ARRAY_CONTAINER_TYPE) {
+        return;
+    }
+    container_t *container = get_container(r, *leaf);
+    const array_container_t *ac = const_CAST_array(container);
+    if (ac->cardinality == 0 || ac->cardinality > INLINE_LEAF_CAPACITY) {
+        return;
+    }
+    remove_container(r, *leaf);
+    *leaf = create_inline_leaf(ac->array, ac->cardinality);
+    r->inline_cardinality += ac->cardinality;
+    container_free(container, ARRAY_CONTAINER_TYPE);
+}
+
+// Replaces a full container by the shared full container, so that huge ranges
+// do not cost an allocation per 65536 values. Full containers are common
+// enough in such bitmaps that the O(1) check pays for itself.
+static inline container_t *share_if_full(container_t *c, uint8_t *typecode) {
+    if (*typecode != SHARED_CONTAINER_TYPE && container_is_full(c, *typecode)) {
+        container_free(c, *typecode);
+        *typecode = SHARED_CONTAINER_TYPE;
+        return shared_container_full();
+    }
+    return c;
+}
+
+// Copies the container of `leaf` for another bitmap. If `r` is copy-on-write,
+// the container is shared rather than cloned: the first copy wraps it, which
+// updates `leaf` and the slot of `r`.
+static inline container_t *copy_container_of(const roaring64_bitmap_t *r,
+                                             leaf_t *leaf, uint8_t *typecode) {
+    *typecode = get_typecode(*leaf);
+    container_t *container = get_container(r, *leaf);
+    if (!is_cow64(r)) {
+        // get_copy_of_container modifies the typecode passed in.
+        return get_copy_of_container(container, typecode,
+                                     /*copy_on_write=*/false);
+    }
+    bool was_shared = *typecode == SHARED_CONTAINER_TYPE;
+    container_t *shared =
+        get_copy_of_container(container, typecode, /*copy_on_write=*/true);
+    if (shared != NULL && !was_shared) {
+        replace_container((roaring64_bitmap_t *)r, leaf, shared,
+                          SHARED_CONTAINER_TYPE);
+    }
+    return shared;
+}
+
 // Copies the container referenced by `leaf` from `r1` to `r2`.
 static inline leaf_t copy_leaf_container(const roaring64_bitmap_t *r1,
-                                         roaring64_bitmap_t *r2, leaf_t leaf) {
+                                         roaring64_bitmap_t *r2,
+                                         leaf_t *leaf) {
+    if (is_inline_leaf(*leaf)) {
+        r2->inline_cardinality += inline_leaf_cardinality(*leaf);
+        return *leaf;
+    }
+    uint8_t typecode;
+    container_t *container = copy_container_of(r1, leaf, &typecode);
+    return add_container(r2, container, typecode);
+}
+
+// Like copy_leaf_container, but clones the container even if `r1` is
+// copy-on-write.
+static inline leaf_t clone_leaf_container(const roaring64_bitmap_t *r1,
+                                          roaring64_bitmap_t *r2,
+                                          leaf_t leaf) {
+    if (is_inline_leaf(leaf)) {
+        r2->inline_cardinality += inline_leaf_cardinality(leaf);
+        return leaf;
+    }
     uint8_t typecode = get_typecode(leaf);
-    // get_copy_of_container modifies the typecode passed in.
     container_t *container = get_copy_of_container(
         get_container(r1, leaf), &typecode, /*copy_on_write=*/false);
     return add_container(r2, container, typecode);
 }
 
+// Clones every shared container of `r`, except the shared full container
+// which bitmaps hold whether or not they are copy-on-write.
+static void unshare_all_containers(roaring64_bitmap_t *r) {
+    art_iterator_t it = art_init_iterator(&r->art, /*first=*/true);
+    while (it.value != NULL) {
+        leaf_t *leaf = (leaf_t *)it.value;
+        if (!is_inline_leaf(*leaf) && !is_shared_full_leaf(r, *leaf)) {
+            unshare_container(r, leaf);
+        }
+        art_iterator_next(&it);
+    }
+}
+
 static inline int compare_high48(art_key_chunk_t key1[],
                                  art_key_chunk_t key2[]) {
     return art_compare_keys(key1, key2);
@@ -287,11 +647,13 @@ static inline void roaring64_iterator_prime(roaring64_iterator_t *it) {
         return;
     }
     leaf_t leaf = (leaf_t)*it->art_it.value;
-    if (get_typecode(leaf) != BITSET_CONTAINER_TYPE) {
+    uint8_t typecode;
+    const container_t *c =
+        get_actual_container(it->r, leaf, &typecode, &it->view);
+    if (typecode != BITSET_CONTAINER_TYPE) {
         return;
     }
-    const bitset_container_t *bc =
-        const_CAST_bitset(get_container(it->r, leaf));
+    const bitset_container_t *bc = const_CAST_bitset(c);
     int32_t index = it->container_it.index;
     uint32_t wordindex = (uint32_t)index >> 6;
     uint32_t bit = (uint32_t)index & 63u;
@@ -311,9 +673,11 @@ static inline bool roaring64_iterator_init_at_leaf_first(
     roaring64_iterator_t *it) {
     it->high48 = combine_key(it->art_it.key, 0);
     leaf_t leaf = (leaf_t)*it->art_it.value;
+    uint8_t typecode;
+    const container_t *c =
+        get_actual_container(it->r, leaf, &typecode, &it->view);
     uint16_t low16 = 0;
-    it->container_it = container_init_iterator(get_container(it->r, leaf),
-                                               get_typecode(leaf), &low16);
+    it->container_it = container_init_iterator(c, typecode, &low16);
     it->pub.value = it->high48 | low16;
     it->pub.has_value = true;
     roaring64_iterator_prime(it);
@@ -324,9 +688,11 @@ static inline bool roaring64_iterator_init_at_leaf_last(
     roaring64_iterator_t *it) {
     it->high48 = combine_key(it->art_it.key, 0);
     leaf_t leaf = (leaf_t)*it->art_it.value;
+    uint8_t typecode;
+    const container_t *c =
+        get_actual_container(it->r, leaf, &typecode, &it->view);
     uint16_t low16 = 0;
-    it->container_it = container_init_iterator_last(get_container(it->r, leaf),
-                                                    get_typecode(leaf), &low16);
+    it->container_it = container_init_iterator_last(c, typecode, &low16);
     it->pub.value = it->high48 | low16;
     it->pub.has_value = true;
     roaring64_iterator_prime(it);
@@ -358,15 +724,31 @@ roaring64_bitmap_t *roaring64_bitmap_create(void) {
     r->flags = 0;
     r->capacity = 0;
     r->first_free = 0;
+    r->live_containers = 0;
     r->containers = NULL;
     r->typecodes = NULL;
+    r->inline_cardinality = 0;
+    r->cumulative_cardinalities = NULL;
+    r->allocator = roaring_allocator_current();
     return r;
 }
 
-void roaring64_bitmap_free(roaring64_bitmap_t *r) {
-    if (!r) {
-        return;
-    }
+// Frees the block of a sealed bitmap, which leaves it empty and unsealed.
+static void release_sealed64(roaring64_bitmap_t *r) {
+    // The container pointers come first in the block.
+    roaring_aligned_free(r->containers);
+    art_init_cleared(&r->art);
+    r->flags &= (uint8_t)~ROARING_FLAG_SEALED;
+    r->capacity = 0;
+    r->first_free = 0;
+    r->live_containers = 0;
+    r->containers = NULL;
+    r->typecodes = NULL;
+    r->inline_cardinality = 0;
+    r->cumulative_cardinalities = NULL;
+}
+
+static void roaring64_bitmap_free_impl(roaring64_bitmap_t *r) {
     if (is_frozen64(r)) {
         // Headers, containers[], and typecodes[] live in the same allocation
         // as `r`. Payloads alias a caller buffer.
@@ -376,10 +758,15 @@ void roaring64_bitmap_free(roaring64_bitmap_t *r) {
         roaring_free(r);
         return;
     }
+    if (is_sealed64(r)) {
+        release_sealed64(r);
+        roaring_free(r);
+        return;
+    }
     art_iterator_t it = art_init_iterator(&r->art, /*first=*/true);
     while (it.value != NULL) {
         leaf_t leaf = (leaf_t)*it.value;
-        container_free(get_container(r, leaf), get_typecode(leaf));
+        free_leaf_container(r, leaf);
         art_iterator_next(&it);
     }
     art_free(&r->art);
@@ -388,42 +775,84 @@ void roaring64_bitmap_free(roaring64_bitmap_t *r) {
     roaring_free(r);
 }
 
-roaring64_bitmap_t *roaring64_bitmap_copy(const roaring64_bitmap_t *r) {
+void roaring64_bitmap_free(roaring64_bitmap_t *r) {
+    if (!r) {
+        return;
+    }
+    const roaring_allocator_t *previous = enter_allocator_of64(r);
+    roaring64_bitmap_free_impl(r);
+    leave_allocator(previous);
+}
+
+const roaring_allocator_t *roaring64_bitmap_get_allocator(
+    const roaring64_bitmap_t *r) {
+    return r->allocator;
+}
+
+bool roaring64_bitmap_get_copy_on_write(const roaring64_bitmap_t *r) {
+    return r->flags & ROARING_FLAG_COW;
+}
+
+void roaring64_bitmap_set_copy_on_write(roaring64_bitmap_t *r, bool cow) {
+    if (cow) {
+        r->flags |= ROARING_FLAG_COW;
+        return;
+    }
+    if (r->flags & ROARING_FLAG_COW) {
+        const roaring_allocator_t *previous = enter_allocator_of64(r);
+        unshare_all_containers(r);
+        leave_allocator(previous);
+    }
+    r->flags &= (uint8_t)~ROARING_FLAG_COW;
+}
+
+static roaring64_bitmap_t *roaring64_bitmap_copy_impl(
+    const roaring64_bitmap_t *r) {
     roaring64_bitmap_t *result = roaring64_bitmap_create();
+    result->flags = r->flags & ROARING_FLAG_COW;
 
     art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
     while (it.value != NULL) {
-        leaf_t leaf = (leaf_t)*it.value;
-        uint8_t result_typecode = get_typecode(leaf);
-        container_t *result_container = get_copy_of_container(
-            get_container(r, leaf), &result_typecode, /*copy_on_write=*/false);
         leaf_t result_leaf =
-            add_container(result, result_container, result_typecode);
-        art_insert(&result->art, it.key, (art_val_t)result_leaf);
+            copy_leaf_container(r, result, (leaf_t *)it.value);
+        art_bulk_append(&result->art, it.key, (art_val_t)result_leaf);
         art_iterator_next(&it);
     }
+    art_bulk_finish(&result->art);
     return result;
 }
 
-void roaring64_bitmap_overwrite(roaring64_bitmap_t *dest,
-                                const roaring64_bitmap_t *src) {
+roaring64_bitmap_t *roaring64_bitmap_copy(const roaring64_bitmap_t *r) {
+    const roaring_allocator_t *previous = enter_result_allocator_of64(r);
+    roaring64_bitmap_t *answer = roaring64_bitmap_copy_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+static void roaring64_bitmap_overwrite_impl(roaring64_bitmap_t *dest,
+                                            const roaring64_bitmap_t *src) {
     if (dest == src) {
         return;
     }
+    if (is_sealed64(dest)) {
+        release_sealed64(dest);
+    }
 
     // Free dest's containers.
     art_iterator_t it = art_init_iterator(&dest->art, /*first=*/true);
     while (it.value != NULL) {
         leaf_t leaf = (leaf_t)*it.value;
-        container_free(get_container(dest, leaf), get_typecode(leaf));
+        free_leaf_container(dest, leaf);
         art_iterator_next(&it);
     }
     art_free(&dest->art);
 
     // Reinitialize dest.
     art_init_cleared(&dest->art);
-    dest->flags = 0;
+    dest->flags = src->flags & ROARING_FLAG_COW;
     dest->first_free = 0;
+    dest->live_containers = 0;
+    dest->inline_cardinality = 0;
     if (dest->capacity > 0) {
         memset(dest->containers, 0,
                sizeof(dest->containers[0]) * dest->capacity);
@@ -432,22 +861,35 @@ void roaring64_bitmap_overwrite(roaring64_bitmap_t *dest,
     // Copy src's containers into dest.
     it = art_init_iterator((art_t *)&src->art, /*first=*/true);
     while (it.value != NULL) {
-        leaf_t leaf = (leaf_t)*it.value;
-        uint8_t typecode = get_typecode(leaf);
-        container_t *container = get_copy_of_container(
-            get_container(src, leaf), &typecode, /*copy_on_write=*/false);
-        leaf_t dest_leaf = add_container(dest, container, typecode);
+        leaf_t dest_leaf = copy_leaf_container(src, dest, (leaf_t *)it.value);
         art_insert(&dest->art, it.key, (art_val_t)dest_leaf);
         art_iterator_next(&it);
     }
 }
 
+void roaring64_bitmap_overwrite(roaring64_bitmap_t *dest,
+                                const roaring64_bitmap_t *src) {
+    const roaring_allocator_t *previous = enter_allocator_of64(dest);
+    roaring64_bitmap_overwrite_impl(dest, src);
+    leave_allocator(previous);
+}
+
+// Frees a bitmap whose ART is still being bulk-loaded (see art_bulk_append):
+// its containers are only reachable once the inner nodes are built.
+static void free_bulk_loaded64(roaring64_bitmap_t *r) {
+    art_bulk_finish(&r->art);
+    roaring64_bitmap_free(r);
+}
+
 /**
  * Steal the containers from a 32-bit bitmap and insert them into a 64-bit
  * bitmap (with an offset)
  *
  * After calling this function, the original bitmap will be empty, and the
  * returned bitmap will contain all the values from the original bitmap.
+ *
+ * The containers are bulk-appended to the ART of `dst`, which must be under
+ * construction with keys smaller than those of `src` (see art_bulk_append).
  */
 static void move_from_roaring32_offset(roaring64_bitmap_t *dst,
                                        roaring_bitmap_t *src,
@@ -460,26 +902,42 @@ static void move_from_roaring32_offset(roaring64_bitmap_t *dst,
         uint8_t typecode;
         container_t *container = ra_get_container_at_index(
             &src->high_low_container, (uint16_t)i, &typecode);
+        container = share_if_full(container, &typecode);
 
         uint8_t high48[ART_KEY_BYTES];
         uint64_t high48_bits = key_base | ((uint64_t)key << 16);
         split_key(high48_bits, high48);
         leaf_t leaf = add_container(dst, container, typecode);
-        art_insert(&dst->art, high48, (art_val_t)leaf);
+        art_bulk_append(&dst->art, high48, (art_val_t)leaf);
     }
     // We stole all the containers, so leave behind a size of zero
     src->high_low_container.size = 0;
 }
 
-roaring64_bitmap_t *roaring64_bitmap_move_from_roaring32(
+static roaring64_bitmap_t *roaring64_bitmap_move_from_roaring32_impl(
     roaring_bitmap_t *bitmap32) {
     roaring64_bitmap_t *result = roaring64_bitmap_create();
 
     move_from_roaring32_offset(result, bitmap32, 0);
+    art_bulk_finish(&result->art);
 
     return result;
 }
 
+roaring64_bitmap_t *roaring64_bitmap_move_from_roaring32(
+    roaring_bitmap_t *bitmap32) {
+    // The containers of a sealed bitmap cannot be taken one by one.
+    if (!roaring_bitmap_unseal(bitmap32)) {
+        return NULL;
+    }
+    const roaring_allocator_t *previous =
+        switch_allocator(roaring_bitmap_get_allocator(bitmap32));
+    roaring64_bitmap_t *answer =
+        roaring64_bitmap_move_from_roaring32_impl(bitmap32);
+    leave_allocator(previous);
+    return answer;
+}
+
 roaring64_bitmap_t *roaring64_bitmap_from_range(uint64_t min, uint64_t max,
                                                 uint64_t step) {
     if (step == 0 || max <= min) {
@@ -504,6 +962,7 @@ roaring64_bitmap_t *roaring64_bitmap_from_range(uint64_t min, uint64_t max,
         uint8_t typecode;
         container_t *container = container_from_range(
             &typecode, container_min, container_max, (uint16_t)step);
+        container = share_if_full(container, &typecode);
 
         uint8_t high48[ART_KEY_BYTES];
         split_key(min, high48);
@@ -527,13 +986,400 @@ roaring64_bitmap_t *roaring64_bitmap_of_ptr(size_t n_args,
     return r;
 }
 
+// Returns the index of the first value at or after `begin` whose high 48 bits
+// exceed `high48`, or n if there is none, assuming vals is sorted.
+static size_t sorted_uint64_segment_end(const uint64_t *vals, size_t begin,
+                                        size_t n, uint64_t high48) {
+    size_t lo = begin;  // vals[lo] >> 16 <= high48
+    size_t step = 1;
+    while (lo + step < n && (vals[lo + step] >> 16) <= high48) {
+        lo += step;
+        step *= 2;
+    }
+    size_t hi = lo + step < n ? lo + step : n;
+    while (lo + 1 < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if ((vals[mid] >> 16) <= high48) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return hi;
+}
+
+roaring64_bitmap_t *roaring64_bitmap_from_sorted(const uint64_t *vals,
+                                                 size_t n) {
+    roaring64_bitmap_t *r = roaring64_bitmap_create();
+    size_t i = 0;
+    while (i < n) {
+        uint64_t high48_bits = vals[i] >> 16;
+        size_t end = sorted_uint64_segment_end(vals, i, n, high48_bits);
+        // container_from_sorted_uint64 checks that each segment is sorted,
+        // check that segments are too.
+        if ((vals[end - 1] >> 16) != high48_bits ||
+            (end < n && (vals[end] >> 16) <= high48_bits)) {
+            free_bulk_loaded64(r);
+            return NULL;
+        }
+        uint8_t typecode;
+        container_t *container =
+            container_from_sorted_uint64(vals + i, end - i, &typecode);
+        if (container == NULL) {
+            free_bulk_loaded64(r);
+            return NULL;
+        }
+        // Leaves are inserted in key order.
+        uint8_t high48[ART_KEY_BYTES];
+        split_key(vals[i], high48);
+        leaf_t leaf = add_container(r, container, typecode);
+        art_bulk_append(&r->art, high48, (art_val_t)leaf);
+        i = end;
+    }
+    art_bulk_finish(&r->art);
+    return r;
+}
+
+// The containers built from one bucket of a roaring64_bulk_loader_t, in key
+// order. A NULL `containers` means that the bucket could not be built.
+typedef struct bulk_loader_bucket_s {
+    container_t **containers;
+    uint64_t *high48;
+    uint8_t *typecodes;
+    size_t count;
+} bulk_loader_bucket_t;
+
+struct roaring64_bulk_loader_s {
+    const uint64_t *vals;
+    size_t n;
+    uint32_t num_parts;
+    // Values go to bucket ((val >> 16) - min_high48) >> shift, so that there
+    // are at most 65536 buckets, in key order.
+    uint64_t min_high48;
+    int shift;
+    uint32_t num_slots;
+    // Per-part bucket histograms, turned into per-part write offsets by
+    // roaring64_bulk_loader_plan: counts[part * num_slots + slot].
+    size_t *counts;
+    // Values grouped by bucket: the values of slot s are at
+    // [starts[s], starts[s + 1]).
+    uint64_t *grouped;
+    size_t *starts;
+    uint32_t num_buckets;
+    uint32_t *slots;
+    bulk_loader_bucket_t *buckets;
+    bool planned;
+    const roaring_allocator_t *allocator;  // of the bitmap being built
+};
+
+static void bulk_loader64_part_range(size_t n, uint32_t num_parts,
+                                     uint32_t part, size_t *begin,
+                                     size_t *end) {
+    *begin = (size_t)((uint64_t)n * part / num_parts);
+    *end = (size_t)((uint64_t)n * (part + 1) / num_parts);
+}
+
+roaring64_bulk_loader_t *roaring64_bulk_loader_create(const uint64_t *vals,
+                                                      size_t n,
+                                                      uint32_t num_parts) {
+    if (num_parts == 0) num_parts = 1;
+    roaring64_bulk_loader_t *l =
+        (roaring64_bulk_loader_t *)roaring_calloc(1, sizeof(*l));
+    if (l == NULL) {
+        return NULL;
+    }
+    l->vals = vals;
+    l->n = n;
+    l->num_parts = num_parts;
+    l->allocator = roaring_allocator_current();
+    uint64_t min_high48 = UINT64_MAX, max_high48 = 0;
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t high48 = vals[i] >> 16;
+        min_high48 = high48 < min_high48 ? high48 : min_high48;
+        max_high48 = high48 > max_high48 ? high48 : max_high48;
+    }
+    if (n == 0) min_high48 = 0;
+    uint64_t span = max_high48 - min_high48;
+    int bits = span == 0 ? 0 : 64 - roaring_leading_zeroes(span);
+    l->min_high48 = min_high48;
+    l->shift = bits > 16 ? bits - 16 : 0;
+    l->num_slots = (uint32_t)(span >> l->shift) + 1;
+    l->counts = (size_t *)roaring_calloc((size_t)num_parts * l->num_slots,
+                                         sizeof(size_t));
+    if (l->counts == NULL) {
+        roaring_free(l);
+        return NULL;
+    }
+    return l;
+}
+
+static inline uint32_t bulk_loader_slot(const roaring64_bulk_loader_t *l,
+                                        uint64_t val) {
+    return (uint32_t)(((val >> 16) - l->min_high48) >> l->shift);
+}
+
+void roaring64_bulk_loader_count(roaring64_bulk_loader_t *l, uint32_t part) {
+    size_t begin, end;
+    bulk_loader64_part_range(l->n, l->num_parts, part, &begin, &end);
+    size_t *counts = l->counts + (size_t)part * l->num_slots;
+    for (size_t i = begin; i < end; ++i) {
+        counts[bulk_loader_slot(l, l->vals[i])]++;
+    }
+}
+
+static bool roaring64_bulk_loader_plan_impl(roaring64_bulk_loader_t *l,
+                                            uint32_t *num_buckets) {
+    l->grouped = (uint64_t *)roaring_malloc(l->n * sizeof(uint64_t) + 1);
+    l->starts = (size_t *)roaring_malloc((l->num_slots + 1) * sizeof(size_t));
+    l->slots = (uint32_t *)roaring_malloc(l->num_slots * sizeof(uint32_t));
+    if (l->grouped == NULL || l->starts == NULL || l->slots == NULL) {
+        return false;
+    }
+    size_t offset = 0;
+    uint32_t k = 0;
+    for (uint32_t slot = 0; slot < l->num_slots; ++slot) {
+        l->starts[slot] = offset;
+        for (uint32_t part = 0; part < l->num_parts; ++part) {
+            size_t *count = l->counts + (size_t)part * l->num_slots + slot;
+            size_t c = *count;
+            *count = offset;
+            offset += c;
+        }
+        if (offset != l->starts[slot]) {
+            l->slots[k++] = slot;
+        }
+    }
+    l->starts[l->num_slots] = offset;
+    l->num_buckets = k;
+    l->buckets = (bulk_loader_bucket_t *)roaring_calloc(
+        k + 1, sizeof(bulk_loader_bucket_t));
+    if (l->buckets == NULL) {
+        return false;
+    }
+    l->planned = true;
+    *num_buckets = k;
+    return true;
+}
+
+bool roaring64_bulk_loader_plan(roaring64_bulk_loader_t *l,
+                                uint32_t *num_buckets) {
+    const roaring_allocator_t *previous = switch_allocator(l->allocator);
+    bool answer = roaring64_bulk_loader_plan_impl(l, num_buckets);
+    leave_allocator(previous);
+    return answer;
+}
+
+void roaring64_bulk_loader_scatter(roaring64_bulk_loader_t *l, uint32_t part) {
+    size_t begin, end;
+    bulk_loader64_part_range(l->n, l->num_parts, part, &begin, &end);
+    size_t *offsets = l->counts + (size_t)part * l->num_slots;
+    uint64_t *grouped = l->grouped;
+    for (size_t i = begin; i < end; ++i) {
+        uint64_t val = l->vals[i];
+        grouped[offsets[bulk_loader_slot(l, val)]++] = val;
+    }
+}
+
+// Sorts vals by their low `bits` bits once `base` is subtracted, with an LSD
+// radix sort on bytes. Digits that are the same for all values are skipped.
+static void bulk_loader_sort(uint64_t *vals, uint64_t *tmp, size_t n,
+                             uint64_t base, int bits) {
+    uint64_t *src = vals, *dst = tmp;
+    for (int byte = 0; byte * 8 < bits; ++byte) {
+        size_t counts[256] = {0};
+        int s = 8 * byte;
+        for (size_t i = 0; i < n; ++i) {
+            counts[((src[i] - base) >> s) & 0xFF]++;
+        }
+        if (counts[((src[0] - base) >> s) & 0xFF] == n) {
+            continue;
+        }
+        size_t offset = 0;
+        for (int d = 0; d < 256; ++d) {
+            size_t c = counts[d];
+            counts[d] = offset;
+            offset += c;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            dst[counts[((src[i] - base) >> s) & 0xFF]++] = src[i];
+        }
+        uint64_t *swap = src;
+        src = dst;
+        dst = swap;
+    }
+    if (src != vals) {
+        memcpy(vals, src, n * sizeof(uint64_t));
+    }
+}
+
+static void bulk_loader_build_bucket(roaring64_bulk_loader_t *l, uint32_t i,
+                                     uint64_t *tmp) {
+    uint32_t slot = l->slots[i];
+    uint64_t *vals = l->grouped + l->starts[slot];
+    size_t n = l->starts[slot + 1] - l->starts[slot];
+    uint64_t base = (l->min_high48 + ((uint64_t)slot << l->shift)) << 16;
+    bulk_loader_sort(vals, tmp, n, base, l->shift + 16);
+
+    size_t count = 1;
+    for (size_t j = 1; j < n; ++j) {
+        count += (vals[j] >> 16) != (vals[j - 1] >> 16);
+    }
+    bulk_loader_bucket_t *bucket = &l->buckets[i];
+    char *block = (char *)roaring_malloc(
+        count * (sizeof(container_t *) + sizeof(uint64_t) + 1));
+    if (block == NULL) {
+        return;
+    }
+    container_t **containers = (container_t **)block;
+    uint64_t *high48 = (uint64_t *)(block + count * sizeof(container_t *));
+    uint8_t *typecodes = (uint8_t *)(high48 + count);
+    size_t begin = 0;
+    for (size_t c = 0; c < count; ++c) {
+        size_t end = begin + 1;
+        while (end < n && (vals[end] >> 16) == (vals[begin] >> 16)) ++end;
+        containers[c] = container_from_sorted_uint64(vals + begin, end - begin,
+                                                     &typecodes[c]);
+        if (containers[c] == NULL) {
+            while (c-- > 0) container_free(containers[c], typecodes[c]);
+            roaring_free(block);
+            return;
+        }
+        high48[c] = vals[begin] >> 16;
+        begin = end;
+    }
+    bucket->containers = containers;
+    bucket->high48 = high48;
+    bucket->typecodes = typecodes;
+    bucket->count = count;
+}
+
+static void roaring64_bulk_loader_build_impl(roaring64_bulk_loader_t *l,
+                                             uint32_t begin, uint32_t end) {
+    if (end > l->num_buckets) end = l->num_buckets;
+    if (begin >= end) {
+        return;
+    }
+    size_t max_size = 0;
+    for (uint32_t i = begin; i < end; ++i) {
+        uint32_t slot = l->slots[i];
+        size_t size = l->starts[slot + 1] - l->starts[slot];
+        max_size = size > max_size ? size : max_size;
+    }
+    uint64_t *tmp = (uint64_t *)roaring_malloc(max_size * sizeof(uint64_t));
+    if (tmp == NULL) {
+        return;  // the unbuilt buckets are reported by finish
+    }
+    for (uint32_t i = begin; i < end; ++i) {
+        bulk_loader_build_bucket(l, i, tmp);
+    }
+    roaring_free(tmp);
+}
+
+void roaring64_bulk_loader_build(roaring64_bulk_loader_t *l, uint32_t begin,
+                                 uint32_t end) {
+    const roaring_allocator_t *previous = switch_allocator(l->allocator);
+    roaring64_bulk_loader_build_impl(l, begin, end);
+    leave_allocator(previous);
+}
+
+static roaring64_bitmap_t *roaring64_bulk_loader_finish_impl(
+    roaring64_bulk_loader_t *l) {
+    roaring64_bitmap_t *r = NULL;
+    bool complete = l->planned;
+    size_t total = 0;
+    for (uint32_t i = 0; complete && i < l->num_buckets; ++i) {
+        complete = l->buckets[i].containers != NULL;
+        total += l->buckets[i].count;
+    }
+    if (complete) {
+        r = roaring64_bitmap_create();
+    }
+    if (r != NULL) {
+        ensure_container_capacity(r, total);
+        for (uint32_t i = 0; i < l->num_buckets; ++i) {
+            const bulk_loader_bucket_t *bucket = &l->buckets[i];
+            for (size_t c = 0; c < bucket->count; ++c) {
+                uint8_t high48[ART_KEY_BYTES];
+                split_key(bucket->high48[c] << 16, high48);
+                leaf_t leaf = add_container(r, bucket->containers[c],
+                                            bucket->typecodes[c]);
+                art_insert(&r->art, high48, (art_val_t)leaf);
+            }
+        }
+    }
+    for (uint32_t i = 0; l->buckets != NULL && i < l->num_buckets; ++i) {
+        const bulk_loader_bucket_t *bucket = &l->buckets[i];
+        if (r == NULL) {
+            for (size_t c = 0; c < bucket->count; ++c) {
+                container_free(bucket->containers[c], bucket->typecodes[c]);
+            }
+        }
+        roaring_free(bucket->containers);
+    }
+    roaring_free(l->counts);
+    roaring_free(l->grouped);
+    roaring_free(l->starts);
+    roaring_free(l->slots);
+    roaring_free(l->buckets);
+    roaring_free(l);
+    return r;
+}
+
+roaring64_bitmap_t *roaring64_bulk_loader_finish(roaring64_bulk_loader_t *l) {
+    const roaring_allocator_t *previous = switch_allocator(l->allocator);
+    roaring64_bitmap_t *answer = roaring64_bulk_loader_finish_impl(l);
+    leave_allocator(previous);
+    return answer;
+}
+
+roaring64_bitmap_t *roaring64_bitmap_from_unsorted(const uint64_t *vals,
+                                                   size_t n) {
+    roaring64_bulk_loader_t *l = roaring64_bulk_loader_create(vals, n, 1);
+    if (l == NULL) {
+        return NULL;
+    }
+    uint32_t num_buckets;
+    roaring64_bulk_loader_count(l, 0);
+    if (roaring64_bulk_loader_plan(l, &num_buckets)) {
+        roaring64_bulk_loader_scatter(l, 0);
+        roaring64_bulk_loader_build(l, 0, num_buckets);
+    }
+    return roaring64_bulk_loader_finish(l);
+}
+
+// Adds `low16` to the inline leaf, unless it is full. Returns false if the
+// leaf needs a container.
+static inline bool inline_leaf_add(roaring64_bitmap_t *r, leaf_t *leaf,
+                                   uint16_t low16) {
+    uint16_t values[INLINE_LEAF_CAPACITY + 1];
+    int n = inline_leaf_values(*leaf, values);
+    int i = 0;
+    while (i < n && values[i] < low16) {
+        i++;
+    }
+    if (i < n && values[i] == low16) {
+        return true;
+    }
+    if (n == INLINE_LEAF_CAPACITY) {
+        return false;
+    }
+    memmove(values + i + 1, values + i, (n - i) * sizeof(uint16_t));
+    values[i] = low16;
+    *leaf = create_inline_leaf(values, n + 1);
+    r->inline_cardinality++;
+    return true;
+}
+
 static inline leaf_t *containerptr_roaring64_bitmap_add(roaring64_bitmap_t *r,
                                                         uint8_t *high48,
                                                         uint16_t low16,
                                                         leaf_t *leaf) {
     if (leaf != NULL) {
+        if (is_inline_leaf(*leaf) && inline_leaf_add(r, leaf, low16)) {
+            return leaf;
+        }
+        container_t *container = get_writable_container(r, leaf);
         uint8_t typecode = get_typecode(*leaf);
-        container_t *container = get_container(r, *leaf);
         uint8_t typecode2;
         container_t *container2 =
             container_add(container, low16, typecode, &typecode2);
@@ -543,49 +1389,66 @@ static inline leaf_t *containerptr_roaring64_bitmap_add(roaring64_bitmap_t *r,
         }
         return leaf;
     } else {
-        array_container_t *ac = array_container_create();
-        uint8_t typecode;
-        container_t *container =
-            container_add(ac, low16, ARRAY_CONTAINER_TYPE, &typecode);
-        assert(ac == container);
-        leaf_t new_leaf = add_container(r, container, typecode);
+        leaf_t new_leaf = create_inline_leaf(&low16, 1);
+        r->inline_cardinality++;
         return (leaf_t *)art_insert(&r->art, high48, (art_val_t)new_leaf);
     }
 }
 
-void roaring64_bitmap_add(roaring64_bitmap_t *r, uint64_t val) {
+static void roaring64_bitmap_add_impl(roaring64_bitmap_t *r, uint64_t val) {
     uint8_t high48[ART_KEY_BYTES];
     uint16_t low16 = split_key(val, high48);
     leaf_t *leaf = (leaf_t *)art_find(&r->art, high48);
     containerptr_roaring64_bitmap_add(r, high48, low16, leaf);
 }
 
-bool roaring64_bitmap_add_checked(roaring64_bitmap_t *r, uint64_t val) {
+void roaring64_bitmap_add(roaring64_bitmap_t *r, uint64_t val) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return;
+    }
+    roaring64_bitmap_add_impl(r, val);
+    leave_allocator(previous);
+}
+
+static bool roaring64_bitmap_add_checked_impl(roaring64_bitmap_t *r,
+                                              uint64_t val) {
     uint8_t high48[ART_KEY_BYTES];
     uint16_t low16 = split_key(val, high48);
     leaf_t *leaf = (leaf_t *)art_find(&r->art, high48);
 
-    int old_cardinality = 0;
+    uint64_t old_cardinality = 0;
     if (leaf != NULL) {
-        old_cardinality = container_get_cardinality(get_container(r, *leaf),
-                                                    get_typecode(*leaf));
+        old_cardinality = leaf_cardinality(r, *leaf);
     }
     leaf = containerptr_roaring64_bitmap_add(r, high48, low16, leaf);
-    int new_cardinality =
-        container_get_cardinality(get_container(r, *leaf), get_typecode(*leaf));
-    return old_cardinality != new_cardinality;
+    return old_cardinality != leaf_cardinality(r, *leaf);
 }
 
-void roaring64_bitmap_add_bulk(roaring64_bitmap_t *r,
-                               roaring64_bulk_context_t *context,
-                               uint64_t val) {
+bool roaring64_bitmap_add_checked(roaring64_bitmap_t *r, uint64_t val) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return false;
+    }
+    bool answer = roaring64_bitmap_add_checked_impl(r, val);
+    leave_allocator(previous);
+    return answer;
+}
+
+static void roaring64_bitmap_add_bulk_impl(roaring64_bitmap_t *r,
+                                           roaring64_bulk_context_t *context,
+                                           uint64_t val) {
     uint8_t high48[ART_KEY_BYTES];
     uint16_t low16 = split_key(val, high48);
     leaf_t *leaf = context->leaf;
-    if (leaf != NULL && compare_high48(context->high_bytes, high48) == 0) {
+    if (leaf != NULL && leaf != ABSENT_LEAF &&
+        compare_high48(context->high_bytes, high48) == 0) {
         // We're at a container with the correct high bits.
+        if (is_inline_leaf(*leaf) && inline_leaf_add(r, leaf, low16)) {
+            return;
+        }
+        container_t *container1 = get_writable_container(r, leaf);
         uint8_t typecode1 = get_typecode(*leaf);
-        container_t *container1 = get_container(r, *leaf);
         uint8_t typecode2;
         container_t *container2 =
             container_add(container1, low16, typecode1, &typecode2);
@@ -603,8 +1466,19 @@ void roaring64_bitmap_add_bulk(roaring64_bitmap_t *r,
     }
 }
 
-void roaring64_bitmap_add_many(roaring64_bitmap_t *r, size_t n_args,
-                               const uint64_t *vals) {
+void roaring64_bitmap_add_bulk(roaring64_bitmap_t *r,
+                               roaring64_bulk_context_t *context,
+                               uint64_t val) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return;
+    }
+    roaring64_bitmap_add_bulk_impl(r, context, val);
+    leave_allocator(previous);
+}
+
+static void roaring64_bitmap_add_many_impl(roaring64_bitmap_t *r, size_t n_args,
+                                           const uint64_t *vals) {
     if (n_args == 0) {
         return;
     }
@@ -616,13 +1490,33 @@ void roaring64_bitmap_add_many(roaring64_bitmap_t *r, size_t n_args,
     }
 }
 
+void roaring64_bitmap_add_many(roaring64_bitmap_t *r, size_t n_args,
+                               const uint64_t *vals) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return;
+    }
+    roaring64_bitmap_add_many_impl(r, n_args, vals);
+    leave_allocator(previous);
+}
+
 static inline void add_range_closed_at(roaring64_bitmap_t *r, art_t *art,
                                        uint8_t *high48, uint16_t min,
                                        uint16_t max) {
     leaf_t *leaf = (leaf_t *)art_find(art, high48);
+    bool fill = min == 0 && max == UINT16_MAX;
     if (leaf != NULL) {
+        if (is_shared_full_leaf(r, *leaf)) {
+            return;
+        }
+        if (fill) {
+            free_leaf_container(r, *leaf);
+            replace_container(r, leaf, shared_container_full(),
+                              SHARED_CONTAINER_TYPE);
+            return;
+        }
+        container_t *container1 = get_writable_container(r, leaf);
         uint8_t typecode1 = get_typecode(*leaf);
-        container_t *container1 = get_container(r, *leaf);
         uint8_t typecode2;
         container_t *container2 =
             container_add_range(container1, typecode1, min, max, &typecode2);
@@ -632,6 +1526,12 @@ static inline void add_range_closed_at(roaring64_bitmap_t *r, art_t *art,
         }
         return;
     }
+    if (fill) {
+        leaf_t new_leaf = add_container(r, shared_container_full(),
+                                        SHARED_CONTAINER_TYPE);
+        art_insert(art, high48, (art_val_t)new_leaf);
+        return;
+    }
     uint8_t typecode;
     // container_add_range is inclusive, but `container_range_of_ones` is
     // exclusive.
@@ -640,16 +1540,26 @@ static inline void add_range_closed_at(roaring64_bitmap_t *r, art_t *art,
     art_insert(art, high48, (art_val_t)new_leaf);
 }
 
-void roaring64_bitmap_add_range(roaring64_bitmap_t *r, uint64_t min,
-                                uint64_t max) {
+static void roaring64_bitmap_add_range_impl(roaring64_bitmap_t *r, uint64_t min,
+                                            uint64_t max) {
     if (min >= max) {
         return;
     }
     roaring64_bitmap_add_range_closed(r, min, max - 1);
 }
 
-void roaring64_bitmap_add_range_closed(roaring64_bitmap_t *r, uint64_t min,
-                                       uint64_t max) {
+void roaring64_bitmap_add_range(roaring64_bitmap_t *r, uint64_t min,
+                                uint64_t max) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return;
+    }
+    roaring64_bitmap_add_range_impl(r, min, max);
+    leave_allocator(previous);
+}
+
+static void roaring64_bitmap_add_range_closed_impl(roaring64_bitmap_t *r,
+                                                   uint64_t min, uint64_t max) {
     if (min > max) {
         return;
     }
@@ -679,11 +1589,24 @@ void roaring64_bitmap_add_range_closed(roaring64_bitmap_t *r, uint64_t min,
     add_range_closed_at(r, art, max_high48, 0, max_low16);
 }
 
+void roaring64_bitmap_add_range_closed(roaring64_bitmap_t *r, uint64_t min,
+                                       uint64_t max) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return;
+    }
+    roaring64_bitmap_add_range_closed_impl(r, min, max);
+    leave_allocator(previous);
+}
+
 bool roaring64_bitmap_contains(const roaring64_bitmap_t *r, uint64_t val) {
     uint8_t high48[ART_KEY_BYTES];
     uint16_t low16 = split_key(val, high48);
     leaf_t *leaf = (leaf_t *)art_find(&r->art, high48);
     if (leaf != NULL) {
+        if (is_inline_leaf(*leaf)) {
+            return inline_leaf_contains(*leaf, low16);
+        }
         return container_contains(get_container(r, *leaf), low16,
                                   get_typecode(*leaf));
     }
@@ -739,14 +1662,15 @@ bool roaring64_bitmap_contains_range_closed(const roaring64_bitmap_t *r,
 
         // For the first and last containers we use container_contains_range,
         // for the intermediate containers we can use container_is_full.
+        uint8_t typecode;
+        leaf_view_t view;
+        const container_t *c = get_leaf_container(r, leaf, &typecode, &view);
         if (container_min == 0 && container_max == 0xFFFF + 1) {
-            if (!container_is_full(get_container(r, leaf),
-                                   get_typecode(leaf))) {
+            if (!container_is_full(c, typecode)) {
                 return false;
             }
-        } else if (!container_contains_range(get_container(r, leaf),
-                                             container_min, container_max,
-                                             get_typecode(leaf))) {
+        } else if (!container_contains_range(c, container_min, container_max,
+                                             typecode)) {
             return false;
         }
         prev_high48_bits = current_high48_bits;
@@ -761,39 +1685,100 @@ bool roaring64_bitmap_contains_bulk(const roaring64_bitmap_t *r,
     uint8_t high48[ART_KEY_BYTES];
     uint16_t low16 = split_key(val, high48);
 
+    // An inlined memcmp of ART_KEY_BYTES bytes is a couple of loads, cheaper
+    // than calling art_compare_keys on every query.
     if (context->leaf == NULL ||
-        art_compare_keys(context->high_bytes, high48) != 0) {
+        memcmp(context->high_bytes, high48, ART_KEY_BYTES) != 0) {
         // We're not positioned anywhere yet or the high bits of the key
-        // differ.
+        // differ. Misses are remembered too, so that a run of queries in an
+        // absent chunk only searches the ART once.
         leaf_t *leaf = (leaf_t *)art_find(&r->art, high48);
-        if (leaf == NULL) {
-            return false;
-        }
-        context->leaf = leaf;
+        context->leaf = leaf == NULL ? ABSENT_LEAF : leaf;
         memcpy(context->high_bytes, high48, ART_KEY_BYTES);
     }
+    if (context->leaf == ABSENT_LEAF) {
+        return false;
+    }
+    if (is_inline_leaf(*context->leaf)) {
+        return inline_leaf_contains(*context->leaf, low16);
+    }
     return container_contains(get_container(r, *context->leaf), low16,
                               get_typecode(*context->leaf));
 }
 
+// Moves `it` forward to the first key equal to or greater than `key`, which
+// must be greater than the current key. The next key is often the one, which
+// is cheaper to check than to search from the top of the subtree.
+static inline bool art_iterator_skip_to(art_iterator_t *it,
+                                        const art_key_chunk_t key[]) {
+    if (!art_iterator_next(it)) {
+        return false;
+    }
+    if (art_compare_keys(it->key, key) >= 0) {
+        return true;
+    }
+    return art_iterator_lower_bound(it, key);
+}
+
+// Returns the last leaf of a sealed bitmap that starts at or before `rank`,
+// searching forward from leaf `from`, which does. Requires `rank` to be less
+// than the cardinality.
+static uint64_t cumulative_search(const roaring64_bitmap_t *r, uint64_t from,
+                                  uint64_t rank) {
+    const uint64_t *cumulative = r->cumulative_cardinalities;
+    uint64_t n = art_compact_leaf_count(&r->art);
+    uint64_t lo = from;
+    uint64_t step = 1;
+    while (lo + step < n && cumulative[lo + step] <= rank) {
+        lo += step;
+        step *= 2;
+    }
+    uint64_t hi = lo + step < n ? lo + step : n;
+    while (hi - lo > 1) {
+        uint64_t mid = lo + (hi - lo) / 2;
+        if (cumulative[mid] <= rank) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Returns the value of the given rank within the leaf.
+static uint64_t leaf_select(const roaring64_bitmap_t *r,
+                            const art_key_chunk_t key[], leaf_t leaf,
+                            uint32_t rank) {
+    uint32_t start = 0;
+    uint32_t element = 0;
+    uint8_t typecode;
+    leaf_view_t view;
+    const container_t *c = get_leaf_container(r, leaf, &typecode, &view);
+    container_select(c, typecode, &start, rank, &element);
+    return combine_key(key, (uint16_t)element);
+}
+
 bool roaring64_bitmap_select(const roaring64_bitmap_t *r, uint64_t rank,
                              uint64_t *element) {
+    if (r->cumulative_cardinalities != NULL) {
+        if (rank >= roaring64_bitmap_get_cardinality(r)) {
+            return false;
+        }
+        uint64_t index = cumulative_search(r, 0, rank);
+        art_key_chunk_t key[ART_KEY_BYTES];
+        leaf_t leaf = (leaf_t)*art_compact_leaf_at(&r->art, index, key);
+        *element = leaf_select(r, key, leaf,
+                               rank - r->cumulative_cardinalities[index]);
+        return true;
+    }
     art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
     uint64_t start_rank = 0;
     while (it.value != NULL) {
         leaf_t leaf = (leaf_t)*it.value;
-        uint64_t cardinality = container_get_cardinality(get_container(r, leaf),
-                                                         get_typecode(leaf));
+        uint64_t cardinality = leaf_cardinality(r, leaf);
         if (start_rank + cardinality > rank) {
-            uint32_t uint32_start = 0;
-            uint32_t uint32_rank = rank - start_rank;
-            uint32_t uint32_element = 0;
-            if (container_select(get_container(r, leaf), get_typecode(leaf),
-                                 &uint32_start, uint32_rank, &uint32_element)) {
-                *element = combine_key(it.key, (uint16_t)uint32_element);
-                return true;
-            }
-            return false;
+            *element = leaf_select(r, it.key, leaf, rank - start_rank);
+            return true;
         }
         start_rank += cardinality;
         art_iterator_next(&it);
@@ -801,56 +1786,177 @@ bool roaring64_bitmap_select(const roaring64_bitmap_t *r, uint64_t rank,
     return false;
 }
 
-uint64_t roaring64_bitmap_rank(const roaring64_bitmap_t *r, uint64_t val) {
-    uint8_t high48[ART_KEY_BYTES];
-    uint16_t low16 = split_key(val, high48);
-
+// Returns the leaf at `high48`, or NULL if there is none, and sets `*rank` to
+// the number of values under smaller keys.
+static const leaf_t *find_leaf_and_rank(const roaring64_bitmap_t *r,
+                                        art_key_chunk_t high48[],
+                                        uint64_t *rank) {
+    if (r->cumulative_cardinalities != NULL) {
+        art_iterator_t it = art_lower_bound((art_t *)&r->art, high48);
+        if (it.value == NULL) {
+            *rank = roaring64_bitmap_get_cardinality(r);
+            return NULL;
+        }
+        *rank = r->cumulative_cardinalities[art_compact_leaf_index(
+            &r->art, it.value)];
+        return compare_high48(it.key, high48) == 0 ? (leaf_t *)it.value
+                                                   : NULL;
+    }
     art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
-    uint64_t rank = 0;
+    *rank = 0;
     while (it.value != NULL) {
-        leaf_t leaf = (leaf_t)*it.value;
         int compare_result = compare_high48(it.key, high48);
-        if (compare_result < 0) {
-            rank += container_get_cardinality(get_container(r, leaf),
-                                              get_typecode(leaf));
-        } else if (compare_result == 0) {
-            return rank + container_rank(get_container(r, leaf),
-                                         get_typecode(leaf), low16);
-        } else {
-            return rank;
+        if (compare_result == 0) {
+            return (leaf_t *)it.value;
+        }
+        if (compare_result > 0) {
+            break;
         }
+        *rank += leaf_cardinality(r, (leaf_t)*it.value);
         art_iterator_next(&it);
     }
-    return rank;
+    return NULL;
+}
+
+uint64_t roaring64_bitmap_rank(const roaring64_bitmap_t *r, uint64_t val) {
+    uint8_t high48[ART_KEY_BYTES];
+    uint16_t low16 = split_key(val, high48);
+    uint64_t rank;
+    const leaf_t *leaf = find_leaf_and_rank(r, high48, &rank);
+    if (leaf == NULL) {
+        return rank;
+    }
+    uint8_t typecode;
+    leaf_view_t view;
+    const container_t *c = get_leaf_container(r, *leaf, &typecode, &view);
+    return rank + container_rank(c, typecode, low16);
 }
 
 bool roaring64_bitmap_get_index(const roaring64_bitmap_t *r, uint64_t val,
                                 uint64_t *out_index) {
     uint8_t high48[ART_KEY_BYTES];
     uint16_t low16 = split_key(val, high48);
+    uint64_t index;
+    const leaf_t *leaf = find_leaf_and_rank(r, high48, &index);
+    if (leaf == NULL) {
+        return false;
+    }
+    uint8_t typecode;
+    leaf_view_t view;
+    const container_t *c = get_leaf_container(r, *leaf, &typecode, &view);
+    int index16 = container_get_index(c, typecode, low16);
+    if (index16 < 0) {
+        return false;
+    }
+    *out_index = index + index16;
+    return true;
+}
 
+void roaring64_bitmap_rank_many(const roaring64_bitmap_t *r,
+                                const uint64_t *begin, const uint64_t *end,
+                                uint64_t *ans) {
     art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
-    uint64_t index = 0;
-    while (it.value != NULL) {
-        leaf_t leaf = (leaf_t)*it.value;
-        int compare_result = compare_high48(it.key, high48);
-        if (compare_result < 0) {
-            index += container_get_cardinality(get_container(r, leaf),
-                                               get_typecode(leaf));
-        } else if (compare_result == 0) {
-            int index16 = container_get_index(get_container(r, leaf),
-                                              get_typecode(leaf), low16);
-            if (index16 < 0) {
+    uint64_t rank = 0;  // the number of values before the leaf of `it`
+    while (begin != end) {
+        uint8_t high48[ART_KEY_BYTES];
+        split_key(*begin, high48);
+        if (it.value != NULL && compare_high48(it.key, high48) < 0) {
+            if (r->cumulative_cardinalities != NULL) {
+                art_iterator_skip_to(&it, high48);
+                rank = it.value == NULL
+                           ? roaring64_bitmap_get_cardinality(r)
+                           : r->cumulative_cardinalities[art_compact_leaf_index(
+                                 &r->art, it.value)];
+            } else {
+                do {
+                    rank += leaf_cardinality(r, (leaf_t)*it.value);
+                } while (art_iterator_next(&it) &&
+                         compare_high48(it.key, high48) < 0);
+            }
+        }
+        if (it.value == NULL || compare_high48(it.key, high48) > 0) {
+            *ans++ = rank;
+            begin++;
+            continue;
+        }
+        // All the values under this key.
+        uint8_t typecode;
+        leaf_view_t view;
+        const container_t *c =
+            get_leaf_container(r, (leaf_t)*it.value, &typecode, &view);
+        uint64_t high = *begin >> 16;
+        do {
+            *ans++ = rank + container_rank(c, typecode, (uint16_t)*begin);
+            begin++;
+        } while (begin != end && *begin >> 16 == high);
+    }
+}
+
+bool roaring64_bitmap_select_many(const roaring64_bitmap_t *r,
+                                  const uint64_t *begin, const uint64_t *end,
+                                  uint64_t *elements) {
+    art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
+    uint64_t leaf_index = 0;   // sealed bitmaps
+    uint64_t start = 0;        // the rank of the first value of the leaf
+    uint64_t cardinality = 0;  // of the leaf
+    while (begin != end) {
+        art_key_chunk_t key[ART_KEY_BYTES];
+        leaf_t leaf;
+        if (r->cumulative_cardinalities != NULL) {
+            if (*begin >= roaring64_bitmap_get_cardinality(r)) {
                 return false;
             }
-            *out_index = index + index16;
-            return true;
+            leaf_index = cumulative_search(r, leaf_index, *begin);
+            leaf = (leaf_t)*art_compact_leaf_at(&r->art, leaf_index, key);
+            start = r->cumulative_cardinalities[leaf_index];
+            cardinality =
+                r->cumulative_cardinalities[leaf_index + 1] - start;
         } else {
-            return false;
+            while (it.value != NULL &&
+                   *begin - start >=
+                       (cardinality = leaf_cardinality(r, (leaf_t)*it.value))) {
+                start += cardinality;
+                art_iterator_next(&it);
+            }
+            if (it.value == NULL) {
+                return false;
+            }
+            memcpy(key, it.key, ART_KEY_BYTES);
+            leaf = (leaf_t)*it.value;
         }
-        art_iterator_next(&it);
+        // All the ranks within this leaf.
+        uint8_t typecode;
+        leaf_view_t view;
+        const container_t *c = get_leaf_container(r, leaf, &typecode, &view);
+        do {
+            uint32_t container_start = 0;
+            uint32_t element = 0;
+            container_select(c, typecode, &container_start,
+                             (uint32_t)(*begin - start), &element);
+            *elements++ = combine_key(key, (uint16_t)element);
+            begin++;
+        } while (begin != end && *begin - start < cardinality);
     }
-    return false;
+    return true;
+}
+
+// Removes `low16` from the inline leaf. Returns true if the leaf is left
+// empty, in which case it must be erased.
+static inline bool inline_leaf_remove(roaring64_bitmap_t *r, leaf_t *leaf,
+                                      uint16_t low16) {
+    uint16_t values[INLINE_LEAF_CAPACITY];
+    int n = inline_leaf_values(*leaf, values);
+    int i = 0;
+    while (i < n && values[i] != low16) {
+        i++;
+    }
+    if (i == n) {
+        return false;
+    }
+    memmove(values + i, values + i + 1, (n - i - 1) * sizeof(uint16_t));
+    *leaf = create_inline_leaf(values, n - 1);
+    r->inline_cardinality--;
+    return n == 1;
 }
 
 // Returns true if a container was removed.
@@ -862,8 +1968,17 @@ static inline bool containerptr_roaring64_bitmap_remove(roaring64_bitmap_t *r,
         return false;
     }
 
+    if (is_inline_leaf(*leaf)) {
+        if (!inline_leaf_remove(r, leaf, low16)) {
+            return false;
+        }
+        bool erased = art_erase(&r->art, high48, NULL);
+        assert(erased);
+        (void)erased;
+        return true;
+    }
+    container_t *container = unshare_container(r, leaf);
     uint8_t typecode = get_typecode(*leaf);
-    container_t *container = get_container(r, *leaf);
     uint8_t typecode2;
     container_t *container2 =
         container_remove(container, low16, typecode, &typecode2);
@@ -882,7 +1997,7 @@ static inline bool containerptr_roaring64_bitmap_remove(roaring64_bitmap_t *r,
     return false;
 }
 
-void roaring64_bitmap_remove(roaring64_bitmap_t *r, uint64_t val) {
+static void roaring64_bitmap_remove_impl(roaring64_bitmap_t *r, uint64_t val) {
     art_t *art = &r->art;
     uint8_t high48[ART_KEY_BYTES];
     uint16_t low16 = split_key(val, high48);
@@ -891,7 +2006,18 @@ void roaring64_bitmap_remove(roaring64_bitmap_t *r, uint64_t val) {
     containerptr_roaring64_bitmap_remove(r, high48, low16, leaf);
 }
 
-bool roaring64_bitmap_remove_checked(roaring64_bitmap_t *r, uint64_t val) {
+void roaring64_bitmap_remove(roaring64_bitmap_t *r, uint64_t val) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return;
+    }
+    roaring64_bitmap_remove_impl(r, val);
+    compact_if_sparse(r);
+    leave_allocator(previous);
+}
+
+static bool roaring64_bitmap_remove_checked_impl(roaring64_bitmap_t *r,
+                                                 uint64_t val) {
     art_t *art = &r->art;
     uint8_t high48[ART_KEY_BYTES];
     uint16_t low16 = split_key(val, high48);
@@ -900,27 +2026,44 @@ bool roaring64_bitmap_remove_checked(roaring64_bitmap_t *r, uint64_t val) {
     if (leaf == NULL) {
         return false;
     }
-    int old_cardinality =
-        container_get_cardinality(get_container(r, *leaf), get_typecode(*leaf));
+    uint64_t old_cardinality = leaf_cardinality(r, *leaf);
     if (containerptr_roaring64_bitmap_remove(r, high48, low16, leaf)) {
         return true;
     }
-    int new_cardinality =
-        container_get_cardinality(get_container(r, *leaf), get_typecode(*leaf));
-    return new_cardinality != old_cardinality;
+    return leaf_cardinality(r, *leaf) != old_cardinality;
 }
 
-void roaring64_bitmap_remove_bulk(roaring64_bitmap_t *r,
-                                  roaring64_bulk_context_t *context,
-                                  uint64_t val) {
+bool roaring64_bitmap_remove_checked(roaring64_bitmap_t *r, uint64_t val) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return false;
+    }
+    bool answer = roaring64_bitmap_remove_checked_impl(r, val);
+    compact_if_sparse(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+static void roaring64_bitmap_remove_bulk_impl(roaring64_bitmap_t *r,
+                                              roaring64_bulk_context_t *context,
+                                              uint64_t val) {
     art_t *art = &r->art;
     uint8_t high48[ART_KEY_BYTES];
     uint16_t low16 = split_key(val, high48);
-    if (context->leaf != NULL &&
+    if (context->leaf != NULL && context->leaf != ABSENT_LEAF &&
         compare_high48(context->high_bytes, high48) == 0) {
         // We're at a container with the correct high bits.
+        if (is_inline_leaf(*context->leaf)) {
+            if (inline_leaf_remove(r, context->leaf, low16)) {
+                bool erased = art_erase(art, high48, NULL);
+                assert(erased);
+                (void)erased;
+                context->leaf = NULL;
+            }
+            return;
+        }
+        container_t *container = unshare_container(r, context->leaf);
         uint8_t typecode = get_typecode(*context->leaf);
-        container_t *container = get_container(r, *context->leaf);
         uint8_t typecode2;
         container_t *container2 =
             container_remove(container, low16, typecode, &typecode2);
@@ -941,14 +2084,29 @@ void roaring64_bitmap_remove_bulk(roaring64_bitmap_t *r,
         // We're not positioned anywhere yet or the high bits of the key
         // differ.
         leaf_t *leaf = (leaf_t *)art_find(art, high48);
-        containerptr_roaring64_bitmap_remove(r, high48, low16, leaf);
+        if (containerptr_roaring64_bitmap_remove(r, high48, low16, leaf)) {
+            leaf = NULL;
+        }
         context->leaf = leaf;
         memcpy(context->high_bytes, high48, ART_KEY_BYTES);
     }
 }
 
-void roaring64_bitmap_remove_many(roaring64_bitmap_t *r, size_t n_args,
-                                  const uint64_t *vals) {
+void roaring64_bitmap_remove_bulk(roaring64_bitmap_t *r,
+                                  roaring64_bulk_context_t *context,
+                                  uint64_t val) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return;
+    }
+    roaring64_bitmap_remove_bulk_impl(r, context, val);
+    compact_if_sparse(r);
+    leave_allocator(previous);
+}
+
+static void roaring64_bitmap_remove_many_impl(roaring64_bitmap_t *r,
+                                              size_t n_args,
+                                              const uint64_t *vals) {
     if (n_args == 0) {
         return;
     }
@@ -960,6 +2118,16 @@ void roaring64_bitmap_remove_many(roaring64_bitmap_t *r, size_t n_args,
     }
 }
 
+void roaring64_bitmap_remove_many(roaring64_bitmap_t *r, size_t n_args,
+                                  const uint64_t *vals) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return;
+    }
+    roaring64_bitmap_remove_many_impl(r, n_args, vals);
+    leave_allocator(previous);
+}
+
 static inline void remove_range_closed_at(roaring64_bitmap_t *r, art_t *art,
                                           uint8_t *high48, uint16_t min,
                                           uint16_t max) {
@@ -967,8 +2135,27 @@ static inline void remove_range_closed_at(roaring64_bitmap_t *r, art_t *art,
     if (leaf == NULL) {
         return;
     }
+    if (is_inline_leaf(*leaf)) {
+        uint16_t values[INLINE_LEAF_CAPACITY];
+        int n = inline_leaf_values(*leaf, values);
+        int kept = 0;
+        for (int i = 0; i < n; ++i) {
+            if (values[i] < min || values[i] > max) {
+                values[kept++] = values[i];
+            }
+        }
+        r->inline_cardinality -= n - kept;
+        if (kept > 0) {
+            *leaf = create_inline_leaf(values, kept);
+        } else {
+            bool erased = art_erase(art, high48, NULL);
+            assert(erased);
+            (void)erased;
+        }
+        return;
+    }
+    container_t *container = unshare_container(r, leaf);
     uint8_t typecode = get_typecode(*leaf);
-    container_t *container = get_container(r, *leaf);
     uint8_t typecode2;
     container_t *container2 =
         container_remove_range(container, typecode, min, max, &typecode2);
@@ -981,20 +2168,33 @@ static inline void remove_range_closed_at(roaring64_bitmap_t *r, art_t *art,
             assert(erased);
             (void)erased;
             remove_container(r, *leaf);
+            return;
         }
     }
+    inline_if_tiny(r, leaf);
 }
 
-void roaring64_bitmap_remove_range(roaring64_bitmap_t *r, uint64_t min,
-                                   uint64_t max) {
+static void roaring64_bitmap_remove_range_impl(roaring64_bitmap_t *r,
+                                               uint64_t min, uint64_t max) {
     if (min >= max) {
         return;
     }
     roaring64_bitmap_remove_range_closed(r, min, max - 1);
 }
 
-void roaring64_bitmap_remove_range_closed(roaring64_bitmap_t *r, uint64_t min,
-                                          uint64_t max) {
+void roaring64_bitmap_remove_range(roaring64_bitmap_t *r, uint64_t min,
+                                   uint64_t max) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return;
+    }
+    roaring64_bitmap_remove_range_impl(r, min, max);
+    leave_allocator(previous);
+}
+
+static void roaring64_bitmap_remove_range_closed_impl(roaring64_bitmap_t *r,
+                                                      uint64_t min,
+                                                      uint64_t max) {
     if (min > max) {
         return;
     }
@@ -1020,17 +2220,41 @@ void roaring64_bitmap_remove_range_closed(roaring64_bitmap_t *r, uint64_t min,
         bool erased = art_iterator_erase(&it, (art_val_t *)&leaf);
         assert(erased);
         (void)erased;
-        container_free(get_container(r, leaf), get_typecode(leaf));
+        free_leaf_container(r, leaf);
         remove_container(r, leaf);
     }
     remove_range_closed_at(r, art, max_high48, 0, max_low16);
 }
 
-void roaring64_bitmap_clear(roaring64_bitmap_t *r) {
+void roaring64_bitmap_remove_range_closed(roaring64_bitmap_t *r, uint64_t min,
+                                          uint64_t max) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return;
+    }
+    roaring64_bitmap_remove_range_closed_impl(r, min, max);
+    compact_if_sparse(r);
+    leave_allocator(previous);
+}
+
+static void roaring64_bitmap_clear_impl(roaring64_bitmap_t *r) {
+    if (is_sealed64(r)) {
+        release_sealed64(r);
+        return;
+    }
     roaring64_bitmap_remove_range_closed(r, 0, UINT64_MAX);
 }
 
+void roaring64_bitmap_clear(roaring64_bitmap_t *r) {
+    const roaring_allocator_t *previous = enter_allocator_of64(r);
+    roaring64_bitmap_clear_impl(r);
+    leave_allocator(previous);
+}
+
 uint64_t roaring64_bitmap_get_cardinality(const roaring64_bitmap_t *r) {
+    if (r->cumulative_cardinalities != NULL) {
+        return r->cumulative_cardinalities[art_compact_leaf_count(&r->art)];
+    }
     // Scan the pointer array rather than the ART: the arrays are sequential
     // and the ART is not. first_free is a free-list head, not a size, so
     // after deletes live containers can sit above it; skip NULL slots.
@@ -1041,7 +2265,7 @@ uint64_t roaring64_bitmap_get_cardinality(const roaring64_bitmap_t *r) {
                 container_get_cardinality(r->containers[i], r->typecodes[i]);
         }
     }
-    return cardinality;
+    return cardinality + r->inline_cardinality;
 }
 
 uint64_t roaring64_bitmap_range_cardinality(const roaring64_bitmap_t *r,
@@ -1076,8 +2300,10 @@ uint64_t roaring64_bitmap_range_closed_cardinality(const roaring64_bitmap_t *r,
         }
 
         leaf_t leaf = (leaf_t)*it.value;
-        uint8_t typecode = get_typecode(leaf);
-        container_t *container = get_container(r, leaf);
+        uint8_t typecode;
+        leaf_view_t view;
+        const container_t *container =
+            get_leaf_container(r, leaf, &typecode, &view);
         if (max_compare_result == 0) {
             // We're at the max high key, add only the range up to the low
             // 16 bits of max.
@@ -1107,6 +2333,9 @@ uint64_t roaring64_bitmap_minimum(const roaring64_bitmap_t *r) {
         return UINT64_MAX;
     }
     leaf_t leaf = (leaf_t)*it.value;
+    if (is_inline_leaf(leaf)) {
+        return combine_key(it.key, inline_leaf_value(leaf, 0));
+    }
     return combine_key(
         it.key, container_minimum(get_container(r, leaf), get_typecode(leaf)));
 }
@@ -1117,22 +2346,34 @@ uint64_t roaring64_bitmap_maximum(const roaring64_bitmap_t *r) {
         return 0;
     }
     leaf_t leaf = (leaf_t)*it.value;
+    if (is_inline_leaf(leaf)) {
+        int n = inline_leaf_cardinality(leaf);
+        return combine_key(it.key, inline_leaf_value(leaf, n - 1));
+    }
     return combine_key(
         it.key, container_maximum(get_container(r, leaf), get_typecode(leaf)));
 }
 
-bool roaring64_bitmap_remove_run_compression(roaring64_bitmap_t *r) {
+static bool roaring64_bitmap_remove_run_compression_impl(
+    roaring64_bitmap_t *r) {
     art_iterator_t it = art_init_iterator(&r->art, /*first=*/true);
     bool removed = false;
     while (it.value != NULL) {
         leaf_t *leaf = (leaf_t *)it.value;
-        if (get_typecode(*leaf) == RUN_CONTAINER_TYPE) {
-            run_container_t *run = CAST_run(get_container(r, *leaf));
+        if (is_inline_leaf(*leaf)) {
+            art_iterator_next(&it);
+            continue;
+        }
+        uint8_t typecode;
+        const container_t *c = get_actual_container(r, *leaf, &typecode, NULL);
+        if (typecode == RUN_CONTAINER_TYPE) {
+            // A shared run is converted without cloning it first.
+            run_container_t *run = (run_container_t *)const_CAST_run(c);
             int32_t card = run_container_cardinality(run);
             uint8_t new_typecode;
             container_t *new_container =
                 convert_to_bitset_or_array_container(run, card, &new_typecode);
-            run_container_free(run);
+            container_free(get_container(r, *leaf), get_typecode(*leaf));
             replace_container(r, leaf, new_container, new_typecode);
             removed = true;
         }
@@ -1141,16 +2382,38 @@ bool roaring64_bitmap_remove_run_compression(roaring64_bitmap_t *r) {
     return removed;
 }
 
-bool roaring64_bitmap_run_optimize(roaring64_bitmap_t *r) {
+bool roaring64_bitmap_remove_run_compression(roaring64_bitmap_t *r) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return false;
+    }
+    bool answer = roaring64_bitmap_remove_run_compression_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+static bool roaring64_bitmap_run_optimize_impl(roaring64_bitmap_t *r) {
     art_iterator_t it = art_init_iterator(&r->art, /*first=*/true);
     bool has_run_container = false;
     while (it.value != NULL) {
         leaf_t *leaf = (leaf_t *)it.value;
+        if (is_inline_leaf(*leaf)) {
+            // Smaller than any run container.
+            art_iterator_next(&it);
+            continue;
+        }
+        if (is_shared_full_leaf(r, *leaf)) {
+            // A single run already.
+            has_run_container = true;
+            art_iterator_next(&it);
+            continue;
+        }
         uint8_t new_typecode;
         // We don't need to free the existing container if a new one was
         // created, convert_run_optimize does that internally.
-        container_t *new_container = convert_run_optimize(
-            get_container(r, *leaf), get_typecode(*leaf), &new_typecode);
+        container_t *container = unshare_container(r, leaf);
+        container_t *new_container =
+            convert_run_optimize(container, get_typecode(*leaf), &new_typecode);
         replace_container(r, leaf, new_container, new_typecode);
         has_run_container |= new_typecode == RUN_CONTAINER_TYPE;
         art_iterator_next(&it);
@@ -1158,48 +2421,122 @@ bool roaring64_bitmap_run_optimize(roaring64_bitmap_t *r) {
     return has_run_container;
 }
 
-static void move_to_shrink(roaring64_bitmap_t *r, leaf_t *leaf) {
-    uint64_t idx = get_index(*leaf);
-    if (idx < r->first_free) {
-        return;
+bool roaring64_bitmap_run_optimize(roaring64_bitmap_t *r) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return false;
     }
-    uint8_t typecode = get_typecode(*leaf);
-    set_container_at(r, r->first_free, get_container(r, *leaf), typecode);
-    r->containers[idx] = NULL;
-    *leaf = create_leaf(r->first_free, typecode);
-    r->first_free = next_free_container_idx(r);
+    bool answer = roaring64_bitmap_run_optimize_impl(r);
+    leave_allocator(previous);
+    return answer;
 }
 
 static inline bool is_shrunken(const roaring64_bitmap_t *r) {
     return art_is_shrunken(&r->art) && r->first_free == r->capacity;
 }
 
-size_t roaring64_bitmap_shrink_to_fit(roaring64_bitmap_t *r) {
+static size_t roaring64_bitmap_shrink_to_fit_impl(roaring64_bitmap_t *r) {
+    if (is_sealed64(r)) {
+        return 0;
+    }
     size_t freed = art_shrink_to_fit(&r->art);
+    // Inline tiny containers first, so that the slots they free are released
+    // when the containers are compacted below.
     art_iterator_t it = art_init_iterator(&r->art, true);
     while (it.value != NULL) {
         leaf_t *leaf = (leaf_t *)it.value;
-        freed += container_shrink_to_fit(get_container(r, *leaf),
-                                         get_typecode(*leaf));
-        move_to_shrink(r, leaf);
+        if (!is_inline_leaf(*leaf) &&
+            get_typecode(*leaf) == ARRAY_CONTAINER_TYPE) {
+            const array_container_t *ac =
+                const_CAST_array(get_container(r, *leaf));
+            size_t bytes =
+                sizeof(array_container_t) + ac->capacity * sizeof(uint16_t);
+            inline_if_tiny(r, leaf);
+            if (is_inline_leaf(*leaf)) {
+                freed += bytes;
+            }
+        }
         art_iterator_next(&it);
     }
-    if (is_shrunken(r)) {
-        return freed;
+    it = art_init_iterator(&r->art, true);
+    while (it.value != NULL) {
+        leaf_t *leaf = (leaf_t *)it.value;
+        if (is_inline_leaf(*leaf)) {
+            art_iterator_next(&it);
+            continue;
+        }
+        // Other bitmaps may be reading a shared container: leave it be.
+        if (get_typecode(*leaf) != SHARED_CONTAINER_TYPE) {
+            freed += container_shrink_to_fit(get_container(r, *leaf),
+                                             get_typecode(*leaf));
+        }
+        art_iterator_next(&it);
     }
-    uint64_t new_capacity = r->first_free;
-    if (new_capacity < r->capacity) {
-        r->containers = (container_t **)roaring_realloc(
-            r->containers, new_capacity * sizeof(container_t *));
-        r->typecodes = (uint8_t *)roaring_realloc(
-            r->typecodes, new_capacity * sizeof(uint8_t));
-        freed += (r->capacity - new_capacity) *
+    uint64_t capacity = r->capacity;
+    if (r->live_containers < capacity && compact_containers(r)) {
+        freed += (capacity - r->capacity) *
                  (sizeof(container_t *) + sizeof(uint8_t));
-        r->capacity = new_capacity;
     }
     return freed;
 }
 
+size_t roaring64_bitmap_shrink_to_fit(roaring64_bitmap_t *r) {
+    const roaring_allocator_t *previous = enter_allocator_of64(r);
+    size_t answer = roaring64_bitmap_shrink_to_fit_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+bool roaring64_bitmap_compact(roaring64_bitmap_t *r) {
+    if (is_frozen64(r)) {
+        return false;
+    }
+    if (is_sealed64(r)) {
+        return true;
+    }
+    const roaring_allocator_t *previous = enter_allocator_of64(r);
+    bool answer = compact_containers(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+static size_t roaring64_bitmap_intern_impl(roaring64_bitmap_t *r,
+                                           roaring_interner_t *in) {
+    size_t bytes_saved = 0;
+    r->flags |= ROARING_FLAG_COW;
+    art_iterator_t it = art_init_iterator(&r->art, /*first=*/true);
+    while (it.value != NULL) {
+        leaf_t *leaf = (leaf_t *)it.value;
+        if (is_inline_leaf(*leaf)) {
+            // Nothing to share.
+            art_iterator_next(&it);
+            continue;
+        }
+        uint8_t typecode = get_typecode(*leaf);
+        container_t *c = interner_intern_container(
+            in, get_container(r, *leaf), &typecode, &bytes_saved);
+        if (c == NULL) {
+            break;
+        }
+        replace_container(r, leaf, c, typecode);
+        art_iterator_next(&it);
+    }
+    return bytes_saved;
+}
+
+size_t roaring64_bitmap_intern(roaring64_bitmap_t *r, roaring_interner_t *in) {
+    if (is_frozen64(r)) {
+        return 0;
+    }
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return 0;
+    }
+    size_t answer = roaring64_bitmap_intern_impl(r, in);
+    leave_allocator(previous);
+    return answer;
+}
+
 /**
  *  (For advanced users.)
  * Collect statistics about the bitmap
@@ -1214,12 +2551,14 @@ void roaring64_bitmap_statistics(const roaring64_bitmap_t *r,
     while (it.value != NULL) {
         leaf_t leaf = (leaf_t)*it.value;
         stat->n_containers++;
-        uint8_t truetype =
-            get_container_type(get_container(r, leaf), get_typecode(leaf));
-        uint32_t card = container_get_cardinality(get_container(r, leaf),
-                                                  get_typecode(leaf));
+        // Inline leaves count as array containers that take no bytes.
+        uint8_t typecode;
+        leaf_view_t view;
+        const container_t *c = get_leaf_container(r, leaf, &typecode, &view);
+        uint8_t truetype = get_container_type(c, typecode);
+        uint32_t card = container_get_cardinality(c, typecode);
         uint32_t sbytes =
-            container_size_in_bytes(get_container(r, leaf), get_typecode(leaf));
+            is_inline_leaf(leaf) ? 0 : container_size_in_bytes(c, typecode);
         stat->cardinality += card;
         switch (truetype) {
             case BITSET_CONTAINER_TYPE:
@@ -1245,11 +2584,43 @@ void roaring64_bitmap_statistics(const roaring64_bitmap_t *r,
     }
 }
 
+typedef struct validate_context_s {
+    const roaring64_bitmap_t *r;
+    uint64_t inline_cardinality;
+    uint64_t live_containers;
+} validate_context_t;
+
+static bool inline_leaf_internal_validate(leaf_t leaf, const char **reason) {
+    int n = inline_leaf_cardinality(leaf);
+    if (n == 0 || n > INLINE_LEAF_CAPACITY) {
+        *reason = "inline leaf has an invalid cardinality";
+        return false;
+    }
+    if ((leaf & 0xFF00) != 0 || (n < INLINE_LEAF_CAPACITY &&
+                                 (leaf >> (16 * (n + 1))) != 0)) {
+        *reason = "inline leaf has stray bits";
+        return false;
+    }
+    for (int i = 1; i < n; ++i) {
+        if (inline_leaf_value(leaf, i - 1) >= inline_leaf_value(leaf, i)) {
+            *reason = "inline leaf values are not strictly increasing";
+            return false;
+        }
+    }
+    return true;
+}
+
 static bool roaring64_leaf_internal_validate(const art_val_t val,
                                              const char **reason,
                                              void *context) {
     leaf_t leaf = (leaf_t)val;
-    roaring64_bitmap_t *r = (roaring64_bitmap_t *)context;
+    validate_context_t *ctx = (validate_context_t *)context;
+    const roaring64_bitmap_t *r = ctx->r;
+    if (is_inline_leaf(leaf)) {
+        ctx->inline_cardinality += inline_leaf_cardinality(leaf);
+        return inline_leaf_internal_validate(leaf, reason);
+    }
+    ctx->live_containers++;
     uint64_t index = get_index(leaf);
     uint8_t typecode = get_typecode(leaf);
     if (index >= r->capacity || r->containers[index] == NULL) {
@@ -1265,8 +2636,37 @@ static bool roaring64_leaf_internal_validate(const art_val_t val,
 
 bool roaring64_bitmap_internal_validate(const roaring64_bitmap_t *r,
                                         const char **reason) {
-    return art_internal_validate(&r->art, reason,
-                                 roaring64_leaf_internal_validate, (void *)r);
+    validate_context_t ctx = {r, 0, 0};
+    if (!art_internal_validate(&r->art, reason,
+                               roaring64_leaf_internal_validate, &ctx)) {
+        return false;
+    }
+    if (ctx.inline_cardinality != r->inline_cardinality) {
+        *reason = "inline cardinality does not match the inline leaves";
+        return false;
+    }
+    if (ctx.live_containers != r->live_containers) {
+        *reason = "live container count does not match the ART leaves";
+        return false;
+    }
+    if (r->cumulative_cardinalities != NULL) {
+        art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
+        uint64_t cardinality = 0;
+        for (uint64_t i = 0; it.value != NULL; art_iterator_next(&it), ++i) {
+            if (art_compact_leaf_index(&r->art, it.value) != i ||
+                r->cumulative_cardinalities[i] != cardinality) {
+                *reason = "cumulative cardinalities do not match the leaves";
+                return false;
+            }
+            cardinality += leaf_cardinality(r, (leaf_t)*it.value);
+        }
+        if (r->cumulative_cardinalities[art_compact_leaf_count(&r->art)] !=
+            cardinality) {
+            *reason = "cumulative cardinalities do not match the leaves";
+            return false;
+        }
+    }
+    return true;
 }
 
 bool roaring64_bitmap_equals(const roaring64_bitmap_t *r1,
@@ -1280,8 +2680,11 @@ bool roaring64_bitmap_equals(const roaring64_bitmap_t *r1,
         }
         leaf_t leaf1 = (leaf_t)*it1.value;
         leaf_t leaf2 = (leaf_t)*it2.value;
-        if (!container_equals(get_container(r1, leaf1), get_typecode(leaf1),
-                              get_container(r2, leaf2), get_typecode(leaf2))) {
+        uint8_t type1, type2;
+        leaf_view_t view1, view2;
+        const container_t *c1 = get_leaf_container(r1, leaf1, &type1, &view1);
+        const container_t *c2 = get_leaf_container(r2, leaf2, &type2, &view2);
+        if (!container_equals(c1, type1, c2, type2)) {
             return false;
         }
         art_iterator_next(&it1);
@@ -1290,8 +2693,126 @@ bool roaring64_bitmap_equals(const roaring64_bitmap_t *r1,
     return it1.value == NULL && it2.value == NULL;
 }
 
+// Two ARTs with similar numbers of leaves are traversed in lockstep, by
+// jumping one iterator to the key of the other, which skips the subtrees that
+// hold no key of the other ART. When one has far fewer leaves, these are
+// instead looked up one by one in the other ART.
+#define GALLOP_RATIO 64
+
+// Estimated number of leaves: inline leaves hold one to three values each.
+static inline uint64_t leaf_count_estimate(const roaring64_bitmap_t *r) {
+    return r->live_containers + r->inline_cardinality;
+}
+
+static inline bool should_gallop(const roaring64_bitmap_t *small,
+                                 const roaring64_bitmap_t *large) {
+    return leaf_count_estimate(small) * GALLOP_RATIO <
+           leaf_count_estimate(large);
+}
+
+// Visits the keys that two bitmaps have in common, in increasing order.
+typedef struct common_leaves_s {
+    art_iterator_t it1;
+    art_iterator_t it2;  // unused when galloping
+    // When galloping, the ART that the keys of it1 are looked up in, and its
+    // largest key.
+    const art_t *probed;
+    art_key_chunk_t probed_max[ART_KEY_BYTES];
+    bool swapped;  // it1 iterates over the second bitmap
+    bool started;
+    leaf_t leaf1;
+    leaf_t leaf2;
+} common_leaves_t;
+
+// Positions `it` at the first key of `art` within the key range of `probed`,
+// which is not empty.
+static art_iterator_t gallop_init_iterator(const art_t *art,
+                                           const art_t *probed,
+                                           art_key_chunk_t probed_max[]) {
+    art_iterator_t last = art_init_iterator((art_t *)probed, /*first=*/false);
+    memcpy(probed_max, last.key, ART_KEY_BYTES);
+    art_iterator_t first = art_init_iterator((art_t *)probed, /*first=*/true);
+    return art_lower_bound((art_t *)art, first.key);
+}
+
+static void common_leaves_init(common_leaves_t *c, const roaring64_bitmap_t *r1,
+                               const roaring64_bitmap_t *r2) {
+    c->probed = NULL;
+    c->swapped = false;
+    c->started = false;
+    if (should_gallop(r2, r1)) {
+        c->probed = &r1->art;
+        c->it1 = gallop_init_iterator(&r2->art, c->probed, c->probed_max);
+        c->swapped = true;
+    } else if (should_gallop(r1, r2)) {
+        c->probed = &r2->art;
+        c->it1 = gallop_init_iterator(&r1->art, c->probed, c->probed_max);
+    } else {
+        c->it1 = art_init_iterator((art_t *)&r1->art, /*first=*/true);
+        c->it2 = art_init_iterator((art_t *)&r2->art, /*first=*/true);
+    }
+}
+
+// Moves to the next common key, `c->it1.key`, and sets the leaves of both
+// bitmaps. Returns false when there is none.
+static bool common_leaves_next(common_leaves_t *c) {
+    if (c->started) {
+        art_iterator_next(&c->it1);
+        if (c->probed == NULL) {
+            art_iterator_next(&c->it2);
+        }
+    }
+    c->started = true;
+    if (c->probed != NULL) {
+        for (; c->it1.value != NULL; art_iterator_next(&c->it1)) {
+            if (art_compare_keys(c->it1.key, c->probed_max) > 0) {
+                return false;
+            }
+            const art_val_t *val = art_find(c->probed, c->it1.key);
+            if (val != NULL) {
+                c->leaf1 = (leaf_t)(c->swapped ? *val : *c->it1.value);
+                c->leaf2 = (leaf_t)(c->swapped ? *c->it1.value : *val);
+                return true;
+            }
+        }
+        return false;
+    }
+    while (c->it1.value != NULL && c->it2.value != NULL) {
+        int compare_result = art_compare_keys(c->it1.key, c->it2.key);
+        if (compare_result == 0) {
+            c->leaf1 = (leaf_t)*c->it1.value;
+            c->leaf2 = (leaf_t)*c->it2.value;
+            return true;
+        } else if (compare_result < 0) {
+            art_iterator_skip_to(&c->it1, c->it2.key);
+        } else {
+            art_iterator_skip_to(&c->it2, c->it1.key);
+        }
+    }
+    return false;
+}
+
 bool roaring64_bitmap_is_subset(const roaring64_bitmap_t *r1,
                                 const roaring64_bitmap_t *r2) {
+    if (should_gallop(r1, r2)) {
+        art_iterator_t it = art_init_iterator((art_t *)&r1->art, true);
+        for (; it.value != NULL; art_iterator_next(&it)) {
+            const art_val_t *val = art_find(&r2->art, it.key);
+            if (val == NULL) {
+                return false;
+            }
+            uint8_t type1, type2;
+            leaf_view_t view1, view2;
+            const container_t *c1 =
+                get_leaf_container(r1, (leaf_t)*it.value, &type1, &view1);
+            const container_t *c2 =
+                get_leaf_container(r2, (leaf_t)*val, &type2, &view2);
+            if (!container_is_subset(c1, type1, c2, type2)) {
+                return false;
+            }
+        }
+        return true;
+    }
     art_iterator_t it1 = art_init_iterator((art_t *)&r1->art, /*first=*/true);
     art_iterator_t it2 = art_init_iterator((art_t *)&r2->art, /*first=*/true);
 
@@ -1304,9 +2825,13 @@ bool roaring64_bitmap_is_subset(const roaring64_bitmap_t *r1,
             if (compare_result == 0) {
                 leaf_t leaf1 = (leaf_t)*it1.value;
                 leaf_t leaf2 = (leaf_t)*it2.value;
-                if (!container_is_subset(
-                        get_container(r1, leaf1), get_typecode(leaf1),
-                        get_container(r2, leaf2), get_typecode(leaf2))) {
+                uint8_t type1, type2;
+                leaf_view_t view1, view2;
+                const container_t *c1 =
+                    get_leaf_container(r1, leaf1, &type1, &view1);
+                const container_t *c2 =
+                    get_leaf_container(r2, leaf2, &type2, &view2);
+                if (!container_is_subset(c1, type1, c2, type2)) {
                     return false;
                 }
                 art_iterator_next(&it1);
@@ -1316,7 +2841,7 @@ bool roaring64_bitmap_is_subset(const roaring64_bitmap_t *r1,
         if (!it2_present || compare_result < 0) {
             return false;
         } else if (compare_result > 0) {
-            art_iterator_lower_bound(&it2, it1.key);
+            art_iterator_skip_to(&it2, it1.key);
         }
     }
     return true;
@@ -1329,85 +2854,67 @@ bool roaring64_bitmap_is_strict_subset(const roaring64_bitmap_t *r1,
            roaring64_bitmap_is_subset(r1, r2);
 }
 
-roaring64_bitmap_t *roaring64_bitmap_and(const roaring64_bitmap_t *r1,
-                                         const roaring64_bitmap_t *r2) {
+static roaring64_bitmap_t *roaring64_bitmap_and_impl(
+    const roaring64_bitmap_t *r1, const roaring64_bitmap_t *r2) {
     roaring64_bitmap_t *result = roaring64_bitmap_create();
-
-    art_iterator_t it1 = art_init_iterator((art_t *)&r1->art, /*first=*/true);
-    art_iterator_t it2 = art_init_iterator((art_t *)&r2->art, /*first=*/true);
-
-    while (it1.value != NULL && it2.value != NULL) {
-        // Cases:
-        // 1. it1 <  it2 -> it1++
-        // 2. it1 == it1 -> output it1 & it2, it1++, it2++
-        // 3. it1 >  it2 -> it2++
-        int compare_result = compare_high48(it1.key, it2.key);
-        if (compare_result == 0) {
-            // Case 2: iterators at the same high key position.
-            leaf_t leaf1 = (leaf_t)*it1.value;
-            leaf_t leaf2 = (leaf_t)*it2.value;
-            uint8_t result_typecode;
-            container_t *result_container =
-                container_and(get_container(r1, leaf1), get_typecode(leaf1),
-                              get_container(r2, leaf2), get_typecode(leaf2),
-                              &result_typecode);
-            if (container_nonzero_cardinality(result_container,
-                                              result_typecode)) {
-                leaf_t result_leaf =
-                    add_container(result, result_container, result_typecode);
-                art_insert(&result->art, it1.key, (art_val_t)result_leaf);
-            } else {
-                container_free(result_container, result_typecode);
-            }
-            art_iterator_next(&it1);
-            art_iterator_next(&it2);
-        } else if (compare_result < 0) {
-            // Case 1: it1 is before it2.
-            art_iterator_lower_bound(&it1, it2.key);
+    result->flags = (r1->flags | r2->flags) & ROARING_FLAG_COW;
+
+    common_leaves_t common;
+    common_leaves_init(&common, r1, r2);
+    while (common_leaves_next(&common)) {
+        uint8_t type1, type2;
+        leaf_view_t view1, view2;
+        const container_t *c1 =
+            get_leaf_container(r1, common.leaf1, &type1, &view1);
+        const container_t *c2 =
+            get_leaf_container(r2, common.leaf2, &type2, &view2);
+        uint8_t result_typecode;
+        container_t *result_container =
+            container_and(c1, type1, c2, type2, &result_typecode);
+        if (container_nonzero_cardinality(result_container, result_typecode)) {
+            result_container =
+                share_if_full(result_container, &result_typecode);
+            leaf_t result_leaf =
+                add_container(result, result_container, result_typecode);
+            art_bulk_append(&result->art, common.it1.key,
+                            (art_val_t)result_leaf);
         } else {
-            // Case 3: it2 is before it1.
-            art_iterator_lower_bound(&it2, it1.key);
+            container_free(result_container, result_typecode);
         }
     }
+    art_bulk_finish(&result->art);
     return result;
 }
 
+roaring64_bitmap_t *roaring64_bitmap_and(const roaring64_bitmap_t *r1,
+                                         const roaring64_bitmap_t *r2) {
+    const roaring_allocator_t *previous = enter_result_allocator_of64(r1);
+    roaring64_bitmap_t *answer = roaring64_bitmap_and_impl(r1, r2);
+    leave_allocator(previous);
+    return answer;
+}
+
 uint64_t roaring64_bitmap_and_cardinality(const roaring64_bitmap_t *r1,
                                           const roaring64_bitmap_t *r2) {
     uint64_t result = 0;
 
-    art_iterator_t it1 = art_init_iterator((art_t *)&r1->art, /*first=*/true);
-    art_iterator_t it2 = art_init_iterator((art_t *)&r2->art, /*first=*/true);
-
-    while (it1.value != NULL && it2.value != NULL) {
-        // Cases:
-        // 1. it1 <  it2 -> it1++
-        // 2. it1 == it1 -> output cardinaltiy it1 & it2, it1++, it2++
-        // 3. it1 >  it2 -> it2++
-        int compare_result = compare_high48(it1.key, it2.key);
-        if (compare_result == 0) {
-            // Case 2: iterators at the same high key position.
-            leaf_t leaf1 = (leaf_t)*it1.value;
-            leaf_t leaf2 = (leaf_t)*it2.value;
-            result += container_and_cardinality(
-                get_container(r1, leaf1), get_typecode(leaf1),
-                get_container(r2, leaf2), get_typecode(leaf2));
-            art_iterator_next(&it1);
-            art_iterator_next(&it2);
-        } else if (compare_result < 0) {
-            // Case 1: it1 is before it2.
-            art_iterator_lower_bound(&it1, it2.key);
-        } else {
-            // Case 3: it2 is before it1.
-            art_iterator_lower_bound(&it2, it1.key);
-        }
+    common_leaves_t common;
+    common_leaves_init(&common, r1, r2);
+    while (common_leaves_next(&common)) {
+        uint8_t type1, type2;
+        leaf_view_t view1, view2;
+        const container_t *c1 =
+            get_leaf_container(r1, common.leaf1, &type1, &view1);
+        const container_t *c2 =
+            get_leaf_container(r2, common.leaf2, &type2, &view2);
+        result += container_and_cardinality(c1, type1, c2, type2);
     }
     return result;
 }
 
 // Inplace and (modifies its first argument).
-void roaring64_bitmap_and_inplace(roaring64_bitmap_t *r1,
-                                  const roaring64_bitmap_t *r2) {
+static void roaring64_bitmap_and_inplace_impl(roaring64_bitmap_t *r1,
+                                              const roaring64_bitmap_t *r2) {
     if (r1 == r2) {
         return;
     }
@@ -1431,36 +2938,43 @@ void roaring64_bitmap_and_inplace(roaring64_bitmap_t *r1,
                 leaf_t leaf2 = (leaf_t)*it2.value;
 
                 // We do the computation "in place" only when c1 is not a
-                // shared container. Rationale: using a shared container
-                // safely with in place computation would require making a
-                // copy and then doing the computation in place which is
-                // likely less efficient than avoiding in place entirely and
-                // always generating a new container.
-                uint8_t typecode = get_typecode(*leaf1);
-                container_t *container = get_container(r1, *leaf1);
+                // shared container or an inline leaf. Rationale: using a
+                // shared container safely with in place computation would
+                // require making a copy and then doing the computation in
+                // place which is likely less efficient than avoiding in place
+                // entirely and always generating a new container.
+                uint8_t typecode;
+                leaf_view_t view1;
+                const container_t *container =
+                    get_leaf_container(r1, *leaf1, &typecode, &view1);
+                uint8_t type2;
+                leaf_view_t view2;
+                const container_t *c2 =
+                    get_leaf_container(r2, leaf2, &type2, &view2);
                 uint8_t typecode2;
                 container_t *container2;
-                if (typecode == SHARED_CONTAINER_TYPE) {
-                    container2 = container_and(container, typecode,
-                                               get_container(r2, leaf2),
-                                               get_typecode(leaf2), &typecode2);
+                if (is_inline_leaf(*leaf1) ||
+                    typecode == SHARED_CONTAINER_TYPE) {
+                    container2 = container_and(container, typecode, c2, type2,
+                                               &typecode2);
                 } else {
-                    container2 = container_iand(
-                        container, typecode, get_container(r2, leaf2),
-                        get_typecode(leaf2), &typecode2);
+                    container2 = container_iand(get_container(r1, *leaf1),
+                                                typecode, c2, type2,
+                                                &typecode2);
                 }
 
                 if (container2 != container) {
-                    container_free(container, typecode);
+                    free_leaf_container(r1, *leaf1);
                 }
                 if (!container_nonzero_cardinality(container2, typecode2)) {
                     container_free(container2, typecode2);
-                    art_iterator_erase(&it1, NULL);
                     remove_container(r1, *leaf1);
+                    art_iterator_erase(&it1, NULL);
                 } else {
                     if (container2 != container) {
                         replace_container(r1, leaf1, container2, typecode2);
                     }
+                    inline_if_tiny(r1, leaf1);
                     // Only advance the iterator if we didn't delete the
                     // leaf, as erasing advances by itself.
                     art_iterator_next(&it1);
@@ -1475,7 +2989,7 @@ void roaring64_bitmap_and_inplace(roaring64_bitmap_t *r1,
             bool erased = art_iterator_erase(&it1, (art_val_t *)&leaf);
             assert(erased);
             (void)erased;
-            container_free(get_container(r1, leaf), get_typecode(leaf));
+            free_leaf_container(r1, leaf);
             remove_container(r1, leaf);
         } else if (compare_result > 0) {
             // Case 2c: it1 is after it2.
@@ -1484,36 +2998,33 @@ void roaring64_bitmap_and_inplace(roaring64_bitmap_t *r1,
     }
 }
 
+void roaring64_bitmap_and_inplace(roaring64_bitmap_t *r1,
+                                  const roaring64_bitmap_t *r2) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r1, &previous)) {
+        return;
+    }
+    roaring64_bitmap_and_inplace_impl(r1, r2);
+    compact_if_sparse(r1);
+    leave_allocator(previous);
+}
+
 bool roaring64_bitmap_intersect(const roaring64_bitmap_t *r1,
                                 const roaring64_bitmap_t *r2) {
-    bool intersect = false;
-    art_iterator_t it1 = art_init_iterator((art_t *)&r1->art, /*first=*/true);
-    art_iterator_t it2 = art_init_iterator((art_t *)&r2->art, /*first=*/true);
-
-    while (it1.value != NULL && it2.value != NULL) {
-        // Cases:
-        // 1. it1 <  it2 -> it1++
-        // 2. it1 == it1 -> intersect |= it1 & it2, it1++, it2++
-        // 3. it1 >  it2 -> it2++
-        int compare_result = compare_high48(it1.key, it2.key);
-        if (compare_result == 0) {
-            // Case 2: iterators at the same high key position.
-            leaf_t leaf1 = (leaf_t)*it1.value;
-            leaf_t leaf2 = (leaf_t)*it2.value;
-            intersect |= container_intersect(
-                get_container(r1, leaf1), get_typecode(leaf1),
-                get_container(r2, leaf2), get_typecode(leaf2));
-            art_iterator_next(&it1);
-            art_iterator_next(&it2);
-        } else if (compare_result < 0) {
-            // Case 1: it1 is before it2.
-            art_iterator_lower_bound(&it1, it2.key);
-        } else {
-            // Case 3: it2 is before it1.
-            art_iterator_lower_bound(&it2, it1.key);
+    common_leaves_t common;
+    common_leaves_init(&common, r1, r2);
+    while (common_leaves_next(&common)) {
+        uint8_t type1, type2;
+        leaf_view_t view1, view2;
+        const container_t *c1 =
+            get_leaf_container(r1, common.leaf1, &type1, &view1);
+        const container_t *c2 =
+            get_leaf_container(r2, common.leaf2, &type2, &view2);
+        if (container_intersect(c1, type1, c2, type2)) {
+            return true;
         }
     }
-    return intersect;
+    return false;
 }
 
 bool roaring64_bitmap_intersect_with_range(const roaring64_bitmap_t *r,
@@ -1538,9 +3049,10 @@ double roaring64_bitmap_jaccard_index(const roaring64_bitmap_t *r1,
     return (double)inter / (double)(c1 + c2 - inter);
 }
 
-roaring64_bitmap_t *roaring64_bitmap_or(const roaring64_bitmap_t *r1,
-                                        const roaring64_bitmap_t *r2) {
+static roaring64_bitmap_t *roaring64_bitmap_or_impl(
+    const roaring64_bitmap_t *r1, const roaring64_bitmap_t *r2) {
     roaring64_bitmap_t *result = roaring64_bitmap_create();
+    result->flags = (r1->flags | r2->flags) & ROARING_FLAG_COW;
 
     art_iterator_t it1 = art_init_iterator((art_t *)&r1->art, /*first=*/true);
     art_iterator_t it2 = art_init_iterator((art_t *)&r2->art, /*first=*/true);
@@ -1563,14 +3075,20 @@ roaring64_bitmap_t *roaring64_bitmap_or(const roaring64_bitmap_t *r1,
                 // Case 3b: iterators at the same high key position.
                 leaf_t leaf1 = (leaf_t)*it1.value;
                 leaf_t leaf2 = (leaf_t)*it2.value;
+                uint8_t type1, type2;
+                leaf_view_t view1, view2;
+                const container_t *c1 =
+                    get_leaf_container(r1, leaf1, &type1, &view1);
+                const container_t *c2 =
+                    get_leaf_container(r2, leaf2, &type2, &view2);
                 uint8_t result_typecode;
                 container_t *result_container =
-                    container_or(get_container(r1, leaf1), get_typecode(leaf1),
-                                 get_container(r2, leaf2), get_typecode(leaf2),
-                                 &result_typecode);
+                    container_or(c1, type1, c2, type2, &result_typecode);
+                result_container =
+                    share_if_full(result_container, &result_typecode);
                 leaf_t result_leaf =
                     add_container(result, result_container, result_typecode);
-                art_insert(&result->art, it1.key, (art_val_t)result_leaf);
+                art_bulk_append(&result->art, it1.key, (art_val_t)result_leaf);
                 art_iterator_next(&it1);
                 art_iterator_next(&it2);
             }
@@ -1578,20 +3096,29 @@ roaring64_bitmap_t *roaring64_bitmap_or(const roaring64_bitmap_t *r1,
         if ((it1_present && !it2_present) || compare_result < 0) {
             // Cases 1 and 3a: it1 is the only iterator or is before it2.
             leaf_t result_leaf =
-                copy_leaf_container(r1, result, (leaf_t)*it1.value);
-            art_insert(&result->art, it1.key, (art_val_t)result_leaf);
+                copy_leaf_container(r1, result, (leaf_t *)it1.value);
+            art_bulk_append(&result->art, it1.key, (art_val_t)result_leaf);
             art_iterator_next(&it1);
         } else if ((!it1_present && it2_present) || compare_result > 0) {
             // Cases 2 and 3c: it2 is the only iterator or is before it1.
             leaf_t result_leaf =
-                copy_leaf_container(r2, result, (leaf_t)*it2.value);
-            art_insert(&result->art, it2.key, (art_val_t)result_leaf);
+                copy_leaf_container(r2, result, (leaf_t *)it2.value);
+            art_bulk_append(&result->art, it2.key, (art_val_t)result_leaf);
             art_iterator_next(&it2);
         }
     }
+    art_bulk_finish(&result->art);
     return result;
 }
 
+roaring64_bitmap_t *roaring64_bitmap_or(const roaring64_bitmap_t *r1,
+                                        const roaring64_bitmap_t *r2) {
+    const roaring_allocator_t *previous = enter_result_allocator_of64(r1);
+    roaring64_bitmap_t *answer = roaring64_bitmap_or_impl(r1, r2);
+    leave_allocator(previous);
+    return answer;
+}
+
 uint64_t roaring64_bitmap_or_cardinality(const roaring64_bitmap_t *r1,
                                          const roaring64_bitmap_t *r2) {
     uint64_t c1 = roaring64_bitmap_get_cardinality(r1);
@@ -1600,8 +3127,8 @@ uint64_t roaring64_bitmap_or_cardinality(const roaring64_bitmap_t *r1,
     return c1 + c2 - inter;
 }
 
-void roaring64_bitmap_or_inplace(roaring64_bitmap_t *r1,
-                                 const roaring64_bitmap_t *r2) {
+static void roaring64_bitmap_or_inplace_impl(roaring64_bitmap_t *r1,
+                                             const roaring64_bitmap_t *r2) {
     if (r1 == r2) {
         return;
     }
@@ -1626,23 +3153,30 @@ void roaring64_bitmap_or_inplace(roaring64_bitmap_t *r1,
                 // Case 3b: iterators at the same high key position.
                 leaf_t *leaf1 = (leaf_t *)it1.value;
                 leaf_t leaf2 = (leaf_t)*it2.value;
-                uint8_t typecode1 = get_typecode(*leaf1);
-                container_t *container1 = get_container(r1, *leaf1);
+                uint8_t typecode1;
+                leaf_view_t view1;
+                const container_t *container1 =
+                    get_leaf_container(r1, *leaf1, &typecode1, &view1);
+                uint8_t type2;
+                leaf_view_t view2;
+                const container_t *c2 =
+                    get_leaf_container(r2, leaf2, &type2, &view2);
                 uint8_t typecode2;
                 container_t *container2;
-                if (get_typecode(*leaf1) == SHARED_CONTAINER_TYPE) {
-                    container2 = container_or(container1, typecode1,
-                                              get_container(r2, leaf2),
-                                              get_typecode(leaf2), &typecode2);
+                if (is_inline_leaf(*leaf1) ||
+                    typecode1 == SHARED_CONTAINER_TYPE) {
+                    container2 = container_or(container1, typecode1, c2, type2,
+                                              &typecode2);
                 } else {
-                    container2 = container_ior(container1, typecode1,
-                                               get_container(r2, leaf2),
-                                               get_typecode(leaf2), &typecode2);
+                    container2 = container_ior(get_container(r1, *leaf1),
+                                               typecode1, c2, type2,
+                                               &typecode2);
                 }
                 if (container2 != container1) {
-                    container_free(container1, typecode1);
+                    free_leaf_container(r1, *leaf1);
                     replace_container(r1, leaf1, container2, typecode2);
                 }
+                inline_if_tiny(r1, leaf1);
                 art_iterator_next(&it1);
                 art_iterator_next(&it2);
             }
@@ -1653,16 +3187,27 @@ void roaring64_bitmap_or_inplace(roaring64_bitmap_t *r1,
         } else if ((!it1_present && it2_present) || compare_result > 0) {
             // Cases 2 and 3c: it2 is the only iterator or is before it1.
             leaf_t result_leaf =
-                copy_leaf_container(r2, r1, (leaf_t)*it2.value);
+                copy_leaf_container(r2, r1, (leaf_t *)it2.value);
             art_iterator_insert(&it1, it2.key, (art_val_t)result_leaf);
             art_iterator_next(&it2);
         }
     }
 }
 
-roaring64_bitmap_t *roaring64_bitmap_xor(const roaring64_bitmap_t *r1,
-                                         const roaring64_bitmap_t *r2) {
+void roaring64_bitmap_or_inplace(roaring64_bitmap_t *r1,
+                                 const roaring64_bitmap_t *r2) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r1, &previous)) {
+        return;
+    }
+    roaring64_bitmap_or_inplace_impl(r1, r2);
+    leave_allocator(previous);
+}
+
+static roaring64_bitmap_t *roaring64_bitmap_xor_impl(
+    const roaring64_bitmap_t *r1, const roaring64_bitmap_t *r2) {
     roaring64_bitmap_t *result = roaring64_bitmap_create();
+    result->flags = (r1->flags | r2->flags) & ROARING_FLAG_COW;
 
     art_iterator_t it1 = art_init_iterator((art_t *)&r1->art, /*first=*/true);
     art_iterator_t it2 = art_init_iterator((art_t *)&r2->art, /*first=*/true);
@@ -1685,16 +3230,23 @@ roaring64_bitmap_t *roaring64_bitmap_xor(const roaring64_bitmap_t *r1,
                 // Case 3b: iterators at the same high key position.
                 leaf_t leaf1 = (leaf_t)*it1.value;
                 leaf_t leaf2 = (leaf_t)*it2.value;
+                uint8_t type1, type2;
+                leaf_view_t view1, view2;
+                const container_t *c1 =
+                    get_leaf_container(r1, leaf1, &type1, &view1);
+                const container_t *c2 =
+                    get_leaf_container(r2, leaf2, &type2, &view2);
                 uint8_t result_typecode;
                 container_t *result_container =
-                    container_xor(get_container(r1, leaf1), get_typecode(leaf1),
-                                  get_container(r2, leaf2), get_typecode(leaf2),
-                                  &result_typecode);
+                    container_xor(c1, type1, c2, type2, &result_typecode);
                 if (container_nonzero_cardinality(result_container,
                                                   result_typecode)) {
+                    result_container =
+                        share_if_full(result_container, &result_typecode);
                     leaf_t result_leaf = add_container(result, result_container,
                                                        result_typecode);
-                    art_insert(&result->art, it1.key, (art_val_t)result_leaf);
+                    art_bulk_append(&result->art, it1.key,
+                                    (art_val_t)result_leaf);
                 } else {
                     container_free(result_container, result_typecode);
                 }
@@ -1705,20 +3257,29 @@ roaring64_bitmap_t *roaring64_bitmap_xor(const roaring64_bitmap_t *r1,
         if ((it1_present && !it2_present) || compare_result < 0) {
             // Cases 1 and 3a: it1 is the only iterator or is before it2.
             leaf_t result_leaf =
-                copy_leaf_container(r1, result, (leaf_t)*it1.value);
-            art_insert(&result->art, it1.key, (art_val_t)result_leaf);
+                copy_leaf_container(r1, result, (leaf_t *)it1.value);
+            art_bulk_append(&result->art, it1.key, (art_val_t)result_leaf);
             art_iterator_next(&it1);
         } else if ((!it1_present && it2_present) || compare_result > 0) {
             // Cases 2 and 3c: it2 is the only iterator or is before it1.
             leaf_t result_leaf =
-                copy_leaf_container(r2, result, (leaf_t)*it2.value);
-            art_insert(&result->art, it2.key, (art_val_t)result_leaf);
+                copy_leaf_container(r2, result, (leaf_t *)it2.value);
+            art_bulk_append(&result->art, it2.key, (art_val_t)result_leaf);
             art_iterator_next(&it2);
         }
     }
+    art_bulk_finish(&result->art);
     return result;
 }
 
+roaring64_bitmap_t *roaring64_bitmap_xor(const roaring64_bitmap_t *r1,
+                                         const roaring64_bitmap_t *r2) {
+    const roaring_allocator_t *previous = enter_result_allocator_of64(r1);
+    roaring64_bitmap_t *answer = roaring64_bitmap_xor_impl(r1, r2);
+    leave_allocator(previous);
+    return answer;
+}
+
 uint64_t roaring64_bitmap_xor_cardinality(const roaring64_bitmap_t *r1,
                                           const roaring64_bitmap_t *r2) {
     uint64_t c1 = roaring64_bitmap_get_cardinality(r1);
@@ -1727,8 +3288,8 @@ uint64_t roaring64_bitmap_xor_cardinality(const roaring64_bitmap_t *r1,
     return c1 + c2 - 2 * inter;
 }
 
-void roaring64_bitmap_xor_inplace(roaring64_bitmap_t *r1,
-                                  const roaring64_bitmap_t *r2) {
+static void roaring64_bitmap_xor_inplace_impl(roaring64_bitmap_t *r1,
+                                              const roaring64_bitmap_t *r2) {
     assert(r1 != r2);
     art_iterator_t it1 = art_init_iterator(&r1->art, /*first=*/true);
     art_iterator_t it2 = art_init_iterator((art_t *)&r2->art, /*first=*/true);
@@ -1751,36 +3312,43 @@ void roaring64_bitmap_xor_inplace(roaring64_bitmap_t *r1,
                 // Case 3b: iterators at the same high key position.
                 leaf_t *leaf1 = (leaf_t *)it1.value;
                 leaf_t leaf2 = (leaf_t)*it2.value;
-                uint8_t typecode1 = get_typecode(*leaf1);
-                container_t *container1 = get_container(r1, *leaf1);
+                uint8_t typecode1;
+                leaf_view_t view1;
+                const container_t *container1 =
+                    get_leaf_container(r1, *leaf1, &typecode1, &view1);
+                uint8_t type2;
+                leaf_view_t view2;
+                const container_t *c2 =
+                    get_leaf_container(r2, leaf2, &type2, &view2);
                 uint8_t typecode2;
                 container_t *container2;
-                if (typecode1 == SHARED_CONTAINER_TYPE) {
-                    container2 = container_xor(container1, typecode1,
-                                               get_container(r2, leaf2),
-                                               get_typecode(leaf2), &typecode2);
+                if (is_inline_leaf(*leaf1) ||
+                    typecode1 == SHARED_CONTAINER_TYPE) {
+                    container2 = container_xor(container1, typecode1, c2, type2,
+                                               &typecode2);
                     if (container2 != container1) {
                         // We only free when doing container_xor, not
                         // container_ixor, as ixor frees the original
                         // internally.
-                        container_free(container1, typecode1);
+                        free_leaf_container(r1, *leaf1);
                     }
                 } else {
-                    container2 = container_ixor(
-                        container1, typecode1, get_container(r2, leaf2),
-                        get_typecode(leaf2), &typecode2);
+                    container2 = container_ixor(get_container(r1, *leaf1),
+                                                typecode1, c2, type2,
+                                                &typecode2);
                 }
 
                 if (!container_nonzero_cardinality(container2, typecode2)) {
                     container_free(container2, typecode2);
+                    remove_container(r1, *leaf1);
                     bool erased = art_iterator_erase(&it1, NULL);
                     assert(erased);
                     (void)erased;
-                    remove_container(r1, *leaf1);
                 } else {
                     if (container2 != container1) {
                         replace_container(r1, leaf1, container2, typecode2);
                     }
+                    inline_if_tiny(r1, leaf1);
                     // Only advance the iterator if we didn't delete the
                     // leaf, as erasing advances by itself.
                     art_iterator_next(&it1);
@@ -1794,7 +3362,7 @@ void roaring64_bitmap_xor_inplace(roaring64_bitmap_t *r1,
         } else if ((!it1_present && it2_present) || compare_result > 0) {
             // Cases 2 and 3c: it2 is the only iterator or is before it1.
             leaf_t result_leaf =
-                copy_leaf_container(r2, r1, (leaf_t)*it2.value);
+                copy_leaf_container(r2, r1, (leaf_t *)it2.value);
             if (it1_present) {
                 art_iterator_insert(&it1, it2.key, (art_val_t)result_leaf);
                 art_iterator_next(&it1);
@@ -1806,9 +3374,60 @@ void roaring64_bitmap_xor_inplace(roaring64_bitmap_t *r1,
     }
 }
 
-roaring64_bitmap_t *roaring64_bitmap_andnot(const roaring64_bitmap_t *r1,
-                                            const roaring64_bitmap_t *r2) {
+void roaring64_bitmap_xor_inplace(roaring64_bitmap_t *r1,
+                                  const roaring64_bitmap_t *r2) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r1, &previous)) {
+        return;
+    }
+    roaring64_bitmap_xor_inplace_impl(r1, r2);
+    compact_if_sparse(r1);
+    leave_allocator(previous);
+}
+
+// Andnot of a bitmap with far fewer leaves than `r2`, into `result`.
+static void roaring64_bitmap_andnot_galloping(const roaring64_bitmap_t *r1,
+                                              const roaring64_bitmap_t *r2,
+                                              roaring64_bitmap_t *result) {
+    art_iterator_t it1 = art_init_iterator((art_t *)&r1->art, /*first=*/true);
+    for (; it1.value != NULL; art_iterator_next(&it1)) {
+        const art_val_t *val2 = art_find(&r2->art, it1.key);
+        leaf_t result_leaf;
+        if (val2 == NULL) {
+            result_leaf = copy_leaf_container(r1, result, (leaf_t *)it1.value);
+        } else {
+            uint8_t type1, type2;
+            leaf_view_t view1, view2;
+            const container_t *c1 =
+                get_leaf_container(r1, (leaf_t)*it1.value, &type1, &view1);
+            const container_t *c2 =
+                get_leaf_container(r2, (leaf_t)*val2, &type2, &view2);
+            uint8_t result_typecode;
+            container_t *result_container =
+                container_andnot(c1, type1, c2, type2, &result_typecode);
+            if (!container_nonzero_cardinality(result_container,
+                                               result_typecode)) {
+                container_free(result_container, result_typecode);
+                continue;
+            }
+            result_container =
+                share_if_full(result_container, &result_typecode);
+            result_leaf =
+                add_container(result, result_container, result_typecode);
+        }
+        art_bulk_append(&result->art, it1.key, (art_val_t)result_leaf);
+    }
+    art_bulk_finish(&result->art);
+}
+
+static roaring64_bitmap_t *roaring64_bitmap_andnot_impl(
+    const roaring64_bitmap_t *r1, const roaring64_bitmap_t *r2) {
     roaring64_bitmap_t *result = roaring64_bitmap_create();
+    result->flags = (r1->flags | r2->flags) & ROARING_FLAG_COW;
+    if (should_gallop(r1, r2)) {
+        roaring64_bitmap_andnot_galloping(r1, r2, result);
+        return result;
+    }
 
     art_iterator_t it1 = art_init_iterator((art_t *)&r1->art, /*first=*/true);
     art_iterator_t it2 = art_init_iterator((art_t *)&r2->art, /*first=*/true);
@@ -1826,19 +3445,26 @@ roaring64_bitmap_t *roaring64_bitmap_andnot(const roaring64_bitmap_t *r1,
             compare_result = compare_high48(it1.key, it2.key);
             if (compare_result == 0) {
                 // Case 2b: iterators at the same high key position.
-                leaf_t *leaf1 = (leaf_t *)it1.value;
+                leaf_t leaf1 = (leaf_t)*it1.value;
                 leaf_t leaf2 = (leaf_t)*it2.value;
+                uint8_t type1, type2;
+                leaf_view_t view1, view2;
+                const container_t *c1 =
+                    get_leaf_container(r1, leaf1, &type1, &view1);
+                const container_t *c2 =
+                    get_leaf_container(r2, leaf2, &type2, &view2);
                 uint8_t result_typecode;
-                container_t *result_container = container_andnot(
-                    get_container(r1, *leaf1), get_typecode(*leaf1),
-                    get_container(r2, leaf2), get_typecode(leaf2),
-                    &result_typecode);
+                container_t *result_container =
+                    container_andnot(c1, type1, c2, type2, &result_typecode);
 
                 if (container_nonzero_cardinality(result_container,
                                                   result_typecode)) {
+                    result_container =
+                        share_if_full(result_container, &result_typecode);
                     leaf_t result_leaf = add_container(result, result_container,
                                                        result_typecode);
-                    art_insert(&result->art, it1.key, (art_val_t)result_leaf);
+                    art_bulk_append(&result->art, it1.key,
+                                    (art_val_t)result_leaf);
                 } else {
                     container_free(result_container, result_typecode);
                 }
@@ -1849,17 +3475,26 @@ roaring64_bitmap_t *roaring64_bitmap_andnot(const roaring64_bitmap_t *r1,
         if (!it2_present || compare_result < 0) {
             // Cases 1 and 2a: it1 is the only iterator or is before it2.
             leaf_t result_leaf =
-                copy_leaf_container(r1, result, (leaf_t)*it1.value);
-            art_insert(&result->art, it1.key, (art_val_t)result_leaf);
+                copy_leaf_container(r1, result, (leaf_t *)it1.value);
+            art_bulk_append(&result->art, it1.key, (art_val_t)result_leaf);
             art_iterator_next(&it1);
         } else if (compare_result > 0) {
             // Case 2c: it1 is after it2.
-            art_iterator_next(&it2);
+            art_iterator_skip_to(&it2, it1.key);
         }
     }
+    art_bulk_finish(&result->art);
     return result;
 }
 
+roaring64_bitmap_t *roaring64_bitmap_andnot(const roaring64_bitmap_t *r1,
+                                            const roaring64_bitmap_t *r2) {
+    const roaring_allocator_t *previous = enter_result_allocator_of64(r1);
+    roaring64_bitmap_t *answer = roaring64_bitmap_andnot_impl(r1, r2);
+    leave_allocator(previous);
+    return answer;
+}
+
 uint64_t roaring64_bitmap_andnot_cardinality(const roaring64_bitmap_t *r1,
                                              const roaring64_bitmap_t *r2) {
     uint64_t c1 = roaring64_bitmap_get_cardinality(r1);
@@ -1867,16 +3502,16 @@ uint64_t roaring64_bitmap_andnot_cardinality(const roaring64_bitmap_t *r1,
     return c1 - inter;
 }
 
-void roaring64_bitmap_andnot_inplace(roaring64_bitmap_t *r1,
-                                     const roaring64_bitmap_t *r2) {
+static void roaring64_bitmap_andnot_inplace_impl(roaring64_bitmap_t *r1,
+                                                 const roaring64_bitmap_t *r2) {
     art_iterator_t it1 = art_init_iterator(&r1->art, /*first=*/true);
     art_iterator_t it2 = art_init_iterator((art_t *)&r2->art, /*first=*/true);
 
     while (it1.value != NULL) {
         // Cases:
-        // 1. it1_present && !it2_present -> it1++
+        // 1. it1_present && !it2_present -> done
         // 2. it1_present &&  it2_present
-        //    a. it1 <  it2 -> it1++
+        //    a. it1 <  it2 -> it1 = lower_bound(it2)
         //    b. it1 == it2 -> it1 - it2, it1++, it2++
         //    c. it1 >  it2 -> it2++
         bool it2_present = it2.value != NULL;
@@ -1887,36 +3522,43 @@ void roaring64_bitmap_andnot_inplace(roaring64_bitmap_t *r1,
                 // Case 2b: iterators at the same high key position.
                 leaf_t *leaf1 = (leaf_t *)it1.value;
                 leaf_t leaf2 = (leaf_t)*it2.value;
-                uint8_t typecode1 = get_typecode(*leaf1);
-                container_t *container1 = get_container(r1, *leaf1);
+                uint8_t typecode1;
+                leaf_view_t view1;
+                const container_t *container1 =
+                    get_leaf_container(r1, *leaf1, &typecode1, &view1);
+                uint8_t type2;
+                leaf_view_t view2;
+                const container_t *c2 =
+                    get_leaf_container(r2, leaf2, &type2, &view2);
                 uint8_t typecode2;
                 container_t *container2;
-                if (typecode1 == SHARED_CONTAINER_TYPE) {
-                    container2 = container_andnot(
-                        container1, typecode1, get_container(r2, leaf2),
-                        get_typecode(leaf2), &typecode2);
+                if (is_inline_leaf(*leaf1) ||
+                    typecode1 == SHARED_CONTAINER_TYPE) {
+                    container2 = container_andnot(container1, typecode1, c2,
+                                                  type2, &typecode2);
                     if (container2 != container1) {
                         // We only free when doing container_andnot, not
                         // container_iandnot, as iandnot frees the original
                         // internally.
-                        container_free(container1, typecode1);
+                        free_leaf_container(r1, *leaf1);
                     }
                 } else {
-                    container2 = container_iandnot(
-                        container1, typecode1, get_container(r2, leaf2),
-                        get_typecode(leaf2), &typecode2);
+                    container2 = container_iandnot(get_container(r1, *leaf1),
+                                                   typecode1, c2, type2,
+                                                   &typecode2);
                 }
 
                 if (!container_nonzero_cardinality(container2, typecode2)) {
                     container_free(container2, typecode2);
+                    remove_container(r1, *leaf1);
                     bool erased = art_iterator_erase(&it1, NULL);
                     assert(erased);
                     (void)erased;
-                    remove_container(r1, *leaf1);
                 } else {
                     if (container2 != container1) {
                         replace_container(r1, leaf1, container2, typecode2);
                     }
+                    inline_if_tiny(r1, leaf1);
                     // Only advance the iterator if we didn't delete the
                     // leaf, as erasing advances by itself.
                     art_iterator_next(&it1);
@@ -1924,14 +3566,351 @@ void roaring64_bitmap_andnot_inplace(roaring64_bitmap_t *r1,
                 art_iterator_next(&it2);
             }
         }
-        if (!it2_present || compare_result < 0) {
-            // Cases 1 and 2a: it1 is the only iterator or is before it2.
-            art_iterator_next(&it1);
+        if (!it2_present) {
+            // Case 1: nothing left to remove.
+            break;
+        } else if (compare_result < 0) {
+            // Case 2a: it1 is before it2, skip the leaves of r1 up to it2.
+            art_iterator_skip_to(&it1, it2.key);
         } else if (compare_result > 0) {
             // Case 2c: it1 is after it2.
-            art_iterator_next(&it2);
+            art_iterator_skip_to(&it2, it1.key);
+        }
+    }
+}
+
+void roaring64_bitmap_andnot_inplace(roaring64_bitmap_t *r1,
+                                     const roaring64_bitmap_t *r2) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r1, &previous)) {
+        return;
+    }
+    roaring64_bitmap_andnot_inplace_impl(r1, r2);
+    compact_if_sparse(r1);
+    leave_allocator(previous);
+}
+
+// Multi-way aggregation. The leaves of the inputs are merged in key order by
+// a min-heap of ART iterators, and the containers found under one key are
+// combined at once: lazily for unions and xors, with a single repair.
+typedef struct aggregation_input_s {
+    const roaring64_bitmap_t *r;
+    art_iterator_t it;
+    uint64_t high48;  // key of the current leaf
+} aggregation_input_t;
+
+typedef struct aggregation_s {
+    aggregation_input_t *inputs;
+    size_t *heap;  // the inputs with leaves left, ordered by high48
+    size_t heap_size;
+    // The leaves found under the current key, and their bitmaps.
+    leaf_t **leaves;
+    const roaring64_bitmap_t **owners;
+    size_t group_size;
+    art_key_chunk_t key[ART_KEY_BYTES];
+} aggregation_t;
+
+static void aggregation_sift_down(aggregation_t *a, size_t i) {
+    size_t top = a->heap[i];
+    uint64_t key = a->inputs[top].high48;
+    while (true) {
+        size_t child = 2 * i + 1;
+        if (child >= a->heap_size) {
+            break;
+        }
+        if (child + 1 < a->heap_size &&
+            a->inputs[a->heap[child + 1]].high48 <
+                a->inputs[a->heap[child]].high48) {
+            child++;
+        }
+        if (a->inputs[a->heap[child]].high48 >= key) {
+            break;
+        }
+        a->heap[i] = a->heap[child];
+        i = child;
+    }
+    a->heap[i] = top;
+}
+
+static bool aggregation_init(aggregation_t *a, size_t number,
+                             const roaring64_bitmap_t **rs) {
+    size_t entry_size = sizeof(aggregation_input_t) + sizeof(size_t) +
+                        sizeof(leaf_t *) + sizeof(roaring64_bitmap_t *);
+    if (number > SIZE_MAX / entry_size) {
+        return false;
+    }
+    char *block = (char *)roaring_malloc(number * entry_size);
+    if (block == NULL) {
+        return false;
+    }
+    a->inputs = (aggregation_input_t *)block;
+    a->leaves = (leaf_t **)(a->inputs + number);
+    a->owners = (const roaring64_bitmap_t **)(a->leaves + number);
+    a->heap = (size_t *)(a->owners + number);
+    a->heap_size = 0;
+    a->group_size = 0;
+    for (size_t i = 0; i < number; ++i) {
+        aggregation_input_t *in = &a->inputs[i];
+        in->r = rs[i];
+        in->it = art_init_iterator((art_t *)&rs[i]->art, /*first=*/true);
+        if (in->it.value != NULL) {
+            in->high48 = combine_key(in->it.key, 0) >> 16;
+            a->heap[a->heap_size++] = i;
+        }
+    }
+    for (size_t i = a->heap_size / 2; i-- > 0;) {
+        aggregation_sift_down(a, i);
+    }
+    return true;
+}
+
+static void aggregation_free(aggregation_t *a) { roaring_free(a->inputs); }
+
+// Collects the leaves of the smallest key left, returns false if none.
+static bool aggregation_next_group(aggregation_t *a) {
+    if (a->heap_size == 0) {
+        return false;
+    }
+    aggregation_input_t *first = &a->inputs[a->heap[0]];
+    uint64_t high48 = first->high48;
+    memcpy(a->key, first->it.key, ART_KEY_BYTES);
+    a->group_size = 0;
+    while (a->heap_size > 0 && a->inputs[a->heap[0]].high48 == high48) {
+        aggregation_input_t *in = &a->inputs[a->heap[0]];
+        a->leaves[a->group_size] = (leaf_t *)in->it.value;
+        a->owners[a->group_size] = in->r;
+        a->group_size++;
+        if (art_iterator_next(&in->it)) {
+            in->high48 = combine_key(in->it.key, 0) >> 16;
+        } else {
+            a->heap[0] = a->heap[--a->heap_size];
+        }
+        if (a->heap_size > 0) {
+            aggregation_sift_down(a, 0);
+        }
+    }
+    return true;
+}
+
+// Appends the result of combining the containers of a key to `result`, or
+// frees it if empty.
+static void aggregation_append(roaring64_bitmap_t *result,
+                               const art_key_chunk_t key[],
+                               container_t *container, uint8_t typecode) {
+    if (!container_nonzero_cardinality(container, typecode)) {
+        container_free(container, typecode);
+        return;
+    }
+    container = share_if_full(container, &typecode);
+    leaf_t leaf = add_container(result, container, typecode);
+    art_bulk_append(&result->art, key, (art_val_t)leaf);
+}
+
+// The union (or xor) of the containers of the current key, which has at
+// least two.
+static container_t *aggregation_combine(const aggregation_t *a, bool is_xor,
+                                        uint8_t *typecode) {
+    uint8_t type0, type1;
+    leaf_view_t view0, view1;
+    const container_t *c0 =
+        get_actual_container(a->owners[0], *a->leaves[0], &type0, &view0);
+    const container_t *c1 =
+        get_actual_container(a->owners[1], *a->leaves[1], &type1, &view1);
+    if (!is_xor && (container_is_full(c0, type0) ||
+                    container_is_full(c1, type1))) {
+        *typecode = SHARED_CONTAINER_TYPE;
+        return shared_container_full();
+    }
+    container_t *acc =
+        is_xor ? container_lazy_xor(c0, type0, c1, type1, typecode)
+               : container_lazy_or(c0, type0, c1, type1, typecode);
+    for (size_t i = 2; i < a->group_size; ++i) {
+        uint8_t type;
+        leaf_view_t view;
+        const container_t *c =
+            get_actual_container(a->owners[i], *a->leaves[i], &type, &view);
+        if (is_xor) {
+            // ixor frees the original if it returns a new container.
+            acc = container_lazy_ixor(acc, *typecode, c, type, typecode);
+            continue;
+        }
+        if (container_is_full(c, type)) {
+            container_free(acc, *typecode);
+            *typecode = SHARED_CONTAINER_TYPE;
+            return shared_container_full();
+        }
+        uint8_t new_typecode;
+        container_t *next =
+            container_lazy_ior(acc, *typecode, c, type, &new_typecode);
+        if (next != acc) {
+            container_free(acc, *typecode);
+        }
+        acc = next;
+        *typecode = new_typecode;
+    }
+    return container_repair_after_lazy(acc, typecode);
+}
+
+static roaring64_bitmap_t *roaring64_bitmap_or_xor_many_impl(
+    size_t number, const roaring64_bitmap_t **rs, bool is_xor) {
+    if (number == 0) {
+        return roaring64_bitmap_create();
+    }
+    if (number == 1) {
+        return roaring64_bitmap_copy(rs[0]);
+    }
+    aggregation_t a;
+    if (!aggregation_init(&a, number, rs)) {
+        return NULL;
+    }
+    roaring64_bitmap_t *result = roaring64_bitmap_create();
+    for (size_t i = 0; i < number; ++i) {
+        result->flags |= rs[i]->flags & ROARING_FLAG_COW;
+    }
+    while (aggregation_next_group(&a)) {
+        if (a.group_size == 1) {
+            leaf_t leaf = copy_leaf_container(a.owners[0], result, a.leaves[0]);
+            art_bulk_append(&result->art, a.key, (art_val_t)leaf);
+            continue;
+        }
+        uint8_t typecode;
+        container_t *container = aggregation_combine(&a, is_xor, &typecode);
+        aggregation_append(result, a.key, container, typecode);
+    }
+    art_bulk_finish(&result->art);
+    aggregation_free(&a);
+    return result;
+}
+
+roaring64_bitmap_t *roaring64_bitmap_or_many(size_t number,
+                                             const roaring64_bitmap_t **rs) {
+    const roaring_allocator_t *previous =
+        enter_result_allocator_of64(number > 0 ? rs[0] : NULL);
+    roaring64_bitmap_t *answer =
+        roaring64_bitmap_or_xor_many_impl(number, rs, /*is_xor=*/false);
+    leave_allocator(previous);
+    return answer;
+}
+
+roaring64_bitmap_t *roaring64_bitmap_xor_many(size_t number,
+                                              const roaring64_bitmap_t **rs) {
+    const roaring_allocator_t *previous =
+        enter_result_allocator_of64(number > 0 ? rs[0] : NULL);
+    roaring64_bitmap_t *answer =
+        roaring64_bitmap_or_xor_many_impl(number, rs, /*is_xor=*/true);
+    leave_allocator(previous);
+    return answer;
+}
+
+static int aggregation_input_compare_size(const void *x, const void *y) {
+    uint64_t size_x =
+        leaf_count_estimate(((const aggregation_input_t *)x)->r);
+    uint64_t size_y =
+        leaf_count_estimate(((const aggregation_input_t *)y)->r);
+    return (size_x > size_y) - (size_x < size_y);
+}
+
+// Intersects `acc` (or, when NULL, the container of `first`) with the
+// container of `in`.
+static container_t *aggregation_intersect(const aggregation_input_t *first,
+                                          const aggregation_input_t *in,
+                                          container_t *acc,
+                                          uint8_t *typecode) {
+    uint8_t type;
+    leaf_view_t view;
+    const container_t *c =
+        get_actual_container(in->r, *(leaf_t *)in->it.value, &type, &view);
+    if (acc == NULL) {
+        uint8_t type0;
+        leaf_view_t view0;
+        const container_t *c0 = get_actual_container(
+            first->r, *(leaf_t *)first->it.value, &type0, &view0);
+        return container_and(c0, type0, c, type, typecode);
+    }
+    uint8_t new_typecode;
+    container_t *next = container_iand(acc, *typecode, c, type, &new_typecode);
+    if (next != acc) {
+        container_free(acc, *typecode);
+    }
+    *typecode = new_typecode;
+    return next;
+}
+
+static roaring64_bitmap_t *roaring64_bitmap_and_many_impl(
+    size_t number, const roaring64_bitmap_t **rs) {
+    if (number == 0) {
+        return roaring64_bitmap_create();
+    }
+    if (number == 1) {
+        return roaring64_bitmap_copy(rs[0]);
+    }
+    aggregation_t a;
+    if (!aggregation_init(&a, number, rs)) {
+        return NULL;
+    }
+    roaring64_bitmap_t *result = roaring64_bitmap_create();
+    for (size_t i = 0; i < number; ++i) {
+        result->flags |= rs[i]->flags & ROARING_FLAG_COW;
+    }
+    // The input with the fewest leaves drives the join: each of its keys is
+    // looked up in the other inputs in turn, which skip the subtrees that
+    // are not in all ARTs. The intersection is built along the way, and a
+    // key is given up on as soon as it is empty.
+    qsort(a.inputs, number, sizeof(aggregation_input_t),
+          aggregation_input_compare_size);
+    aggregation_input_t *first = &a.inputs[0];
+    bool done = a.heap_size < number;
+    while (!done) {
+        container_t *acc = NULL;
+        uint8_t typecode = 0;
+        size_t i = 1;
+        for (; i < number; ++i) {
+            aggregation_input_t *in = &a.inputs[i];
+            if (in->high48 < first->high48) {
+                if (!art_iterator_skip_to(&in->it, first->it.key)) {
+                    done = true;
+                    break;
+                }
+                in->high48 = combine_key(in->it.key, 0) >> 16;
+            }
+            if (in->high48 > first->high48) {
+                break;
+            }
+            acc = aggregation_intersect(first, in, acc, &typecode);
+            if (!container_nonzero_cardinality(acc, typecode)) {
+                break;
+            }
+        }
+        if (i == number) {
+            aggregation_append(result, first->it.key, acc, typecode);
+        } else if (acc != NULL) {
+            container_free(acc, typecode);
+        }
+        if (done) {
+            break;
+        }
+        // Either to the key another input stopped at, or to the next one.
+        if (i < number && a.inputs[i].high48 > first->high48) {
+            done = !art_iterator_skip_to(&first->it, a.inputs[i].it.key);
+        } else {
+            done = !art_iterator_next(&first->it);
+        }
+        if (!done) {
+            first->high48 = combine_key(first->it.key, 0) >> 16;
         }
     }
+    art_bulk_finish(&result->art);
+    aggregation_free(&a);
+    return result;
+}
+
+roaring64_bitmap_t *roaring64_bitmap_and_many(size_t number,
+                                              const roaring64_bitmap_t **rs) {
+    const roaring_allocator_t *previous =
+        enter_result_allocator_of64(number > 0 ? rs[0] : NULL);
+    roaring64_bitmap_t *answer = roaring64_bitmap_and_many_impl(number, rs);
+    leave_allocator(previous);
+    return answer;
 }
 
 /**
@@ -1947,15 +3926,19 @@ static void roaring64_flip_leaf(const roaring64_bitmap_t *r1,
     if (leaf1 == NULL) {
         // No container at this key, create a full container.
         container2 = container_range_of_ones(min, max, &typecode2);
-    } else if (min == 0 && max > 0xFFFF) {
-        // Flip whole container.
-        container2 = container_not(get_container(r1, *leaf1),
-                                   get_typecode(*leaf1), &typecode2);
     } else {
-        // Partially flip a container.
-        container2 =
-            container_not_range(get_container(r1, *leaf1), get_typecode(*leaf1),
-                                min, max, &typecode2);
+        uint8_t typecode1;
+        leaf_view_t view1;
+        const container_t *container1 =
+            get_leaf_container(r1, *leaf1, &typecode1, &view1);
+        if (min == 0 && max > 0xFFFF) {
+            // Flip whole container.
+            container2 = container_not(container1, typecode1, &typecode2);
+        } else {
+            // Partially flip a container.
+            container2 = container_not_range(container1, typecode1, min, max,
+                                             &typecode2);
+        }
     }
     if (container_nonzero_cardinality(container2, typecode2)) {
         leaf_t leaf2 = add_container(r2, container2, typecode2);
@@ -1983,7 +3966,16 @@ static void roaring64_flip_leaf_inplace(roaring64_bitmap_t *r, uint8_t high48[],
         return;
     }
 
-    if (min == 0 && max > 0xFFFF) {
+    if (is_inline_leaf(*leaf)) {
+        leaf_view_t view;
+        uint8_t typecode;
+        const container_t *c = get_leaf_container(r, *leaf, &typecode, &view);
+        if (min == 0 && max > 0xFFFF) {
+            container2 = container_not(c, typecode, &typecode2);
+        } else {
+            container2 = container_not_range(c, typecode, min, max, &typecode2);
+        }
+    } else if (min == 0 && max > 0xFFFF) {
         // Flip whole container.
         container2 = container_inot(get_container(r, *leaf),
                                     get_typecode(*leaf), &typecode2);
@@ -1995,25 +3987,34 @@ static void roaring64_flip_leaf_inplace(roaring64_bitmap_t *r, uint8_t high48[],
 
     if (container_nonzero_cardinality(container2, typecode2)) {
         replace_container(r, leaf, container2, typecode2);
+        inline_if_tiny(r, leaf);
     } else {
+        container_free(container2, typecode2);
+        remove_container(r, *leaf);
         bool erased = art_erase(&r->art, high48, NULL);
         assert(erased);
         (void)erased;
-        container_free(container2, typecode2);
-        remove_container(r, *leaf);
     }
 }
 
-roaring64_bitmap_t *roaring64_bitmap_flip(const roaring64_bitmap_t *r,
-                                          uint64_t min, uint64_t max) {
+static roaring64_bitmap_t *roaring64_bitmap_flip_impl(
+    const roaring64_bitmap_t *r, uint64_t min, uint64_t max) {
     if (min >= max) {
         return roaring64_bitmap_copy(r);
     }
     return roaring64_bitmap_flip_closed(r, min, max - 1);
 }
 
-roaring64_bitmap_t *roaring64_bitmap_flip_closed(const roaring64_bitmap_t *r1,
-                                                 uint64_t min, uint64_t max) {
+roaring64_bitmap_t *roaring64_bitmap_flip(const roaring64_bitmap_t *r,
+                                          uint64_t min, uint64_t max) {
+    const roaring_allocator_t *previous = enter_result_allocator_of64(r);
+    roaring64_bitmap_t *answer = roaring64_bitmap_flip_impl(r, min, max);
+    leave_allocator(previous);
+    return answer;
+}
+
+static roaring64_bitmap_t *roaring64_bitmap_flip_closed_impl(
+    const roaring64_bitmap_t *r1, uint64_t min, uint64_t max) {
     if (min > max) {
         return roaring64_bitmap_copy(r1);
     }
@@ -2029,11 +4030,7 @@ roaring64_bitmap_t *roaring64_bitmap_flip_closed(const roaring64_bitmap_t *r1,
 
     // Copy the containers before min unchanged.
     while (it.value != NULL && compare_high48(it.key, min_high48_key) < 0) {
-        leaf_t leaf1 = (leaf_t)*it.value;
-        uint8_t typecode2 = get_typecode(leaf1);
-        container_t *container2 = get_copy_of_container(
-            get_container(r1, leaf1), &typecode2, /*copy_on_write=*/false);
-        leaf_t leaf2 = add_container(r2, container2, typecode2);
+        leaf_t leaf2 = clone_leaf_container(r1, r2, (leaf_t)*it.value);
         art_insert(&r2->art, it.key, (art_val_t)leaf2);
         art_iterator_next(&it);
     }
@@ -2061,11 +4058,7 @@ roaring64_bitmap_t *roaring64_bitmap_flip_closed(const roaring64_bitmap_t *r1,
     // Copy the containers after max unchanged.
     it = art_upper_bound((art_t *)&r1->art, max_high48_key);
     while (it.value != NULL) {
-        leaf_t leaf1 = (leaf_t)*it.value;
-        uint8_t typecode2 = get_typecode(leaf1);
-        container_t *container2 = get_copy_of_container(
-            get_container(r1, leaf1), &typecode2, /*copy_on_write=*/false);
-        leaf_t leaf2 = add_container(r2, container2, typecode2);
+        leaf_t leaf2 = clone_leaf_container(r1, r2, (leaf_t)*it.value);
         art_insert(&r2->art, it.key, (art_val_t)leaf2);
         art_iterator_next(&it);
     }
@@ -2073,16 +4066,37 @@ roaring64_bitmap_t *roaring64_bitmap_flip_closed(const roaring64_bitmap_t *r1,
     return r2;
 }
 
-void roaring64_bitmap_flip_inplace(roaring64_bitmap_t *r, uint64_t min,
-                                   uint64_t max) {
+roaring64_bitmap_t *roaring64_bitmap_flip_closed(const roaring64_bitmap_t *r1,
+                                                 uint64_t min, uint64_t max) {
+    const roaring_allocator_t *previous = enter_result_allocator_of64(r1);
+    roaring64_bitmap_t *answer =
+        roaring64_bitmap_flip_closed_impl(r1, min, max);
+    leave_allocator(previous);
+    return answer;
+}
+
+static void roaring64_bitmap_flip_inplace_impl(roaring64_bitmap_t *r,
+                                               uint64_t min, uint64_t max) {
     if (min >= max) {
         return;
     }
     roaring64_bitmap_flip_closed_inplace(r, min, max - 1);
 }
 
-void roaring64_bitmap_flip_closed_inplace(roaring64_bitmap_t *r, uint64_t min,
-                                          uint64_t max) {
+void roaring64_bitmap_flip_inplace(roaring64_bitmap_t *r, uint64_t min,
+                                   uint64_t max) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return;
+    }
+    roaring64_bitmap_flip_inplace_impl(r, min, max);
+    compact_if_sparse(r);
+    leave_allocator(previous);
+}
+
+static void roaring64_bitmap_flip_closed_inplace_impl(roaring64_bitmap_t *r,
+                                                      uint64_t min,
+                                                      uint64_t max) {
     if (min > max) {
         return;
     }
@@ -2112,7 +4126,18 @@ void roaring64_bitmap_flip_closed_inplace(roaring64_bitmap_t *r, uint64_t min,
     }
 }
 
-roaring64_bitmap_t *roaring64_bitmap_add_offset_signed(
+void roaring64_bitmap_flip_closed_inplace(roaring64_bitmap_t *r, uint64_t min,
+                                          uint64_t max) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return;
+    }
+    roaring64_bitmap_flip_closed_inplace_impl(r, min, max);
+    compact_if_sparse(r);
+    leave_allocator(previous);
+}
+
+static roaring64_bitmap_t *roaring64_bitmap_add_offset_signed_impl(
     const roaring64_bitmap_t *r, bool positive, uint64_t offset) {
     if (offset == 0) {
         return roaring64_bitmap_copy(r);
@@ -2149,11 +4174,7 @@ roaring64_bitmap_t *roaring64_bitmap_add_offset_signed(
             if ((uint64_t)k < (uint64_t)1 << 48) {
                 uint8_t new_high48[ART_KEY_BYTES];
                 split_key((uint64_t)k << 16, new_high48);
-                uint8_t typecode = get_typecode(leaf);
-                container_t *container =
-                    get_copy_of_container(get_container(r, leaf), &typecode,
-                                          /*copy_on_write=*/false);
-                leaf_t new_leaf = add_container(answer, container, typecode);
+                leaf_t new_leaf = clone_leaf_container(r, answer, leaf);
                 art_insert(&answer->art, new_high48, (art_val_t)new_leaf);
             }
             art_iterator_next(&it);
@@ -2184,15 +4205,16 @@ roaring64_bitmap_t *roaring64_bitmap_add_offset_signed(
             continue;
         }
 
-        uint8_t typecode = get_typecode(leaf);
-        const container_t *c =
-            container_unwrap_shared(get_container(r, leaf), &typecode);
+        uint8_t typecode;
+        leaf_view_t view;
+        const container_t *c = get_actual_container(r, leaf, &typecode, &view);
         container_add_offset(c, typecode, lo_ptr, hi_ptr, in_offset);
 
         if (lo != NULL) {
             if (prev_hi_leaf != NULL && prev_hi_k == k) {
+                container_t *existing_c =
+                    get_writable_container(answer, prev_hi_leaf);
                 uint8_t existing_type = get_typecode(*prev_hi_leaf);
-                container_t *existing_c = get_container(answer, *prev_hi_leaf);
                 uint8_t merged_type;
                 container_t *merged_c = container_ior(
                     existing_c, existing_type, lo, typecode, &merged_type);
@@ -2227,16 +4249,28 @@ roaring64_bitmap_t *roaring64_bitmap_add_offset_signed(
     art_iterator_t repair_it = art_init_iterator(&answer->art, /*first=*/true);
     while (repair_it.value != NULL) {
         leaf_t *leaf_ptr = (leaf_t *)repair_it.value;
-        uint8_t typecode = get_typecode(*leaf_ptr);
-        container_t *repaired = container_repair_after_lazy(
-            get_container(answer, *leaf_ptr), &typecode);
-        replace_container(answer, leaf_ptr, repaired, typecode);
+        if (!is_inline_leaf(*leaf_ptr)) {
+            uint8_t typecode = get_typecode(*leaf_ptr);
+            container_t *repaired = container_repair_after_lazy(
+                get_container(answer, *leaf_ptr), &typecode);
+            replace_container(answer, leaf_ptr, repaired, typecode);
+            inline_if_tiny(answer, leaf_ptr);
+        }
         art_iterator_next(&repair_it);
     }
 
     return answer;
 }
 
+roaring64_bitmap_t *roaring64_bitmap_add_offset_signed(
+    const roaring64_bitmap_t *r, bool positive, uint64_t offset) {
+    const roaring_allocator_t *previous = enter_result_allocator_of64(r);
+    roaring64_bitmap_t *answer =
+        roaring64_bitmap_add_offset_signed_impl(r, positive, offset);
+    leave_allocator(previous);
+    return answer;
+}
+
 // Returns the number of distinct high 32-bit entries in the bitmap.
 static inline uint64_t count_high32(const roaring64_bitmap_t *r) {
     art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
@@ -2271,6 +4305,8 @@ size_t roaring64_bitmap_portable_size_in_bytes(const roaring64_bitmap_t *r) {
     art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
     uint32_t prev_high32 = 0;
     roaring_bitmap_t *bitmap32 = NULL;
+    // The bucket's inline leaves, as containers.
+    leaf_view_t *views = NULL;
 
     // Iterate through buckets ordered by increasing keys.
     while (it.value != NULL) {
@@ -2285,6 +4321,7 @@ size_t roaring64_bitmap_portable_size_in_bytes(const roaring64_bitmap_t *r) {
                 // significant bits of a set of elements.
                 size += roaring_bitmap_portable_size_in_bytes(bitmap32);
                 roaring_bitmap_free_without_containers(bitmap32);
+                roaring_free(views);
             }
 
             // Start a new 32-bit bitmap with the current high 32 bits.
@@ -2297,13 +4334,18 @@ size_t roaring64_bitmap_portable_size_in_bytes(const roaring64_bitmap_t *r) {
             }
             bitmap32 =
                 roaring_bitmap_create_with_capacity(containers_with_high32);
+            views = (leaf_view_t *)roaring_malloc(containers_with_high32 *
+                                                  sizeof(leaf_view_t));
 
             prev_high32 = current_high32;
         }
         leaf_t leaf = (leaf_t)*it.value;
+        uint8_t typecode;
+        const container_t *c = get_leaf_container(
+            r, leaf, &typecode, &views[bitmap32->high_low_container.size]);
         ra_append(&bitmap32->high_low_container,
-                  (uint16_t)(current_high32 >> 16), get_container(r, leaf),
-                  get_typecode(leaf));
+                  (uint16_t)(current_high32 >> 16), (container_t *)c,
+                  typecode);
         art_iterator_next(&it);
     }
 
@@ -2315,6 +4357,7 @@ size_t roaring64_bitmap_portable_size_in_bytes(const roaring64_bitmap_t *r) {
         // significant bits of a set of elements.
         size += roaring_bitmap_portable_size_in_bytes(bitmap32);
         roaring_bitmap_free_without_containers(bitmap32);
+        roaring_free(views);
     }
 
     return size;
@@ -2338,6 +4381,8 @@ size_t roaring64_bitmap_portable_serialize(const roaring64_bitmap_t *r,
     art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
     uint32_t prev_high32 = 0;
     roaring_bitmap_t *bitmap32 = NULL;
+    // The bucket's inline leaves, as containers.
+    leaf_view_t *views = NULL;
 
     // Iterate through buckets ordered by increasing keys.
     while (it.value != NULL) {
@@ -2355,25 +4400,31 @@ size_t roaring64_bitmap_portable_serialize(const roaring64_bitmap_t *r,
                 // significant bits of a set of elements.
                 buf += roaring_bitmap_portable_serialize(bitmap32, buf);
                 roaring_bitmap_free_without_containers(bitmap32);
+                roaring_free(views);
             }
 
             // Start a new 32-bit bitmap with the current high 32 bits.
             art_iterator_t it2 = it;
             uint32_t containers_with_high32 = 0;
-            while (it2.value != NULL &&
-                   (uint32_t)combine_key(it2.key, 0) == current_high32) {
+            while (it2.value != NULL && (uint32_t)(combine_key(it2.key, 0) >>
+                                                   32) == current_high32) {
                 containers_with_high32++;
                 art_iterator_next(&it2);
             }
             bitmap32 =
                 roaring_bitmap_create_with_capacity(containers_with_high32);
+            views = (leaf_view_t *)roaring_malloc(containers_with_high32 *
+                                                  sizeof(leaf_view_t));
 
             prev_high32 = current_high32;
         }
         leaf_t leaf = (leaf_t)*it.value;
+        uint8_t typecode;
+        const container_t *c = get_leaf_container(
+            r, leaf, &typecode, &views[bitmap32->high_low_container.size]);
         ra_append(&bitmap32->high_low_container,
-                  (uint16_t)(current_high48 >> 16), get_container(r, leaf),
-                  get_typecode(leaf));
+                  (uint16_t)(current_high48 >> 16), (container_t *)c,
+                  typecode);
         art_iterator_next(&it);
     }
 
@@ -2387,6 +4438,7 @@ size_t roaring64_bitmap_portable_serialize(const roaring64_bitmap_t *r,
         // significant bits of a set of elements.
         buf += roaring_bitmap_portable_serialize(bitmap32, buf);
         roaring_bitmap_free_without_containers(bitmap32);
+        roaring_free(views);
     }
 
     return buf - initial_buf;
@@ -2470,7 +4522,7 @@ roaring64_bitmap_t *roaring64_bitmap_portable_deserialize_safe(
         // Read as uint32 the most significant 32 bits of the bucket.
         uint32_t high32;
         if (read_bytes + sizeof(high32) > maxbytes) {
-            roaring64_bitmap_free(r);
+            free_bulk_loaded64(r);
             return NULL;
         }
         memcpy(&high32, buf, sizeof(high32));
@@ -2479,7 +4531,7 @@ roaring64_bitmap_t *roaring64_bitmap_portable_deserialize_safe(
         read_bytes += sizeof(high32);
         // High 32 bits must be strictly increasing.
         if (high32 <= previous_high32) {
-            roaring64_bitmap_free(r);
+            free_bulk_loaded64(r);
             return NULL;
         }
         previous_high32 = high32;
@@ -2491,7 +4543,7 @@ roaring64_bitmap_t *roaring64_bitmap_portable_deserialize_safe(
         roaring_bitmap_t *bitmap32 =
             (roaring_bitmap_t *)roaring_malloc(sizeof(roaring_bitmap_t));
         if (bitmap32 == NULL) {
-            roaring64_bitmap_free(r);
+            free_bulk_loaded64(r);
             return NULL;
         }
         size_t bytesread = 0;
@@ -2499,38 +4551,219 @@ roaring64_bitmap_t *roaring64_bitmap_portable_deserialize_safe(
                                              maxbytes - read_bytes, &bytesread);
         if (!is_ok) {
             roaring_free(bitmap32);
-            roaring64_bitmap_free(r);
+            free_bulk_loaded64(r);
+            return NULL;
+        }
+        roaring_bitmap_set_copy_on_write(bitmap32, false);
+        buf += bytesread;
+        read_bytes += bytesread;
+
+        // While we don't attempt to validate much, we must ensure that there
+        // is no duplication in the high 48 bits - inserting into the ART
+        // assumes (or UB) no duplicate keys. The top 32 bits must be unique
+        // because we check for strict increasing values of  high32, but we
+        // must also ensure the top 16 bits within each 32-bit bitmap are also
+        // at least unique (we ensure they're strictly increasing as well,
+        // which they must be for a _valid_ bitmap, since it's cheaper to check)
+        int32_t last_bitmap_key = -1;
+        for (int i = 0; i < bitmap32->high_low_container.size; i++) {
+            uint16_t key = bitmap32->high_low_container.keys[i];
+            if (key <= last_bitmap_key) {
+                roaring_bitmap_free(bitmap32);
+                free_bulk_loaded64(r);
+                return NULL;
+            }
+            last_bitmap_key = key;
+        }
+
+        // Insert all containers of the 32-bit bitmap into the 64-bit bitmap.
+        move_from_roaring32_offset(r, bitmap32, high32);
+        roaring_bitmap_free(bitmap32);
+    }
+    art_bulk_finish(&r->art);
+    return r;
+}
+
+// Frees a bitmap whose containers were only partially read by
+// roaring64_bitmap_portable_deserialize_range: unread slots are NULL.
+static void free_partially_deserialized(roaring64_bitmap_t *r) {
+    for (uint64_t i = 0; i < r->first_free; ++i) {
+        if (r->containers[i] != NULL) {
+            container_free(r->containers[i], r->typecodes[i]);
+        }
+    }
+    art_free(&r->art);
+    roaring_free(r->containers);
+    roaring_free(r->typecodes);
+    roaring_free(r);
+}
+
+roaring64_bitmap_t *roaring64_bitmap_portable_deserialize_prepare(
+    const char *buf, size_t maxbytes, uint64_t *container_count) {
+    if (buf == NULL) {
+        return NULL;
+    }
+    size_t read_bytes = 0;
+    uint64_t buckets;
+    if (read_bytes + sizeof(buckets) > maxbytes) {
+        return NULL;
+    }
+    memcpy(&buckets, buf, sizeof(buckets));
+    buckets = croaring_letoh64(buckets);
+    read_bytes += sizeof(buckets);
+    if (buckets > UINT32_MAX) {
+        return NULL;
+    }
+
+    roaring64_bitmap_t *r = roaring64_bitmap_create();
+    int64_t previous_high32 = -1;
+    for (uint64_t bucket = 0; bucket < buckets; ++bucket) {
+        uint32_t high32;
+        if (read_bytes + sizeof(high32) > maxbytes) {
+            free_partially_deserialized(r);
+            return NULL;
+        }
+        memcpy(&high32, buf + read_bytes, sizeof(high32));
+        high32 = croaring_letoh32(high32);
+        read_bytes += sizeof(high32);
+        if (high32 <= previous_high32) {
+            free_partially_deserialized(r);
             return NULL;
         }
-        roaring_bitmap_set_copy_on_write(bitmap32, false);
-        buf += bytesread;
-        read_bytes += bytesread;
+        previous_high32 = high32;
 
-        // While we don't attempt to validate much, we must ensure that there
-        // is no duplication in the high 48 bits - inserting into the ART
-        // assumes (or UB) no duplicate keys. The top 32 bits must be unique
-        // because we check for strict increasing values of  high32, but we
-        // must also ensure the top 16 bits within each 32-bit bitmap are also
-        // at least unique (we ensure they're strictly increasing as well,
-        // which they must be for a _valid_ bitmap, since it's cheaper to check)
+        ra_portable_header_t header;
+        size_t bitmap32_size = 0;
+        if (ra_portable_parse_header(buf + read_bytes, maxbytes - read_bytes,
+                                     &header)) {
+            bitmap32_size = ra_portable_header_total_bytes(
+                &header, maxbytes - read_bytes);
+        }
+        if (bitmap32_size == 0) {
+            free_partially_deserialized(r);
+            return NULL;
+        }
+        read_bytes += bitmap32_size;
+
+        // Containers are added in key order to a fresh bitmap, so the k-th
+        // container overall lands in slot k. The range function relies on it.
+        ensure_container_capacity(r, header.size);
+        uint64_t key_base = ((uint64_t)high32) << 32;
         int32_t last_bitmap_key = -1;
-        for (int i = 0; i < bitmap32->high_low_container.size; i++) {
-            uint16_t key = bitmap32->high_low_container.keys[i];
+        for (int32_t k = 0; k < header.size; ++k) {
+            uint16_t key = ra_portable_header_key(&header, k);
+            // Inserting into the ART assumes no duplicate keys.
             if (key <= last_bitmap_key) {
-                roaring_bitmap_free(bitmap32);
-                roaring64_bitmap_free(r);
+                free_partially_deserialized(r);
                 return NULL;
             }
             last_bitmap_key = key;
+            uint8_t high48[ART_KEY_BYTES];
+            split_key(key_base | ((uint64_t)key << 16), high48);
+            leaf_t leaf = add_container(
+                r, NULL, ra_portable_header_typecode(&header, k));
+            art_insert(&r->art, high48, (art_val_t)leaf);
         }
+    }
+    *container_count = r->first_free;
+    return r;
+}
 
-        // Insert all containers of the 32-bit bitmap into the 64-bit bitmap.
-        move_from_roaring32_offset(r, bitmap32, high32);
-        roaring_bitmap_free(bitmap32);
+static bool roaring64_bitmap_portable_deserialize_range_impl(
+    roaring64_bitmap_t *r, const char *buf, size_t maxbytes, uint64_t begin,
+    uint64_t end) {
+    if (buf == NULL || begin > end || end > r->first_free) {
+        return false;
+    }
+    // Headers were validated by prepare, walk them again to find the buckets
+    // overlapping [begin, end).
+    size_t read_bytes = sizeof(uint64_t);
+    uint64_t base = 0;
+    while (base < end) {
+        ra_portable_header_t header;
+        read_bytes += sizeof(uint32_t);
+        if (read_bytes > maxbytes ||
+            !ra_portable_parse_header(buf + read_bytes, maxbytes - read_bytes,
+                                      &header)) {
+            break;
+        }
+        uint64_t bucket_end = base + header.size;
+        if (bucket_end > begin) {
+            uint64_t first = begin > base ? begin : base;
+            uint64_t last = end < bucket_end ? end : bucket_end;
+            for (uint64_t i = first; i < last; ++i) {
+                uint8_t typecode;
+                container_t *c = ra_portable_read_container(
+                    &header, maxbytes - read_bytes, (int32_t)(i - base),
+                    &typecode);
+                if (c == NULL) {
+                    for (uint64_t j = begin; j < i; ++j) {
+                        container_free(r->containers[j], r->typecodes[j]);
+                        r->containers[j] = NULL;
+                    }
+                    return false;
+                }
+                r->containers[i] = c;
+            }
+        }
+        size_t bitmap32_size =
+            ra_portable_header_total_bytes(&header, maxbytes - read_bytes);
+        if (bitmap32_size == 0) {
+            break;
+        }
+        read_bytes += bitmap32_size;
+        base = bucket_end;
+    }
+    if (base < end) {
+        for (uint64_t j = begin; j < base; ++j) {
+            container_free(r->containers[j], r->typecodes[j]);
+            r->containers[j] = NULL;
+        }
+        return false;
+    }
+    return true;
+}
+
+bool roaring64_bitmap_portable_deserialize_range(roaring64_bitmap_t *r,
+                                                 const char *buf,
+                                                 size_t maxbytes,
+                                                 uint64_t begin, uint64_t end) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return false;
+    }
+    bool answer = roaring64_bitmap_portable_deserialize_range_impl(r, buf,
+                                                                   maxbytes,
+                                                                   begin, end);
+    leave_allocator(previous);
+    return answer;
+}
+
+static roaring64_bitmap_t *roaring64_bitmap_portable_deserialize_finish_impl(
+    roaring64_bitmap_t *r) {
+    for (uint64_t i = 0; i < r->first_free; ++i) {
+        if (r->containers[i] == NULL) {
+            free_partially_deserialized(r);
+            return NULL;
+        }
+    }
+    art_iterator_t it = art_init_iterator(&r->art, /*first=*/true);
+    while (it.value != NULL) {
+        inline_if_tiny(r, (leaf_t *)it.value);
+        art_iterator_next(&it);
     }
     return r;
 }
 
+roaring64_bitmap_t *roaring64_bitmap_portable_deserialize_finish(
+    roaring64_bitmap_t *r) {
+    const roaring_allocator_t *previous = enter_allocator_of64(r);
+    roaring64_bitmap_t *answer =
+        roaring64_bitmap_portable_deserialize_finish_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
 // Returns an "element count" for the given container. This has a different
 // meaning for each container type, but the purpose is the minimal information
 // required to serialize the container metadata.
@@ -2578,32 +4811,85 @@ uint64_t align_size(uint64_t size, uint64_t alignment) {
     return (size + alignment - 1) & ~(alignment - 1);
 }
 
+// The frozen format stores the ART leaves, and with them the typecodes: it has
+// no room for shared containers. The shared full container is the exception,
+// it is written as a run container.
+static bool has_shared_containers(const roaring64_bitmap_t *r) {
+    for (uint64_t i = 0; i < r->capacity; ++i) {
+        if (r->containers[i] != NULL &&
+            r->typecodes[i] == SHARED_CONTAINER_TYPE &&
+            r->containers[i] != shared_container_full()) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Serializes the ART of `r` for the frozen format, with the leaves of the
+// shared full container retyped as run containers, and inline leaves as array
+// containers numbered from r->capacity in key order. Returns 0 on failure.
+static size_t frozen_serialize_art(const roaring64_bitmap_t *r, char *buf,
+                                   bool retype_leaves) {
+    if (!retype_leaves) {
+        return art_serialize(&r->art, buf);
+    }
+    // A compacted copy has the same nodes as the shrunken ART, in a buffer
+    // whose leaves we may modify.
+    size_t nodes_size = art_compact_size_in_bytes(&r->art);
+    char *nodes = (char *)roaring_aligned_malloc(8, nodes_size);
+    if (nodes == NULL) {
+        return 0;
+    }
+    art_t art;
+    art_compact(&r->art, nodes, &art);
+    art_iterator_t it = art_init_iterator(&art, /*first=*/true);
+    uint64_t inline_index = r->capacity;
+    while (it.value != NULL) {
+        leaf_t leaf = (leaf_t)*it.value;
+        if (is_inline_leaf(leaf)) {
+            *it.value = create_leaf(inline_index++, ARRAY_CONTAINER_TYPE);
+        } else if (get_typecode(leaf) == SHARED_CONTAINER_TYPE) {
+            *it.value = create_leaf(get_index(leaf), RUN_CONTAINER_TYPE);
+        }
+        art_iterator_next(&it);
+    }
+    size_t size = art_serialize(&art, buf);
+    roaring_aligned_free(nodes);
+    return size;
+}
+
 size_t roaring64_bitmap_frozen_size_in_bytes(const roaring64_bitmap_t *r) {
-    if (!is_shrunken(r)) {
+    if (!is_shrunken(r) || has_shared_containers(r)) {
         return 0;
     }
+    uint64_t total_sizes[4] =
+        CROARING_ZERO_INITIALIZER;  // Indexed by typecode.
+    // Inline leaves are written as array containers.
+    uint64_t n_inline = 0;
+    art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
+    while (it.value != NULL) {
+        leaf_t leaf = (leaf_t)*it.value;
+        n_inline += is_inline_leaf(leaf);
+        uint8_t typecode;
+        leaf_view_t view;
+        const container_t *container =
+            get_actual_container(r, leaf, &typecode, &view);
+        total_sizes[typecode] += container_get_frozen_size(container, typecode);
+        art_iterator_next(&it);
+    }
+
     // Flags.
     uint64_t size = sizeof(r->flags);
     // Container count.
     size += sizeof(r->capacity);
     // Container element counts.
-    size += r->capacity * sizeof(uint16_t);
+    size += (r->capacity + n_inline) * sizeof(uint16_t);
     // Total container sizes.
     size += 3 * sizeof(uint64_t);
     // ART (8 byte aligned).
     size = align_size(size, 8);
     size += art_size_in_bytes(&r->art);
 
-    uint64_t total_sizes[4] =
-        CROARING_ZERO_INITIALIZER;  // Indexed by typecode.
-    art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
-    while (it.value != NULL) {
-        leaf_t leaf = (leaf_t)*it.value;
-        uint8_t typecode = get_typecode(leaf);
-        total_sizes[typecode] +=
-            container_get_frozen_size(get_container(r, leaf), typecode);
-        art_iterator_next(&it);
-    }
     // Containers (aligned).
     size = align_size(size, CROARING_BITSET_ALIGNMENT);
     size += total_sizes[BITSET_CONTAINER_TYPE];
@@ -2661,7 +4947,7 @@ size_t roaring64_bitmap_frozen_serialize(const roaring64_bitmap_t *r,
     if (buf == NULL) {
         return 0;
     }
-    if (!is_shrunken(r)) {
+    if (!is_shrunken(r) || has_shared_containers(r)) {
         return 0;
     }
     const char *initial_buf = buf;
@@ -2670,18 +4956,29 @@ size_t roaring64_bitmap_frozen_serialize(const roaring64_bitmap_t *r,
     memcpy(buf, &r->flags, sizeof(r->flags));
     buf += sizeof(r->flags);
 
-    // Container count.
-    memcpy(buf, &r->capacity, sizeof(r->capacity));
-    buf += sizeof(r->capacity);
+    // Container count, with inline leaves written as array containers.
+    uint64_t n_inline = 0;
+    art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
+    while (it.value != NULL) {
+        n_inline += is_inline_leaf((leaf_t)*it.value);
+        art_iterator_next(&it);
+    }
+    uint64_t container_count = r->capacity + n_inline;
+    memcpy(buf, &container_count, sizeof(container_count));
+    buf += sizeof(container_count);
 
     // Container element counts.
     uint64_t total_sizes[4] =
         CROARING_ZERO_INITIALIZER;  // Indexed by typecode.
-    art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
+    bool retype_leaves = n_inline > 0;
+    it = art_init_iterator((art_t *)&r->art, /*first=*/true);
     while (it.value != NULL) {
         leaf_t leaf = (leaf_t)*it.value;
-        uint8_t typecode = get_typecode(leaf);
-        container_t *container = get_container(r, leaf);
+        retype_leaves |= get_typecode(leaf) == SHARED_CONTAINER_TYPE;
+        uint8_t typecode;
+        leaf_view_t view;
+        const container_t *container =
+            get_actual_container(r, leaf, &typecode, &view);
 
         uint32_t elem_count = container_get_element_count(container, typecode);
         uint16_t compressed_elem_count = (uint16_t)(elem_count - 1);
@@ -2702,7 +4999,11 @@ size_t roaring64_bitmap_frozen_serialize(const roaring64_bitmap_t *r,
 
     // ART.
     buf = pad_align(buf, initial_buf, 8);
-    buf += art_serialize(&r->art, buf);
+    size_t art_size = frozen_serialize_art(r, buf, retype_leaves);
+    if (art_size == 0) {
+        return 0;
+    }
+    buf += art_size;
 
     // Containers (aligned).
     // Runs before arrays as run elements are larger than array elements and
@@ -2719,9 +5020,10 @@ size_t roaring64_bitmap_frozen_serialize(const roaring64_bitmap_t *r,
 
     it = art_init_iterator((art_t *)&r->art, /*first=*/true);
     while (it.value != NULL) {
-        leaf_t leaf = (leaf_t)*it.value;
-        uint8_t typecode = get_typecode(leaf);
-        container_t *container = get_container(r, leaf);
+        uint8_t typecode;
+        leaf_view_t view;
+        const container_t *container =
+            get_actual_container(r, (leaf_t)*it.value, &typecode, &view);
         container_frozen_serialize(container, typecode, &bitsets, &arrays,
                                    &runs);
         art_iterator_next(&it);
@@ -2758,8 +5060,12 @@ static roaring64_bitmap_t *alloc_frozen_bitmap(
         &cursor, sizeof(roaring64_bitmap_t));
     art_init_cleared(&r->art);
     r->flags = ROARING_FLAG_FROZEN;
+    r->allocator = roaring_allocator_current();
     r->capacity = capacity;
     r->first_free = 0;
+    r->live_containers = 0;
+    r->inline_cardinality = 0;
+    r->cumulative_cardinalities = NULL;
     cursor = roaring64_arena_pad(cursor, base, alignof(container_t *));
     if (capacity == 0) {
         r->containers = NULL;
@@ -2798,6 +5104,7 @@ static container_t *container_frozen_view_at(
             c->cardinality = elem_count;
             c->capacity = elem_count;
             c->array = (uint16_t *)*arrays;
+            c->inline_values = false;
             *arrays += elem_count;
             return (container_t *)c;
         }
@@ -2940,9 +5247,199 @@ roaring64_bitmap_t *roaring64_bitmap_frozen_view(const char *buf,
     buf = CROARING_ALIGN_BUF(buf, CROARING_BITSET_ALIGNMENT);
 
     r->first_free = r->capacity;
+    r->live_containers = r->capacity;
     return r;
 }
 
+// Copies a container to a sealed block: its header to `header`, and its
+// values to `*payload`, which is advanced past them.
+static container_t *seal_container(const container_t *c, uint8_t typecode,
+                                   frozen_container_header_t *header,
+                                   char **payload, const char *block) {
+    if (typecode == BITSET_CONTAINER_TYPE) {
+        *payload =
+            roaring64_arena_pad(*payload, block, CROARING_BITSET_ALIGNMENT);
+    }
+    uint64_t *bitsets = (uint64_t *)*payload;
+    uint16_t *arrays = (uint16_t *)*payload;
+    rle16_t *runs = (rle16_t *)*payload;
+    container_frozen_serialize(c, typecode, &bitsets, &arrays, &runs);
+    const uint64_t *bitset_view = (const uint64_t *)*payload;
+    const uint16_t *array_view = (const uint16_t *)*payload;
+    const rle16_t *run_view = (const rle16_t *)*payload;
+    *payload += container_get_frozen_size(c, typecode);
+    return container_frozen_view_at(header, typecode,
+                                    container_get_element_count(c, typecode),
+                                    &bitset_view, &array_view, &run_view);
+}
+
+static bool roaring64_bitmap_seal_impl(roaring64_bitmap_t *r) {
+    uint64_t n = 0;
+    uint64_t leaves = 0;
+    size_t payload_size = 0;  // from a cache-line aligned start
+    art_iterator_t it = art_init_iterator(&r->art, /*first=*/true);
+    while (it.value != NULL) {
+        leaf_t leaf = (leaf_t)*it.value;
+        leaves++;
+        if (is_inline_leaf(leaf)) {
+            // Packed with the ART already.
+            art_iterator_next(&it);
+            continue;
+        }
+        uint8_t typecode;
+        const container_t *c = get_actual_container(r, leaf, &typecode, NULL);
+        if (typecode == BITSET_CONTAINER_TYPE) {
+            payload_size =
+                align_size(payload_size, CROARING_BITSET_ALIGNMENT);
+        }
+        payload_size += container_get_frozen_size(c, typecode);
+        n++;
+        art_iterator_next(&it);
+    }
+    if (art_is_empty(&r->art)) {
+        return true;  // nothing to pack
+    }
+    // Container pointers and typecodes, cumulative cardinalities, ART nodes,
+    // container headers, then payloads.
+    size_t cumulative_offset =
+        align_size(n * (sizeof(container_t *) + sizeof(uint8_t)), 8);
+    size_t art_offset =
+        cumulative_offset + (leaves + 1) * sizeof(uint64_t);
+    size_t headers_offset = art_offset + art_compact_size_in_bytes(&r->art);
+    size_t payloads_offset =
+        align_size(headers_offset + n * sizeof(frozen_container_header_t),
+                   CROARING_BITSET_ALIGNMENT);
+    char *block = (char *)roaring_aligned_malloc(
+        CROARING_BITSET_ALIGNMENT, payloads_offset + payload_size);
+    if (block == NULL) {
+        return false;
+    }
+    art_t art;
+    if (art_compact(&r->art, block + art_offset, &art) !=
+        headers_offset - art_offset) {
+        roaring_aligned_free(block);
+        return false;
+    }
+    container_t **containers = (container_t **)block;
+    uint8_t *typecodes = (uint8_t *)(containers + n);
+    frozen_container_header_t *headers =
+        (frozen_container_header_t *)(block + headers_offset);
+    char *payload = block + payloads_offset;
+    uint64_t *cumulative = (uint64_t *)(block + cumulative_offset);
+    uint64_t cardinality = 0;
+    // The compacted leaves still refer to the containers of `r`: number them
+    // in key order.
+    it = art_init_iterator(&art, /*first=*/true);
+    for (uint64_t i = 0, j = 0; it.value != NULL;
+         art_iterator_next(&it), ++j) {
+        leaf_t *leaf = (leaf_t *)it.value;
+        cumulative[j] = cardinality;
+        cardinality += leaf_cardinality(r, *leaf);
+        if (is_inline_leaf(*leaf)) {
+            continue;
+        }
+        uint8_t typecode;
+        const container_t *c = get_actual_container(r, *leaf, &typecode, NULL);
+        containers[i] =
+            seal_container(c, typecode, headers + i, &payload, block);
+        typecodes[i] = typecode;
+        *leaf = create_leaf(i, typecode);
+        ++i;
+    }
+    assert(payload <= block + payloads_offset + payload_size);
+    cumulative[leaves] = cardinality;
+
+    it = art_init_iterator(&r->art, /*first=*/true);
+    while (it.value != NULL) {
+        leaf_t leaf = (leaf_t)*it.value;
+        free_leaf_container(r, leaf);
+        art_iterator_next(&it);
+    }
+    art_free(&r->art);
+    roaring_free(r->containers);
+    roaring_free(r->typecodes);
+    r->art = art;
+    r->containers = containers;
+    r->typecodes = typecodes;
+    r->capacity = n;
+    r->first_free = n;
+    r->live_containers = n;
+    r->cumulative_cardinalities = cumulative;
+    r->flags |= ROARING_FLAG_SEALED;
+    return true;
+}
+
+static bool roaring64_bitmap_unseal_impl(roaring64_bitmap_t *r) {
+    uint64_t n = r->capacity;
+    container_t **containers =
+        (container_t **)roaring_malloc(n * sizeof(container_t *));
+    uint8_t *typecodes = (uint8_t *)roaring_malloc(n * sizeof(uint8_t));
+    uint64_t cloned = 0;
+    if (containers != NULL && typecodes != NULL) {
+        for (; cloned < n; ++cloned) {
+            containers[cloned] =
+                container_clone(r->containers[cloned], r->typecodes[cloned]);
+            if (containers[cloned] == NULL) {
+                break;
+            }
+            typecodes[cloned] = r->typecodes[cloned];
+        }
+    }
+    if (cloned < n) {
+        for (uint64_t i = 0; i < cloned; ++i) {
+            container_free(containers[i], typecodes[i]);
+        }
+        roaring_free(containers);
+        roaring_free(typecodes);
+        return false;
+    }
+    // The leaves keep their container indices.
+    art_t art;
+    art_init_cleared(&art);
+    art_iterator_t it = art_init_iterator(&r->art, /*first=*/true);
+    while (it.value != NULL) {
+        art_insert(&art, it.key, *it.value);
+        art_iterator_next(&it);
+    }
+    uint64_t inline_cardinality = r->inline_cardinality;
+    release_sealed64(r);
+    r->inline_cardinality = inline_cardinality;
+    r->art = art;
+    r->containers = containers;
+    r->typecodes = typecodes;
+    r->capacity = n;
+    r->first_free = n;
+    r->live_containers = n;
+    return true;
+}
+
+bool roaring64_bitmap_seal(roaring64_bitmap_t *r) {
+    if (is_frozen64(r)) {
+        return false;
+    }
+    if (is_sealed64(r)) {
+        return true;
+    }
+    const roaring_allocator_t *previous = enter_allocator_of64(r);
+    bool answer = roaring64_bitmap_seal_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+bool roaring64_bitmap_unseal(roaring64_bitmap_t *r) {
+    if (!is_sealed64(r)) {
+        return true;
+    }
+    const roaring_allocator_t *previous = enter_allocator_of64(r);
+    bool answer = roaring64_bitmap_unseal_impl(r);
+    leave_allocator(previous);
+    return answer;
+}
+
+bool roaring64_bitmap_is_sealed(const roaring64_bitmap_t *r) {
+    return is_sealed64(r);
+}
+
 static bool view_one_portable32(roaring64_bitmap_t *r,
                                 frozen_container_header_t *headers,
                                 uint32_t high32, const char *buf,
@@ -3092,6 +5589,7 @@ static bool view_one_portable32(roaring64_bitmap_t *r,
             header->array.cardinality = (int32_t)cardinality;
             header->array.capacity = (int32_t)cardinality;
             header->array.array = (uint16_t *)payload;
+            header->array.inline_values = false;
             c = (container_t *)&header->array;
         }
         set_container_at(r, index, c, typecode);
@@ -3231,8 +5729,10 @@ bool roaring64_bitmap_iterate(const roaring64_bitmap_t *r,
         uint64_t high32 = high48 & 0xFFFFFFFF00000000ULL;
         uint32_t low32 = high48;
         leaf_t leaf = (leaf_t)*it.value;
-        if (!container_iterate64(get_container(r, leaf), get_typecode(leaf),
-                                 low32, iterator, high32, ptr)) {
+        uint8_t typecode;
+        leaf_view_t view;
+        const container_t *c = get_leaf_container(r, leaf, &typecode, &view);
+        if (!container_iterate64(c, typecode, low32, iterator, high32, ptr)) {
             return false;
         }
         art_iterator_next(&it);
@@ -3242,9 +5742,62 @@ bool roaring64_bitmap_iterate(const roaring64_bitmap_t *r,
 
 void roaring64_bitmap_to_uint64_array(const roaring64_bitmap_t *r,
                                       uint64_t *out) {
-    roaring64_iterator_t it;  // gets initialized in the next line
-    roaring64_iterator_init_at(r, &it, /*first=*/true);
-    roaring64_iterator_read(&it, out, UINT64_MAX);
+    roaring64_bitmap_range_uint64_array(r, 0, UINT64_MAX, out);
+}
+
+uint64_t roaring64_bitmap_range_uint64_array(const roaring64_bitmap_t *r,
+                                             uint64_t offset, uint64_t limit,
+                                             uint64_t *out) {
+    uint64_t written = 0;
+    art_iterator_t art_it;
+    if (r->cumulative_cardinalities != NULL && offset > 0) {
+        // Start right at the leaf of rank `offset`.
+        if (offset >= roaring64_bitmap_get_cardinality(r)) {
+            return 0;
+        }
+        uint64_t index = cumulative_search(r, 0, offset);
+        art_key_chunk_t key[ART_KEY_BYTES];
+        art_compact_leaf_at(&r->art, index, key);
+        art_it = art_lower_bound((art_t *)&r->art, key);
+        offset -= r->cumulative_cardinalities[index];
+    } else {
+        art_it = art_init_iterator((art_t *)&r->art, /*first=*/true);
+    }
+    for (; art_it.value != NULL && written < limit;
+         art_iterator_next(&art_it)) {
+        leaf_t leaf = (leaf_t)*art_it.value;
+        uint8_t typecode;
+        leaf_view_t view;
+        const container_t *c = get_actual_container(r, leaf, &typecode, &view);
+        uint32_t card = (uint32_t)container_get_cardinality(c, typecode);
+        if (offset >= card) {
+            offset -= card;
+            continue;
+        }
+        uint64_t high48 = combine_key(art_it.key, 0);
+        if (offset == 0 && card <= limit - written) {
+            // Whole containers are decoded in one go.
+            written +=
+                container_to_uint64_array(out + written, c, typecode, high48);
+            continue;
+        }
+        uint16_t value;
+        uint32_t consumed;
+        roaring_container_iterator_t it =
+            container_init_iterator(c, typecode, &value);
+        if (offset > 0) {
+            container_iterator_skip(c, typecode, &it, (uint32_t)offset,
+                                    &consumed, &value);
+        }
+        uint64_t count = card - offset;
+        if (count > limit - written) count = limit - written;
+        container_iterator_read_into_uint64(c, typecode, &it, high48,
+                                            out + written, (uint32_t)count,
+                                            &consumed, &value);
+        written += consumed;
+        offset = 0;
+    }
+    return written;
 }
 
 roaring64_iterator_t *roaring64_iterator_create(const roaring64_bitmap_t *r) {
@@ -3306,10 +5859,11 @@ static inline bool roaring64_iterator_advance_slow(roaring64_iterator_t *it) {
         return it->pub.has_value;
     }
     leaf_t leaf = (leaf_t)*it->art_it.value;
-    uint8_t typecode = get_typecode(leaf);
+    uint8_t typecode;
+    const container_t *c =
+        get_actual_container(it->r, leaf, &typecode, &it->view);
     uint16_t low16 = (uint16_t)it->pub.value;
-    if (container_iterator_next(get_container(it->r, leaf), typecode,
-                                &it->container_it, &low16)) {
+    if (container_iterator_next(c, typecode, &it->container_it, &low16)) {
         it->pub.value = it->high48 | low16;
         it->pub.has_value = true;
         if (typecode == BITSET_CONTAINER_TYPE) {
@@ -3360,9 +5914,11 @@ bool roaring64_iterator_previous(roaring64_iterator_t *it) {
         return it->pub.has_value;
     }
     leaf_t leaf = (leaf_t)*it->art_it.value;
+    uint8_t typecode;
+    const container_t *c =
+        get_actual_container(it->r, leaf, &typecode, &it->view);
     uint16_t low16 = (uint16_t)it->pub.value;
-    if (container_iterator_prev(get_container(it->r, leaf), get_typecode(leaf),
-                                &it->container_it, &low16)) {
+    if (container_iterator_prev(c, typecode, &it->container_it, &low16)) {
         it->pub.value = it->high48 | low16;
         it->pub.has_value = true;
         it->fast_type = 0;
@@ -3398,10 +5954,12 @@ bool roaring64_iterator_move_equalorlarger(roaring64_iterator_t *it,
         // We're at equal high bits, check if a suitable value can be found
         // in this container.
         leaf_t leaf = (leaf_t)*it->art_it.value;
+        uint8_t typecode;
+        const container_t *c =
+            get_actual_container(it->r, leaf, &typecode, &it->view);
         uint16_t low16 = (uint16_t)it->pub.value;
-        if (container_iterator_lower_bound(
-                get_container(it->r, leaf), get_typecode(leaf),
-                &it->container_it, &low16, val_low16)) {
+        if (container_iterator_lower_bound(c, typecode, &it->container_it,
+                                           &low16, val_low16)) {
             it->pub.value = it->high48 | low16;
             it->pub.has_value = true;
             it->fast_type = 0;
@@ -3431,9 +5989,12 @@ uint64_t roaring64_iterator_read(roaring64_iterator_t *it, uint64_t *buf,
         if (count - consumed < (uint64_t)UINT32_MAX) {
             container_count = count - consumed;
         }
+        uint8_t typecode;
+        const container_t *c =
+            get_actual_container(it->r, leaf, &typecode, &it->view);
         bool has_value = container_iterator_read_into_uint64(
-            get_container(it->r, leaf), get_typecode(leaf), &it->container_it,
-            it->high48, buf, container_count, &container_consumed, &low16);
+            c, typecode, &it->container_it, it->high48, buf, container_count,
+            &container_consumed, &low16);
         consumed += container_consumed;
         buf += container_consumed;
         if (has_value) {
@@ -3465,9 +6026,12 @@ uint64_t roaring64_iterator_read_backward(roaring64_iterator_t *it,
         if (count - consumed < (uint64_t)UINT32_MAX) {
             container_count = count - consumed;
         }
+        uint8_t typecode;
+        const container_t *c =
+            get_actual_container(it->r, leaf, &typecode, &it->view);
         bool has_value = container_iterator_read_backward_into_uint64(
-            get_container(it->r, leaf), get_typecode(leaf), &it->container_it,
-            it->high48, buf, container_count, &container_consumed, &low16);
+            c, typecode, &it->container_it, it->high48, buf, container_count,
+            &container_consumed, &low16);
         consumed += container_consumed;
         buf += container_consumed;
         if (has_value) {
@@ -3495,10 +6059,12 @@ size_t roaring64_iterator_read_ranges(roaring64_iterator_t *it,
         for (;;) {
             uint16_t low16 = (uint16_t)it->pub.value;
             leaf_t leaf = (leaf_t)*it->art_it.value;
+            uint8_t typecode;
+            const container_t *c =
+                get_actual_container(it->r, leaf, &typecode, &it->view);
             bool container_has_more;
             uint16_t run_end_low16 = container_iterator_find_run_end(
-                get_container(it->r, leaf), get_typecode(leaf),
-                &it->container_it, &low16, &container_has_more);
+                c, typecode, &it->container_it, &low16, &container_has_more);
             buf[ret].max = it->high48 | run_end_low16;
 
             if (container_has_more) {
@@ -3534,10 +6100,12 @@ size_t roaring64_iterator_read_prev_ranges(roaring64_iterator_t *it,
         for (;;) {
             uint16_t low16 = (uint16_t)it->pub.value;
             leaf_t leaf = (leaf_t)*it->art_it.value;
+            uint8_t typecode;
+            const container_t *c =
+                get_actual_container(it->r, leaf, &typecode, &it->view);
             bool container_has_more;
             uint16_t run_start_low16 = container_iterator_find_run_start(
-                get_container(it->r, leaf), get_typecode(leaf),
-                &it->container_it, &low16, &container_has_more);
+                c, typecode, &it->container_it, &low16, &container_has_more);
             buf[ret].min = it->high48 | run_start_low16;
 
             if (container_has_more) {
@@ -3563,6 +6131,143 @@ size_t roaring64_iterator_read_prev_ranges(roaring64_iterator_t *it,
     return ret;
 }
 
+static bool ranges64_are_valid(const roaring64_range_closed_t *ranges,
+                               size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if (ranges[i].min > ranges[i].max ||
+            (i > 0 && ranges[i].min < ranges[i - 1].min)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool ranges64_insert_container(roaring64_bitmap_t *r, uint64_t high48,
+                                      container_t *c, uint8_t typecode) {
+    if (c == NULL) {
+        return false;
+    }
+    uint8_t high48_bytes[ART_KEY_BYTES];
+    split_key(high48 << 16, high48_bytes);
+    leaf_t leaf = add_container(r, c, typecode);
+    art_insert(&r->art, high48_bytes, (art_val_t)leaf);
+    return true;
+}
+
+roaring64_bitmap_t *roaring64_bitmap_from_ranges(
+    const roaring64_range_closed_t *ranges, size_t n) {
+    if (!ranges64_are_valid(ranges, n)) {
+        return NULL;
+    }
+    roaring64_bitmap_t *r = roaring64_bitmap_create();
+    // The runs of the current key; a container has at most 2^15 runs.
+    rle16_t *runs = (rle16_t *)roaring_malloc((1 << 15) * sizeof(rle16_t));
+    if (runs == NULL) {
+        roaring64_bitmap_free(r);
+        return NULL;
+    }
+    int32_t n_runs = 0;
+    uint64_t key = 0;
+    uint8_t typecode;
+    bool ok = true;
+    size_t i = 0;
+    while (ok && i < n) {
+        uint64_t min = ranges[i].min, max = ranges[i].max;
+        // Merge the following ranges that overlap or touch this one.
+        for (++i; i < n && (max == UINT64_MAX || ranges[i].min <= max + 1);
+             ++i) {
+            if (ranges[i].max > max) max = ranges[i].max;
+        }
+        uint64_t first_key = min >> 16, last_key = max >> 16;
+        for (uint64_t k = first_key; ok && k <= last_key; ++k) {
+            uint16_t lo = k == first_key ? (uint16_t)min : 0;
+            uint16_t hi = k == last_key ? (uint16_t)max : 0xFFFF;
+            if (n_runs > 0 && k != key) {
+                container_t *c = container_from_runs(runs, n_runs, &typecode);
+                ok = ranges64_insert_container(r, key, c, typecode);
+                n_runs = 0;
+            }
+            if (ok && lo == 0 && hi == 0xFFFF) {
+                // Full container, no need to go through the runs.
+                ok = ranges64_insert_container(
+                    r, k, run_container_create_range(0, 1 << 16),
+                    RUN_CONTAINER_TYPE);
+                continue;
+            }
+            key = k;
+            runs[n_runs].value = lo;
+            runs[n_runs].length = hi - lo;
+            n_runs++;
+        }
+    }
+    if (ok && n_runs > 0) {
+        container_t *c = container_from_runs(runs, n_runs, &typecode);
+        ok = ranges64_insert_container(r, key, c, typecode);
+    }
+    roaring_free(runs);
+    if (!ok) {
+        roaring64_bitmap_free(r);
+        return NULL;
+    }
+    return r;
+}
+
+static bool roaring64_bitmap_add_ranges_impl(
+    roaring64_bitmap_t *r, const roaring64_range_closed_t *ranges, size_t n) {
+    roaring64_bitmap_t *added = roaring64_bitmap_from_ranges(ranges, n);
+    if (added == NULL) {
+        return false;
+    }
+    roaring64_bitmap_or_inplace(r, added);
+    roaring64_bitmap_free(added);
+    return true;
+}
+
+bool roaring64_bitmap_add_ranges(roaring64_bitmap_t *r,
+                                 const roaring64_range_closed_t *ranges,
+                                 size_t n) {
+    const roaring_allocator_t *previous;
+    if (!enter_allocator_to_modify64(r, &previous)) {
+        return false;
+    }
+    bool answer = roaring64_bitmap_add_ranges_impl(r, ranges, n);
+    leave_allocator(previous);
+    return answer;
+}
+
+size_t roaring64_bitmap_range_count(const roaring64_bitmap_t *r) {
+    size_t count = 0;
+    bool prev_ends_full = false;
+    uint64_t prev_high48 = 0;
+    art_iterator_t it = art_init_iterator((art_t *)&r->art, /*first=*/true);
+    while (it.value != NULL) {
+        leaf_t leaf = (leaf_t)*it.value;
+        uint8_t typecode;
+        leaf_view_t view;
+        const container_t *c = get_leaf_container(r, leaf, &typecode, &view);
+        uint64_t high48 = combine_key(it.key, 0) >> 16;
+        count += container_number_of_runs(c, typecode);
+        // A run reaching the end of a container goes on in the next one if
+        // that one starts with 0.
+        if (prev_ends_full && high48 == prev_high48 + 1 &&
+            container_contains(c, 0, typecode)) {
+            count--;
+        }
+        prev_ends_full = container_contains(c, 0xFFFF, typecode);
+        prev_high48 = high48;
+        art_iterator_next(&it);
+    }
+    return count;
+}
+
+size_t roaring64_bitmap_to_ranges(const roaring64_bitmap_t *r,
+                                  roaring64_range_closed_t *buf,
+                                  size_t count) {
+    roaring64_iterator_t it;  // gets initialized in the next line
+    roaring64_iterator_init_at(r, &it, /*first=*/true);
+    return roaring64_iterator_read_ranges(&it, buf, count);
+}
+
 #ifdef __cplusplus
 }  // extern "C"
 }  // namespace roaring
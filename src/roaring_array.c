@@ -39,45 +39,89 @@ extern inline void ra_set_container_at_index(const roaring_array_t *ra,
                                              int32_t i, container_t *c,
                                              uint8_t typecode);
 
-static bool realloc_array(roaring_array_t *ra, int32_t new_capacity) {
+// The block of an array holds its containers, keys and typecodes. With
+// ROARING_FLAG_ALLOCATOR, it starts with the allocator, so such an array always
+// has a block, if only for the allocator.
+static void *ra_block(const roaring_array_t *ra) {
+    if (ra->flags & ROARING_FLAG_ALLOCATOR) {
+        return (char *)ra->containers - sizeof(const roaring_allocator_t *);
+    }
+    return ra->containers;
+}
+
+static void ra_free_block(roaring_array_t *ra) {
+    if (ra->flags & ROARING_FLAG_SEALED) {
+        roaring_aligned_free(ra_block(ra));
+    } else {
+        roaring_free(ra_block(ra));
+    }
+    ra->flags &= (uint8_t)~(ROARING_FLAG_SEALED | ROARING_FLAG_ALLOCATOR);
+}
+
+// Moves the ra->size entries of the array into a new block with room for
+// `new_capacity` entries, allocated by `allocator`.
+static bool ra_move_to_block(roaring_array_t *ra,
+                             const roaring_allocator_t *allocator,
+                             int32_t new_capacity) {
     //
     // Note: not implemented using C's realloc(), because the memory layout is
     // Struct-of-Arrays vs. Array-of-Structs:
     // https://github.com/RoaringBitmap/CRoaring/issues/256
 
-    if (new_capacity == 0) {
-        roaring_free(ra->containers);
+    const roaring_allocator_t *previous = roaring_allocator_enter(allocator);
+    if (new_capacity == 0 && allocator == NULL) {
+        ra_free_block(ra);
+        roaring_allocator_leave(previous);
         ra->containers = NULL;
         ra->keys = NULL;
         ra->typecodes = NULL;
         ra->allocation_size = 0;
         return true;
     }
+    const size_t slot = allocator != NULL ? sizeof(allocator) : 0;
     const size_t memoryneeded =
-        new_capacity *
-        (sizeof(uint16_t) + sizeof(container_t *) + sizeof(uint8_t));
-    void *bigalloc = roaring_malloc(memoryneeded);
-    if (!bigalloc) return false;
-    void *oldbigalloc = ra->containers;
-    container_t **newcontainers = (container_t **)bigalloc;
+        slot + new_capacity * (sizeof(uint16_t) + sizeof(container_t *) +
+                               sizeof(uint8_t));
+    char *bigalloc = (char *)roaring_malloc(memoryneeded);
+    if (!bigalloc) {
+        roaring_allocator_leave(previous);
+        return false;
+    }
+    if (allocator != NULL) {
+        memcpy(bigalloc, &allocator, sizeof(allocator));
+    }
+    container_t **newcontainers = (container_t **)(bigalloc + slot);
     uint16_t *newkeys = (uint16_t *)(newcontainers + new_capacity);
     uint8_t *newtypecodes = (uint8_t *)(newkeys + new_capacity);
-    assert((char *)(newtypecodes + new_capacity) ==
-           (char *)bigalloc + memoryneeded);
+    assert((char *)(newtypecodes + new_capacity) == bigalloc + memoryneeded);
     if (ra->size > 0) {
         memcpy(newcontainers, ra->containers, sizeof(container_t *) * ra->size);
         memcpy(newkeys, ra->keys, sizeof(uint16_t) * ra->size);
         memcpy(newtypecodes, ra->typecodes, sizeof(uint8_t) * ra->size);
     }
+    ra_free_block(ra);
+    roaring_allocator_leave(previous);
+    if (allocator != NULL) {
+        ra->flags |= ROARING_FLAG_ALLOCATOR;
+    }
     ra->containers = newcontainers;
     ra->keys = newkeys;
     ra->typecodes = newtypecodes;
     ra->allocation_size = new_capacity;
-    roaring_free(oldbigalloc);
     return true;
 }
 
+static bool realloc_array(roaring_array_t *ra, int32_t new_capacity) {
+    return ra_move_to_block(ra, ra_get_allocator(ra), new_capacity);
+}
+
 bool ra_init_with_capacity(roaring_array_t *new_ra, uint32_t cap) {
+    return ra_init_with_allocator(new_ra, roaring_allocator_current(), cap);
+}
+
+bool ra_init_with_allocator(roaring_array_t *new_ra,
+                            const roaring_allocator_t *allocator,
+                            uint32_t cap) {
     if (!new_ra) return false;
     ra_init(new_ra);
 
@@ -87,17 +131,8 @@ bool ra_init_with_capacity(roaring_array_t *new_ra, uint32_t cap) {
         cap = 0x10000;
     }
 
-    if (cap > 0) {
-        void *bigalloc = roaring_malloc(
-            cap * (sizeof(uint16_t) + sizeof(container_t *) + sizeof(uint8_t)));
-        if (bigalloc == NULL) return false;
-        new_ra->containers = (container_t **)bigalloc;
-        new_ra->keys = (uint16_t *)(new_ra->containers + cap);
-        new_ra->typecodes = (uint8_t *)(new_ra->keys + cap);
-        // Narrowing is safe because of above check
-        new_ra->allocation_size = (int32_t)cap;
-    }
-    return true;
+    // Narrowing is safe because of above check
+    return ra_move_to_block(new_ra, allocator, (int32_t)cap);
 }
 
 int ra_shrink_to_fit(roaring_array_t *ra) {
@@ -125,7 +160,15 @@ void ra_init(roaring_array_t *new_ra) {
 
 bool ra_overwrite(const roaring_array_t *source, roaring_array_t *dest,
                   bool copy_on_write) {
-    ra_clear_containers(dest);  // we are going to overwrite them
+    if (dest->flags & ROARING_FLAG_SEALED) {
+        // The sealed block cannot be reused.
+        dest->size = 0;
+        if (!realloc_array(dest, source->size)) {
+            return false;
+        }
+    } else {
+        ra_clear_containers(dest);  // we are going to overwrite them
+    }
     if (source->size == 0) {    // Note: can't call memcpy(NULL), even w/size
         dest->size = 0;         // <--- This is important.
         return true;            // output was just cleared, so they match
@@ -158,7 +201,7 @@ bool ra_overwrite(const roaring_array_t *source, roaring_array_t *dest,
                 for (int32_t j = 0; j < i; j++) {
                     container_free(dest->containers[j], dest->typecodes[j]);
                 }
-                ra_clear_without_containers(dest);
+                dest->size = 0;
                 return false;
             }
         }
@@ -167,6 +210,9 @@ bool ra_overwrite(const roaring_array_t *source, roaring_array_t *dest,
 }
 
 void ra_clear_containers(roaring_array_t *ra) {
+    if (ra->flags & ROARING_FLAG_SEALED) {
+        return;  // freed with the sealed block
+    }
     for (int32_t i = 0; i < ra->size; ++i) {
         container_free(ra->containers[i], ra->typecodes[i]);
     }
@@ -175,12 +221,12 @@ void ra_clear_containers(roaring_array_t *ra) {
 void ra_reset(roaring_array_t *ra) {
     ra_clear_containers(ra);
     ra->size = 0;
-    ra_shrink_to_fit(ra);
+    realloc_array(ra, 0);  // keeps the allocator, in a block of its own
 }
 
 void ra_clear_without_containers(roaring_array_t *ra) {
-    roaring_free(
-        ra->containers);  // keys and typecodes are allocated with containers
+    // keys and typecodes are allocated with containers, as is the allocator
+    ra_free_block(ra);
     ra->size = 0;
     ra->allocation_size = 0;
     ra->containers = NULL;
@@ -812,6 +858,205 @@ bool ra_portable_deserialize(roaring_array_t *answer, const char *buf,
     return true;
 }
 
+bool ra_portable_parse_header(const char *buf, size_t maxbytes,
+                              ra_portable_header_t *header) {
+    size_t bytes = sizeof(uint32_t);  // for cookie
+    if (bytes > maxbytes) return false;
+    uint32_t cookie;
+    memcpy(&cookie, buf, sizeof(cookie));
+    cookie = croaring_letoh32(cookie);
+    if ((cookie & 0xFFFF) != SERIAL_COOKIE &&
+        cookie != SERIAL_COOKIE_NO_RUNCONTAINER) {
+        return false;
+    }
+    int32_t size;
+    bool hasrun = (cookie & 0xFFFF) == SERIAL_COOKIE;
+    if (hasrun) {
+        size = (cookie >> 16) + 1;
+    } else {
+        if (bytes + sizeof(uint32_t) > maxbytes) return false;
+        uint32_t size_le;
+        memcpy(&size_le, buf + bytes, sizeof(size_le));
+        size = (int32_t)croaring_letoh32(size_le);
+        bytes += sizeof(uint32_t);
+    }
+    if (size > (1 << 16) || size < 0) {
+        return false;
+    }
+    header->buf = buf;
+    header->size = size;
+    header->run_flags = NULL;
+    if (hasrun) {
+        header->run_flags = buf + bytes;
+        bytes += (size + 7) / 8;
+    }
+    header->keyscards = buf + bytes;
+    bytes += size * 2 * sizeof(uint16_t);
+    header->offsets = NULL;
+    if ((!hasrun) || (size >= NO_OFFSET_THRESHOLD)) {
+        header->offsets = buf + bytes;
+        bytes += size * sizeof(uint32_t);
+    }
+    if (bytes > maxbytes) return false;
+    header->header_bytes = bytes;
+    return true;
+}
+
+uint16_t ra_portable_header_key(const ra_portable_header_t *header,
+                                int32_t k) {
+    uint16_t key;
+    memcpy(&key, header->keyscards + 4 * k, sizeof(key));
+    return croaring_letoh16(key);
+}
+
+static inline uint32_t ra_portable_header_card(
+    const ra_portable_header_t *header, int32_t k) {
+    uint16_t card;
+    memcpy(&card, header->keyscards + 4 * k + 2, sizeof(card));
+    return (uint32_t)croaring_letoh16(card) + 1;
+}
+
+uint8_t ra_portable_header_typecode(const ra_portable_header_t *header,
+                                    int32_t k) {
+    if (header->run_flags != NULL &&
+        (header->run_flags[k / 8] & (1 << (k % 8))) != 0) {
+        return RUN_CONTAINER_TYPE;
+    }
+    return ra_portable_header_card(header, k) > DEFAULT_MAX_SIZE
+               ? BITSET_CONTAINER_TYPE
+               : ARRAY_CONTAINER_TYPE;
+}
+
+// Number of bytes taken by the k-th container when it starts at the given
+// offset, or 0 if it does not fit in maxbytes.
+static size_t ra_portable_container_bytes(const ra_portable_header_t *header,
+                                          size_t maxbytes, int32_t k,
+                                          size_t offset) {
+    size_t containersize;
+    switch (ra_portable_header_typecode(header, k)) {
+        case BITSET_CONTAINER_TYPE:
+            containersize = BITSET_CONTAINER_SIZE_IN_WORDS * sizeof(uint64_t);
+            break;
+        case RUN_CONTAINER_TYPE: {
+            if (offset + sizeof(uint16_t) > maxbytes) return 0;
+            uint16_t n_runs;
+            memcpy(&n_runs, header->buf + offset, sizeof(n_runs));
+            n_runs = croaring_letoh16(n_runs);
+            containersize = sizeof(uint16_t) + n_runs * sizeof(rle16_t);
+            break;
+        }
+        default:
+            containersize =
+                ra_portable_header_card(header, k) * sizeof(uint16_t);
+            break;
+    }
+    if (offset + containersize > maxbytes) return 0;
+    return containersize;
+}
+
+// Offset of the k-th container from the start of the serialized bitmap, or 0
+// if it cannot be located within maxbytes.
+static size_t ra_portable_container_offset(const ra_portable_header_t *header,
+                                           size_t maxbytes, int32_t k) {
+    if (header->offsets != NULL) {
+        uint32_t offset;
+        memcpy(&offset, header->offsets + 4 * k, sizeof(offset));
+        offset = croaring_letoh32(offset);
+        if (offset < header->header_bytes || offset > maxbytes) return 0;
+        return offset;
+    }
+    // Small bitmaps with run containers omit the offsets (fewer than
+    // NO_OFFSET_THRESHOLD containers): skip over the preceding ones.
+    size_t offset = header->header_bytes;
+    for (int32_t i = 0; i < k; ++i) {
+        size_t containersize =
+            ra_portable_container_bytes(header, maxbytes, i, offset);
+        if (containersize == 0) return 0;
+        offset += containersize;
+    }
+    return offset;
+}
+
+size_t ra_portable_header_total_bytes(const ra_portable_header_t *header,
+                                      size_t maxbytes) {
+    if (header->size == 0) {
+        return header->header_bytes;
+    }
+    int32_t last = header->size - 1;
+    size_t offset = ra_portable_container_offset(header, maxbytes, last);
+    if (offset == 0) return 0;
+    size_t containersize =
+        ra_portable_container_bytes(header, maxbytes, last, offset);
+    if (containersize == 0) return 0;
+    return offset + containersize;
+}
+
+container_t *ra_portable_read_container(const ra_portable_header_t *header,
+                                        size_t maxbytes, int32_t k,
+                                        uint8_t *typecode) {
+    size_t offset = ra_portable_container_offset(header, maxbytes, k);
+    if (offset == 0 ||
+        ra_portable_container_bytes(header, maxbytes, k, offset) == 0) {
+        return NULL;
+    }
+    const char *buf = header->buf + offset;
+    uint32_t thiscard = ra_portable_header_card(header, k);
+    *typecode = ra_portable_header_typecode(header, k);
+    switch (*typecode) {
+        case BITSET_CONTAINER_TYPE: {
+            bitset_container_t *c = bitset_container_create_uninitialized();
+            if (c != NULL) bitset_container_read(thiscard, c, buf);
+            return c;
+        }
+        case RUN_CONTAINER_TYPE: {
+            run_container_t *c = run_container_create();
+            if (c != NULL) run_container_read(thiscard, c, buf);
+            return c;
+        }
+        default: {
+            array_container_t *c =
+                array_container_create_given_capacity(thiscard);
+            if (c != NULL) array_container_read(thiscard, c, buf);
+            return c;
+        }
+    }
+}
+
+bool ra_portable_deserialize_prepare(roaring_array_t *ra,
+                                     const ra_portable_header_t *header) {
+    if (!ra_init_with_capacity(ra, header->size)) {
+        return false;
+    }
+    for (int32_t k = 0; k < header->size; ++k) {
+        ra->keys[k] = ra_portable_header_key(header, k);
+        ra->typecodes[k] = ra_portable_header_typecode(header, k);
+        ra->containers[k] = NULL;
+    }
+    ra->size = header->size;
+    return true;
+}
+
+bool ra_portable_deserialize_range(roaring_array_t *ra,
+                                   const ra_portable_header_t *header,
+                                   size_t maxbytes, int32_t begin,
+                                   int32_t end) {
+    for (int32_t k = begin; k < end; ++k) {
+        uint8_t typecode;
+        container_t *c =
+            ra_portable_read_container(header, maxbytes, k, &typecode);
+        if (c == NULL) {
+            for (int32_t i = begin; i < k; ++i) {
+                container_free(ra->containers[i], ra->typecodes[i]);
+                ra->containers[i] = NULL;
+            }
+            return false;
+        }
+        ra->containers[k] = c;
+        ra->typecodes[k] = typecode;
+    }
+    return true;
+}
+
 #ifdef __cplusplus
 }
 }
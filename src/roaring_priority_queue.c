@@ -197,8 +197,8 @@ static roaring_bitmap_t *lazy_or_from_lazy_inputs(roaring_bitmap_t *x1,
  * a naive algorithm. Caller is responsible for freeing the
  * result.
  */
-roaring_bitmap_t *roaring_bitmap_or_many_heap(uint32_t number,
-                                              const roaring_bitmap_t **x) {
+static roaring_bitmap_t *roaring_bitmap_or_many_heap_impl(
+    uint32_t number, const roaring_bitmap_t **x) {
     if (number == 0) {
         return roaring_bitmap_create();
     }
@@ -246,6 +246,20 @@ roaring_bitmap_t *roaring_bitmap_or_many_heap(uint32_t number,
     return answer;
 }
 
+roaring_bitmap_t *roaring_bitmap_or_many_heap(uint32_t number,
+                                              const roaring_bitmap_t **x) {
+    // The result uses the allocator entered by the caller, if any, otherwise
+    // that of the first input; see roaring_allocator_t.
+    const roaring_allocator_t *allocator = roaring_allocator_current();
+    if (allocator == NULL && number > 0) {
+        allocator = roaring_bitmap_get_allocator(x[0]);
+    }
+    const roaring_allocator_t *previous = roaring_allocator_enter(allocator);
+    roaring_bitmap_t *answer = roaring_bitmap_or_many_heap_impl(number, x);
+    roaring_allocator_leave(previous);
+    return answer;
+}
+
 #ifdef __cplusplus
 }
 }
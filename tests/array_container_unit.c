@@ -6,10 +6,12 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <roaring/containers/array.h>
 #include <roaring/containers/bitset.h>
 #include <roaring/containers/mixed_equal.h>
+#include <roaring/memory.h>
 #include <roaring/misc/configreport.h>
 
 #ifdef __cplusplus  // stronger type checking errors if C built in C++ mode
@@ -193,6 +195,99 @@ DEFINE_TEST(capacity_test) {
     array_container_free(array);
 }
 
+DEFINE_TEST(inline_test) {
+    // Small arrays keep their values after the container until they grow.
+    array_container_t* array = array_container_create();
+    assert_int_equal(array->capacity, ARRAY_INLINE_SIZE);
+    assert_ptr_equal(array->array, (uint16_t*)(array + 1));
+    for (uint32_t i = 0; i < ARRAY_INLINE_SIZE; i++) {
+        array_container_add(array, (uint16_t)(3 * i));
+    }
+    assert_ptr_equal(array->array, (uint16_t*)(array + 1));
+    assert_int_equal(array_container_shrink_to_fit(array), 0);
+
+    array_container_t* clone = array_container_clone(array);
+    array_container_add(array, 1);
+    assert_ptr_not_equal(array->array, (uint16_t*)(array + 1));
+    assert_int_equal(array->cardinality, ARRAY_INLINE_SIZE + 1);
+    for (uint32_t i = 0; i < ARRAY_INLINE_SIZE; i++) {
+        assert_true(array_container_contains(array, (uint16_t)(3 * i)));
+        assert_true(array_container_contains(clone, (uint16_t)(3 * i)));
+    }
+    assert_false(array_container_contains(clone, 1));
+
+    // Copies into an inline array grow it if needed.
+    array_container_t* small = array_container_create_given_capacity(2);
+    assert_ptr_equal(small->array, (uint16_t*)(small + 1));
+    array_container_copy(array, small);
+    assert_true(array_container_equals(small, array));
+
+    array_container_free(array);
+    array_container_free(clone);
+    array_container_free(small);
+}
+
+// A bump allocator: each block directly follows the previous one.
+static char bump_buffer[1 << 16];
+static size_t bump_used;
+static int bump_live;
+
+static void* bump_aligned_malloc(void* context, size_t alignment, size_t n) {
+    (void)context;
+    bump_used = (bump_used + alignment - 1) & ~(alignment - 1);
+    if (n > sizeof(bump_buffer) - bump_used) return NULL;
+    void* p = bump_buffer + bump_used;
+    bump_used += n;
+    bump_live++;
+    return p;
+}
+
+static void* bump_malloc(void* context, size_t n) {
+    return bump_aligned_malloc(context, sizeof(void*), n);
+}
+
+static void* bump_calloc(void* context, size_t count, size_t size) {
+    void* p = bump_malloc(context, count * size);
+    if (p != NULL) memset(p, 0, count * size);
+    return p;
+}
+
+static void bump_free(void* context, void* p) {
+    (void)context;
+    if (p != NULL) bump_live--;
+}
+
+static void* bump_realloc(void* context, void* p, size_t n) {
+    void* q = bump_malloc(context, n);
+    if (q != NULL && p != NULL) {
+        // Copies past the end of the old block, within the buffer, which may
+        // overlap the new block.
+        memmove(q, p, n);
+        bump_free(context, p);
+    }
+    return q;
+}
+
+DEFINE_TEST(inline_flag_test) {
+    // Values allocated right after their container are not inline.
+    roaring_allocator_t bump = {NULL,        bump_malloc,
+                                bump_realloc, bump_calloc,
+                                bump_free,    bump_aligned_malloc,
+                                bump_free};
+    const roaring_allocator_t* previous = roaring_allocator_enter(&bump);
+    array_container_t* array = array_container_create_given_capacity(0);
+    array_container_add(array, 1);
+    assert_ptr_equal(array->array, (uint16_t*)(array + 1));
+    assert_false(array->inline_values);
+    for (uint32_t i = 2; i < 100; i++) {
+        array_container_add(array, (uint16_t)i);
+    }
+    assert_int_equal(array->cardinality, 99);
+    array_container_free(array);
+    roaring_allocator_leave(previous);
+    assert_int_equal(bump_live, 0);
+}
+
 /* This is a fixed-increment version of Java 8's SplittableRandom generator
    See http://dx.doi.org/10.1145/2714064.2660195 and
    http://docs.oracle.com/javase/8/docs/api/java/util/SplittableRandom.html */
@@ -374,7 +469,9 @@ int main() {
         cmocka_unit_test(and_or_test),
         cmocka_unit_test(to_uint32_array_test),
         cmocka_unit_test(select_test),
-        cmocka_unit_test(capacity_test)};
+        cmocka_unit_test(capacity_test),
+        cmocka_unit_test(inline_test),
+        cmocka_unit_test(inline_flag_test)};
 
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
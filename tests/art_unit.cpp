@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <array>
 #include <cinttypes>
 #include <iomanip>
@@ -731,8 +732,136 @@ DEFINE_TEST(test_art_frozen_view) {
     }
 }
 
+DEFINE_TEST(test_art_compact) {
+    {
+        // ART with multiple node sizes and unused elements.
+        std::vector<std::array<uint8_t, 6>> keys;
+        std::vector<art_val_t> values;
+        std::vector<size_t> sizes = {4, 16, 48, 256};
+        art_t art1;
+        art_init_cleared(&art1);
+        for (size_t i = 0; i < sizes.size(); i++) {
+            for (size_t j = 0; j < sizes[i]; j++) {
+                std::array<uint8_t, 6> key = {0, 0, static_cast<uint8_t>(i),
+                                              0, static_cast<uint8_t>(j)};
+                art_insert(&art1, key.data(), i * j);
+                if (j == 0) {
+                    art_erase(&art1, key.data(), nullptr);
+                    continue;
+                }
+                keys.push_back(key);
+                values.push_back(i * j);
+            }
+        }
+        assert_false(art_is_shrunken(&art1));
+
+        size_t size = art_compact_size_in_bytes(&art1);
+        char* buf = (char*)roaring_aligned_malloc(8, size);
+        art_t art2;
+        assert_int_equal(art_compact(&art1, buf, &art2), size);
+        art_free(&art1);
+        assert_art_valid(&art2);
+        assert_true(art_is_shrunken(&art2));
+        // The same nodes as serialized.
+        size_t serialized_size =
+            sizeof(art2.root) + sizeof(art2.capacities) + size;
+        assert_int_equal(art_size_in_bytes(&art2), serialized_size);
+
+        art_iterator_t iterator = art_init_iterator(&art2, true);
+        size_t i = 0;
+        do {
+            assert_key_eq(iterator.key, (art_key_chunk_t*)keys[i].data());
+            assert_true(*iterator.value == values[i]);
+            assert_true(*art_find(&art2, keys[i].data()) == values[i]);
+            ++i;
+        } while (art_iterator_next(&iterator));
+        assert_int_equal(i, keys.size());
+        roaring_aligned_free(buf);
+    }
+    {
+        // Single leaf, and empty.
+        art_t art1;
+        art_init_cleared(&art1);
+        std::array<uint8_t, 6> key = {1, 2, 3, 4, 5, 6};
+        art_insert(&art1, key.data(), 7);
+        size_t size = art_compact_size_in_bytes(&art1);
+        char* buf = (char*)roaring_aligned_malloc(8, size);
+        art_t art2;
+        assert_int_equal(art_compact(&art1, buf, &art2), size);
+        assert_art_valid(&art2);
+        assert_true(*art_find(&art2, key.data()) == 7);
+        roaring_aligned_free(buf);
+
+        art_erase(&art1, key.data(), nullptr);
+        assert_int_equal(art_compact_size_in_bytes(&art1), 0);
+        assert_int_equal(art_compact(&art1, nullptr, &art2), 0);
+        assert_true(art_is_empty(&art2));
+        art_free(&art1);
+    }
+}
+
 }  // namespace
 
+DEFINE_TEST(test_art_bulk_load) {
+    {
+        // Inner nodes of every type, below prefixes of different lengths.
+        std::vector<Key> keys;
+        std::vector<size_t> sizes = {2, 4, 5, 16, 17, 48, 49, 256};
+        for (uint64_t i = 1; i <= sizes.size(); i++) {
+            for (uint64_t j = 0; j < sizes[i - 1]; j++) {
+                keys.push_back((i << 40) | (i << 16) | (j << 8) | j);
+                keys.push_back((i << 40) | (i << 24) | j);
+            }
+        }
+        std::sort(keys.begin(), keys.end());
+        art_t art1;
+        art_t art2;
+        art_init_cleared(&art1);
+        art_init_cleared(&art2);
+        for (size_t i = 0; i < keys.size(); i++) {
+            art_insert(&art1, keys[i].data(), i);
+            assert_true(*art_bulk_append(&art2, keys[i].data(), i) == i);
+            assert_true(art_is_empty(&art2));
+        }
+        art_bulk_finish(&art2);
+        art_bulk_finish(&art2);
+        assert_art_valid(&art2);
+
+        art_iterator_t iterator1 = art_init_iterator(&art1, true);
+        art_iterator_t iterator2 = art_init_iterator(&art2, true);
+        size_t i = 0;
+        do {
+            assert_true(iterator2.value != nullptr);
+            assert_key_eq(iterator1.key, iterator2.key);
+            assert_true(*iterator2.value == i);
+            assert_true(*art_find(&art2, keys[i].data()) == i);
+            ++i;
+            art_iterator_next(&iterator1);
+        } while (art_iterator_next(&iterator2));
+        assert_int_equal(i, keys.size());
+        assert_true(iterator1.value == nullptr);
+
+        // The result is an ordinary ART.
+        art_insert(&art2, Key(1).data(), 0);
+        assert_true(art_erase(&art2, keys[0].data(), nullptr));
+        assert_art_valid(&art2);
+        art_free(&art1);
+        art_free(&art2);
+    }
+    {
+        // Single leaf, and empty.
+        art_t art;
+        art_init_cleared(&art);
+        art_bulk_finish(&art);
+        assert_true(art_is_empty(&art));
+        art_bulk_append(&art, Key(7).data(), 7);
+        art_bulk_finish(&art);
+        assert_art_valid(&art);
+        assert_true(*art_find(&art, Key(7).data()) == 7);
+        art_free(&art);
+    }
+}
+
 int main() {
     const struct CMUnitTest tests[] = {
         cmocka_unit_test(test_art_simple),
@@ -748,6 +877,8 @@ int main() {
         cmocka_unit_test(test_art_shadowed),
         cmocka_unit_test(test_art_shrink_grow_node48),
         cmocka_unit_test(test_art_frozen_view),
+        cmocka_unit_test(test_art_compact),
+        cmocka_unit_test(test_art_bulk_load),
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
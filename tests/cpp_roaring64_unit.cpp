@@ -129,6 +129,8 @@ DEFINE_TEST(test_cpp_r64_set_ops) {
     Roaring64 a_or_b = a | b;
     assert_true((a_or_b == Roaring64{1, 2, 3, 4, 7, K1 + 1, K1 + 5, K1 + 9,
                                      K2 + 1, K2 + 2}));
+    const Roaring64* inputs[] = {&a, &b};
+    assert_true(Roaring64::fastunion(2, inputs) == a_or_b);
 
     Roaring64 a_xor_b = a ^ b;
     assert_true(
@@ -2155,6 +2155,156 @@ DEFINE_TEST(test_cpp_fast_union_64) {
     }
 }
 
+// Roaring64Map and its iterator are classes, which can be declared ahead.
+namespace roaring {
+class Roaring64Map;
+class Roaring64MapSetBitBiDirectionalIterator;
+}  // namespace roaring
+
+// The operators and static methods return the class they are called on.
+static_assert(std::is_same<decltype(Roaring64Map() | Roaring64Map()),
+                           Roaring64Map>::value,
+              "Roaring64Map::operator| returns a Roaring64Map");
+static_assert(std::is_same<decltype(Roaring64Map::bitmapOfList({1})),
+                           Roaring64Map>::value,
+              "Roaring64Map::bitmapOfList returns a Roaring64Map");
+static_assert(
+    std::is_same<decltype(++std::declval<Roaring64Map::const_iterator &>()),
+                 roaring::Roaring64MapSetBitBiDirectionalIterator &>::value,
+    "Roaring64Map iterators increment to themselves");
+static_assert(std::is_same<decltype(roaring::Roaring64FlatMap() &
+                                    roaring::Roaring64FlatMap()),
+                           roaring::Roaring64FlatMap>::value,
+              "Roaring64FlatMap::operator& returns a Roaring64FlatMap");
+
+namespace {
+// Checks that a Roaring64FlatMap holds the same values as a Roaring64Map.
+void assert_same_values(const Roaring64Map &expected,
+                        const roaring::Roaring64FlatMap &actual) {
+    assert_int_equal(expected.cardinality(), actual.cardinality());
+    assert_true(std::equal(expected.begin(), expected.end(), actual.begin()));
+}
+}  // namespace
+
+DEFINE_TEST(test_cpp_flat_map_64) {
+    using roaring::Roaring64FlatMap;
+    std::mt19937_64 gen(1234);
+    // Values near the start or the end of a few slots, so that the ranges
+    // below cross from one slot to the next.
+    auto random_value = [&gen]() {
+        uint64_t low = gen() % 1000;
+        return ((gen() % 32) << 32) | (gen() % 2 ? low : uint32_max - low);
+    };
+
+    Roaring64Map expected;
+    Roaring64FlatMap actual;
+    for (int i = 0; i < 500; ++i) {
+        uint64_t min = random_value();
+        uint64_t max = min + gen() % 5000;
+        switch (gen() % 8) {
+            case 0:
+                expected.add(min);
+                actual.add(min);
+                break;
+            case 1:
+                expected.remove(min);
+                actual.remove(min);
+                break;
+            case 2:
+                expected.addRange(min, max);
+                actual.addRange(min, max);
+                break;
+            case 3:
+                expected.removeRange(min, max);
+                actual.removeRange(min, max);
+                break;
+            case 4:
+                expected.flip(min, max);
+                actual.flip(min, max);
+                break;
+            case 5:
+                expected.shrinkToFit();
+                actual.shrinkToFit();
+                break;
+            default: {
+                Roaring64Map other;
+                Roaring64FlatMap flat_other;
+                for (int j = 0; j < 50; ++j) {
+                    uint64_t value = random_value();
+                    other.add(value);
+                    flat_other.add(value);
+                }
+                switch (gen() % 4) {
+                    case 0:
+                        expected |= other;
+                        actual |= flat_other;
+                        break;
+                    case 1:
+                        expected &= other;
+                        actual &= flat_other;
+                        break;
+                    case 2:
+                        expected -= other;
+                        actual -= flat_other;
+                        break;
+                    default:
+                        expected ^= other;
+                        actual ^= flat_other;
+                        break;
+                }
+            }
+        }
+        assert_same_values(expected, actual);
+        uint64_t probe = random_value();
+        assert_int_equal(expected.rank(probe), actual.rank(probe));
+        assert_true(expected.contains(probe) == actual.contains(probe));
+    }
+
+    // Both store the same serialized form.
+    std::vector<char> buffer(actual.getSizeInBytes());
+    actual.write(buffer.data());
+    assert_true(Roaring64Map::read(buffer.data()) == expected);
+    assert_true(Roaring64FlatMap::read(buffer.data()) == actual);
+
+    Roaring64FlatMap copy(actual);
+    const Roaring64FlatMap *inputs[] = {&actual, &copy};
+    assert_true(Roaring64FlatMap::fastunion(2, inputs) == actual);
+
+    auto iter = actual.begin();
+    iter.move_equalorlarger(uint64_t(7) << 32);
+    auto expected_iter = expected.begin();
+    expected_iter.move_equalorlarger(uint64_t(7) << 32);
+    assert_int_equal(*expected_iter, *iter);
+}
+
+DEFINE_TEST(test_cpp_flat_map_64_empty_slots) {
+    // read() keeps the empty slots of a serialized map: slot 1 here. The ^=
+    // empties slot 0 and must leave slot 1 alone.
+    Roaring slots[3];
+    slots[0].add(1);
+    slots[2].add(7);
+    std::vector<char> buffer(sizeof(uint64_t));
+    uint64_t count = 3;
+    memcpy(buffer.data(), &count, sizeof(count));
+    for (uint32_t key = 0; key < 3; ++key) {
+        size_t offset = buffer.size();
+        buffer.resize(offset + sizeof(key) + slots[key].getSizeInBytes());
+        memcpy(&buffer[offset], &key, sizeof(key));
+        slots[key].write(&buffer[offset + sizeof(key)]);
+    }
+    Roaring64Map expected = Roaring64Map::read(buffer.data());
+    auto actual = roaring::Roaring64FlatMap::read(buffer.data());
+    Roaring64Map other;
+    other.add(uint64_t(1));
+    roaring::Roaring64FlatMap flat_other;
+    flat_other.add(uint64_t(1));
+    expected ^= other;
+    actual ^= flat_other;
+    assert_same_values(expected, actual);
+    // The empty slot is still serialized.
+    assert_int_equal(expected.getSizeInBytes(), actual.getSizeInBytes());
+}
+
 DEFINE_TEST(test_cpp_to_string) {
     // test toString
     const auto b5 = uint64_t(5) << 32;
@@ -2326,6 +2476,65 @@ DEFINE_TEST(test_cpp_copy_map_iterator_to_different_map) {
     assert_int_equal(2, n);
 }
 
+DEFINE_TEST(test_cpp_allocator) {
+    roaring_arena_t *arena = roaring_arena_create();
+    const roaring_allocator_t *allocator = roaring_arena_allocator(arena);
+    {
+        Roaring hook;
+        hook.addRange(0, 100000);
+        Roaring a(allocator);
+        a.addRange(50000, 200000);
+        assert_true(a.getAllocator() == allocator);
+        assert_null(hook.getAllocator());
+        // Copies and results of operations keep the allocator of their
+        // (first) operand; assignment keeps the one of its target.
+        Roaring copy(a);
+        Roaring u = a | hook;
+        Roaring x = hook & a;
+        assert_true(copy.getAllocator() == allocator);
+        assert_true(u.getAllocator() == allocator);
+        assert_null(x.getAllocator());
+        x = a;
+        assert_null(x.getAllocator());
+        assert_true(x == a);
+        copy.clear();
+        assert_true(copy.isEmpty());
+        assert_true(copy.getAllocator() == allocator);
+        assert_int_equal(u.cardinality(), 200000);
+
+        Roaring64Map map(allocator);
+        map.add(uint64_t(1) << 40);
+        map.addRange(0, uint64_t(1) << 33);
+        Roaring64Map other{uint64_t(7) << 40};
+        map |= other;
+        assert_true(map.getAllocator() == allocator);
+        assert_int_equal(map.cardinality(), (uint64_t(1) << 33) + 2);
+        Roaring64Map map_copy(map);
+        assert_true(map_copy.getAllocator() == allocator);
+        assert_true(map_copy == map);
+    }
+    assert_true(roaring_arena_size_in_bytes(arena) > 0);
+    roaring_arena_free(arena);
+}
+
+#if ROARING_HAS_MEMORY_RESOURCE
+DEFINE_TEST(test_cpp_memory_resource) {
+    std::pmr::unsynchronized_pool_resource pool;
+    roaring::MemoryResourceAllocator allocator(&pool);
+    Roaring a(allocator.get());
+    for (uint32_t i = 0; i < 100000; i += 3) {
+        a.add(i);  // arrays grow by reallocation into bitsets
+    }
+    a.addRange(1u << 20, 3u << 20);
+    a.runOptimize();
+    Roaring b = a;
+    b.flip(0, 1u << 22);
+    assert_true(b.getAllocator() == allocator.get());
+    assert_int_equal((a & b).cardinality(), 0);
+    assert_int_equal((a | b).cardinality(), 1u << 22);
+}
+#endif
+
 int main() {
     roaring::misc::tellmeall();
     const struct CMUnitTest tests[] = {
@@ -2400,10 +2609,16 @@ int main() {
         cmocka_unit_test(issue_372),
         cmocka_unit_test(test_cpp_is_subset_64),
         cmocka_unit_test(test_cpp_fast_union_64),
+        cmocka_unit_test(test_cpp_flat_map_64),
+        cmocka_unit_test(test_cpp_flat_map_64_empty_slots),
         cmocka_unit_test(test_cpp_to_string),
         cmocka_unit_test(test_cpp_remove_run_compression),
         cmocka_unit_test(test_cpp_contains_range_interleaved_containers),
         cmocka_unit_test(test_cpp_copy_map_iterator_to_different_map),
+        cmocka_unit_test(test_cpp_allocator),
+#if ROARING_HAS_MEMORY_RESOURCE
+        cmocka_unit_test(test_cpp_memory_resource),
+#endif
     };
     return cmocka_run_group_tests(tests, NULL, NULL);
 }
@@ -1,5 +1,6 @@
 #include <algorithm>
 #include <array>
+#include <iterator>
 #include <map>
 #include <numeric>
 #include <random>
@@ -126,6 +127,149 @@ DEFINE_TEST(test_copy) {
     roaring64_bitmap_free(r2);
 }
 
+// A bitmap with array, bitset and run containers.
+roaring64_bitmap_t* create_mixed_bitmap() {
+    roaring64_bitmap_t* r = roaring64_bitmap_create();
+    for (uint64_t i = 0; i < 100; ++i) {
+        roaring64_bitmap_add(r, i * 3);
+    }
+    for (uint64_t i = 0; i < 20000; ++i) {
+        roaring64_bitmap_add(r, (UINT64_C(1) << 40) + i * 3);
+    }
+    uint64_t start = UINT64_C(1) << 50;
+    roaring64_bitmap_add_range(r, start, start + 300000);
+    roaring64_bitmap_run_optimize(r);
+    return r;
+}
+
+DEFINE_TEST(test_copy_on_write) {
+    roaring64_bitmap_t* r1 = create_mixed_bitmap();
+    roaring64_bitmap_t* expected = roaring64_bitmap_copy(r1);
+    roaring64_bitmap_set_copy_on_write(r1, true);
+    assert_true(roaring64_bitmap_get_copy_on_write(r1));
+
+    // Each modification of a copy clones only what it touches, and leaves the
+    // original and the other copies alone.
+    std::vector<roaring64_bitmap_t*> copies;
+    for (int i = 0; i < 12; ++i) {
+        copies.push_back(roaring64_bitmap_copy(r1));
+        assert_true(roaring64_bitmap_get_copy_on_write(copies.back()));
+    }
+    roaring64_bitmap_t* other = roaring64_bitmap_from_range(5, 1 << 20, 7);
+    uint64_t big = UINT64_C(1) << 40;
+    roaring64_bitmap_add(copies[0], 1);
+    roaring64_bitmap_remove(copies[1], big + 3);
+    roaring64_bitmap_add_range(copies[2], big, big + 1000);
+    roaring64_bitmap_remove_range(copies[3], 0, UINT64_C(1) << 60);
+    roaring64_bitmap_run_optimize(copies[4]);
+    roaring64_bitmap_remove_run_compression(copies[5]);
+    roaring64_bitmap_flip_inplace(copies[6], 0, 1000);
+    roaring64_bitmap_and_inplace(copies[7], other);
+    roaring64_bitmap_or_inplace(copies[8], other);
+    roaring64_bitmap_xor_inplace(copies[9], other);
+    roaring64_bitmap_andnot_inplace(copies[10], other);
+    roaring64_bulk_context_t context{};
+    roaring64_bitmap_add_bulk(copies[11], &context, 2);
+    roaring64_bitmap_remove_bulk(copies[11], &context, 3);
+
+    assert_true(roaring64_bitmap_equals(r1, expected));
+    assert_true(roaring64_bitmap_contains(copies[0], 1));
+    assert_false(roaring64_bitmap_contains(copies[1], big + 3));
+    assert_true(roaring64_bitmap_contains_range(copies[2], big, big + 1000));
+    assert_true(roaring64_bitmap_is_empty(copies[3]));
+    assert_true(roaring64_bitmap_equals(copies[4], expected));
+    assert_true(roaring64_bitmap_equals(copies[5], expected));
+    assert_true(roaring64_bitmap_contains(copies[6], 1));
+    assert_false(roaring64_bitmap_contains(copies[6], 0));
+    assert_true(roaring64_bitmap_contains(copies[11], 2));
+    assert_false(roaring64_bitmap_contains(copies[11], 3));
+    for (roaring64_bitmap_t* copy : copies) {
+        assert_r64_valid(copy);
+    }
+    assert_r64_valid(r1);
+
+    // Reads go through shared containers.
+    roaring64_bitmap_t* copy = roaring64_bitmap_copy(r1);
+    uint64_t card = roaring64_bitmap_get_cardinality(expected);
+    assert_int_equal(roaring64_bitmap_get_cardinality(copy), card);
+    std::vector<uint64_t> values(card), read(card);
+    roaring64_bitmap_to_uint64_array(expected, values.data());
+    roaring64_bitmap_to_uint64_array(copy, read.data());
+    assert_vector_equal(read, values);
+    roaring64_iterator_t* it = roaring64_iterator_create(copy);
+    assert_int_equal(roaring64_iterator_read(it, read.data(), card), card);
+    assert_vector_equal(read, values);
+    roaring64_iterator_free(it);
+
+    // Results of binary operations share the containers they copy.
+    roaring64_bitmap_t* result = roaring64_bitmap_or(copy, other);
+    assert_true(roaring64_bitmap_get_copy_on_write(result));
+    roaring64_bitmap_overwrite(result, copy);
+    assert_true(roaring64_bitmap_equals(result, expected));
+
+    // Shared containers cannot be frozen: they are cloned when copy-on-write
+    // is turned off.
+    roaring64_bitmap_shrink_to_fit(copy);
+    assert_int_equal(roaring64_bitmap_frozen_size_in_bytes(copy), 0);
+    roaring64_bitmap_set_copy_on_write(copy, false);
+    roaring64_bitmap_shrink_to_fit(copy);
+    assert_true(roaring64_bitmap_frozen_size_in_bytes(copy) > 0);
+    assert_r64_valid(copy);
+
+    roaring64_bitmap_free(r1);
+    assert_true(roaring64_bitmap_equals(result, expected));
+    for (roaring64_bitmap_t* c : copies) {
+        roaring64_bitmap_free(c);
+    }
+    roaring64_bitmap_free(copy);
+    roaring64_bitmap_free(result);
+    roaring64_bitmap_free(other);
+    roaring64_bitmap_free(expected);
+}
+
+DEFINE_TEST(test_interner) {
+    roaring64_bitmap_t* r1 = create_mixed_bitmap();
+    roaring64_bitmap_t* r2 = create_mixed_bitmap();
+    roaring64_bitmap_t* expected = roaring64_bitmap_copy(r1);
+    roaring_bitmap_t* r32 = roaring_bitmap_from_range(0, 1 << 16, 1);
+    roaring_bitmap_run_optimize(r32);
+
+    // The range of r1 has four full containers, which are the shared full
+    // container already: r1 has nothing to release. The other containers of
+    // r1 are shared with r2, and the 32-bit bitmap gets the full container.
+    roaring_interner_t* in = roaring_interner_create();
+    assert_int_equal(roaring64_bitmap_intern(r1, in), 0);
+    assert_true(roaring64_bitmap_intern(r2, in) > 0);
+    assert_true(roaring_bitmap_intern(r32, in) > 0);
+    roaring_interner_statistics_t stats;
+    roaring_interner_get_statistics(in, &stats);
+    assert_int_equal(stats.n_containers, 15);
+    assert_int_equal(stats.n_distinct, 3);
+    assert_int_equal(stats.n_deduplicated, 4);
+    assert_true(roaring64_bitmap_get_copy_on_write(r1));
+    assert_r64_valid(r1);
+    assert_r64_valid(r2);
+    assert_true(roaring64_bitmap_equals(r1, expected));
+    assert_true(roaring64_bitmap_equals(r2, expected));
+
+    // Writes clone the shared containers.
+    uint64_t start = UINT64_C(1) << 50;
+    roaring64_bitmap_remove(r1, start + 5);
+    assert_true(roaring64_bitmap_contains(r2, start + 5));
+    assert_true(roaring64_bitmap_contains(r2, start + (1 << 16) + 5));
+    assert_true(roaring_bitmap_contains(r32, 5));
+
+    roaring_interner_free(in);
+    roaring64_bitmap_free(r1);
+    assert_true(roaring64_bitmap_equals(r2, expected));
+    roaring64_bitmap_set_copy_on_write(r2, false);
+    assert_r64_valid(r2);
+    assert_true(roaring64_bitmap_equals(r2, expected));
+    roaring64_bitmap_free(r2);
+    roaring64_bitmap_free(expected);
+    roaring_bitmap_free(r32);
+}
+
 DEFINE_TEST(test_overwrite) {
     roaring64_bitmap_t* r1 = roaring64_bitmap_create();
     roaring64_bitmap_add(r1, 0);
@@ -281,6 +425,141 @@ DEFINE_TEST(test_of_ptr) {
     roaring64_bitmap_free(r);
 }
 
+DEFINE_TEST(test_from_sorted) {
+    std::vector<uint64_t> vals;
+    for (uint64_t i = 0; i < 1000; i += 7) vals.push_back(i);
+    for (uint64_t i = 0; i < 65536; i += 3) vals.push_back((1ULL << 16) + i);
+    for (uint64_t i = 0; i < 65536; ++i) vals.push_back((1ULL << 40) + i);
+    vals.push_back((1ULL << 40) + 65535);  // duplicates are fine
+    for (uint64_t i = 0; i < 100; ++i) vals.push_back((1ULL << 50) + 5 * i);
+    vals.push_back(UINT64_MAX - 1);
+    vals.push_back(UINT64_MAX);
+
+    roaring64_bitmap_t* r =
+        roaring64_bitmap_from_sorted(vals.data(), vals.size());
+    assert_non_null(r);
+    assert_r64_valid(r);
+    roaring64_bitmap_t* expected =
+        roaring64_bitmap_of_ptr(vals.size(), vals.data());
+    roaring64_bitmap_run_optimize(expected);
+    assert_true(roaring64_bitmap_equals(r, expected));
+    size_t len = roaring64_bitmap_portable_size_in_bytes(r);
+    assert_int_equal(len, roaring64_bitmap_portable_size_in_bytes(expected));
+    std::vector<char> actual_buf(len), expected_buf(len);
+    roaring64_bitmap_portable_serialize(r, actual_buf.data());
+    roaring64_bitmap_portable_serialize(expected, expected_buf.data());
+    assert_true(actual_buf == expected_buf);
+    roaring64_bitmap_free(expected);
+    roaring64_bitmap_free(r);
+
+    r = roaring64_bitmap_from_sorted(vals.data(), 0);
+    assert_non_null(r);
+    assert_true(roaring64_bitmap_is_empty(r));
+    roaring64_bitmap_free(r);
+
+    uint64_t unsorted_low[] = {1, 3, 2};
+    assert_null(roaring64_bitmap_from_sorted(unsorted_low, 3));
+    uint64_t unsorted_high[] = {1ULL << 40, 5, 6};
+    assert_null(roaring64_bitmap_from_sorted(unsorted_high, 3));
+    uint64_t unsorted_middle[] = {5, 5, 1ULL << 40, 5, 6};
+    assert_null(roaring64_bitmap_from_sorted(unsorted_middle, 5));
+}
+
+DEFINE_TEST(test_from_unsorted) {
+    // Keys in a narrow range (one key per bucket) and spread over the whole
+    // range (several keys per bucket).
+    for (uint64_t step : {1ULL, 1ULL << 40}) {
+        std::vector<uint64_t> vals;
+        uint64_t x = 12345;
+        for (uint64_t i = 0; i < 50000; ++i) {
+            x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+            vals.push_back((x >> 24) * step);
+            vals.push_back((3ULL << 16) + x % 10000);
+        }
+        for (uint64_t i = 0; i < 20000; ++i) {
+            vals.push_back((5ULL << 16) + 19999 - i);
+        }
+        vals.push_back(0);
+        vals.push_back(step == 1 ? 1ULL << 40 : UINT64_MAX);
+
+        roaring64_bitmap_t* r =
+            roaring64_bitmap_from_unsorted(vals.data(), vals.size());
+        assert_non_null(r);
+        assert_r64_valid(r);
+        roaring64_bitmap_t* expected =
+            roaring64_bitmap_of_ptr(vals.size(), vals.data());
+        assert_true(roaring64_bitmap_equals(r, expected));
+        roaring64_bitmap_run_optimize(expected);
+        assert_int_equal(roaring64_bitmap_portable_size_in_bytes(r),
+                         roaring64_bitmap_portable_size_in_bytes(expected));
+        roaring64_bitmap_free(expected);
+        roaring64_bitmap_free(r);
+    }
+
+    roaring64_bitmap_t* r = roaring64_bitmap_from_unsorted(nullptr, 0);
+    assert_non_null(r);
+    assert_true(roaring64_bitmap_is_empty(r));
+    roaring64_bitmap_free(r);
+}
+
+DEFINE_TEST(test_from_ranges) {
+    std::vector<roaring64_range_closed_t> ranges;
+    for (uint64_t i = 0; i < 1000; i += 3) ranges.push_back({i, i + 1});
+    ranges.push_back({100000, 100010});
+    ranges.push_back({100005, 100007});
+    ranges.push_back({100011, 100020});
+    // Full containers across a 32-bit boundary.
+    ranges.push_back({(1ULL << 32) - 70000, (1ULL << 32) + 300000});
+    ranges.push_back({(1ULL << 40) - 65536, (1ULL << 40) - 1});
+    ranges.push_back({1ULL << 40, (1ULL << 40) + 5});
+    ranges.push_back({UINT64_MAX - 10, UINT64_MAX});
+    ranges.push_back({UINT64_MAX, UINT64_MAX});
+
+    roaring64_bitmap_t* r =
+        roaring64_bitmap_from_ranges(ranges.data(), ranges.size());
+    assert_non_null(r);
+    assert_r64_valid(r);
+    roaring64_bitmap_t* expected = roaring64_bitmap_create();
+    for (const roaring64_range_closed_t& range : ranges) {
+        roaring64_bitmap_add_range_closed(expected, range.min, range.max);
+    }
+    assert_true(roaring64_bitmap_equals(r, expected));
+    roaring64_bitmap_run_optimize(expected);
+    assert_int_equal(roaring64_bitmap_portable_size_in_bytes(r),
+                     roaring64_bitmap_portable_size_in_bytes(expected));
+
+    size_t count = roaring64_bitmap_range_count(r);
+    assert_int_equal(count, 334 + 4);
+    std::vector<roaring64_range_closed_t> exported(count);
+    assert_int_equal(roaring64_bitmap_to_ranges(r, exported.data(), count),
+                     count);
+    assert_int_equal(exported[334].min, 100000);
+    assert_int_equal(exported[334].max, 100020);
+    assert_int_equal(exported[336].min, (1ULL << 40) - 65536);
+    assert_int_equal(exported[336].max, (1ULL << 40) + 5);
+    roaring64_bitmap_t* back =
+        roaring64_bitmap_from_ranges(exported.data(), count);
+    assert_true(roaring64_bitmap_equals(back, r));
+    roaring64_bitmap_free(back);
+
+    roaring64_bitmap_t* other = roaring64_bitmap_from_range(50, 1000000, 7);
+    roaring64_bitmap_t* union_expected = roaring64_bitmap_or(other, r);
+    assert_true(
+        roaring64_bitmap_add_ranges(other, ranges.data(), ranges.size()));
+    assert_true(roaring64_bitmap_equals(other, union_expected));
+    roaring64_bitmap_free(union_expected);
+
+    roaring64_range_closed_t bad[2] = {{10, 20}, {5, 6}};
+    assert_null(roaring64_bitmap_from_ranges(bad, 2));
+    assert_false(roaring64_bitmap_add_ranges(other, bad, 2));
+    bad[1] = {30, 25};
+    assert_null(roaring64_bitmap_from_ranges(bad, 2));
+    roaring64_bitmap_free(other);
+
+    roaring64_bitmap_free(expected);
+    roaring64_bitmap_free(r);
+}
+
 DEFINE_TEST(test_of) {
     roaring64_bitmap_t* r = roaring64_bitmap_from(1, 20000, 500000);
     assert_r64_valid(r);
@@ -470,6 +749,25 @@ DEFINE_TEST(test_contains_bulk) {
     for (uint64_t i = 0; i < 10000; ++i) {
         assert_true(roaring64_bitmap_contains_bulk(r, &context, i * 1000));
     }
+
+    // Misses in absent containers, including consecutive ones.
+    context = {};
+    uint64_t absent = 1ULL << 40;
+    assert_false(roaring64_bitmap_contains_bulk(r, &context, absent));
+    assert_false(roaring64_bitmap_contains_bulk(r, &context, absent + 1));
+    assert_true(roaring64_bitmap_contains_bulk(r, &context, 1000));
+    assert_false(roaring64_bitmap_contains_bulk(r, &context, absent + 2));
+
+    // The same context still works with the other bulk functions after a
+    // miss.
+    roaring64_bitmap_add_bulk(r, &context, absent + 2);
+    assert_true(roaring64_bitmap_contains_bulk(r, &context, absent + 2));
+    assert_false(roaring64_bitmap_contains_bulk(r, &context, absent + 3));
+    assert_false(roaring64_bitmap_contains_bulk(r, &context, absent << 1));
+    roaring64_bitmap_remove_bulk(r, &context, absent << 1);
+    roaring64_bitmap_remove_bulk(r, &context, absent + 2);
+    assert_false(roaring64_bitmap_contains(r, absent + 2));
+    assert_int_equal(roaring64_bitmap_get_cardinality(r), 10000);
     roaring64_bitmap_free(r);
 }
 
@@ -710,6 +1008,88 @@ DEFINE_TEST(test_get_index) {
     roaring64_bitmap_free(r);
 }
 
+DEFINE_TEST(test_rank_select_many) {
+    // Inline leaves, array, bitset and run containers, and shared full ones.
+    roaring64_bitmap_t* r = create_mixed_bitmap();
+    for (uint64_t i = 0; i < 300; ++i) {
+        roaring64_bitmap_add(r, (i << 16) + i);
+        roaring64_bitmap_add(r, (UINT64_C(1) << 33) + ((i % 10) << 40));
+    }
+    uint64_t full = UINT64_C(1) << 45;
+    roaring64_bitmap_add_range(r, full, full + (UINT64_C(1) << 18));
+    uint64_t card = roaring64_bitmap_get_cardinality(r);
+    std::vector<uint64_t> values(card);
+    roaring64_bitmap_to_uint64_array(r, values.data());
+
+    // Every 97th value, each followed by a value that is not in the bitmap.
+    std::vector<uint64_t> queries;
+    std::vector<uint64_t> ranks;
+    for (uint64_t i = 0; i < card; i += 97) {
+        queries.push_back(values[i]);
+        if (i + 1 < card && values[i + 1] != values[i] + 1) {
+            queries.push_back(values[i] + 1);
+        }
+        ranks.push_back(i);
+    }
+    queries.push_back(UINT64_MAX);
+    ranks.push_back(card - 1);
+
+    for (bool sealed : {false, true}) {
+        if (sealed) {
+            assert_true(roaring64_bitmap_seal(r));
+            assert_r64_valid(r);
+            assert_int_equal(roaring64_bitmap_get_cardinality(r), card);
+        }
+        std::vector<uint64_t> ans(queries.size());
+        roaring64_bitmap_rank_many(r, queries.data(),
+                                   queries.data() + queries.size(),
+                                   ans.data());
+        for (size_t i = 0; i < queries.size(); ++i) {
+            uint64_t expected =
+                std::upper_bound(values.begin(), values.end(), queries[i]) -
+                values.begin();
+            assert_int_equal(ans[i], expected);
+            assert_int_equal(roaring64_bitmap_rank(r, queries[i]), expected);
+            uint64_t index = 0;
+            bool found = roaring64_bitmap_get_index(r, queries[i], &index);
+            assert_int_equal(found, roaring64_bitmap_contains(r, queries[i]));
+            if (found) {
+                assert_int_equal(index, expected - 1);
+            }
+        }
+
+        std::vector<uint64_t> elements(ranks.size());
+        assert_true(roaring64_bitmap_select_many(
+            r, ranks.data(), ranks.data() + ranks.size(), elements.data()));
+        for (size_t i = 0; i < ranks.size(); ++i) {
+            assert_int_equal(elements[i], values[ranks[i]]);
+            uint64_t element = 0;
+            assert_true(roaring64_bitmap_select(r, ranks[i], &element));
+            assert_int_equal(element, values[ranks[i]]);
+        }
+        uint64_t element = 0;
+        assert_false(roaring64_bitmap_select(r, card, &element));
+        uint64_t past_end[] = {0, card - 1, card};
+        assert_false(
+            roaring64_bitmap_select_many(r, past_end, past_end + 3, past_end));
+        assert_int_equal(past_end[0], values[0]);
+        assert_int_equal(past_end[1], values[card - 1]);
+
+        // Exports from an offset.
+        uint64_t offset = card / 3;
+        std::vector<uint64_t> slice(1000);
+        assert_int_equal(roaring64_bitmap_range_uint64_array(r, offset, 1000,
+                                                             slice.data()),
+                         1000);
+        assert_true(std::equal(slice.begin(), slice.end(),
+                               values.begin() + offset));
+        assert_int_equal(
+            roaring64_bitmap_range_uint64_array(r, card, 10, slice.data()),
+            0);
+    }
+    roaring64_bitmap_free(r);
+}
+
 DEFINE_TEST(test_remove) {
     roaring64_bitmap_t* r = roaring64_bitmap_create();
     for (uint64_t i = 0; i < 100; ++i) {
@@ -2108,6 +2488,627 @@ DEFINE_TEST(test_frozen_serialize) {
     roaring64_bitmap_free(r);
 }
 
+// Forwards to an arena and counts the allocations.
+struct counting_allocator_t {
+    roaring_allocator_t allocator;
+    const roaring_allocator_t* arena;
+    size_t n_allocs;
+};
+
+static void* counting_malloc(void* context, size_t size) {
+    counting_allocator_t* c = (counting_allocator_t*)context;
+    c->n_allocs++;
+    return c->arena->malloc(c->arena->context, size);
+}
+
+static void* counting_realloc(void* context, void* p, size_t size) {
+    counting_allocator_t* c = (counting_allocator_t*)context;
+    c->n_allocs += p == nullptr;
+    return c->arena->realloc(c->arena->context, p, size);
+}
+
+static void* counting_calloc(void* context, size_t n, size_t size) {
+    counting_allocator_t* c = (counting_allocator_t*)context;
+    c->n_allocs++;
+    return c->arena->calloc(c->arena->context, n, size);
+}
+
+static void counting_free(void* context, void* p) {
+    counting_allocator_t* c = (counting_allocator_t*)context;
+    c->arena->free(c->arena->context, p);
+}
+
+static void* counting_aligned_malloc(void* context, size_t alignment,
+                                     size_t size) {
+    counting_allocator_t* c = (counting_allocator_t*)context;
+    c->n_allocs++;
+    return c->arena->aligned_malloc(c->arena->context, alignment, size);
+}
+
+static void counting_aligned_free(void* context, void* p) {
+    counting_allocator_t* c = (counting_allocator_t*)context;
+    c->arena->aligned_free(c->arena->context, p);
+}
+
+DEFINE_TEST(test_add_range_huge) {
+    // 2^32 values: the full containers all share one container.
+    uint64_t start = (UINT64_C(1) << 40) - 5;
+    uint64_t end = start + (UINT64_C(1) << 32) + 9;
+    roaring64_bitmap_t* r = roaring64_bitmap_create();
+    roaring64_bitmap_add_range_closed(r, start, end);
+    roaring64_bitmap_add_range_closed(r, start + 100, start + 200000);
+    assert_r64_valid(r);
+    assert_int_equal(roaring64_bitmap_get_cardinality(r), end - start + 1);
+    assert_int_equal(roaring64_bitmap_minimum(r), start);
+    assert_int_equal(roaring64_bitmap_maximum(r), end);
+    assert_false(roaring64_bitmap_contains(r, start - 1));
+    assert_true(roaring64_bitmap_contains(r, start + (UINT64_C(1) << 31)));
+    assert_false(roaring64_bitmap_contains(r, end + 1));
+    assert_true(roaring64_bitmap_contains_range(r, start, end + 1));
+    assert_int_equal(roaring64_bitmap_rank(r, start + 1000), 1001);
+
+    roaring64_iterator_t* it = roaring64_iterator_create(r);
+    assert_true(roaring64_iterator_move_equalorlarger(it, 1ULL << 40));
+    assert_int_equal(roaring64_iterator_value(it), 1ULL << 40);
+    assert_true(roaring64_iterator_previous(it));
+    assert_int_equal(roaring64_iterator_value(it), (1ULL << 40) - 1);
+    roaring64_iterator_free(it);
+
+    check_portable_serialization(r);
+    check_frozen_serialization(r);
+
+    // Copies hold the shared full container too, even without copy on write,
+    // rather than a clone of it per 65536 values.
+    roaring_arena_t* arena = roaring_arena_create();
+    counting_allocator_t counting;
+    counting.allocator.context = &counting;
+    counting.allocator.malloc = counting_malloc;
+    counting.allocator.realloc = counting_realloc;
+    counting.allocator.calloc = counting_calloc;
+    counting.allocator.free = counting_free;
+    counting.allocator.aligned_malloc = counting_aligned_malloc;
+    counting.allocator.aligned_free = counting_aligned_free;
+    counting.arena = roaring_arena_allocator(arena);
+    counting.n_allocs = 0;
+    const roaring_allocator_t* previous =
+        roaring_allocator_enter(&counting.allocator);
+    roaring64_bitmap_t* counted = roaring64_bitmap_copy(r);
+    roaring_allocator_leave(previous);
+    assert_false(roaring64_bitmap_get_copy_on_write(counted));
+    assert_true(counting.n_allocs < 1000);
+    assert_true(roaring64_bitmap_equals(counted, r));
+    roaring64_bitmap_remove(counted, start + (UINT64_C(1) << 31));
+    assert_true(roaring64_bitmap_contains(r, start + (UINT64_C(1) << 31)));
+    roaring64_bitmap_free(counted);
+    roaring_arena_free(arena);
+
+    // Writes to a full container leave the others alone.
+    roaring64_bitmap_t* copy = roaring64_bitmap_copy(r);
+    uint64_t middle = (UINT64_C(1) << 40) + (UINT64_C(1) << 31);
+    roaring64_bitmap_remove_range_closed(copy, middle, middle + 70000);
+    assert_r64_valid(copy);
+    assert_false(roaring64_bitmap_contains(copy, middle + 65536));
+    assert_true(roaring64_bitmap_contains(r, middle + 65536));
+    assert_int_equal(roaring64_bitmap_get_cardinality(copy),
+                     end - start + 1 - 70001);
+    roaring64_bitmap_set_copy_on_write(copy, true);
+    roaring64_bitmap_add_range_closed(copy, middle, middle + 70000);
+    assert_r64_valid(copy);
+    assert_true(roaring64_bitmap_equals(copy, r));
+    roaring64_bitmap_set_copy_on_write(copy, false);
+    assert_r64_valid(copy);
+    assert_true(roaring64_bitmap_equals(copy, r));
+    roaring64_bitmap_remove(copy, middle);
+
+    roaring64_bitmap_t* other = roaring64_bitmap_from_range(
+        middle - (1 << 20), middle + (1 << 20), 1);
+    roaring64_bitmap_t* both = roaring64_bitmap_and(r, other);
+    assert_r64_valid(both);
+    assert_true(roaring64_bitmap_equals(both, other));
+    roaring64_bitmap_t* either = roaring64_bitmap_or(copy, other);
+    assert_r64_valid(either);
+    assert_true(roaring64_bitmap_equals(either, r));
+    roaring64_bitmap_t* diff = roaring64_bitmap_xor(r, copy);
+    assert_int_equal(roaring64_bitmap_get_cardinality(diff), 1);
+    roaring64_bitmap_t* rest = roaring64_bitmap_andnot(r, other);
+    assert_r64_valid(rest);
+    assert_int_equal(roaring64_bitmap_get_cardinality(rest),
+                     end - start + 1 - (2 << 20));
+    roaring64_bitmap_xor_inplace(rest, other);
+    assert_true(roaring64_bitmap_equals(rest, r));
+    roaring64_bitmap_free(both);
+    roaring64_bitmap_free(either);
+    roaring64_bitmap_free(diff);
+    roaring64_bitmap_free(rest);
+    roaring64_bitmap_free(other);
+    roaring64_bitmap_free(copy);
+
+    roaring64_bitmap_run_optimize(r);
+    roaring64_bitmap_shrink_to_fit(r);
+    assert_true(roaring64_bitmap_seal(r));
+    assert_r64_valid(r);
+    assert_int_equal(roaring64_bitmap_get_cardinality(r), end - start + 1);
+    roaring64_bitmap_free(r);
+}
+
+std::vector<uint64_t> to_vector(const roaring64_bitmap_t* r) {
+    std::vector<uint64_t> values(roaring64_bitmap_get_cardinality(r));
+    roaring64_bitmap_to_uint64_array(r, values.data());
+    return values;
+}
+
+DEFINE_TEST(test_sparse_inline_leaves) {
+    // Chunks with one to three values are stored in their leaves, the chunks
+    // with four values in array containers.
+    std::vector<uint64_t> expected;
+    roaring64_bitmap_t* r = roaring64_bitmap_create();
+    for (uint64_t i = 0; i < 2000; ++i) {
+        uint64_t base = i * UINT64_C(0x9E3779B97F4A7) & ~UINT64_C(0xFFFF);
+        for (uint64_t j = 0; j <= i % 4; ++j) {
+            uint64_t v = base + j * 3 + (i & 1) * 60000;
+            roaring64_bitmap_add(r, v);
+            expected.push_back(v);
+        }
+    }
+    std::sort(expected.begin(), expected.end());
+    assert_r64_valid(r);
+    assert_int_equal(roaring64_bitmap_get_cardinality(r), expected.size());
+    assert_true(to_vector(r) == expected);
+    for (size_t k = 0; k < expected.size(); k += 7) {
+        uint64_t v = expected[k];
+        assert_true(roaring64_bitmap_contains(r, v));
+        assert_int_equal(
+            roaring64_bitmap_contains(r, v + 1),
+            std::binary_search(expected.begin(), expected.end(), v + 1));
+        uint64_t selected;
+        assert_true(roaring64_bitmap_select(r, k, &selected));
+        assert_int_equal(selected, v);
+        assert_int_equal(roaring64_bitmap_rank(r, v), k + 1);
+    }
+    assert_int_equal(roaring64_bitmap_minimum(r), expected.front());
+    assert_int_equal(roaring64_bitmap_maximum(r), expected.back());
+
+    std::vector<uint64_t> iterated;
+    roaring64_iterator_t* it = roaring64_iterator_create(r);
+    while (roaring64_iterator_has_value(it)) {
+        iterated.push_back(roaring64_iterator_value(it));
+        roaring64_iterator_advance(it);
+    }
+    assert_true(roaring64_iterator_previous(it));
+    assert_int_equal(roaring64_iterator_value(it), expected.back());
+    roaring64_iterator_free(it);
+    assert_true(iterated == expected);
+
+    // Removing every other value shrinks the leaves and erases some.
+    roaring64_bitmap_t* half = roaring64_bitmap_copy(r);
+    std::vector<uint64_t> kept;
+    for (size_t k = 0; k < expected.size(); ++k) {
+        if (k % 2 == 0) {
+            roaring64_bitmap_remove(half, expected[k]);
+        } else {
+            kept.push_back(expected[k]);
+        }
+    }
+    assert_r64_valid(half);
+    assert_true(to_vector(half) == kept);
+    assert_true(roaring64_bitmap_is_subset(half, r));
+
+    // Set operations between inline leaves and containers.
+    roaring64_bitmap_t* other = roaring64_bitmap_create();
+    std::vector<uint64_t> other_values;
+    for (size_t k = 0; k < expected.size(); k += 3) {
+        other_values.push_back(expected[k]);
+        other_values.push_back(expected[k] + 1);
+    }
+    std::sort(other_values.begin(), other_values.end());
+    other_values.erase(std::unique(other_values.begin(), other_values.end()),
+                       other_values.end());
+    roaring64_bitmap_add_many(other, other_values.size(), other_values.data());
+    assert_r64_valid(other);
+
+    std::vector<uint64_t> op_expected;
+    std::set_intersection(expected.begin(), expected.end(),
+                          other_values.begin(), other_values.end(),
+                          std::back_inserter(op_expected));
+    roaring64_bitmap_t* result = roaring64_bitmap_and(r, other);
+    assert_r64_valid(result);
+    assert_true(to_vector(result) == op_expected);
+    assert_int_equal(roaring64_bitmap_and_cardinality(r, other),
+                     op_expected.size());
+    assert_true(roaring64_bitmap_intersect(r, other));
+    roaring64_bitmap_t* inplace = roaring64_bitmap_copy(r);
+    roaring64_bitmap_and_inplace(inplace, other);
+    assert_r64_valid(inplace);
+    assert_true(roaring64_bitmap_equals(inplace, result));
+    roaring64_bitmap_free(inplace);
+    roaring64_bitmap_free(result);
+
+    op_expected.clear();
+    std::set_union(expected.begin(), expected.end(), other_values.begin(),
+                   other_values.end(), std::back_inserter(op_expected));
+    result = roaring64_bitmap_or(r, other);
+    assert_r64_valid(result);
+    assert_true(to_vector(result) == op_expected);
+    inplace = roaring64_bitmap_copy(r);
+    roaring64_bitmap_or_inplace(inplace, other);
+    assert_r64_valid(inplace);
+    assert_true(roaring64_bitmap_equals(inplace, result));
+    roaring64_bitmap_free(inplace);
+    roaring64_bitmap_free(result);
+
+    op_expected.clear();
+    std::set_symmetric_difference(expected.begin(), expected.end(),
+                                  other_values.begin(), other_values.end(),
+                                  std::back_inserter(op_expected));
+    result = roaring64_bitmap_xor(r, other);
+    assert_r64_valid(result);
+    assert_true(to_vector(result) == op_expected);
+    inplace = roaring64_bitmap_copy(r);
+    roaring64_bitmap_xor_inplace(inplace, other);
+    assert_r64_valid(inplace);
+    assert_true(roaring64_bitmap_equals(inplace, result));
+    roaring64_bitmap_free(inplace);
+    roaring64_bitmap_free(result);
+
+    op_expected.clear();
+    std::set_difference(expected.begin(), expected.end(),
+                        other_values.begin(), other_values.end(),
+                        std::back_inserter(op_expected));
+    result = roaring64_bitmap_andnot(r, other);
+    assert_r64_valid(result);
+    assert_true(to_vector(result) == op_expected);
+    inplace = roaring64_bitmap_copy(r);
+    roaring64_bitmap_andnot_inplace(inplace, other);
+    assert_r64_valid(inplace);
+    assert_true(roaring64_bitmap_equals(inplace, result));
+    roaring64_bitmap_free(inplace);
+    roaring64_bitmap_free(result);
+
+    // Flipping a few values of an inline leaf.
+    uint64_t first = expected.front();
+    size_t n_flipped = std::lower_bound(expected.begin(), expected.end(),
+                                        first + 10) -
+                       expected.begin();
+    result = roaring64_bitmap_flip(r, first, first + 10);
+    assert_r64_valid(result);
+    assert_int_equal(roaring64_bitmap_get_cardinality(result),
+                     expected.size() + 10 - 2 * n_flipped);
+    roaring64_bitmap_flip_inplace(result, first, first + 10);
+    assert_r64_valid(result);
+    assert_true(roaring64_bitmap_equals(result, r));
+    roaring64_bitmap_free(result);
+
+    // Offsets within and across chunks.
+    const uint64_t offsets[] = {5, 1 << 15, UINT64_C(1) << 40};
+    for (uint64_t offset : offsets) {
+        result = roaring64_bitmap_add_offset(r, offset);
+        assert_r64_valid(result);
+        std::vector<uint64_t> shifted;
+        for (uint64_t v : expected) {
+            if (v + offset >= v) shifted.push_back(v + offset);
+        }
+        assert_true(to_vector(result) == shifted);
+        roaring64_bitmap_free(result);
+    }
+
+    check_portable_serialization(r);
+    check_frozen_serialization(half);
+    assert_true(to_vector(half) == kept);
+
+    roaring64_bitmap_t* sealed = roaring64_bitmap_copy(half);
+    assert_true(roaring64_bitmap_seal(sealed));
+    assert_r64_valid(sealed);
+    assert_true(roaring64_bitmap_equals(sealed, half));
+    assert_true(roaring64_bitmap_unseal(sealed));
+    roaring64_bitmap_add(sealed, kept.front() + 1);
+    assert_r64_valid(sealed);
+    assert_int_equal(roaring64_bitmap_get_cardinality(sealed), kept.size() + 1);
+
+    roaring64_bitmap_free(sealed);
+    roaring64_bitmap_free(other);
+    roaring64_bitmap_free(half);
+    roaring64_bitmap_free(r);
+}
+
+DEFINE_TEST(test_compact) {
+    // Containers created in shuffled key order, then mostly removed.
+    std::vector<uint64_t> keys(2000);
+    std::iota(keys.begin(), keys.end(), 0);
+    std::shuffle(keys.begin(), keys.end(), std::mt19937_64(42));
+    roaring64_bitmap_t* r = roaring64_bitmap_create();
+    for (uint64_t key : keys) {
+        roaring64_bitmap_add_range(r, key << 20, (key << 20) + 10);
+    }
+    roaring64_bitmap_t* expected = roaring64_bitmap_create();
+    for (uint64_t key : keys) {
+        if (key % 10 == 0) {
+            roaring64_bitmap_add_range(expected, key << 20, (key << 20) + 10);
+        } else if (key % 3 == 0) {
+            roaring64_bitmap_remove_range(r, key << 20, (key << 20) + 10);
+        } else {
+            for (uint64_t v = key << 20; v < (key << 20) + 10; ++v) {
+                roaring64_bitmap_remove(r, v);
+            }
+        }
+        assert_r64_valid(r);
+    }
+    assert_true(roaring64_bitmap_equals(r, expected));
+    assert_true(roaring64_bitmap_compact(r));
+    assert_r64_valid(r);
+    assert_true(roaring64_bitmap_equals(r, expected));
+    assert_true(to_vector(r) == to_vector(expected));
+
+    // Later additions fill the container array again.
+    for (uint64_t key : keys) {
+        roaring64_bitmap_add(r, (key << 20) + 20);
+    }
+    roaring64_bitmap_andnot_inplace(r, expected);
+    assert_r64_valid(r);
+    assert_int_equal(roaring64_bitmap_get_cardinality(r), keys.size());
+    roaring64_bitmap_and_inplace(r, expected);
+    assert_r64_valid(r);
+    assert_true(roaring64_bitmap_is_empty(r));
+    assert_true(roaring64_bitmap_compact(r));
+    assert_r64_valid(r);
+
+    // Sealed bitmaps are compact already, frozen ones cannot be changed.
+    assert_true(roaring64_bitmap_seal(expected));
+    assert_true(roaring64_bitmap_compact(expected));
+    assert_true(roaring64_bitmap_is_sealed(expected));
+    roaring64_bitmap_shrink_to_fit(expected);
+    size_t size = roaring64_bitmap_frozen_size_in_bytes(expected);
+    char* buf = (char*)roaring_aligned_malloc(64, size);
+    assert_int_equal(roaring64_bitmap_frozen_serialize(expected, buf), size);
+    roaring64_bitmap_t* frozen = roaring64_bitmap_frozen_view(buf, size);
+    assert_false(roaring64_bitmap_compact(frozen));
+    assert_true(roaring64_bitmap_equals(frozen, expected));
+    roaring64_bitmap_free(frozen);
+    roaring_aligned_free(buf);
+
+    roaring64_bitmap_free(expected);
+    roaring64_bitmap_free(r);
+}
+
+DEFINE_TEST(test_skewed_set_operations) {
+    // `dense` has far more leaves than `sparse`, whose leaves are looked up
+    // in `dense` rather than merged with them.
+    roaring64_bitmap_t* dense = roaring64_bitmap_create();
+    for (uint64_t key = 0; key < 10000; ++key) {
+        roaring64_bitmap_add_range(dense, (key << 16) + (key % 7),
+                                   (key << 16) + 10);
+    }
+    roaring64_bitmap_t* sparse = roaring64_bitmap_create();
+    for (uint64_t key = 3; key < 20000; key += 401) {
+        roaring64_bitmap_add(sparse, (key << 16) + 5);
+        roaring64_bitmap_add(sparse, (key << 16) + 100);
+    }
+    roaring64_bitmap_t* inside = roaring64_bitmap_from_range(
+        (UINT64_C(5) << 16) + 6, (UINT64_C(5) << 16) + 9, 1);
+    std::vector<uint64_t> d = to_vector(dense), s = to_vector(sparse);
+
+    std::vector<uint64_t> expected;
+    std::set_intersection(d.begin(), d.end(), s.begin(), s.end(),
+                          std::back_inserter(expected));
+    for (int order = 0; order < 2; ++order) {
+        roaring64_bitmap_t* a = order == 0 ? dense : sparse;
+        roaring64_bitmap_t* b = order == 0 ? sparse : dense;
+        roaring64_bitmap_t* result = roaring64_bitmap_and(a, b);
+        assert_r64_valid(result);
+        assert_true(to_vector(result) == expected);
+        roaring64_bitmap_free(result);
+        assert_int_equal(roaring64_bitmap_and_cardinality(a, b),
+                         expected.size());
+        assert_true(roaring64_bitmap_intersect(a, b));
+    }
+
+    expected.clear();
+    std::set_difference(s.begin(), s.end(), d.begin(), d.end(),
+                        std::back_inserter(expected));
+    roaring64_bitmap_t* result = roaring64_bitmap_andnot(sparse, dense);
+    assert_r64_valid(result);
+    assert_true(to_vector(result) == expected);
+    roaring64_bitmap_andnot_inplace(sparse, dense);
+    assert_r64_valid(sparse);
+    assert_true(roaring64_bitmap_equals(sparse, result));
+    roaring64_bitmap_free(result);
+
+    expected.clear();
+    std::set_difference(d.begin(), d.end(), s.begin(), s.end(),
+                        std::back_inserter(expected));
+    roaring64_bitmap_t* copy = roaring64_bitmap_copy(dense);
+    roaring64_bitmap_t* original = roaring64_bitmap_create();
+    for (uint64_t v : s) roaring64_bitmap_add(original, v);
+    roaring64_bitmap_andnot_inplace(copy, original);
+    assert_r64_valid(copy);
+    assert_true(to_vector(copy) == expected);
+
+    // No common keys, or none within the key range of the other bitmap.
+    assert_false(roaring64_bitmap_intersect(sparse, dense));
+    assert_int_equal(roaring64_bitmap_and_cardinality(dense, sparse), 0);
+    roaring64_bitmap_t* beyond = roaring64_bitmap_from_range(
+        UINT64_C(1) << 40, (UINT64_C(1) << 40) + 3, 1);
+    assert_false(roaring64_bitmap_intersect(dense, beyond));
+    assert_false(roaring64_bitmap_is_subset(beyond, dense));
+
+    assert_true(roaring64_bitmap_is_subset(inside, dense));
+    roaring64_bitmap_add(inside, 11);
+    assert_false(roaring64_bitmap_is_subset(inside, dense));
+
+    roaring64_bitmap_free(beyond);
+    roaring64_bitmap_free(original);
+    roaring64_bitmap_free(copy);
+    roaring64_bitmap_free(inside);
+    roaring64_bitmap_free(sparse);
+    roaring64_bitmap_free(dense);
+}
+
+DEFINE_TEST(test_many_operations) {
+    // Inline leaves, array, bitset and run containers, full containers and
+    // copy-on-write bitmaps, with keys shared by a few or all of them.
+    std::vector<roaring64_bitmap_t*> bitmaps;
+    std::mt19937_64 gen(1234);
+    for (int i = 0; i < 12; ++i) {
+        roaring64_bitmap_t* r = roaring64_bitmap_create();
+        for (int j = 0; j < 300; ++j) {
+            uint64_t key = gen() % 64;
+            roaring64_bitmap_add(r, (key << 16) + gen() % 65536);
+        }
+        roaring64_bitmap_add_range(r, (UINT64_C(1) << 40) + i * 5000,
+                                   (UINT64_C(1) << 40) + 70000 + i * 3);
+        for (int j = 0; j < 5000; ++j) {
+            roaring64_bitmap_add(r, (UINT64_C(3) << 32) + gen() % 65536);
+        }
+        roaring64_bitmap_add(r, (UINT64_C(5) << 48) + i);
+        if (i % 3 == 0) {
+            roaring64_bitmap_add_range(r, UINT64_C(7) << 32,
+                                       (UINT64_C(7) << 32) + 65536);
+        }
+        roaring64_bitmap_run_optimize(r);
+        roaring64_bitmap_set_copy_on_write(r, i % 2 == 0);
+        bitmaps.push_back(r);
+    }
+
+    for (size_t n = 0; n <= bitmaps.size(); ++n) {
+        const roaring64_bitmap_t** inputs =
+            (const roaring64_bitmap_t**)bitmaps.data();
+        roaring64_bitmap_t* expected_or = roaring64_bitmap_create();
+        roaring64_bitmap_t* expected_xor = roaring64_bitmap_create();
+        roaring64_bitmap_t* expected_and =
+            n > 0 ? roaring64_bitmap_copy(bitmaps[0])
+                  : roaring64_bitmap_create();
+        for (size_t i = 0; i < n; ++i) {
+            roaring64_bitmap_or_inplace(expected_or, bitmaps[i]);
+            roaring64_bitmap_xor_inplace(expected_xor, bitmaps[i]);
+            roaring64_bitmap_and_inplace(expected_and, bitmaps[i]);
+        }
+        roaring64_bitmap_t* result = roaring64_bitmap_or_many(n, inputs);
+        assert_r64_valid(result);
+        assert_true(roaring64_bitmap_equals(result, expected_or));
+        roaring64_bitmap_free(result);
+        result = roaring64_bitmap_xor_many(n, inputs);
+        assert_r64_valid(result);
+        assert_true(roaring64_bitmap_equals(result, expected_xor));
+        roaring64_bitmap_free(result);
+        result = roaring64_bitmap_and_many(n, inputs);
+        assert_r64_valid(result);
+        assert_true(roaring64_bitmap_equals(result, expected_and));
+        roaring64_bitmap_free(result);
+        roaring64_bitmap_free(expected_or);
+        roaring64_bitmap_free(expected_xor);
+        roaring64_bitmap_free(expected_and);
+    }
+
+    // The same bitmap twice, and an empty bitmap.
+    roaring64_bitmap_t* empty = roaring64_bitmap_create();
+    const roaring64_bitmap_t* twice[] = {bitmaps[1], bitmaps[1], empty};
+    roaring64_bitmap_t* result = roaring64_bitmap_xor_many(2, twice);
+    assert_true(roaring64_bitmap_is_empty(result));
+    roaring64_bitmap_free(result);
+    result = roaring64_bitmap_and_many(2, twice);
+    assert_true(roaring64_bitmap_equals(result, bitmaps[1]));
+    roaring64_bitmap_free(result);
+    result = roaring64_bitmap_and_many(3, twice);
+    assert_true(roaring64_bitmap_is_empty(result));
+    roaring64_bitmap_free(result);
+    result = roaring64_bitmap_or_many(3, twice);
+    assert_true(roaring64_bitmap_equals(result, bitmaps[1]));
+    roaring64_bitmap_free(result);
+
+    roaring64_bitmap_free(empty);
+    for (roaring64_bitmap_t* r : bitmaps) {
+        assert_r64_valid(r);
+        roaring64_bitmap_free(r);
+    }
+}
+
+DEFINE_TEST(test_seal) {
+    // Leaves below each inner node type, some of them shared.
+    roaring64_bitmap_t* r = create_mixed_bitmap();
+    for (uint64_t i = 0; i < 300; ++i) {
+        roaring64_bitmap_add(r, (i << 16) + i);
+        roaring64_bitmap_add(r, (UINT64_C(1) << 32) + ((i % 40) << 24) + i);
+        roaring64_bitmap_add(r, (UINT64_C(1) << 33) + ((i % 10) << 40));
+    }
+    roaring64_bitmap_remove(r, 1 << 16);  // leaves a free slot
+    roaring64_bitmap_set_copy_on_write(r, true);
+    roaring64_bitmap_t* shared = roaring64_bitmap_copy(r);
+    roaring64_bitmap_t* expected = roaring64_bitmap_copy(r);
+    roaring64_bitmap_set_copy_on_write(expected, false);
+    roaring64_bitmap_t* other = roaring64_bitmap_from_range(0, 1 << 24, 5);
+
+    assert_true(roaring64_bitmap_seal(r));
+    assert_true(roaring64_bitmap_is_sealed(r));
+    assert_r64_valid(r);
+    assert_true(roaring64_bitmap_equals(r, expected));
+    assert_true(roaring64_bitmap_equals(shared, expected));
+    assert_int_equal(roaring64_bitmap_shrink_to_fit(r), 0);
+
+    // Reads.
+    uint64_t card = roaring64_bitmap_get_cardinality(expected);
+    std::vector<uint64_t> values(card), read(card);
+    roaring64_bitmap_to_uint64_array(expected, values.data());
+    roaring64_iterator_t* it = roaring64_iterator_create(r);
+    assert_int_equal(roaring64_iterator_read(it, read.data(), card), card);
+    assert_vector_equal(read, values);
+    roaring64_iterator_free(it);
+    for (uint64_t v : values) {
+        assert_true(roaring64_bitmap_contains(r, v));
+    }
+    assert_false(roaring64_bitmap_contains(r, 1 << 16));
+    assert_int_equal(roaring64_bitmap_and_cardinality(r, other),
+                     roaring64_bitmap_and_cardinality(expected, other));
+    check_frozen_serialization(r);
+
+    // Copies and results are neither sealed nor sharing.
+    roaring64_bitmap_t* copy = roaring64_bitmap_copy(r);
+    assert_false(roaring64_bitmap_is_sealed(copy));
+    assert_true(roaring64_bitmap_get_copy_on_write(copy));
+    roaring64_bitmap_add(copy, 1);
+    assert_false(roaring64_bitmap_contains(r, 1));
+    roaring64_bitmap_t* result = roaring64_bitmap_or(r, other);
+    roaring64_bitmap_or_inplace(copy, r);
+    assert_r64_valid(result);
+    roaring64_bitmap_free(result);
+    roaring64_bitmap_free(copy);
+    assert_true(roaring64_bitmap_is_sealed(r));
+
+    // Modifications unseal.
+    roaring64_bitmap_add(r, 1 << 16);
+    assert_false(roaring64_bitmap_is_sealed(r));
+    assert_true(roaring64_bitmap_contains(r, 1 << 16));
+    roaring64_bitmap_remove(r, 1 << 16);
+    assert_r64_valid(r);
+    assert_true(roaring64_bitmap_equals(r, expected));
+
+    assert_true(roaring64_bitmap_seal(r));
+    roaring64_bitmap_and_inplace(r, other);
+    assert_false(roaring64_bitmap_is_sealed(r));
+    assert_r64_valid(r);
+    assert_true(roaring64_bitmap_seal(r));
+    roaring64_bitmap_overwrite(r, expected);
+    assert_false(roaring64_bitmap_is_sealed(r));
+    assert_true(roaring64_bitmap_equals(r, expected));
+    assert_true(roaring64_bitmap_seal(r));
+    assert_true(roaring64_bitmap_unseal(r));
+    assert_false(roaring64_bitmap_is_sealed(r));
+    assert_r64_valid(r);
+    assert_true(roaring64_bitmap_equals(r, expected));
+
+    assert_true(roaring64_bitmap_seal(r));
+    roaring64_bitmap_clear(r);
+    assert_false(roaring64_bitmap_is_sealed(r));
+    assert_true(roaring64_bitmap_is_empty(r));
+    assert_true(roaring64_bitmap_seal(r));
+    assert_false(roaring64_bitmap_is_sealed(r));
+
+    roaring64_bitmap_overwrite(r, expected);
+    assert_true(roaring64_bitmap_seal(r));
+    roaring64_bitmap_free(r);
+    roaring64_bitmap_free(shared);
+    roaring64_bitmap_free(expected);
+    roaring64_bitmap_free(other);
+}
+
 bool roaring_iterator64_sumall(uint64_t value, void* param) {
     *(uint64_t*)param += value;
     return true;
@@ -2145,6 +3146,170 @@ DEFINE_TEST(test_to_uint64_array) {
     roaring64_bitmap_free(r);
 }
 
+DEFINE_TEST(test_range_uint64_array) {
+    roaring64_bitmap_t* r = roaring64_bitmap_create();
+    std::vector<uint64_t> vals;
+    // Array, bitset and run containers under different high 48 bits.
+    for (uint64_t i = 0; i < 1000; i += 7) vals.push_back(i);
+    for (uint64_t i = 0; i < 65536; i += 2) vals.push_back((1ULL << 35) + i);
+    for (uint64_t i = 0; i < 20000; i++) vals.push_back((1ULL << 50) + i);
+    vals.push_back(UINT64_MAX);
+    roaring64_bitmap_add_many(r, vals.size(), vals.data());
+    roaring64_bitmap_run_optimize(r);
+
+    std::vector<uint64_t> all(vals.size());
+    roaring64_bitmap_to_uint64_array(r, all.data());
+    assert_vector_equal(all, vals);
+
+    const uint64_t offsets[] = {0, 1, 143, 144, 20000, 32911, vals.size() - 1};
+    const uint64_t limits[] = {0, 1, 100, 40000, vals.size()};
+    for (uint64_t offset : offsets) {
+        for (uint64_t limit : limits) {
+            uint64_t expected = std::min<uint64_t>(limit, vals.size() - offset);
+            std::vector<uint64_t> out(limit + 1, 42);
+            assert_int_equal(
+                roaring64_bitmap_range_uint64_array(r, offset, limit,
+                                                    out.data()),
+                expected);
+            assert_true(std::equal(out.begin(), out.begin() + expected,
+                                   vals.begin() + offset));
+            assert_int_equal(out[expected], 42);
+        }
+    }
+    uint64_t past;
+    assert_int_equal(
+        roaring64_bitmap_range_uint64_array(r, vals.size(), 10, &past), 0);
+
+    roaring64_bitmap_free(r);
+}
+
+DEFINE_TEST(test_bitmap_allocator) {
+    roaring64_bitmap_t* h = roaring64_bitmap_create();
+    for (uint64_t i = 0; i < 3000; i++) {
+        roaring64_bitmap_add(h, (i << 34) + (i % 70));
+    }
+    roaring_arena_t* arena = roaring_arena_create();
+    const roaring_allocator_t* allocator = roaring_arena_allocator(arena);
+
+    const roaring_allocator_t* previous = roaring_allocator_enter(allocator);
+    roaring64_bitmap_t* a = roaring64_bitmap_create();
+    roaring_allocator_leave(previous);
+    assert_true(roaring64_bitmap_get_allocator(a) == allocator);
+    assert_null(roaring64_bitmap_get_allocator(h));
+
+    // Outside of the scope, `a` still allocates from the arena.
+    size_t size = roaring_arena_size_in_bytes(arena);
+    for (uint64_t i = 0; i < 5000; i++) {
+        roaring64_bitmap_add(a, (i << 33) + (i % 50));
+    }
+    roaring64_bitmap_add_range(a, 1ULL << 40, (1ULL << 40) + 300000);
+    assert_true(roaring_arena_size_in_bytes(arena) > size);
+
+    // Operations on hook bitmaps do not use it.
+    size = roaring_arena_size_in_bytes(arena);
+    roaring64_bitmap_or_inplace(h, a);
+    roaring64_bitmap_t* x = roaring64_bitmap_and(h, a);
+    assert_null(roaring64_bitmap_get_allocator(x));
+    assert_int_equal(roaring_arena_size_in_bytes(arena), size);
+
+    // Results use the allocator of their first argument.
+    roaring64_bitmap_t* u = roaring64_bitmap_or(a, h);
+    roaring64_bitmap_t* y = roaring64_bitmap_copy(a);
+    assert_true(roaring64_bitmap_get_allocator(u) == allocator);
+    assert_true(roaring64_bitmap_get_allocator(y) == allocator);
+    assert_true(roaring64_bitmap_equals(u, h));
+    assert_true(roaring64_bitmap_equals(x, y));
+    roaring64_bitmap_free(x);
+    roaring64_bitmap_free(h);
+
+    // The arena releases u, y and a at once.
+    roaring_arena_free(arena);
+}
+
+// Forwards to an arena, and fails allocations while `fail` is set.
+struct failing_allocator_t {
+    roaring_allocator_t allocator;
+    const roaring_allocator_t* arena;
+    bool fail;
+};
+
+static void* failing_malloc(void* context, size_t size) {
+    failing_allocator_t* f = (failing_allocator_t*)context;
+    return f->fail ? nullptr : f->arena->malloc(f->arena->context, size);
+}
+
+static void* failing_realloc(void* context, void* p, size_t size) {
+    failing_allocator_t* f = (failing_allocator_t*)context;
+    return f->fail ? nullptr : f->arena->realloc(f->arena->context, p, size);
+}
+
+static void* failing_calloc(void* context, size_t n, size_t size) {
+    failing_allocator_t* f = (failing_allocator_t*)context;
+    return f->fail ? nullptr : f->arena->calloc(f->arena->context, n, size);
+}
+
+static void failing_free(void* context, void* p) {
+    failing_allocator_t* f = (failing_allocator_t*)context;
+    f->arena->free(f->arena->context, p);
+}
+
+static void* failing_aligned_malloc(void* context, size_t alignment,
+                                    size_t size) {
+    failing_allocator_t* f = (failing_allocator_t*)context;
+    return f->fail ? nullptr
+                   : f->arena->aligned_malloc(f->arena->context, alignment,
+                                              size);
+}
+
+static void failing_aligned_free(void* context, void* p) {
+    failing_allocator_t* f = (failing_allocator_t*)context;
+    f->arena->aligned_free(f->arena->context, p);
+}
+
+DEFINE_TEST(test_seal_unseal_failure) {
+    roaring_arena_t* arena = roaring_arena_create();
+    failing_allocator_t f;
+    f.allocator.context = &f;
+    f.allocator.malloc = failing_malloc;
+    f.allocator.realloc = failing_realloc;
+    f.allocator.calloc = failing_calloc;
+    f.allocator.free = failing_free;
+    f.allocator.aligned_malloc = failing_aligned_malloc;
+    f.allocator.aligned_free = failing_aligned_free;
+    f.arena = roaring_arena_allocator(arena);
+    f.fail = false;
+
+    const roaring_allocator_t* previous = roaring_allocator_enter(&f.allocator);
+    roaring64_bitmap_t* r = create_mixed_bitmap();
+    roaring_allocator_leave(previous);
+    roaring64_bitmap_t* other = roaring64_bitmap_from_range(0, 1 << 20, 2);
+    roaring64_bitmap_t* expected = roaring64_bitmap_copy(r);
+    assert_true(roaring64_bitmap_seal(r));
+
+    // Modifications that cannot unseal leave the bitmap sealed and intact.
+    f.fail = true;
+    roaring64_bitmap_add(r, 1);
+    assert_false(roaring64_bitmap_add_checked(r, 2));
+    assert_false(roaring64_bitmap_remove_checked(r, 3));
+    roaring64_bitmap_remove_range(r, 0, 100000);
+    roaring64_bitmap_or_inplace(r, other);
+    roaring64_bitmap_and_inplace(r, other);
+    roaring64_bitmap_flip_inplace(r, 0, 1000);
+    assert_false(roaring64_bitmap_run_optimize(r));
+    assert_true(roaring64_bitmap_is_sealed(r));
+    assert_r64_valid(r);
+    assert_true(roaring64_bitmap_equals(r, expected));
+
+    f.fail = false;
+    roaring64_bitmap_add(r, 1);
+    assert_false(roaring64_bitmap_is_sealed(r));
+    assert_true(roaring64_bitmap_contains(r, 1));
+    roaring64_bitmap_free(other);
+
+    // The arena releases r and expected at once.
+    roaring_arena_free(arena);
+}
+
 DEFINE_TEST(test_iterator_create) {
     roaring64_bitmap_t* r = roaring64_bitmap_create();
     {
@@ -3023,9 +4188,14 @@ int main() {
         cmocka_unit_test(fuzz_deserializer),
         cmocka_unit_test(test_copy),
         cmocka_unit_test(test_overwrite),
+        cmocka_unit_test(test_copy_on_write),
+        cmocka_unit_test(test_interner),
         cmocka_unit_test(test_from_range),
         cmocka_unit_test(test_move_from_roaring32),
         cmocka_unit_test(test_of_ptr),
+        cmocka_unit_test(test_from_sorted),
+        cmocka_unit_test(test_from_unsorted),
+        cmocka_unit_test(test_from_ranges),
         cmocka_unit_test(test_of),
         cmocka_unit_test(test_add),
         cmocka_unit_test(test_add_checked),
@@ -3038,6 +4208,7 @@ int main() {
         cmocka_unit_test(test_select),
         cmocka_unit_test(test_rank),
         cmocka_unit_test(test_get_index),
+        cmocka_unit_test(test_rank_select_many),
         cmocka_unit_test(test_remove),
         cmocka_unit_test(test_remove_checked),
         cmocka_unit_test(test_remove_bulk),
@@ -3072,8 +4243,17 @@ int main() {
         cmocka_unit_test(test_add_offset),
         cmocka_unit_test(test_portable_serialize),
         cmocka_unit_test(test_frozen_serialize),
+        cmocka_unit_test(test_add_range_huge),
+        cmocka_unit_test(test_sparse_inline_leaves),
+        cmocka_unit_test(test_compact),
+        cmocka_unit_test(test_skewed_set_operations),
+        cmocka_unit_test(test_many_operations),
+        cmocka_unit_test(test_seal),
         cmocka_unit_test(test_iterate),
         cmocka_unit_test(test_to_uint64_array),
+        cmocka_unit_test(test_range_uint64_array),
+        cmocka_unit_test(test_bitmap_allocator),
+        cmocka_unit_test(test_seal_unseal_failure),
         cmocka_unit_test(test_iterator_create),
         cmocka_unit_test(test_iterator_create_last),
         cmocka_unit_test(test_iterator_reinit),
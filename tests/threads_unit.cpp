@@ -1,9 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
+
+#include <algorithm>
+#include <random>
 #include <thread>
+#include <vector>
 
 #include <roaring/misc/configreport.h>
+#include <roaring/parallel.hh>
 #include <roaring/roaring.h>
+#include <roaring/roaring64.h>
 
 // We are mostly running this test to check for data races using thread
 // sanitizer.
@@ -74,9 +80,334 @@ bool run_threads_unit_tests() {
     return true;
 }
 
+bool run_parallel_deserialize_tests() {
+    // Enough containers of each kind for every thread to get a mix.
+    roaring::Roaring r;
+    for (uint32_t key = 0; key < 1000; key++) {
+        uint32_t base = key << 16;
+        switch (key % 3) {
+            case 0:
+                r.add(base + key);
+                r.add(base + 3 * key + 7);
+                break;
+            case 1:
+                for (uint32_t i = 0; i < 10000; i += 3) r.add(base + i);
+                break;
+            default:
+                r.addRange(base + 100, base + 40000);
+                break;
+        }
+    }
+    r.runOptimize();
+    std::vector<char> buf(r.getSizeInBytes());
+    r.write(buf.data());
+    for (unsigned threads : {1u, 3u, 8u}) {
+        roaring::Roaring read =
+            roaring::parallel::readSafe(buf.data(), buf.size(), threads);
+        if (!(read == r)) {
+            printf("parallel deserialization mismatch (%u threads)\n", threads);
+            return false;
+        }
+    }
+
+    // A truncated buffer must be rejected even though its header is intact.
+    uint32_t count = 0;
+    roaring_bitmap_t *partial = roaring_bitmap_portable_deserialize_prepare(
+        buf.data(), buf.size() - 1, &count);
+    if (partial == NULL || count != 1000) {
+        printf("failed to prepare truncated bitmap\n");
+        return false;
+    }
+    roaring_bitmap_portable_deserialize_range(partial, buf.data(),
+                                              buf.size() - 1, 0, count / 2);
+    roaring_bitmap_portable_deserialize_range(partial, buf.data(),
+                                              buf.size() - 1, count / 2, count);
+    if (roaring_bitmap_portable_deserialize_finish(partial) != NULL) {
+        printf("truncated bitmap was accepted\n");
+        return false;
+    }
+
+    roaring64_bitmap_t *c64 = roaring64_bitmap_create();
+    for (uint64_t high = 0; high < 5; high++) {
+        for (uint64_t key = 0; key < 100; key++) {
+            uint64_t base = (high << 32) + (key << 16);
+            roaring64_bitmap_add(c64, base + key);
+            roaring64_bitmap_add_range(c64, base + 1000,
+                                       base + (key % 2 ? 1100 : 60000));
+        }
+    }
+    roaring::Roaring64 r64(c64);
+    r64.runOptimize();
+    std::vector<char> buf64(r64.getSizeInBytes());
+    r64.write(buf64.data());
+    for (unsigned threads : {1u, 4u, 16u}) {
+        roaring::Roaring64 read =
+            roaring::parallel::readSafe64(buf64.data(), buf64.size(), threads);
+        if (!(read == r64)) {
+            printf("parallel 64-bit deserialization mismatch (%u threads)\n",
+                   threads);
+            return false;
+        }
+    }
+    uint64_t count64 = 0;
+    roaring64_bitmap_t *partial64 = roaring64_bitmap_portable_deserialize_prepare(
+        buf64.data(), buf64.size(), &count64);
+    if (partial64 == NULL || count64 != 500) {
+        printf("failed to prepare 64-bit bitmap\n");
+        return false;
+    }
+    // Leave the last container unread.
+    roaring64_bitmap_portable_deserialize_range(partial64, buf64.data(),
+                                                buf64.size(), 0, count64 - 1);
+    if (roaring64_bitmap_portable_deserialize_finish(partial64) != NULL) {
+        printf("incomplete 64-bit bitmap was accepted\n");
+        return false;
+    }
+    return true;
+}
+
+bool run_parallel_bulk_load_tests() {
+    // Random values, runs and duplicates, in no particular order.
+    std::mt19937 gen(1234);
+    std::vector<uint32_t> vals;
+    for (int i = 0; i < 1000000; i++) vals.push_back(gen());
+    for (uint32_t i = 0; i < 200000; i++) vals.push_back((7u << 16) + i % 70000);
+    vals.push_back(0);
+    vals.push_back(UINT32_MAX);
+    std::shuffle(vals.begin(), vals.end(), gen);
+    roaring::Roaring expected(
+        roaring_bitmap_of_ptr(vals.size(), vals.data()));
+    for (unsigned threads : {1u, 3u, 8u}) {
+        roaring::Roaring r =
+            roaring::parallel::fromUnsorted(vals.data(), vals.size(), threads);
+        if (!(r == expected)) {
+            printf("parallel bulk load mismatch (%u threads)\n", threads);
+            return false;
+        }
+    }
+
+    // Keys close together (one key per bucket) and far apart (several keys
+    // per bucket).
+    for (uint64_t spread : {1ull << 20, 1ull << 50}) {
+        std::vector<uint64_t> vals64;
+        for (int i = 0; i < 500000; i++) {
+            vals64.push_back(((uint64_t)gen() << 32 | gen()) % spread);
+        }
+        for (uint64_t i = 0; i < 100000; i++) vals64.push_back(spread - i % 1000);
+        std::shuffle(vals64.begin(), vals64.end(), gen);
+        roaring::Roaring64 expected64(
+            roaring64_bitmap_of_ptr(vals64.size(), vals64.data()));
+        for (unsigned threads : {1u, 4u, 16u}) {
+            roaring::Roaring64 r = roaring::parallel::fromUnsorted64(
+                vals64.data(), vals64.size(), threads);
+            if (!(r == expected64)) {
+                printf("parallel 64-bit bulk load mismatch (%u threads)\n",
+                       threads);
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+bool run_parallel_export_tests() {
+    // Arrays, bitsets and runs, with the slices cut across all of them.
+    std::mt19937 gen(4321);
+    std::vector<uint32_t> vals;
+    for (int i = 0; i < 300000; i++) vals.push_back(gen() % (1u << 24));
+    for (uint32_t i = 0; i < 150000; i++) vals.push_back((300u << 16) + i);
+    for (uint32_t i = 0; i < 65536; i += 3) vals.push_back((400u << 16) + i);
+    vals.push_back(UINT32_MAX);
+    std::sort(vals.begin(), vals.end());
+    vals.erase(std::unique(vals.begin(), vals.end()), vals.end());
+    roaring::Roaring r(roaring_bitmap_of_ptr(vals.size(), vals.data()));
+    r.runOptimize();
+    std::vector<uint64_t> vals64;
+    for (uint32_t v : vals) {
+        vals64.push_back((uint64_t)v << 8);
+        vals64.push_back(((uint64_t)1 << 60) + v);
+    }
+    std::sort(vals64.begin(), vals64.end());
+    roaring::Roaring64 r64(
+        roaring64_bitmap_of_ptr(vals64.size(), vals64.data()));
+    r64.runOptimize();
+    for (unsigned threads : {1u, 3u, 8u}) {
+        std::vector<uint32_t> out(vals.size() + 1, 0xdeadbeef);
+        roaring::parallel::toUint32Array(r, out.data(), threads);
+        if (out.back() != 0xdeadbeef ||
+            !std::equal(vals.begin(), vals.end(), out.begin())) {
+            printf("parallel export mismatch (%u threads)\n", threads);
+            return false;
+        }
+        std::vector<uint64_t> out64(vals64.size() + 1, 0xdeadbeef);
+        roaring::parallel::toUint64Array(r64, out64.data(), threads);
+        if (out64.back() != 0xdeadbeef ||
+            !std::equal(vals64.begin(), vals64.end(), out64.begin())) {
+            printf("parallel 64-bit export mismatch (%u threads)\n", threads);
+            return false;
+        }
+    }
+    return true;
+}
+
+template <class Map>
+bool run_parallel_map64_tests_for(const char *name) {
+    // Thousands of buckets of varied sizes, so that the chunks are cut by
+    // cost rather than by count, with keys missing on either side.
+    std::mt19937_64 gen(2024);
+    Map a, b;
+    for (uint64_t high = 0; high < 2000; high++) {
+        uint64_t base = high << 32;
+        if (high % 3 != 0) {
+            int n = (int)(gen() % 300);
+            for (int i = 0; i < n; i++) a.add(base + gen() % (1u << 20));
+        }
+        if (high % 100 == 1) a.addRange(base, base + (1u << 26) + 1234);
+        if (high % 5 != 0) {
+            for (int i = 0; i < 200; i++) b.add(base + gen() % (1u << 20));
+        }
+        if (high % 7 == 0) b.addRange(base, base + 70000);
+    }
+    // Buckets that end up empty after the operations.
+    for (uint64_t high = 4000; high < 4100; high++) {
+        a.add((high << 32) + 5);
+        b.add((high << 32) + 5);
+    }
+    for (unsigned threads : {1u, 3u, 8u}) {
+        Map r = a;
+        roaring::parallel::andInplace(r, b, threads);
+        bool ok = r == (a & b);
+        r = a;
+        roaring::parallel::orInplace(r, b, threads);
+        ok = ok && r == (a | b);
+        r = a;
+        roaring::parallel::xorInplace(r, b, threads);
+        ok = ok && r == (a ^ b);
+        r = a;
+        roaring::parallel::andnotInplace(r, b, threads);
+        ok = ok && r == (a - b);
+        ok = ok && roaring::parallel::cardinality(a, threads) ==
+                       a.cardinality();
+        r = a;
+        Map expected = a;
+        ok = ok && roaring::parallel::runOptimize(r, threads) ==
+                       expected.runOptimize();
+        ok = ok && r == expected;
+        for (bool portable : {true, false}) {
+            std::vector<char> buf(a.getSizeInBytes(portable));
+            std::vector<char> out(buf.size());
+            a.write(buf.data(), portable);
+            ok = ok && roaring::parallel::write(a, out.data(), portable,
+                                                threads) == buf.size();
+            ok = ok && buf == out;
+        }
+        const Map *inputs[] = {&a, &b, &expected};
+        ok = ok && roaring::parallel::fastunion(3, inputs, threads) ==
+                       Map::fastunion(3, inputs);
+        if (!ok) {
+            printf("parallel %s mismatch (%u threads)\n", name, threads);
+            return false;
+        }
+    }
+    return true;
+}
+
+bool run_parallel_map64_tests() {
+    return run_parallel_map64_tests_for<roaring::Roaring64Map>(
+               "Roaring64Map") &&
+           run_parallel_map64_tests_for<roaring::Roaring64FlatMap>(
+               "Roaring64FlatMap");
+}
+
+bool run_arena_tests() {
+    // Each thread computes its results in its own arena; the scope is per
+    // thread, so the threads do not see each other's arenas.
+    roaring::Roaring a, b;
+    for (uint32_t i = 0; i < 3000; i++) {
+        a.add(i * 65536 + i % 300);
+        b.add(i * 65536 + i % 200);
+    }
+    a.addRange(100u << 16, 110u << 16);
+    const roaring::Roaring expected = a | b;
+    std::vector<char> ok(4, 0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < ok.size(); t++) {
+        threads.emplace_back([&, t]() {
+            roaring_arena_t *arena = roaring_arena_create();
+            bool all_ok = arena != NULL;
+            for (int round = 0; all_ok && round < 20; round++) {
+                {
+                    roaring::AllocatorScope scope(
+                        roaring_arena_allocator(arena));
+                    roaring::Roaring u = a | b;
+                    u.runOptimize();
+                    all_ok = u == expected;
+                }
+                roaring_arena_reset(arena);
+            }
+            roaring_arena_free(arena);
+            ok[t] = all_ok;
+        });
+    }
+    for (std::thread &t : threads) t.join();
+    if (std::count(ok.begin(), ok.end(), 1) != (long)ok.size()) {
+        printf("arena results mismatch\n");
+        return false;
+    }
+    return true;
+}
+
+bool run_copy_on_write64_tests() {
+    // The main thread keeps modifying a copy-on-write bitmap and hands out
+    // snapshots; each snapshot is read, modified and freed on its own thread
+    // while the containers it shares are cloned or released elsewhere.
+    roaring64_bitmap_t *r = roaring64_bitmap_create();
+    for (uint64_t i = 0; i < 200000; i += 3) {
+        roaring64_bitmap_add(r, (i % 7) << 36 | i);
+    }
+    const uint64_t range_start = UINT64_C(1) << 45;
+    roaring64_bitmap_add_range(r, range_start, range_start + 500000);
+    roaring64_bitmap_set_copy_on_write(r, true);
+    std::vector<char> ok(32, 0);
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < ok.size(); t++) {
+        roaring64_bitmap_t *snapshot = roaring64_bitmap_copy(r);
+        uint64_t cardinality = roaring64_bitmap_get_cardinality(r);
+        threads.emplace_back([&ok, t, snapshot, cardinality]() {
+            roaring64_bitmap_t *copy = roaring64_bitmap_copy(snapshot);
+            bool all_ok =
+                roaring64_bitmap_get_cardinality(snapshot) == cardinality;
+            roaring64_bitmap_add_range(copy, 0, 1 << 20);
+            roaring64_bitmap_remove_range(copy, UINT64_C(3) << 36,
+                                          UINT64_C(1) << 46);
+            all_ok = all_ok &&
+                     roaring64_bitmap_get_cardinality(snapshot) == cardinality;
+            roaring64_bitmap_free(snapshot);
+            roaring64_bitmap_free(copy);
+            ok[t] = all_ok;
+        });
+        // Touch every key so that each one gets cloned while shared.
+        for (uint64_t k = 0; k < 7; k++) {
+            roaring64_bitmap_flip_inplace(r, k << 36 | t, (k << 36 | t) + 1);
+        }
+        roaring64_bitmap_remove(r, range_start + t);
+    }
+    for (std::thread &t : threads) t.join();
+    roaring64_bitmap_free(r);
+    if (std::count(ok.begin(), ok.end(), 1) != (long)ok.size()) {
+        printf("copy-on-write snapshot mismatch\n");
+        return false;
+    }
+    return true;
+}
+
 int main() {
     roaring::misc::tellmeall();
-    bool is_ok = run_threads_unit_tests();
+    bool is_ok = run_threads_unit_tests() && run_parallel_deserialize_tests() &&
+                 run_parallel_bulk_load_tests() &&
+                 run_parallel_export_tests() &&
+                 run_parallel_map64_tests() && run_arena_tests() &&
+                 run_copy_on_write64_tests();
     if (is_ok) {
         printf("code run completed.\n");
     }
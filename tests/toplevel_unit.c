@@ -598,6 +598,248 @@ DEFINE_TEST(test_stats) {
     roaring_bitmap_free(r1);
 }
 
+#if CROARING_COUNTERS
+static void assert_counters_balanced(const roaring_container_counters_t *c) {
+    assert_int_equal(c->n_allocs, c->n_frees);
+    assert_int_equal(c->n_bytes_allocated, c->n_bytes_freed);
+}
+#endif
+
+DEFINE_TEST(test_counters) {
+    roaring_counters_t before, counters;
+    roaring_counters_get_thread(&before);
+
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    // An array grows, then turns into a bitset.
+    for (uint32_t i = 0; i < 10000; i += 2) {
+        roaring_bitmap_add(r, i);
+    }
+    // Arrays of consecutive values turn into runs.
+    roaring_bitmap_add_range(r, 1u << 16, (1u << 16) + 1000);
+    roaring_bitmap_remove(r, (1u << 16) + 500);
+    roaring_bitmap_run_optimize(r);
+    roaring_bitmap_shrink_to_fit(r);
+    // Writing to a shared container copies it.
+    roaring_bitmap_set_copy_on_write(r, true);
+    roaring_bitmap_t *c = roaring_bitmap_copy(r);
+    roaring_bitmap_add(c, 1);
+    roaring_bitmap_free(c);
+    roaring_bitmap_free(r);
+
+    roaring_counters_get_thread(&counters);
+    roaring_counters_subtract(&counters, &before);
+    roaring_counters_printf(&counters);
+#if CROARING_COUNTERS
+    assert_true(counters.array.n_reallocs > 0);
+    assert_true(counters.array.n_bytes_overallocated > 0);
+    assert_true(counters.bitset.n_allocs > 0);
+    assert_true(counters.n_array_to_bitset > 0);
+    assert_true(counters.n_shared_clones > 0);
+    assert_counters_balanced(&counters.array);
+    assert_counters_balanced(&counters.bitset);
+    assert_counters_balanced(&counters.run);
+
+    roaring_counters_t all;
+    roaring_counters_get(&all);
+    assert_true(all.array.n_allocs >= counters.array.n_allocs);
+#else
+    roaring_counters_t zero;
+    memset(&zero, 0, sizeof(zero));
+    assert_memory_equal(&counters, &zero, sizeof(zero));
+#endif
+}
+
+DEFINE_TEST(test_interner) {
+    // Every bitmap has a full container, which becomes the shared full
+    // container, one shared with every other bitmap and one of its own.
+    enum { NUM_BITMAPS = 10 };
+    roaring_bitmap_t *bitmaps[NUM_BITMAPS];
+    roaring_bitmap_t *expected[NUM_BITMAPS];
+    for (uint32_t i = 0; i < NUM_BITMAPS; i++) {
+        roaring_bitmap_t *r = roaring_bitmap_create();
+        roaring_bitmap_add_range(r, 0, 1u << 16);
+        for (uint32_t v = 0; v < 100; v++) {
+            roaring_bitmap_add(r, (5u << 16) + v * 3);
+            roaring_bitmap_add(r, ((10u + i) << 16) + v * (i + 1) + 1);
+        }
+        roaring_bitmap_run_optimize(r);
+        bitmaps[i] = r;
+        expected[i] = roaring_bitmap_copy(r);
+    }
+
+    roaring_interner_t *in = roaring_interner_create();
+    assert_non_null(in);
+    size_t saved = roaring_bitmap_intern_many(NUM_BITMAPS, bitmaps, in);
+    roaring_interner_statistics_t stats;
+    roaring_interner_get_statistics(in, &stats);
+    assert_int_equal(stats.n_containers, 3 * NUM_BITMAPS);
+    assert_int_equal(stats.n_distinct, 1 + NUM_BITMAPS);
+    assert_int_equal(stats.n_deduplicated, 2 * NUM_BITMAPS - 1);
+    assert_int_equal(stats.n_bytes_saved, saved);
+    assert_true(saved > 0);
+
+    for (uint32_t i = 0; i < NUM_BITMAPS; i++) {
+        assert_true(roaring_bitmap_get_copy_on_write(bitmaps[i]));
+        assert_true(roaring_contains_shared(bitmaps[i]));
+        assert_true(roaring_bitmap_internal_validate(bitmaps[i], NULL));
+        assert_true(roaring_bitmap_equals(bitmaps[i], expected[i]));
+    }
+    // Interning again finds the same containers.
+    assert_int_equal(roaring_bitmap_intern(bitmaps[0], in), 0);
+    roaring_interner_get_statistics(in, &stats);
+    assert_int_equal(stats.n_distinct, 1 + NUM_BITMAPS);
+
+    // Writes do not leak into the other bitmaps.
+    roaring_bitmap_remove(bitmaps[0], 7);
+    roaring_bitmap_add(bitmaps[1], (5u << 16) + 1);
+    assert_false(roaring_bitmap_contains(bitmaps[0], 7));
+    assert_true(roaring_bitmap_contains(bitmaps[2], 7));
+    assert_true(roaring_bitmap_contains(bitmaps[1], (5u << 16) + 1));
+    assert_false(roaring_bitmap_contains(bitmaps[2], (5u << 16) + 1));
+    roaring_bitmap_add(bitmaps[0], 7);
+    roaring_bitmap_remove(bitmaps[1], (5u << 16) + 1);
+
+    // Serialized bitmaps hold the values of the shared containers.
+    for (uint32_t i = 0; i < NUM_BITMAPS; i++) {
+        size_t size = roaring_bitmap_frozen_size_in_bytes(bitmaps[i]);
+        char *buf = (char *)roaring_aligned_malloc(32, size);
+        roaring_bitmap_frozen_serialize(bitmaps[i], buf);
+        const roaring_bitmap_t *view = roaring_bitmap_frozen_view(buf, size);
+        assert_non_null(view);
+        assert_true(roaring_bitmap_equals(view, expected[i]));
+        roaring_bitmap_free(view);
+        roaring_aligned_free(buf);
+
+        size = roaring_bitmap_portable_size_in_bytes(bitmaps[i]);
+        buf = (char *)malloc(size);
+        roaring_bitmap_portable_serialize(bitmaps[i], buf);
+        roaring_bitmap_t *r =
+            roaring_bitmap_portable_deserialize_interned(buf, size, in);
+        free(buf);
+        assert_non_null(r);
+        assert_true(roaring_bitmap_equals(r, expected[i]));
+        roaring_bitmap_free(bitmaps[i]);
+        bitmaps[i] = r;
+    }
+    roaring_interner_get_statistics(in, &stats);
+    assert_int_equal(stats.n_distinct, 1 + NUM_BITMAPS);
+    assert_int_equal(stats.n_deduplicated, 5 * NUM_BITMAPS - 1);
+
+    // The bitmaps outlive the interner.
+    roaring_interner_free(in);
+    for (uint32_t i = 0; i < NUM_BITMAPS; i++) {
+        assert_true(roaring_bitmap_equals(bitmaps[i], expected[i]));
+        roaring_bitmap_free(bitmaps[i]);
+        roaring_bitmap_free(expected[i]);
+    }
+}
+
+DEFINE_TEST(test_seal) {
+    // Array, bitset and run containers, one of them shared.
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 100; i++) {
+        roaring_bitmap_add(r, i * 7);
+    }
+    for (uint32_t i = 0; i < 20000; i++) {
+        roaring_bitmap_add(r, (1u << 16) + i * 3);
+    }
+    roaring_bitmap_add_range(r, 5u << 16, (5u << 16) + 50000);
+    roaring_bitmap_run_optimize(r);
+    roaring_bitmap_set_copy_on_write(r, true);
+    roaring_bitmap_t *shared = roaring_bitmap_copy(r);
+    roaring_bitmap_t *expected = roaring_bitmap_copy(r);
+    roaring_bitmap_set_copy_on_write(expected, false);
+    roaring_bitmap_t *other = roaring_bitmap_from_range(0, 1u << 20, 5);
+
+    assert_true(roaring_bitmap_seal(r));
+    assert_true(roaring_bitmap_is_sealed(r));
+    assert_false(roaring_contains_shared(r));
+    assert_true(roaring_bitmap_internal_validate(r, NULL));
+    assert_true(roaring_bitmap_equals(r, expected));
+    assert_true(roaring_bitmap_equals(shared, expected));
+    assert_int_equal(roaring_bitmap_shrink_to_fit(r), 0);
+
+    // Reads.
+    uint64_t card = roaring_bitmap_get_cardinality(expected);
+    uint32_t *values = (uint32_t *)malloc(card * sizeof(uint32_t));
+    uint32_t *sealed_values = (uint32_t *)malloc(card * sizeof(uint32_t));
+    roaring_bitmap_to_uint32_array(expected, values);
+    roaring_uint32_iterator_t *it = roaring_iterator_create(r);
+    assert_int_equal(roaring_uint32_iterator_read(it, sealed_values,
+                                                  (uint32_t)card),
+                     card);
+    roaring_uint32_iterator_free(it);
+    assert_memory_equal(values, sealed_values, card * sizeof(uint32_t));
+    free(values);
+    free(sealed_values);
+    assert_int_equal(roaring_bitmap_and_cardinality(r, other),
+                     roaring_bitmap_and_cardinality(expected, other));
+
+    // Serialization.
+    size_t size = roaring_bitmap_portable_size_in_bytes(r);
+    char *buf = (char *)malloc(size);
+    assert_int_equal(roaring_bitmap_portable_serialize(r, buf), size);
+    roaring_bitmap_t *read =
+        roaring_bitmap_portable_deserialize_safe(buf, size);
+    assert_true(roaring_bitmap_equals(read, expected));
+    roaring_bitmap_free(read);
+    free(buf);
+
+    // Copies are neither sealed nor sharing.
+    roaring_bitmap_t *copy = roaring_bitmap_copy(r);
+    assert_false(roaring_bitmap_is_sealed(copy));
+    assert_true(roaring_bitmap_get_copy_on_write(copy));
+    assert_false(roaring_contains_shared(copy));
+    roaring_bitmap_add(copy, 1);
+    assert_false(roaring_bitmap_contains(r, 1));
+    roaring_bitmap_t *result = roaring_bitmap_or(r, other);
+    roaring_bitmap_or_inplace(copy, r);
+    roaring_bitmap_free(result);
+    roaring_bitmap_free(copy);
+    assert_true(roaring_bitmap_is_sealed(r));
+
+    // Modifications unseal.
+    roaring_bitmap_add(r, 1);
+    assert_false(roaring_bitmap_is_sealed(r));
+    assert_true(roaring_bitmap_contains(r, 1));
+    roaring_bitmap_remove(r, 1);
+    assert_true(roaring_bitmap_equals(r, expected));
+    assert_true(roaring_bitmap_internal_validate(r, NULL));
+
+    assert_true(roaring_bitmap_seal(r));
+    roaring_bitmap_and_inplace(r, other);
+    assert_false(roaring_bitmap_is_sealed(r));
+    assert_true(roaring_bitmap_seal(r));
+    roaring_bitmap_overwrite(r, expected);
+    assert_false(roaring_bitmap_is_sealed(r));
+    assert_true(roaring_bitmap_equals(r, expected));
+    assert_true(roaring_bitmap_seal(r));
+    assert_true(roaring_bitmap_unseal(r));
+    assert_false(roaring_bitmap_is_sealed(r));
+    assert_true(roaring_bitmap_equals(r, expected));
+
+    assert_true(roaring_bitmap_seal(r));
+    roaring64_bitmap_t *r64 = roaring64_bitmap_move_from_roaring32(r);
+    assert_int_equal(roaring64_bitmap_get_cardinality(r64), card);
+    roaring64_bitmap_free(r64);
+    assert_true(roaring_bitmap_is_empty(r));
+
+    roaring_bitmap_overwrite(r, expected);
+    assert_true(roaring_bitmap_seal(r));
+    roaring_bitmap_clear(r);
+    assert_false(roaring_bitmap_is_sealed(r));
+    assert_true(roaring_bitmap_is_empty(r));
+    assert_true(roaring_bitmap_seal(r));
+    assert_false(roaring_bitmap_is_sealed(r));
+
+    roaring_bitmap_overwrite(r, expected);
+    assert_true(roaring_bitmap_seal(r));
+    roaring_bitmap_free(r);
+    roaring_bitmap_free(shared);
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(other);
+}
+
 DEFINE_TEST(with_huge_capacity) {
     roaring_bitmap_t *r = roaring_bitmap_create_with_capacity(UINT32_MAX);
     assert_non_null(r);
@@ -1460,6 +1702,607 @@ DEFINE_TEST(test_portable_serialize) {
     roaring_bitmap_free(r2);
 }
 
+// Checks that the writer produces the same bytes as serializing the bitmap
+// holding the same values after run_optimize.
+static void check_portable_writer(const roaring_bitmap_t *expected,
+                                  const char *written, size_t written_len) {
+    roaring_bitmap_t *optimized = roaring_bitmap_copy(expected);
+    roaring_bitmap_run_optimize(optimized);
+    size_t expected_len = roaring_bitmap_portable_size_in_bytes(optimized);
+    char *serialized = (char *)malloc(expected_len);
+    roaring_bitmap_portable_serialize(optimized, serialized);
+    assert_int_equal(written_len, expected_len);
+    assert_memory_equal(written, serialized, expected_len);
+    roaring_bitmap_t *read =
+        roaring_bitmap_portable_deserialize_safe(written, written_len);
+    assert_non_null(read);
+    assert_true(roaring_bitmap_equals(read, expected));
+    roaring_bitmap_free(read);
+    free(serialized);
+    roaring_bitmap_free(optimized);
+}
+
+DEFINE_TEST(test_portable_writer) {
+    size_t capacity = 1 << 20;
+    char *buf = (char *)malloc(capacity);
+
+    // Sparse, dense and run containers, followed by ranges over several keys
+    // and values at the very end of the range.
+    uint32_t n = 0;
+    uint32_t *vals = (uint32_t *)malloc(100000 * sizeof(uint32_t));
+    for (uint32_t i = 0; i < 1000; i += 7) vals[n++] = i;
+    for (uint32_t i = 0; i < 65536; i += 3) vals[n++] = (1 << 16) + i;
+    for (uint32_t i = 0; i < 65536; i += 1000) {
+        for (uint32_t j = 0; j < 10; j++) vals[n++] = (2 << 16) + i + j;
+    }
+    vals[n++] = (2 << 16) + 65535;
+    vals[n++] = (2 << 16) + 65535;  // duplicates are fine
+    uint32_t tail[] = {UINT32_MAX - 64, UINT32_MAX - 1, UINT32_MAX};
+
+    roaring_bitmap_t *expected = roaring_bitmap_create();
+    roaring_bitmap_add_many(expected, n, vals);
+    roaring_bitmap_add_range(expected, (10 << 16) + 5, (13 << 16) + 70);
+    roaring_bitmap_add_range(expected, (13 << 16) + 60, (13 << 16) + 100);
+    roaring_bitmap_add_many(expected, 3, tail);
+
+    roaring_portable_writer_t *w = roaring_portable_writer_create(buf, capacity);
+    assert_non_null(w);
+    // Feed the values in chunks of various sizes.
+    for (uint32_t i = 0; i < n; i += 1 + i % 5000) {
+        uint32_t len = 1 + i % 5000;
+        if (len > n - i) len = n - i;
+        assert_true(roaring_portable_writer_add_many(w, len, vals + i));
+    }
+    assert_true(roaring_portable_writer_add_range(w, (10 << 16) + 5,
+                                                  (13 << 16) + 70));
+    assert_true(roaring_portable_writer_add_range(w, (13 << 16) + 60,
+                                                  (13 << 16) + 100));
+    assert_true(roaring_portable_writer_add_many(w, 3, tail));
+    size_t len = roaring_portable_writer_finish(w);
+    roaring_portable_writer_free(w);
+    check_portable_writer(expected, buf, len);
+    roaring_bitmap_free(expected);
+
+    // Fewer than NO_OFFSET_THRESHOLD containers with runs: no offset header.
+    expected = roaring_bitmap_from_range(5, 200000, 1);
+    w = roaring_portable_writer_create(buf, capacity);
+    assert_true(roaring_portable_writer_add_range(w, 5, 200000));
+    len = roaring_portable_writer_finish(w);
+    roaring_portable_writer_free(w);
+    check_portable_writer(expected, buf, len);
+    roaring_bitmap_free(expected);
+
+    // Empty input.
+    expected = roaring_bitmap_create();
+    w = roaring_portable_writer_create(buf, capacity);
+    len = roaring_portable_writer_finish(w);
+    roaring_portable_writer_free(w);
+    check_portable_writer(expected, buf, len);
+    roaring_bitmap_free(expected);
+
+    // Going back to an earlier key is rejected.
+    w = roaring_portable_writer_create(buf, capacity);
+    uint32_t unsorted[] = {70000, 5};
+    assert_false(roaring_portable_writer_add_many(w, 2, unsorted));
+    assert_false(roaring_portable_writer_add_range(w, 80000, 80010));
+    assert_int_equal(roaring_portable_writer_finish(w), 0);
+    roaring_portable_writer_free(w);
+
+    // The buffer capacity is never exceeded.
+    w = roaring_portable_writer_create(buf, 90);
+    assert_true(roaring_portable_writer_add_many(w, 40, vals));
+    assert_int_equal(roaring_portable_writer_finish(w), 0);
+    roaring_portable_writer_free(w);
+
+    free(vals);
+    free(buf);
+}
+
+// Checks that roaring_bitmap_from_sorted builds the same containers as adding
+// the values one by one and calling run_optimize.
+static void check_from_sorted(const uint32_t *vals, size_t n) {
+    roaring_bitmap_t *r = roaring_bitmap_from_sorted(vals, n);
+    assert_non_null(r);
+    roaring_bitmap_t *expected = roaring_bitmap_of_ptr(n, vals);
+    roaring_bitmap_run_optimize(expected);
+    assert_true(roaring_bitmap_equals(r, expected));
+    size_t len = roaring_bitmap_portable_size_in_bytes(r);
+    assert_int_equal(len, roaring_bitmap_portable_size_in_bytes(expected));
+    char *actual_buf = (char *)malloc(len);
+    char *expected_buf = (char *)malloc(len);
+    roaring_bitmap_portable_serialize(r, actual_buf);
+    roaring_bitmap_portable_serialize(expected, expected_buf);
+    assert_memory_equal(actual_buf, expected_buf, len);
+    free(expected_buf);
+    free(actual_buf);
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(r);
+}
+
+DEFINE_TEST(test_from_sorted) {
+    uint32_t n = 0;
+    uint32_t *vals = (uint32_t *)malloc(300000 * sizeof(uint32_t));
+    for (uint32_t i = 0; i < 1000; i += 7) vals[n++] = i;
+    vals[n++] = 65535;
+    for (uint32_t i = 0; i < 65536; i += 3) vals[n++] = (1 << 16) + i;
+    for (uint32_t i = 0; i < 65536; i += 1000) {
+        for (uint32_t j = 0; j < 10; j++) vals[n++] = (2 << 16) + i + j;
+    }
+    vals[n++] = (2 << 16) + 65535;
+    vals[n++] = (2 << 16) + 65535;  // duplicates are fine
+    for (uint32_t i = 0; i < 65536; i++) vals[n++] = (3 << 16) + i;
+    for (uint32_t i = 0; i < 4096; i++) vals[n++] = (4 << 16) + 2 * i;
+    for (uint32_t i = 0; i < 4097; i++) vals[n++] = (5 << 16) + 2 * i;
+    vals[n++] = UINT32_MAX - 1;
+    vals[n++] = UINT32_MAX;
+    check_from_sorted(vals, n);
+    check_from_sorted(vals + n - 1, 1);
+
+    roaring_bitmap_t *r = roaring_bitmap_from_sorted(vals, 0);
+    assert_non_null(r);
+    assert_true(roaring_bitmap_is_empty(r));
+    roaring_bitmap_free(r);
+
+    // Unsorted input is rejected, within a container or across containers.
+    uint32_t unsorted_low[] = {1, 3, 2};
+    assert_null(roaring_bitmap_from_sorted(unsorted_low, 3));
+    uint32_t unsorted_high[] = {70000, 5, 6};
+    assert_null(roaring_bitmap_from_sorted(unsorted_high, 3));
+    uint32_t unsorted_middle[] = {5, 5, 200000, 5, 6};
+    assert_null(roaring_bitmap_from_sorted(unsorted_middle, 5));
+
+    free(vals);
+}
+
+DEFINE_TEST(test_from_unsorted) {
+    uint32_t n = 0;
+    uint32_t *vals = (uint32_t *)malloc(200000 * sizeof(uint32_t));
+    // Pseudo-random values with duplicates, dense keys and runs.
+    uint32_t x = 12345;
+    for (uint32_t i = 0; i < 50000; i++) {
+        x = x * 1103515245 + 12345;
+        vals[n++] = x;
+        vals[n++] = (3 << 16) + x % 10000;
+        vals[n++] = (9 << 16) + (x & 0xFFFF);
+    }
+    for (uint32_t i = 0; i < 20000; i++) vals[n++] = (5 << 16) + 19999 - i;
+    vals[n++] = UINT32_MAX;
+    vals[n++] = 0;
+
+    roaring_bitmap_t *r = roaring_bitmap_from_unsorted(vals, n);
+    assert_non_null(r);
+    roaring_bitmap_t *expected = roaring_bitmap_of_ptr(n, vals);
+    assert_true(roaring_bitmap_equals(r, expected));
+    // Containers are run-optimized.
+    roaring_bitmap_run_optimize(expected);
+    assert_int_equal(roaring_bitmap_portable_size_in_bytes(r),
+                     roaring_bitmap_portable_size_in_bytes(expected));
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(r);
+
+    r = roaring_bitmap_from_unsorted(vals, 0);
+    assert_non_null(r);
+    assert_true(roaring_bitmap_is_empty(r));
+    roaring_bitmap_free(r);
+
+    // The steps can be run by hand, over several parts and ranges.
+    roaring_bulk_loader_t *l = roaring_bulk_loader_create(vals, n, 3);
+    assert_non_null(l);
+    for (uint32_t part = 0; part < 3; part++) {
+        roaring_bulk_loader_count(l, part);
+    }
+    uint32_t num_keys;
+    assert_true(roaring_bulk_loader_plan(l, &num_keys));
+    for (uint32_t part = 0; part < 3; part++) {
+        roaring_bulk_loader_scatter(l, part);
+    }
+    roaring_bulk_loader_build(l, 0, num_keys / 2);
+    roaring_bulk_loader_build(l, num_keys / 2, num_keys);
+    r = roaring_bulk_loader_finish(l);
+    expected = roaring_bitmap_of_ptr(n, vals);
+    assert_true(roaring_bitmap_equals(r, expected));
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(r);
+
+    // An incomplete build is reported.
+    l = roaring_bulk_loader_create(vals, n, 1);
+    roaring_bulk_loader_count(l, 0);
+    assert_true(roaring_bulk_loader_plan(l, &num_keys));
+    roaring_bulk_loader_scatter(l, 0);
+    roaring_bulk_loader_build(l, 1, num_keys);
+    assert_null(roaring_bulk_loader_finish(l));
+
+    free(vals);
+}
+
+DEFINE_TEST(test_from_ranges) {
+    size_t n = 0;
+    roaring_uint32_range_closed_t *ranges =
+        (roaring_uint32_range_closed_t *)malloc(
+            40000 * sizeof(roaring_uint32_range_closed_t));
+    // Every other value: as many runs as a container can hold.
+    for (uint32_t i = 0; i < 65536; i += 2) {
+        ranges[n].min = ranges[n].max = i;
+        n++;
+    }
+    // Overlapping and touching ranges, merged.
+    ranges[n].min = 100000, ranges[n++].max = 100010;
+    ranges[n].min = 100005, ranges[n++].max = 100007;
+    ranges[n].min = 100011, ranges[n++].max = 100020;
+    // Full containers, and a range ending on a container boundary.
+    ranges[n].min = 200000, ranges[n++].max = 600000;
+    ranges[n].min = 655360, ranges[n++].max = 720895;
+    ranges[n].min = UINT32_MAX - 70000, ranges[n++].max = UINT32_MAX;
+    ranges[n].min = UINT32_MAX, ranges[n++].max = UINT32_MAX;
+
+    roaring_bitmap_t *r = roaring_bitmap_from_ranges(ranges, n);
+    assert_non_null(r);
+    roaring_bitmap_t *expected = roaring_bitmap_create();
+    for (size_t i = 0; i < n; i++) {
+        roaring_bitmap_add_range_closed(expected, ranges[i].min,
+                                        ranges[i].max);
+    }
+    assert_true(roaring_bitmap_equals(r, expected));
+    roaring_bitmap_run_optimize(expected);
+    assert_int_equal(roaring_bitmap_portable_size_in_bytes(r),
+                     roaring_bitmap_portable_size_in_bytes(expected));
+
+    // Exporting gives the merged ranges back.
+    size_t count = roaring_bitmap_range_count(r);
+    assert_int_equal(count, 32768 + 4);
+    roaring_uint32_range_closed_t *exported =
+        (roaring_uint32_range_closed_t *)malloc(
+            count * sizeof(roaring_uint32_range_closed_t));
+    assert_int_equal(roaring_bitmap_to_ranges(r, exported, count), count);
+    assert_int_equal(exported[32768].min, 100000);
+    assert_int_equal(exported[32768].max, 100020);
+    assert_int_equal(exported[count - 1].max, UINT32_MAX);
+    roaring_bitmap_t *back = roaring_bitmap_from_ranges(exported, count);
+    assert_true(roaring_bitmap_equals(back, r));
+    roaring_bitmap_free(back);
+    assert_int_equal(roaring_bitmap_to_ranges(r, exported, 3), 3);
+    free(exported);
+
+    // add_ranges is a union.
+    roaring_bitmap_t *other = roaring_bitmap_from_range(50000, 300000, 7);
+    roaring_bitmap_t *union_expected = roaring_bitmap_or(other, r);
+    assert_true(roaring_bitmap_add_ranges(other, ranges, n));
+    assert_true(roaring_bitmap_equals(other, union_expected));
+    roaring_bitmap_free(union_expected);
+
+    // Unsorted or inverted ranges are rejected.
+    roaring_uint32_range_closed_t bad[2] = {{10, 20}, {5, 6}};
+    assert_null(roaring_bitmap_from_ranges(bad, 2));
+    assert_false(roaring_bitmap_add_ranges(other, bad, 2));
+    bad[1].min = 30, bad[1].max = 25;
+    assert_null(roaring_bitmap_from_ranges(bad, 2));
+    roaring_bitmap_free(other);
+
+    roaring_bitmap_t *empty = roaring_bitmap_from_ranges(ranges, 0);
+    assert_true(roaring_bitmap_is_empty(empty));
+    assert_int_equal(roaring_bitmap_range_count(empty), 0);
+    roaring_bitmap_free(empty);
+
+    roaring_bitmap_free(expected);
+    roaring_bitmap_free(r);
+    free(ranges);
+}
+
+DEFINE_TEST(test_range_uint32_array) {
+    // Array, bitset and run containers, with slices cut across all of them.
+    roaring_bitmap_t *r = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 1000; i += 7) roaring_bitmap_add(r, i);
+    for (uint32_t i = 0; i < 65536; i += 2) roaring_bitmap_add(r, 65536 + i);
+    roaring_bitmap_add_range(r, 5u << 16, (5u << 16) + 20000);
+    roaring_bitmap_add(r, UINT32_MAX);
+    roaring_bitmap_run_optimize(r);
+    uint64_t card = roaring_bitmap_get_cardinality(r);
+    uint32_t *all = (uint32_t *)malloc(card * sizeof(uint32_t));
+    uint32_t *out = (uint32_t *)malloc((card + 1) * sizeof(uint32_t));
+    roaring_bitmap_to_uint32_array(r, all);
+
+    const size_t offsets[] = {0, 1, 143, 144, 20000, 32911, card - 1};
+    const size_t limits[] = {0, 1, 100, 40000, card};
+    for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {
+        for (size_t j = 0; j < sizeof(limits) / sizeof(limits[0]); j++) {
+            size_t offset = offsets[i];
+            size_t limit = limits[j];
+            size_t expected = limit < card - offset ? limit : card - offset;
+            out[expected] = 42;
+            assert_true(
+                roaring_bitmap_range_uint32_array(r, offset, limit, out));
+            assert_memory_equal(out, all + offset,
+                                expected * sizeof(uint32_t));
+            assert_int_equal(out[expected], 42);
+        }
+    }
+    free(out);
+    free(all);
+    roaring_bitmap_free(r);
+}
+
+DEFINE_TEST(test_arena) {
+    // Inputs and expected results come from the memory hook.
+    roaring_bitmap_t *a = roaring_bitmap_create();
+    roaring_bitmap_t *b = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 5000; i++) {
+        roaring_bitmap_add(a, i * 65536 + (i % 100));
+        roaring_bitmap_add(b, i * 65536 + (i % 50));
+    }
+    roaring_bitmap_add_range(a, 10000u << 16, 10005u << 16);
+    for (uint32_t i = 0; i < 65536; i += 3) {
+        roaring_bitmap_add(b, (10002u << 16) + i);
+    }
+    roaring_bitmap_t *expected_or = roaring_bitmap_or(a, b);
+    roaring_bitmap_t *expected_and = roaring_bitmap_and(a, b);
+    roaring_bitmap_t *expected_grown = roaring_bitmap_create();
+    roaring_bitmap_add_range(expected_grown, 0, 20000);
+
+    roaring_arena_t *arena = roaring_arena_create();
+    assert_non_null(arena);
+    size_t size_after_reset = 0;
+    for (int round = 0; round < 3; round++) {
+        const roaring_allocator_t *previous =
+            roaring_allocator_enter(roaring_arena_allocator(arena));
+        assert_null(previous);
+        roaring_bitmap_t *u = roaring_bitmap_or(a, b);
+        roaring_bitmap_t *x = roaring_bitmap_and(a, b);
+        // Arrays grow by reallocation, then turn into bitsets and runs.
+        roaring_bitmap_t *grown = roaring_bitmap_create();
+        for (uint32_t v = 0; v < 20000; v++) roaring_bitmap_add(grown, v);
+        roaring_bitmap_t *y = roaring_bitmap_copy(x);
+        roaring_bitmap_run_optimize(grown);
+        roaring_bitmap_free(x);
+        // Scopes nest.
+        roaring_arena_t *inner = roaring_arena_create();
+        assert_true(roaring_allocator_enter(roaring_arena_allocator(
+                        inner)) == roaring_arena_allocator(arena));
+        roaring_bitmap_t *z = roaring_bitmap_or(a, b);
+        assert_true(roaring_bitmap_equals(z, expected_or));
+        roaring_bitmap_free(z);
+        roaring_allocator_leave(roaring_arena_allocator(arena));
+        roaring_arena_free(inner);
+        roaring_allocator_leave(previous);
+
+        assert_true(roaring_bitmap_equals(u, expected_or));
+        assert_true(roaring_bitmap_equals(y, expected_and));
+        assert_true(roaring_bitmap_equals(grown, expected_grown));
+        assert_true(roaring_arena_size_in_bytes(arena) > (1 << 18));
+        // Everything is released at once; the slabs are reused next round.
+        roaring_arena_reset(arena);
+        if (round > 0) {
+            assert_int_equal(roaring_arena_size_in_bytes(arena),
+                             size_after_reset);
+        }
+        size_after_reset = roaring_arena_size_in_bytes(arena);
+    }
+    // Large blocks get an allocation of their own, found by its address.
+    const roaring_allocator_t *allocator = roaring_arena_allocator(arena);
+    char *large = (char *)allocator->malloc(allocator->context, 40000);
+    assert_non_null(large);
+    memset(large, 1, 40000);
+    large = (char *)allocator->realloc(allocator->context, large, 80000);
+    assert_non_null(large);
+    assert_int_equal(large[39999], 1);
+    void *aligned = allocator->aligned_malloc(allocator->context, 64, 40000);
+    assert_int_equal((uintptr_t)aligned % 64, 0);
+    allocator->aligned_free(allocator->context, aligned);
+    allocator->free(allocator->context, large);
+    assert_int_equal(roaring_arena_size_in_bytes(arena), size_after_reset);
+    roaring_arena_free(arena);
+
+    roaring_bitmap_free(expected_grown);
+    roaring_bitmap_free(expected_and);
+    roaring_bitmap_free(expected_or);
+    roaring_bitmap_free(b);
+    roaring_bitmap_free(a);
+}
+
+// Counts the blocks of the bitmaps that use it, and fails allocations while
+// `fail` is set.
+typedef struct {
+    roaring_allocator_t allocator;
+    int64_t live;
+    int64_t total;
+    bool fail;
+} counting_allocator_t;
+
+static void *counting_malloc(void *context, size_t size) {
+    counting_allocator_t *c = (counting_allocator_t *)context;
+    if (c->fail) {
+        return NULL;
+    }
+    c->live++;
+    c->total++;
+    return malloc(size);
+}
+
+static void *counting_realloc(void *context, void *p, size_t size) {
+    counting_allocator_t *c = (counting_allocator_t *)context;
+    if (c->fail) {
+        return NULL;
+    }
+    if (p == NULL) {
+        c->live++;
+    }
+    c->total++;
+    return realloc(p, size);
+}
+
+static void *counting_calloc(void *context, size_t n, size_t size) {
+    counting_allocator_t *c = (counting_allocator_t *)context;
+    if (c->fail) {
+        return NULL;
+    }
+    c->live++;
+    c->total++;
+    return calloc(n, size);
+}
+
+static void counting_free(void *context, void *p) {
+    counting_allocator_t *c = (counting_allocator_t *)context;
+    if (p != NULL) {
+        c->live--;
+        free(p);
+    }
+}
+
+static void *counting_aligned_malloc(void *context, size_t alignment,
+                                     size_t size) {
+    char *p = (char *)counting_malloc(context, size + alignment + sizeof(p));
+    if (p == NULL) {
+        return NULL;
+    }
+    uintptr_t a = ((uintptr_t)(p + sizeof(p)) + alignment - 1) &
+                  ~(uintptr_t)(alignment - 1);
+    ((char **)a)[-1] = p;
+    return (void *)a;
+}
+
+static void counting_aligned_free(void *context, void *p) {
+    if (p != NULL) {
+        counting_free(context, ((char **)p)[-1]);
+    }
+}
+
+static void counting_allocator_init(counting_allocator_t *c) {
+    c->allocator.context = c;
+    c->allocator.malloc = counting_malloc;
+    c->allocator.realloc = counting_realloc;
+    c->allocator.calloc = counting_calloc;
+    c->allocator.free = counting_free;
+    c->allocator.aligned_malloc = counting_aligned_malloc;
+    c->allocator.aligned_free = counting_aligned_free;
+    c->live = 0;
+    c->total = 0;
+    c->fail = false;
+}
+
+DEFINE_TEST(test_bitmap_allocator) {
+    counting_allocator_t c;
+    counting_allocator_init(&c);
+    roaring_bitmap_t *h = roaring_bitmap_create();
+    for (uint32_t i = 0; i < 3000; i++) {
+        roaring_bitmap_add(h, i * 65536 + (i % 70));
+    }
+
+    const roaring_allocator_t *previous = roaring_allocator_enter(&c.allocator);
+    assert_null(previous);
+    assert_true(roaring_allocator_current() == &c.allocator);
+    roaring_bitmap_t *a = roaring_bitmap_create();
+    // Bitmaps created before the scope keep using the memory hook.
+    int64_t total = c.total;
+    roaring_bitmap_add_range(h, 1000, 200000);
+    assert_int_equal(c.total, total);
+    // Results take the entered allocator over that of their arguments.
+    roaring_bitmap_t *s = roaring_bitmap_or(h, h);
+    assert_true(roaring_bitmap_get_allocator(s) == &c.allocator);
+    roaring_allocator_leave(previous);
+    assert_null(roaring_allocator_current());
+    assert_true(roaring_bitmap_get_allocator(a) == &c.allocator);
+    assert_null(roaring_bitmap_get_allocator(h));
+
+    // Outside of the scope, `a` still allocates through its allocator.
+    total = c.total;
+    for (uint32_t i = 0; i < 5000; i++) {
+        roaring_bitmap_add(a, i * 65536 + (i % 50));
+    }
+    roaring_bitmap_add_range(a, 100000, 300000);
+    roaring_bitmap_run_optimize(a);
+    assert_true(c.total > total);
+
+    // Operations on hook bitmaps do not use it.
+    total = c.total;
+    roaring_bitmap_t *hh = roaring_bitmap_or(h, h);
+    roaring_bitmap_or_inplace(h, a);
+    roaring_bitmap_free(hh);
+    assert_int_equal(c.total, total);
+
+    // Results use the allocator of their first argument.
+    roaring_bitmap_t *u = roaring_bitmap_or(a, h);
+    roaring_bitmap_t *x = roaring_bitmap_and(h, a);
+    roaring_bitmap_t *y = roaring_bitmap_copy(a);
+    roaring_bitmap_t *f = roaring_bitmap_flip(a, 0, 1000000);
+    const roaring_bitmap_t *inputs[] = {a, h, x};
+    roaring_bitmap_t *m = roaring_bitmap_or_many(3, inputs);
+    assert_true(roaring_bitmap_get_allocator(u) == &c.allocator);
+    assert_null(roaring_bitmap_get_allocator(x));
+    assert_true(roaring_bitmap_get_allocator(y) == &c.allocator);
+    assert_true(roaring_bitmap_get_allocator(f) == &c.allocator);
+    assert_true(roaring_bitmap_get_allocator(m) == &c.allocator);
+    assert_true(roaring_bitmap_equals(u, h));
+    assert_true(roaring_bitmap_equals(m, h));
+    assert_true(roaring_bitmap_equals(x, y));
+    // Sealing, unsealing and clearing keep the allocator.
+    assert_true(roaring_bitmap_seal(y));
+    assert_true(roaring_bitmap_get_allocator(y) == &c.allocator);
+    roaring_bitmap_xor_inplace(y, h);
+    roaring_bitmap_andnot_inplace(u, y);
+    assert_true(roaring_bitmap_get_allocator(y) == &c.allocator);
+    roaring_bitmap_t *e = roaring_bitmap_copy(m);
+    roaring_bitmap_andnot_inplace(m, e);
+    roaring_bitmap_andnot_inplace(m, e);  // resets the empty `m`
+    assert_true(roaring_bitmap_get_allocator(m) == &c.allocator);
+    roaring_bitmap_free(e);
+    roaring_bitmap_clear(u);
+    assert_true(roaring_bitmap_get_allocator(u) == &c.allocator);
+    // A bitmap initialized in client memory keeps its allocator in a block
+    // of its own, which roaring_bitmap_release() frees.
+    roaring_bitmap_t client;
+    previous = roaring_allocator_enter(&c.allocator);
+    roaring_bitmap_init_cleared(&client);
+    roaring_allocator_leave(previous);
+    assert_true(roaring_bitmap_get_allocator(&client) == &c.allocator);
+    roaring_bitmap_add(&client, 7);
+    roaring_bitmap_clear(&client);
+    assert_true(roaring_bitmap_get_allocator(&client) == &c.allocator);
+    roaring_bitmap_release(&client);
+    assert_null(roaring_bitmap_get_allocator(&client));
+    roaring_bitmap_free(x);
+    roaring_bitmap_free(h);
+
+    roaring_bitmap_free(s);
+    roaring_bitmap_free(m);
+    roaring_bitmap_free(f);
+    roaring_bitmap_free(y);
+    roaring_bitmap_free(u);
+    roaring_bitmap_free(a);
+    assert_int_equal(c.live, 0);
+}
+
+DEFINE_TEST(test_seal_unseal_failure) {
+    counting_allocator_t c;
+    counting_allocator_init(&c);
+    const roaring_allocator_t *previous = roaring_allocator_enter(&c.allocator);
+    roaring_bitmap_t *r = roaring_bitmap_from_range(0, 200000, 3);
+    roaring_allocator_leave(previous);
+    roaring_bitmap_t *other = roaring_bitmap_from_range(1, 300000, 2);
+    roaring_bitmap_t *expected = roaring_bitmap_copy(r);
+    assert_true(roaring_bitmap_seal(r));
+
+    // Modifications that cannot unseal leave the bitmap sealed and intact.
+    c.fail = true;
+    roaring_bitmap_add(r, 1);
+    assert_false(roaring_bitmap_add_checked(r, 2));
+    assert_false(roaring_bitmap_remove_checked(r, 3));
+    roaring_bitmap_remove_range(r, 0, 100000);
+    roaring_bitmap_or_inplace(r, other);
+    roaring_bitmap_and_inplace(r, other);
+    roaring_bitmap_flip_inplace(r, 0, 1000);
+    assert_false(roaring_bitmap_run_optimize(r));
+    assert_true(roaring_bitmap_is_sealed(r));
+    assert_true(roaring_bitmap_equals(r, expected));
+
+    c.fail = false;
+    roaring_bitmap_add(r, 1);
+    assert_false(roaring_bitmap_is_sealed(r));
+    assert_true(roaring_bitmap_contains(r, 1));
+    roaring_bitmap_free(r);
+    roaring_bitmap_free(other);
+    roaring_bitmap_free(expected);
+    assert_int_equal(c.live, 0);
+}
+
 DEFINE_TEST(test_serialize) {
     roaring_bitmap_t *r1 =
         roaring_bitmap_from(1, 2, 3, 100, 1000, 10000, 1000000, 20000000);
@@ -5370,6 +6213,57 @@ DEFINE_TEST(convert_to_bitset) {
     roaring_bitmap_free(r1);
 }
 
+DEFINE_TEST(convert_from_bitset) {
+    // Sparse (array), dense (bitset) and run windows, then a partial window.
+    bitset_t *bitset = bitset_create();
+    for (uint32_t i = 100; i < 100000; i += 1 + (i % 5)) bitset_set(bitset, i);
+    for (uint32_t i = 200000; i < 260000; i += 3) bitset_set(bitset, i);
+    for (uint32_t i = 300000; i < 600000; i++) bitset_set(bitset, i);
+    for (uint32_t i = 700000; i < 710000; i += 100) bitset_set(bitset, i);
+    bitset_set(bitset, 5 * 65536 + 1000);  // forces a window of 1024 words
+    roaring_bitmap_t *r = roaring_bitmap_from_bitset(bitset);
+    assert_non_null(r);
+    assert_int_equal(roaring_bitmap_get_cardinality(r), bitset_count(bitset));
+    roaring_bitmap_t *expected = roaring_bitmap_create();
+    size_t i = 0;
+    while (bitset_next_set_bit(bitset, &i)) {
+        roaring_bitmap_add(expected, (uint32_t)i);
+        i++;
+    }
+    assert_true(roaring_bitmap_equals(r, expected));
+    roaring_bitmap_run_optimize(expected);
+    assert_int_equal(roaring_bitmap_portable_size_in_bytes(r),
+                     roaring_bitmap_portable_size_in_bytes(expected));
+    roaring_bitmap_free(expected);
+
+    // Windows of the bitmap match the bitset, including across containers.
+    size_t num_words = bitset->arraysize;
+    uint64_t *words =
+        (uint64_t *)malloc((num_words + 3010) * sizeof(uint64_t));
+    roaring_bitmap_to_bitset_window(r, words, 0, num_words);
+    assert_memory_equal(words, bitset->array, num_words * sizeof(uint64_t));
+    uint32_t offsets[] = {1, 1000, 1024, 3000, 4600, 9000};
+    for (size_t j = 0; j < sizeof(offsets) / sizeof(offsets[0]); j++) {
+        // Past the end of the bitset, the window is all zeros.
+        uint32_t first = offsets[j];
+        size_t len = first + 3000 < num_words ? 3000 : num_words - first;
+        roaring_bitmap_to_bitset_window(r, words, first, 3010);
+        assert_memory_equal(words, bitset->array + first,
+                            len * sizeof(uint64_t));
+        for (size_t k = len; k < 3010 && first + k >= num_words; k++) {
+            assert_true(words[k] == 0);
+        }
+    }
+    roaring_bitmap_free(r);
+    free(words);
+
+    bitset_clear(bitset);
+    r = roaring_bitmap_from_bitset(bitset);
+    assert_true(roaring_bitmap_is_empty(r));
+    roaring_bitmap_free(r);
+    bitset_free(bitset);
+}
+
 // simple execution test
 DEFINE_TEST(simple_roaring_bitmap_or_many) {
     roaring_bitmap_t *roaring_bitmaps[2];
@@ -5527,6 +6421,7 @@ int main() {
         cmocka_unit_test(robust_deserialization),
         cmocka_unit_test(issue457),
         cmocka_unit_test(convert_to_bitset),
+        cmocka_unit_test(convert_from_bitset),
         cmocka_unit_test(issue440),
         cmocka_unit_test(issue436),
         cmocka_unit_test(issue433),
@@ -5565,6 +6460,9 @@ int main() {
         cmocka_unit_test(test_get_index),
         cmocka_unit_test(test_maximum_minimum),
         cmocka_unit_test(test_stats),
+        cmocka_unit_test(test_counters),
+        cmocka_unit_test(test_interner),
+        cmocka_unit_test(test_seal),
         cmocka_unit_test(test_addremove),
         cmocka_unit_test(test_addremove_bulk),
         cmocka_unit_test(test_addremoverun),
@@ -5589,6 +6487,14 @@ int main() {
         cmocka_unit_test(test_iterate_withrun),
         cmocka_unit_test(test_serialize),
         cmocka_unit_test(test_portable_serialize),
+        cmocka_unit_test(test_portable_writer),
+        cmocka_unit_test(test_from_sorted),
+        cmocka_unit_test(test_from_unsorted),
+        cmocka_unit_test(test_from_ranges),
+        cmocka_unit_test(test_range_uint32_array),
+        cmocka_unit_test(test_arena),
+        cmocka_unit_test(test_bitmap_allocator),
+        cmocka_unit_test(test_seal_unseal_failure),
         cmocka_unit_test(test_add),
         cmocka_unit_test(test_add_checked),
         cmocka_unit_test(test_remove_checked),